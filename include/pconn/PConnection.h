@@ -24,6 +24,7 @@
 #include <sys/time.h>			/* For select() */
 #include <unistd.h>			/* For select() */
 #include <string.h>			/* For bzero() for select() */
+#include <sys/uio.h>			/* For struct iovec */
 
 typedef enum { forReading = 0, forWriting = 1 } pconn_direction;
 
@@ -80,6 +81,13 @@ typedef enum {
 #define PCONNFL_NOCHANGESPEED	0x0004	/* This is a modem, don't change speeds */
 #define PCONNFL_DAEMON		0x0008	/* Daemon mode, don't timeout while waiting for the device */
 #define PCONNFL_EMULATEPALM	0x0010	/* Emulate a Palm device, for device -> desktop connections */
+#define PCONNFL_TCP_NAGLE	0x0020	/* Leave Nagle's algorithm turned on
+					 * for NetSync sockets. By default,
+					 * TCP_NODELAY is set.
+					 */
+#define PCONNFL_TCP_CORK	0x0040	/* Cork NetSync sockets while a
+					 * message is being written.
+					 */
 
 /* Misc defines */
 #define PCONN_NET_CONNECT_RETRIES 10	/* connect() retries */
@@ -100,6 +108,9 @@ typedef struct PConnection
 	/* Common part */
 	int fd;				/* File descriptor */
 	unsigned short flags;		/* Flags. See PCONNFL_*, above */
+	pconn_listen_t listen_type;	/* Type of device. See LISTEN_*,
+					 * above.
+					 */
 
 	int bytes_read,bytes_write;
 	time_t start_time,stop_time;
@@ -111,6 +122,11 @@ typedef struct PConnection
 	int (*io_read)(struct PConnection *p, unsigned char *buf, int len);
 	int (*io_write)(struct PConnection *p, unsigned const char *buf,
 			const int len);
+	int (*io_writev)(struct PConnection *p, const struct iovec *iov,
+			 const int iovcnt);
+				/* Gather-write. Optional: if NULL,
+				 * PConn_writev() falls back on io_write.
+				 */
 	int (*io_connect)(struct PConnection *p, const void *addr,
 			  const int addrlen);
 	int (*io_accept)(struct PConnection *p);
@@ -195,6 +211,8 @@ typedef struct PConnection
 		 * field?
 		 */
 		ubyte xid;		/* Transaction ID */
+		ubyte last_xid;		/* Transaction ID of the last packet
+					 * received */
 		udword inbuf_len;	/* Current length of 'inbuf' */
 		ubyte *inbuf;		/* Buffer to hold incoming packets */
 	} net;
@@ -266,6 +284,9 @@ extern int PConn_read(struct PConnection *p,
 extern int PConn_write(struct PConnection *p,
                 unsigned const char *buf,
                 const int len);
+extern int PConn_writev(struct PConnection *p,
+		const struct iovec *iov,
+		const int iovcnt);
 extern int PConn_connect(struct PConnection *p,
                   const void *addr, 
                   const int addrlen);
@@ -284,6 +305,11 @@ extern void PConn_set_status(PConnection *p, pconn_stat status);
 extern pconn_stat PConn_get_status(PConnection *p);
 extern int PConn_isonline(PConnection *p);
 
+/* Support for long-running NetSync servers. See PConnection_net.c */
+extern int pconn_net_listen(int *wakeup_fd, int *data_fd, const int backlog);
+extern int pconn_net_answer_wakeup(int wakeup_fd);
+extern int PConn_attach(PConnection *pconn, int data_sock);
+
 
 extern int io_trace;
 #define	IO_TRACE(n)	if (io_trace >= (n))
@@ -182,6 +182,10 @@ extern int dlp_init(struct PConnection *pconn);
 extern int dlp_tini(struct PConnection *pconn);
 
 /* Protocol functions */
+extern int dlp_encode_req(const struct dlp_req_header *header,
+			  const struct dlp_arg argv[],
+			  ubyte **outbufp,
+			  long *outlenp);
 extern int dlp_send_req(struct PConnection *pconn,
 			const struct dlp_req_header *header,
 			const struct dlp_arg argv[]);
@@ -199,6 +203,11 @@ extern int dlp_dlpc_req(struct PConnection *pconn,
 			const struct dlp_arg argv[],
 			struct dlp_resp_header *resp_header,
 			const struct dlp_arg **ret_argv);
+extern int dlp_dlpc_req_encoded(struct PConnection *pconn,
+				const ubyte *outbuf,
+				const long outlen,
+				struct dlp_resp_header *resp_header,
+				const struct dlp_arg **ret_argv);
 extern const char * dlp_strerror(const dlp_stat_t err);
 
 #define dlp_latest_error(pconn) (pconn->dlp.resp.error)
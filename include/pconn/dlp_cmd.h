@@ -683,6 +683,26 @@ struct dlp_apppref
 #define DLPC_READAPPFL_BACKEDUP		0x80	/* Read backed up
 						 * preference database */
 
+/* DlpReadAppPreferences() reads a batch of preferences. The caller fills
+ * in 'creator', 'id' and 'flags' in each of these; the rest is filled in
+ * from the Palm's response.
+ */
+struct dlp_apppref_req
+{
+	udword creator;		/* Application creator */
+	uword id;		/* Preference ID */
+	ubyte flags;		/* DLPC_READAPPFL_* */
+	dlp_stat_t status;	/* Status returned by the Palm */
+	struct dlp_apppref pref;	/* Preference descriptor */
+	ubyte *data;		/* Preference data (pref.len bytes),
+				 * malloc()ed, or NULL. The caller frees
+				 * it. */
+};
+
+#define DLPC_PIPELINE_DEPTH	8	/* Max. # of requests
+					 * DlpReadAppPreferences() sends
+					 * ahead */
+
 /** WriteAppPreference **/
 #define DLPARG_WriteAppPreference_Pref	DLPARG_BASE
 #define DLPARGLEN_WriteAppPreference_Pref	12
@@ -1053,6 +1073,10 @@ extern int DlpReadAppPreference(
 	const ubyte flags,
 	struct dlp_apppref *pref,
 	ubyte *data);
+extern int DlpReadAppPreferences(
+	PConnection *pconn,
+	const int num_reqs,
+	struct dlp_apppref_req *reqs);
 /* XXX - DlpWriteAppPreference: untested */
 extern int DlpWriteAppPreference(
 	PConnection *pconn,
@@ -221,6 +221,18 @@ extern void pdb_FreeResource(struct pdb_resource *rsrc);
 extern struct pdb *pdb_Read(int fd);	/* Load a pdb from a file. */
 extern int pdb_Write(const struct pdb *db, int fd);
 					/* Write a pdb to a file */
+
+/* Writing a pdb to a file one record at a time */
+struct pdb_writer;		/* Opaque. See pdb.c */
+extern struct pdb_writer *pdb_WriteStart(const struct pdb *db, int fd);
+extern struct pdb_writer *pdb_WriteResume(const struct pdb *db, int fd,
+					  const udword *ids, uword *done);
+extern int pdb_WriteRecord(struct pdb_writer *w,
+			   const struct pdb_record *rec);
+extern int pdb_WriteResource(struct pdb_writer *w,
+			     const struct pdb_resource *rsrc);
+extern int pdb_WriteEnd(struct pdb_writer *w);
+extern void pdb_WriteAbort(struct pdb_writer *w);
 extern struct pdb_record *pdb_FindRecordByID(
 	const struct pdb *db,
 	const udword id);
@@ -258,6 +270,7 @@ extern struct pdb_resource *pdb_CopyResource(
 	const struct pdb *db,
 	const struct pdb_resource *rsrc);
 extern int pdb_LoadHeader(int fd, struct pdb *db);
+extern int pdb_LoadRecListHeader(int fd, struct pdb *db);
 
 /* XXX - Functions to write:
 pdb_setAppInfo		set the appinfo block
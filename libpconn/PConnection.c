@@ -80,9 +80,11 @@ new_PConnection(char *device,
 
 	pconn->fd		= -1;
 	pconn->flags		= flags;
+	pconn->listen_type	= listenType;
 	pconn->io_bind		= NULL;
 	pconn->io_read		= NULL;
 	pconn->io_write		= NULL;
+	pconn->io_writev	= NULL;
 	pconn->io_connect	= NULL;
 	pconn->io_accept	= NULL;
 	pconn->io_drain		= NULL;
@@ -287,6 +289,46 @@ PConn_write(struct PConnection *p,
 	return err;
 }
 
+/* PConn_writev
+ * Write the 'iovcnt' buffers in 'iov' to the connection, as a single
+ * write if the underlying transport supports it. Like PConn_write(), this
+ * may write less than the full amount; it returns the number of bytes
+ * written, or a negative value in case of error.
+ */
+int
+PConn_writev(struct PConnection *p,
+	     const struct iovec *iov,
+	     const int iovcnt)
+{
+	int i;
+	int err;
+
+	if (p->io_writev != NULL)
+		err = (*p->io_writev)(p, iov, iovcnt);
+	else {
+		/* No gather-write method. Write the first non-empty
+		 * buffer, and let the caller come back for the rest.
+		 */
+		err = 0;
+		for (i = 0; i < iovcnt; i++)
+		{
+			if (iov[i].iov_len == 0)
+				continue;
+			err = (*p->io_write)(p, iov[i].iov_base,
+					     iov[i].iov_len);
+			break;
+		}
+	}
+
+	if (err < 0)
+	{
+		_PConn_handle_ioerr(p);
+		PConn_set_palmerrno(p, PALMERR_SYSTEM);
+	}
+
+	return err;
+}
+
 int
 PConn_connect(struct PConnection *p,
 		  const void *addr,
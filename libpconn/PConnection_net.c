@@ -10,10 +10,14 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>		/* For socket() */
+#include <sys/uio.h>		/* For writev() */
 #include <netinet/in.h>		/* For sockaddr_in, htonl() etc. */
+#include <netinet/tcp.h>	/* For TCP_NODELAY, TCP_CORK */
 #include <arpa/inet.h>		/* For inet_pton() */
 #include <netdb.h>		/* For getservbyname() */
 #include <string.h>		/* For memset() */
+#include <fcntl.h>		/* For fcntl() */
+#include <errno.h>		/* For errno */
 #if HAVE_INET_NTOP
 #  include <arpa/nameser.h>	/* Solaris's <resolv.h> requires this */
 #  include <resolv.h>		/* For inet_ntop() under Solaris */
@@ -81,22 +85,32 @@
 	inet_ntoa(addr)
 #endif	/* HAVE_INET_NTOP */
 
+static int net_udp_recv(
+	int fd,
+	struct netsync_wakeup *wakeup_pkt,
+	struct sockaddr_in *cliaddr,
+	socklen_t *cliaddr_len);
 static int net_udp_listen(
 	PConnection *pconn,
 	struct netsync_wakeup *wakeup_pkt,
 	struct sockaddr_in *cliaddr,
 	socklen_t *cliaddr_len);
 static int net_acknowledge_wakeup(
-	PConnection *pconn,
+	int fd,
 	struct netsync_wakeup *wakeup_pkt,
 	struct sockaddr_in *cliaddr,
 	socklen_t *cliaddr_len);
+static int net_tcp_socket(const int backlog);
 static int net_tcp_listen(PConnection *pconn);
+static int net_tcp_attach(PConnection *pconn, int data_sock);
+static void net_set_tcp_policy(PConnection *pconn);
 
+/* net_udp_bind
+ * Bind the UDP socket 'fd' to the NetSync wakeup port. Closes 'fd' in
+ * case of error.
+ */
 static int
-net_bind(PConnection *pconn,
-	 const void *addr,
-	 const int addrlen)
+net_udp_bind(int fd, const void *addr)
 {
 	struct sockaddr_in myaddr;
 	int err;
@@ -144,20 +158,28 @@ net_bind(PConnection *pconn,
 	IO_TRACE(4)
 		fprintf(stderr, "bind()ing to %d\n",
 			ntohs(myaddr.sin_port));
-	err = bind(pconn->fd,
+	err = bind(fd,
 		   (struct sockaddr *) &myaddr,
 		   sizeof(struct sockaddr_in));
 	if (err < 0)
 	{
 		perror("bind");
-		if (pconn->fd >= 0)
-			close(pconn->fd);
+		if (fd >= 0)
+			close(fd);
 		return -1;
 	}
 
 	return 0;
 }
 
+static int
+net_bind(PConnection *pconn,
+	 const void *addr,
+	 const int addrlen)
+{
+	return net_udp_bind(pconn->fd, addr);
+}
+
 static int
 net_read(PConnection *p, unsigned char *buf, int len)
 {
@@ -170,6 +192,75 @@ net_write(PConnection *p, unsigned const char *buf, const int len)
 	return write(p->fd, buf, len);
 }
 
+#if HAVE_WRITEV
+static int
+net_writev(PConnection *p, const struct iovec *iov, const int iovcnt)
+{
+	int err;
+#ifdef TCP_CORK
+	int on;
+
+	/* If the socket is to be corked, hold back partial segments until
+	 * the whole message has been queued.
+	 */
+	if (p->flags & PCONNFL_TCP_CORK)
+	{
+		on = 1;
+		setsockopt(p->fd, IPPROTO_TCP, TCP_CORK,
+			   (void *) &on, sizeof(on));
+	}
+#endif	/* TCP_CORK */
+
+	err = writev(p->fd, iov, iovcnt);
+
+#ifdef TCP_CORK
+	if (p->flags & PCONNFL_TCP_CORK)
+	{
+		/* Pull the cork, so the message goes out now */
+		on = 0;
+		setsockopt(p->fd, IPPROTO_TCP, TCP_CORK,
+			   (void *) &on, sizeof(on));
+	}
+#endif	/* TCP_CORK */
+
+	return err;
+}
+#endif	/* HAVE_WRITEV */
+
+/* net_set_tcp_policy
+ * Set the TCP options on a freshly-established NetSync data socket,
+ * according to the PCONNFL_TCP_* flags.
+ * DLP is a strict request/response protocol, so Nagle's algorithm buys
+ * nothing: every message is followed by a wait for the reply, and
+ * holding back the tail of a message until the previous segment is
+ * ACKed (which the peer may delay by up to 200 ms) just stalls the sync.
+ * Hence, unless told otherwise, we turn it off.
+ * Failure to set an option isn't fatal: the sync will merely be slower.
+ */
+static void
+net_set_tcp_policy(PConnection *pconn)
+{
+	int on = 1;
+
+	if (pconn->flags & PCONNFL_TCP_NAGLE)
+	{
+		IO_TRACE(4)
+			fprintf(stderr, "Leaving Nagle's algorithm on\n");
+		return;
+	}
+
+	IO_TRACE(4)
+		fprintf(stderr, "Setting TCP_NODELAY%s\n",
+			(pconn->flags & PCONNFL_TCP_CORK ?
+			 " (and corking writes)" : ""));
+	if (setsockopt(pconn->fd, IPPROTO_TCP, TCP_NODELAY,
+		       (void *) &on, sizeof(on)) < 0)
+	{
+		IO_TRACE(2)
+			perror("setsockopt(TCP_NODELAY)");
+	}
+}
+
 #if 0
 
 static int
@@ -451,6 +542,8 @@ net_connect(PConnection *pconn, const void *addr, const int addrlen)
 		return -1;
 	}
 
+	net_set_tcp_policy(pconn);
+
 
 	/* Exchange ritual packets with server */
 	err = ritual_exch_client(pconn);
@@ -480,10 +573,21 @@ net_accept(PConnection *p)
 		       &cliaddr, &cliaddr_len);
 	/* XXX - Error-checking */
 
-	net_acknowledge_wakeup(p, &wakeup_pkt,
+	net_acknowledge_wakeup(p->fd, &wakeup_pkt,
 			       &cliaddr, &cliaddr_len);
 	/* XXX - Error-checking */
 
+	fprintf(stderr, "Closing UDP socket.\n");
+	if (p->fd >= 0)
+	{
+		int err;
+
+		err = close(p->fd);
+		fprintf(stderr, "close() returned %d\n", err);
+		if (err < 0)
+			perror("close");
+	}
+
 	net_tcp_listen(p);
 	/* XXX - Error-checking */
 
@@ -589,6 +693,9 @@ pconn_net_open(PConnection *pconn,
 	pconn->io_bind		= &net_bind;
 	pconn->io_read		= &net_read;
 	pconn->io_write		= &net_write;
+#if HAVE_WRITEV
+	pconn->io_writev	= &net_writev;
+#endif	/* HAVE_WRITEV */
 	pconn->io_connect	= &net_connect;
 	pconn->io_accept	= &net_accept;
 	pconn->io_close		= &net_close;
@@ -614,27 +721,32 @@ pconn_net_open(PConnection *pconn,
 	return pconn->fd;
 }
 
+/* net_udp_recv
+ * Receive one datagram on the wakeup socket 'fd', and parse it.
+ * Returns 0 if it is a wakeup packet, 1 if it isn't, or -1 in case of
+ * error.
+ */
 static int
-net_udp_listen(PConnection *pconn,
-	       struct netsync_wakeup *wakeup_pkt,
-	       struct sockaddr_in *cliaddr,
-	       socklen_t *cliaddr_len)
+net_udp_recv(int fd,
+	     struct netsync_wakeup *wakeup_pkt,
+	     struct sockaddr_in *cliaddr,
+	     socklen_t *cliaddr_len)
 {
 	int len;
 	ubyte buf[1024];		/* XXX - Fixed size bad */
 	const ubyte *rptr;		/* Pointer into buffer, for reading */
 
 	/* Receive a datagram from a client */
-  retry:
-	len = recvfrom(pconn->fd, (char *) buf, sizeof(buf), 0,
+	len = recvfrom(fd, (char *) buf, sizeof(buf), 0,
 		       (struct sockaddr *) cliaddr,
 		       cliaddr_len);
 
 	fprintf(stderr, "recvfrom() returned %d\n", len);
 	if (len < 0)
 	{
-		perror("recvfrom");
-		goto retry;
+		if (errno != EAGAIN)
+			perror("recvfrom");
+		return -1;
 	} else {
 		fprintf(stderr,
 			"Got datagram from host 0x%08lx (%d.%d.%d.%d), "
@@ -680,14 +792,27 @@ net_udp_listen(PConnection *pconn,
 	if (wakeup_pkt->magic != NETSYNC_WAKEUP_MAGIC)
 	{
 		fprintf(stderr, "This is not a wakeup packet.\n");
-		goto retry;
+		return 1;
 	}
 
 	return 0;
 }
 
 static int
-net_acknowledge_wakeup(PConnection *pconn,
+net_udp_listen(PConnection *pconn,
+	       struct netsync_wakeup *wakeup_pkt,
+	       struct sockaddr_in *cliaddr,
+	       socklen_t *cliaddr_len)
+{
+	/* Wait until we get a wakeup packet */
+	while (net_udp_recv(pconn->fd, wakeup_pkt,
+			    cliaddr, cliaddr_len) != 0)
+		;
+	return 0;
+}
+
+static int
+net_acknowledge_wakeup(int fd,
 		       struct netsync_wakeup *wakeup_pkt,
 		       struct sockaddr_in *cliaddr,
 		       socklen_t *cliaddr_len)
@@ -713,7 +838,7 @@ net_acknowledge_wakeup(PConnection *pconn,
 
 	IO_TRACE(3)
 		fprintf(stderr, "Sending acknowledgment.\n");
-	err = sendto(pconn->fd, (const char *) outbuf, pkt_len, 0,
+	err = sendto(fd, (const char *) outbuf, pkt_len, 0,
 		     (struct sockaddr *) cliaddr,
 		     *cliaddr_len);
 	if (err < 0)
@@ -722,43 +847,32 @@ net_acknowledge_wakeup(PConnection *pconn,
 		return -1;
 	}
 
-	fprintf(stderr, "Closing UDP socket.\n");
-	if (pconn->fd >= 0)
-	{
-		err = close(pconn->fd);
-		fprintf(stderr, "close() returned %d\n", err);
-		if (err < 0)
-			perror("close");
-	}
-
 	return 0;
 }
 
+/* net_tcp_socket
+ * Create a TCP socket bound to the NetSync data port, and listen on it
+ * with the given backlog. Returns the socket, or -1 in case of error.
+ */
 static int
-net_tcp_listen(PConnection *pconn)
+net_tcp_socket(const int backlog)
 {
 	int err;
+	int sock;
+	int on = 1;
 	struct sockaddr_in servaddr;	/* Local host's (server's) address */
-	struct sockaddr_in cliaddr;	/* Client's address */
-	socklen_t cliaddr_len;		/* Length of client's address */
 	struct servent *service;	/* "netsync" entry in /etc/services */
-	int data_sock;			/* Data socket (TCP). Will replace
-					 * the UDP socket pconn->fd.
-					 */
-
-	IO_TRACE(4)
-		fprintf(stderr, "Inside net_tcp_listen()\n");
 
 	IO_TRACE(5)
 		fprintf(stderr, "Creating TCP socket.\n");
-	pconn->fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (pconn->fd < 0)
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
 	{
 		perror("socket");
 		return -1;
 	}
 	IO_TRACE(5)
-		fprintf(stderr, "TCP socket == %d\n", pconn->fd);
+		fprintf(stderr, "TCP socket == %d\n", sock);
 
 	service = getservbyname("netsync", "tcp");
 				/* Try to get the entry for "netsync" from
@@ -795,18 +909,49 @@ net_tcp_listen(PConnection *pconn)
 		servaddr.sin_port = service->s_port;
 				/* Port is already in network byte order */
 
+	/* A long-running listener may be restarted while old connections
+	 * are still in TIME_WAIT.
+	 */
+	if (backlog > 1)
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
+			   (void *) &on, sizeof(on));
+
 	IO_TRACE(5)
 		fprintf(stderr, "binding\n");
-	err = bind(pconn->fd, (struct sockaddr *) &servaddr, sizeof(servaddr));
+	err = bind(sock, (struct sockaddr *) &servaddr, sizeof(servaddr));
 	if (err < 0)
 	{
 		perror("bind");
+		close(sock);
 		return -1;
 	}
 
 	IO_TRACE(5)
 		fprintf(stderr, "listening\n");
-	err = listen(pconn->fd, 1);
+	err = listen(sock, backlog);
+	if (err < 0)
+	{
+		perror("listen");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static int
+net_tcp_listen(PConnection *pconn)
+{
+	struct sockaddr_in cliaddr;	/* Client's address */
+	socklen_t cliaddr_len;		/* Length of client's address */
+	int data_sock;			/* Data socket (TCP). Will replace
+					 * the UDP socket pconn->fd.
+					 */
+
+	IO_TRACE(4)
+		fprintf(stderr, "Inside net_tcp_listen()\n");
+
+	pconn->fd = net_tcp_socket(1);
 				/* NB: the backlog is set to 1 because we
 				 * know for sure that there's one incoming
 				 * connection, and if there's a second one,
@@ -814,11 +959,8 @@ net_tcp_listen(PConnection *pconn)
 				 * In other circumstances, a different
 				 * value would be required.
 				 */
-	if (err < 0)
-	{
-		perror("listen");
+	if (pconn->fd < 0)
 		return -1;
-	}
 
 	/* XXX - accept() should time out after a while. 10 seconds? */
 	IO_TRACE(5)
@@ -842,13 +984,25 @@ net_tcp_listen(PConnection *pconn)
 			(int) ((cliaddr.sin_addr.s_addr >> 24) & 0xff),
 			cliaddr.sin_port);
 
+	return net_tcp_attach(pconn, data_sock);
+}
+
+/* net_tcp_attach
+ * Make the already-accepted TCP socket 'data_sock' the data connection
+ * for 'pconn', and go through the ritual exchange with the client.
+ */
+static int
+net_tcp_attach(PConnection *pconn, int data_sock)
+{
+	int err;
+
 	/* We've accepted a TCP connection, so we don't need the UDP socket
-	 * anymore. Replace the UDP socket with the TCP one.
+	 * (or listening socket) anymore. Replace it with the TCP one.
 	 */
-	close(pconn->fd);		/* XXX - Wasn't this done already
-					 * in net_acknowledge_wakeup()?
-					 */
+	if (pconn->fd >= 0)
+		close(pconn->fd);
 	pconn->fd = data_sock;
+	net_set_tcp_policy(pconn);
 
 	/* Exchange ritual packets with the client */
 	err = ritual_exch_server(pconn);
@@ -858,6 +1012,94 @@ net_tcp_listen(PConnection *pconn)
 	return 0;
 }
 
+/* pconn_net_listen
+ * Set up the sockets for a long-running NetSync server, which handles
+ * many connections without going through PConn_accept() for each one:
+ * a UDP socket bound to the wakeup port, returned in '*wakeup_fd', and a
+ * TCP socket listening on the data port with the given backlog, returned
+ * in '*data_fd'. Both are non-blocking, so that they can be watched by
+ * an event loop.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+int
+pconn_net_listen(int *wakeup_fd, int *data_fd, const int backlog)
+{
+	struct sockaddr_in addr;
+	int udp_sock;
+
+	*wakeup_fd = *data_fd = -1;
+
+	if ((udp_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+	bzero((void *) &addr, sizeof(addr));
+	if (net_udp_bind(udp_sock, &addr) < 0)
+		return -1;		/* net_udp_bind() closed the socket */
+
+	if ((*data_fd = net_tcp_socket(backlog)) < 0)
+	{
+		close(udp_sock);
+		return -1;
+	}
+	*wakeup_fd = udp_sock;
+
+	fcntl(*wakeup_fd, F_SETFL, fcntl(*wakeup_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(*data_fd, F_SETFL, fcntl(*data_fd, F_GETFL) | O_NONBLOCK);
+
+	return 0;
+}
+
+/* pconn_net_answer_wakeup
+ * Read one datagram from the wakeup socket set up by pconn_net_listen(),
+ * and acknowledge it if it's a wakeup packet. The client will then
+ * connect to the data port.
+ * Returns 1 if a wakeup packet was acknowledged, 0 if there was nothing
+ * to acknowledge, or -1 in case of error.
+ */
+int
+pconn_net_answer_wakeup(int wakeup_fd)
+{
+	int err;
+	struct netsync_wakeup wakeup_pkt;
+	struct sockaddr_in cliaddr;	/* Client's address */
+	socklen_t cliaddr_len;		/* Length of client's address */
+
+	cliaddr_len = sizeof(cliaddr);
+	err = net_udp_recv(wakeup_fd, &wakeup_pkt, &cliaddr, &cliaddr_len);
+	if (err < 0)
+		return (errno == EAGAIN ? 0 : -1);
+	if (err > 0)
+		return 0;		/* Not a wakeup packet */
+
+	if (net_acknowledge_wakeup(wakeup_fd, &wakeup_pkt,
+				   &cliaddr, &cliaddr_len) < 0)
+		return -1;
+	return 1;
+}
+
+/* PConn_attach
+ * Use 'data_sock', a NetSync data connection accepted from the socket set
+ * up by pconn_net_listen(), as the connection for 'pconn', instead of
+ * calling PConn_accept(). 'pconn' must be a new LISTEN_NET connection.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+int
+PConn_attach(PConnection *pconn, int data_sock)
+{
+	if ((pconn->listen_type != LISTEN_NET) ||
+	    (pconn->protocol != PCONN_STACK_NET))
+		return -1;
+
+	/* The event loop may have left the socket non-blocking; the rest
+	 * of the protocol stack expects blocking I/O.
+	 */
+	fcntl(data_sock, F_SETFL, fcntl(data_sock, F_GETFL) & ~O_NONBLOCK);
+
+	return net_tcp_attach(pconn, data_sock);
+}
+
 /* This is for Emacs's benefit:
  * Local Variables: ***
  * fill-column:	75 ***
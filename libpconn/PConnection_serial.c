@@ -438,8 +438,13 @@ serial_accept(PConnection *pconn)
 
 	    case PCONN_STACK_SIMPLE:
 	    case PCONN_STACK_NET:
-		/* Exchange ritual packets */
-		err = ritual_exch_server(pconn);
+		/* Exchange ritual packets. A Palm speaks first. */
+		if (pconn->flags & PCONNFL_EMULATEPALM)
+		{
+			pconn->whosonfirst = 1;
+			err = ritual_exch_client(pconn);
+		} else
+			err = ritual_exch_server(pconn);
 		if (err < 0)
 			return -1;
 		break;
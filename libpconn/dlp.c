@@ -86,31 +86,32 @@ dlp_tini(PConnection *pconn)
 	return 0;
 }
 
-/* dlp_send_req
- * Send the DLP request defined by 'header'. 'argv' is the list of
- * arguments.
- * Returns 0 if successful. In case of error, returns a negative
- * value. 'palm_errno' is set to indicate the error.
+/* dlp_encode_req
+ * Encode the DLP request defined by 'header' and 'argv' into a newly-
+ * allocated buffer, and return it in '*outbufp', and its length in
+ * '*outlenp'. The caller is responsible for freeing the buffer.
+ * If an argument's 'data' is NULL, room is left for it but nothing is
+ * copied; the caller fills it in. This lets callers build a request in
+ * place, without first assembling the argument in a buffer of its own.
+ * The data of the last argument always ends at the end of the buffer.
+ * Returns 0 if successful, or a negative value in case of error.
  */
-
 int
-dlp_send_req(PConnection *pconn,	/* Connection to Palm */
-	     const struct dlp_req_header *header,
-	     				/* Request header */
-	     const struct dlp_arg argv[])	/* Array of request arguments */
+dlp_encode_req(const struct dlp_req_header *header,
+					/* Request header */
+	       const struct dlp_arg argv[],	/* Array of request arguments */
+	       ubyte **outbufp,		/* Encoded request returned here */
+	       long *outlenp)		/* Its length returned here */
 {
 	int i;
-	int err;
 	ubyte *outbuf;			/* Outgoing request buffer */
 	long buflen;			/* Length of outgoing request */
 	ubyte *wptr;			/* Pointer into buffers (for writing) */
 
-	PConn_set_palmerrno(pconn, PALMERR_NOERR);
-
 	/* Calculate size of outgoing request */
 	DLP_TRACE(6)
 		fprintf(stderr,
-			"dlp_send_req: Calculating outgoing request buffer\n");
+			"dlp_encode_req: Calculating outgoing request buffer\n");
 
 	buflen = 2L;		/* Request id and argc */
 	for (i = 0; i < header->argc; i++)
@@ -152,7 +153,7 @@ dlp_send_req(PConnection *pconn,	/* Connection to Palm */
 	{
 		fprintf(stderr,
 			_("%s: Can't allocate %ld-byte buffer.\n"),
-			"dlp_send_req",
+			"dlp_encode_req",
 			buflen);
 		return -1;
 	}
@@ -161,9 +162,6 @@ dlp_send_req(PConnection *pconn,	/* Connection to Palm */
 	wptr = outbuf;
 	put_ubyte(&wptr, header->id);
 	put_ubyte(&wptr, header->argc);
-	DLP_TRACE(5)
-		fprintf(stderr, ">>> request id 0x%02x, %d args\n",
-			header->id, header->argc);
 
 	/* Append the request headers to the output buffer */
 	for (i = 0; i < header->argc; i++)
@@ -219,24 +217,62 @@ dlp_send_req(PConnection *pconn,	/* Connection to Palm */
 		}
 
 		/* Append the argument data to the header */
-		memcpy(wptr, argv[i].data, argv[i].size);
+		if (argv[i].data != NULL)
+			memcpy(wptr, argv[i].data, argv[i].size);
 		wptr += argv[i].size;
 	}
 
-	/* Send the request */
+	*outbufp = outbuf;
+	*outlenp = wptr - outbuf;
+	return 0;		/* Success */
+}
+
+/* send_encoded_req
+ * Send a request that has already been encoded by dlp_encode_req().
+ */
+static int
+send_encoded_req(PConnection *pconn,
+		 const ubyte *outbuf,
+		 const long outlen)
+{
+	PConn_set_palmerrno(pconn, PALMERR_NOERR);
+
+	DLP_TRACE(5)
+		fprintf(stderr, ">>> request id 0x%02x, %d args\n",
+			outbuf[0], outbuf[1]);
 	DLP_TRACE(8)
-		debug_dump(stderr, "DLP>>>", outbuf, wptr-outbuf);
+		debug_dump(stderr, "DLP>>>", outbuf, outlen);
 
-	err = (*pconn->dlp.write)(pconn, outbuf, wptr-outbuf);
+	return (*pconn->dlp.write)(pconn, outbuf, outlen);
+}
 
-	if (err < 0)
+/* dlp_send_req
+ * Send the DLP request defined by 'header'. 'argv' is the list of
+ * arguments.
+ * Returns 0 if successful. In case of error, returns a negative
+ * value. 'palm_errno' is set to indicate the error.
+ */
+
+int
+dlp_send_req(PConnection *pconn,	/* Connection to Palm */
+	     const struct dlp_req_header *header,
+	     				/* Request header */
+	     const struct dlp_arg argv[])	/* Array of request arguments */
+{
+	int err;
+	ubyte *outbuf;			/* Outgoing request buffer */
+	long outlen;			/* Length of outgoing request */
+
+	if ((err = dlp_encode_req(header, argv, &outbuf, &outlen)) < 0)
 	{
-		free(outbuf);
+		PConn_set_palmerrno(pconn, PALMERR_NOMEM);
 		return err;
 	}
 
+	err = send_encoded_req(pconn, outbuf, outlen);
+
 	free(outbuf);
-	return 0;		/* Success */
+	return err < 0 ? err : 0;
 }
 
 /* dlp_recv_resp
@@ -393,9 +429,13 @@ dlp_recv_req(PConnection *pconn,	/* Connection to Desktop */
 	const ubyte *rptr;	/* Pointer into buffers (for reading) */
 	
 	/* Read the request */
+	inlen = 0;
 	err = (*pconn->dlp.read)(pconn, &inbuf, &inlen);
 	if (err < 0)
 	    return err;	/* Error */
+	if (inlen == 0)
+	    return -1;	/* EOF: the Desktop hung up. PConn_read() has
+			 * already set 'palm_errno'. */
 	
 	DLP_TRACE(8)
 	    debug_dump(stderr, "DLP<<<", inbuf, inlen);
@@ -642,6 +682,39 @@ dlp_dlpc_req(PConnection *pconn,		/* Connection to Palm */
 	     struct dlp_resp_header *resp_header,
 						/* Response header */
 	     const struct dlp_arg **ret_argv)	/* Response argument list */
+{
+	int err;
+	ubyte *outbuf;			/* Encoded request */
+	long outlen;			/* Length of encoded request */
+
+	/* Encode the request once: if it needs to be resent, the same
+	 * buffer will do.
+	 */
+	if ((err = dlp_encode_req(header, argv, &outbuf, &outlen)) < 0)
+	{
+		PConn_set_palmerrno(pconn, PALMERR_NOMEM);
+		return err;
+	}
+
+	err = dlp_dlpc_req_encoded(pconn, outbuf, outlen,
+				   resp_header, ret_argv);
+	free(outbuf);
+
+	return err;
+}
+
+/* dlp_dlpc_req_encoded
+ * Like dlp_dlpc_req(), but for a request that has already been encoded
+ * with dlp_encode_req().
+ */
+int
+dlp_dlpc_req_encoded(PConnection *pconn,	/* Connection to Palm */
+		     const ubyte *outbuf,	/* Encoded request */
+		     const long outlen,		/* Length of 'outbuf' */
+		     struct dlp_resp_header *resp_header,
+						/* Response header */
+		     const struct dlp_arg **ret_argv)
+						/* Response argument list */
 {
 	int err;
 	int trycount;		/* # times to try sending the request */
@@ -652,8 +725,8 @@ dlp_dlpc_req(PConnection *pconn,		/* Connection to Palm */
 		DLP_TRACE(2)
 			fprintf(stderr,
 				"dlp_dlpc_req: sending request 0x%02x, trycount: %d\n",
-				header->id, trycount);
-		err = dlp_send_req(pconn, header, argv);
+				outbuf[0], trycount);
+		err = send_encoded_req(pconn, outbuf, outlen);
 		if (err < 0)
 		{
 			if (PConn_get_palmerrno(pconn) == PALMERR_TIMEOUT2)
@@ -673,7 +746,7 @@ dlp_dlpc_req(PConnection *pconn,		/* Connection to Palm */
 				"dlp_dlpc_req: waiting for response\n");
 
 		/* Get a response */
-		err = dlp_recv_resp(pconn, header->id,
+		err = dlp_recv_resp(pconn, outbuf[0],
 				    resp_header, ret_argv);
 
 		if (err < 0)
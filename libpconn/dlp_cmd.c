@@ -1843,17 +1843,11 @@ DlpWriteRecord(PConnection *pconn,	/* Connection to Palm */
 	struct dlp_resp_header resp_header;	/* Response header */
 	struct dlp_arg argv[1];		/* Request argument list */
 	const struct dlp_arg *ret_argv;	/* Response argument list */
-	ubyte *outbuf;			/* Output buffer */
+	ubyte *outbuf;			/* Encoded request */
+	long outlen;			/* Length of encoded request */
 	const ubyte *rptr;	/* Pointer into buffers (for reading) */
 	ubyte *wptr;		/* Pointer into buffers (for writing) */
 
-	if ((outbuf = malloc(DLPARGLEN_WriteRecord_Rec + len)) == NULL)
-	{
-		fprintf(stderr,
-			_("DlpWriteRecord: Can't allocate output buffer.\n"));
-		return -1;
-	}
-
 	DLPC_TRACE(1)
 		fprintf(stderr,
 			">>> WriteRecord: handle %d, flags 0x%02x, "
@@ -1875,8 +1869,24 @@ DlpWriteRecord(PConnection *pconn,	/* Connection to Palm */
 	header.id = (ubyte) DLPCMD_WriteRecord;
 	header.argc = 1;
 
+	/* Fill in the argument. The record data is large, so rather than
+	 * copying it into an argument buffer, and then again into the
+	 * request, have dlp_encode_req() leave room for the argument and
+	 * build it in place.
+	 */
+	argv[0].id = DLPARG_WriteRecord_Rec;
+	argv[0].size = DLPARGLEN_WriteRecord_Rec + len;
+	argv[0].data = NULL;
+
+	if (dlp_encode_req(&header, argv, &outbuf, &outlen) < 0)
+	{
+		fprintf(stderr,
+			_("DlpWriteRecord: Can't allocate output buffer.\n"));
+		return -1;
+	}
+
 	/* Construct the argument */
-	wptr = outbuf;
+	wptr = outbuf + outlen - argv[0].size;
 	put_ubyte(&wptr, handle);
 	put_ubyte(&wptr, flags | 0x80);
 		/* The Palm header says that the high bit (0x80) should
@@ -1891,17 +1901,10 @@ DlpWriteRecord(PConnection *pconn,	/* Connection to Palm */
 		 */
 	put_ubyte(&wptr, category);
 	memcpy(wptr, data, len);
-	wptr += len;
-
-	/* Fill in the argument */
-	argv[0].id = DLPARG_WriteRecord_Rec;
-	argv[0].size = wptr - outbuf;
-	argv[0].data = outbuf;
 
 	/* Send the DLP request */
-	err = dlp_dlpc_req(pconn,
-			   &header, argv,
-			   &resp_header, &ret_argv);
+	err = dlp_dlpc_req_encoded(pconn, outbuf, outlen,
+				   &resp_header, &ret_argv);
 	free(outbuf);			/* We're done with it now */
 	outbuf = NULL;
 	if (err < 0)
@@ -2206,7 +2209,8 @@ DlpWriteResource(PConnection *pconn,	/* Connection to Palm */
 	struct dlp_resp_header resp_header;	/* Response header */
 	struct dlp_arg argv[1];		/* Request argument list */
 	const struct dlp_arg *ret_argv;	/* Response argument list */
-	ubyte *outbuf;			/* Output buffer */
+	ubyte *outbuf;			/* Encoded request */
+	long outlen;			/* Length of encoded request */
 	ubyte *wptr;		/* Pointer into buffers (for writing) */
 
 	DLPC_TRACE(1)
@@ -2224,32 +2228,32 @@ DlpWriteResource(PConnection *pconn,	/* Connection to Palm */
 	header.id = (ubyte) DLPCMD_WriteResource;
 	header.argc = 1;
 
-	/* Construct the argument */
-	if ((outbuf = (ubyte *) malloc(DLPARGLEN_WriteResource_Rsrc+size))
-	    == NULL)
+	/* Fill in the argument, leaving dlp_encode_req() to make room
+	 * for it: see DlpWriteRecord().
+	 */
+	argv[0].id = DLPARG_WriteResource_Rsrc;
+	argv[0].size = DLPARGLEN_WriteResource_Rsrc + size;
+	argv[0].data = NULL;
+
+	if (dlp_encode_req(&header, argv, &outbuf, &outlen) < 0)
 	{
 		fprintf(stderr, _("%s: Out of memory.\n"),
 			"DlpWriteResource");
 		return -1;
 	}
-	wptr = outbuf;
+
+	/* Construct the argument */
+	wptr = outbuf + outlen - argv[0].size;
 	put_ubyte(&wptr, handle);
 	put_ubyte(&wptr, 0);		/* Padding */
 	put_udword(&wptr, type);
 	put_uword(&wptr, id);
 	put_uword(&wptr, size);
 	memcpy(wptr, data, size);
-	wptr += size;
-
-	/* Fill in the argument */
-	argv[0].id = DLPARG_WriteResource_Rsrc;
-	argv[0].size = wptr - outbuf;
-	argv[0].data = outbuf;
 
 	/* Send the DLP request */
-	err = dlp_dlpc_req(pconn,
-			   &header, argv,
-			   &resp_header, &ret_argv);
+	err = dlp_dlpc_req_encoded(pconn, outbuf, outlen,
+				   &resp_header, &ret_argv);
 	free(outbuf);
 	if (err < 0)
 		return err;
@@ -3377,6 +3381,227 @@ DlpReadAppPreference(
 	return 0;		/* Success */
 }
 
+/* apppref_req
+ * Fill in the header and argument for a ReadAppPreference request for
+ * all of the preference in 'req'. 'outbuf' holds the argument data.
+ */
+static void
+apppref_req(const struct dlp_apppref_req *req,
+	    struct dlp_req_header *header,
+	    struct dlp_arg *argv,
+	    ubyte *outbuf)
+{
+	ubyte *wptr;
+
+	header->id = (ubyte) DLPCMD_ReadAppPreference;
+	header->argc = 1;
+
+	wptr = outbuf;
+	put_udword(&wptr, req->creator);
+	put_uword(&wptr, req->id);
+	put_uword(&wptr, DLPC_READAPP_FULL);
+	put_ubyte(&wptr, req->flags);
+	put_ubyte(&wptr, 0);		/* Padding */
+
+	argv[0].id = DLPARG_ReadAppPreference_Pref;
+	argv[0].size = DLPARGLEN_ReadAppPreference_Pref;
+	argv[0].data = outbuf;
+}
+
+/* apppref_resp
+ * Parse the response to a request built by apppref_req() into 'req'.
+ * Returns 0 if successful, or a negative value in case of error.
+ */
+static int
+apppref_resp(struct dlp_apppref_req *req,
+	     const struct dlp_resp_header *resp_header,
+	     const struct dlp_arg *ret_argv)
+{
+	int i;
+	const ubyte *rptr;
+
+	req->status = (dlp_stat_t) resp_header->error;
+	req->pref.version = 0;
+	req->pref.size = 0;
+	req->pref.len = 0;
+	req->data = NULL;
+	if (req->status != DLPSTAT_NOERR)
+		return 0;
+
+	for (i = 0; i < resp_header->argc; i++)
+	{
+		rptr = ret_argv[i].data;
+		switch (ret_argv[i].id)
+		{
+		    case DLPRET_ReadAppPreference_Pref:
+			req->pref.version = get_uword(&rptr);
+			req->pref.size = get_uword(&rptr);
+			req->pref.len = get_uword(&rptr);
+			if (req->pref.len > ret_argv[i].size -
+			    DLPRETLEN_ReadAppPreference_Pref)
+				req->pref.len = ret_argv[i].size -
+					DLPRETLEN_ReadAppPreference_Pref;
+
+			if (req->pref.len > 0)
+			{
+				if ((req->data = (ubyte *)
+				     malloc(req->pref.len)) == NULL)
+					return -1;
+				memcpy(req->data, rptr, req->pref.len);
+			}
+
+			DLPC_TRACE(3)
+				fprintf(stderr,
+					"Read an app. preference: version %d, "
+					"size %d, len %d\n",
+					req->pref.version, req->pref.size,
+					req->pref.len);
+			break;
+		    default:	/* Unknown argument type */
+			fprintf(stderr, _("##### %s: Unknown argument type: "
+					  "0x%02x.\n"),
+				"DlpReadAppPreferences",
+				ret_argv[i].id);
+			continue;
+		}
+	}
+
+	return 0;
+}
+
+/* apppref_drain
+ * Read and discard the responses to pipelined requests that are still
+ * in flight, up to and including the one with transaction ID 'last_xid',
+ * which was the last one sent. At most 'max' responses are read. Gives up
+ * at the first error: by then, there's not much else to be done with the
+ * connection anyway.
+ */
+static void
+apppref_drain(PConnection *pconn,
+	      int max,
+	      const ubyte last_xid)
+{
+	const ubyte *inbuf;
+	uword inlen;
+
+	for (; (max > 0) && (pconn->net.last_xid != last_xid); max--)
+	{
+		DLPC_TRACE(5)
+			fprintf(stderr, "Discarding a pipelined response\n");
+		if ((*pconn->dlp.read)(pconn, &inbuf, &inlen) <= 0)
+			break;
+	}
+}
+
+/* DlpReadAppPreferences
+ * Read each of the 'num_reqs' preferences described in 'reqs' in full.
+ * DLP is a request-response protocol, but on a NetSync connection
+ * nothing stops us from sending the next request before the previous
+ * response has arrived: the Palm answers them in order. So up to
+ * DLPC_PIPELINE_DEPTH requests are kept in flight, and the round trips
+ * overlap. PADP, on the other hand, is stop-and-wait, so on a serial
+ * connection the requests are sent one at a time.
+ * Each response is checked against the transaction ID of the request it
+ * should answer. If anything goes wrong, the responses to the requests
+ * still in flight are read and thrown away, so that the next command
+ * doesn't get one of them instead of its own.
+ * A preference that the Palm doesn't have isn't an error: its 'status'
+ * is set accordingly.
+ * Returns 0 if successful, or a negative value in case of error.
+ */
+int
+DlpReadAppPreferences(
+	PConnection *pconn,		/* Connection to Palm */
+	const int num_reqs,		/* # of preferences to read */
+	struct dlp_apppref_req *reqs)	/* The preferences */
+{
+	int err;
+	int depth;			/* Max. # of requests in flight */
+	int sent;			/* # of requests sent */
+	int rcvd;			/* # of responses received */
+	ubyte xids[DLPC_PIPELINE_DEPTH];
+					/* Transaction IDs of the requests
+					 * in flight */
+	struct dlp_req_header header;		/* Request header */
+	struct dlp_resp_header resp_header;	/* Response header */
+	struct dlp_arg argv[1];		/* Request argument list */
+	const struct dlp_arg *ret_argv;	/* Response argument list */
+	ubyte outbuf[DLPARGLEN_ReadAppPreference_Pref];
+					/* Output buffer */
+
+	DLPC_TRACE(1)
+		fprintf(stderr, ">>> ReadAppPreferences: %d preferences\n",
+			num_reqs);
+
+	/* Only pipeline when we're the ones picking the transaction IDs:
+	 * otherwise there's no telling which response is which.
+	 */
+	if (((pconn->protocol == PCONN_STACK_NET) ||
+	     (pconn->protocol == PCONN_STACK_SIMPLE)) &&
+	    (pconn->whosonfirst == 0))
+		depth = DLPC_PIPELINE_DEPTH;
+	else
+		depth = 1;
+
+	for (sent = rcvd = 0; rcvd < num_reqs; rcvd++)
+	{
+		if (depth == 1)
+		{
+			/* Plain old request and response, with the usual
+			 * retries.
+			 */
+			apppref_req(&reqs[rcvd], &header, argv, outbuf);
+			err = dlp_dlpc_req(pconn, &header, argv,
+					   &resp_header, &ret_argv);
+			sent++;
+		} else {
+			/* Keep the pipe full */
+			err = 0;
+			while ((sent < num_reqs) && (sent - rcvd < depth))
+			{
+				apppref_req(&reqs[sent], &header, argv,
+					    outbuf);
+				if ((err = dlp_send_req(pconn, &header,
+							argv)) < 0)
+					break;
+				xids[sent % DLPC_PIPELINE_DEPTH] =
+					pconn->net.xid;
+				sent++;
+			}
+
+			if (err == 0)
+				err = dlp_recv_resp(pconn,
+					(ubyte) DLPCMD_ReadAppPreference,
+					&resp_header, &ret_argv);
+			if ((err == 0) &&
+			    (pconn->net.last_xid !=
+			     xids[rcvd % DLPC_PIPELINE_DEPTH]))
+			{
+				fprintf(stderr,
+					_("##### Bad response XID: expected "
+					  "0x%02x, got 0x%02x.\n"),
+					xids[rcvd % DLPC_PIPELINE_DEPTH],
+					pconn->net.last_xid);
+				PConn_set_palmerrno(pconn, PALMERR_BADID);
+				err = -1;
+			}
+		}
+		if (err == 0)
+			err = apppref_resp(&reqs[rcvd], &resp_header,
+					   ret_argv);
+		if (err < 0)
+		{
+			if ((depth > 1) && (sent > rcvd))
+				apppref_drain(pconn, sent - rcvd,
+					      xids[(sent - 1) %
+						   DLPC_PIPELINE_DEPTH]);
+			return err;
+		}
+	}
+
+	return 0;		/* Success */
+}
+
 /* DlpWriteAppPreference
  * XXX - Test this.
  */
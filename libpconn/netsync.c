@@ -547,6 +547,7 @@ netsync_read_method(PConnection *pconn,	/* Connection to Palm */
 	hdr.cmd = get_ubyte(&rptr);
 	hdr.xid = get_ubyte(&rptr);
 	hdr.len = get_udword(&rptr);
+	pconn->net.last_xid = hdr.xid;
 
 	/* If we have initiated the connection, we must use the
 	 * server provided XID in our packets
@@ -657,8 +658,13 @@ netsync_read_method(PConnection *pconn,	/* Connection to Palm */
 	return 1;			/* Success */
 }
 
-/* netsync_write - Old version.
- * Write a NetSync message. Header and data are written separately.
+/* netsync_write
+ * Write a NetSync message. The header and data are handed to the
+ * transport together, so that they go out in a single write (and, on a
+ * TCP connection, in a single segment where possible). Sending them
+ * separately causes the header to sit in the send buffer until the
+ * peer's delayed ACK comes back, which adds tens of milliseconds to
+ * every DLP request.
  */
 int
 netsync_write(PConnection *pconn,
@@ -668,8 +674,9 @@ netsync_write(PConnection *pconn,
 	int err;
 	ubyte out_hdr[NETSYNC_HDR_LEN];	/* Buffer for outgoing header */
 	ubyte *wptr;			/* Pointer into buffer, for writing */
-	udword sent;			/* How many bytes we've sent */
-	udword want;			/* How many bytes we want to send */
+	struct iovec iov[2];		/* Header and data */
+	struct iovec *iovp;		/* First unsent buffer */
+	int iovcnt;			/* # of unsent buffers */
 
 	NET_TRACE(3)
 		fprintf(stderr, "Inside netsync_write()\n");
@@ -685,114 +692,49 @@ netsync_write(PConnection *pconn,
 	put_ubyte(&wptr, pconn->net.xid);
 	put_udword(&wptr, len);
 
-	/* Send the NetSync header */
 	NET_TRACE(5)
 	{
 		fprintf(stderr, "Sending NetSync header (%d bytes)\n",
 			NETSYNC_HDR_LEN);
 		debug_dump(stderr, "NET >>>", out_hdr, NETSYNC_HDR_LEN);
-	}
-
-	err = PConn_write(pconn, out_hdr, NETSYNC_HDR_LEN);
-	NET_TRACE(7)
-		fprintf(stderr, "write() returned %d\n", err);
-	if (err < 0)
-	{
-		fprintf(stderr, _("Error sending NetSync header.\n"));
-		return -1;
-	}
-
-	/* Send the packet data */
-	NET_TRACE(5)
-	{
 		fprintf(stderr, "Sending NetSync data (%d bytes)\n", len);
 		debug_dump(stderr, "NET >>>", buf, len);
 	}
-	want = len;
-	sent = 0;
-	while (sent < want)
+
+	iov[0].iov_base = (void *) out_hdr;
+	iov[0].iov_len = NETSYNC_HDR_LEN;
+	iov[1].iov_base = (void *) buf;
+	iov[1].iov_len = len;
+	iovp = iov;
+	iovcnt = 2;
+
+	/* Send the header and data, picking up where we left off if the
+	 * transport only took part of it.
+	 */
+	while (iovcnt > 0)
 	{
-		err = PConn_write(pconn, buf+sent, want-sent);
+		err = PConn_writev(pconn, iovp, iovcnt);
+		NET_TRACE(7)
+			fprintf(stderr, "writev() returned %d\n", err);
 		if (err < 0)
 		{
 			perror("netsync_write: write");
 			return -1;
 		}
-		sent += err;
-	}
-
-	return len;		/* Success */
-}
-
-/* netsync_write - New version. 
- * Write a NetSync message. The same packet will have header and data.
- * Very useful when debugging and comparing packets...
- */
-
-int
-netsync_write_new(PConnection *pconn,
-	      const ubyte *buf,
-	      const uword len)		/* XXX - Is this enough? */
-{
-	int err;
-	ubyte *wptr;			/* Pointer into buffer, for writing */
-	ubyte *outbuf;
-	udword sent;			/* How many bytes we've sent */
-	udword want;			/* How many bytes we want to send */
-
-	NET_TRACE(3)
-		fprintf(stderr, "Inside netsync_write()\n");
-
-	outbuf = malloc(len + 6);
 
-	if(outbuf == NULL)
-		return -1; /* XXX - Maybe -ENOMEM would be better? */
-
-	/* Construct the NetSync header */
-
-	if (pconn->whosonfirst == 0)
-		bump_xid(pconn);	/* Get the XID for new request */
-
-	wptr = outbuf;
-	put_ubyte(&wptr, 1);
-	put_ubyte(&wptr, pconn->net.xid);
-	put_udword(&wptr, len);
-
-	/* Copy the payload */
-	memcpy( outbuf + NETSYNC_HDR_LEN, buf, len);
-
-
-	/* Send the NetSync header */
-	NET_TRACE(5)
-	{
-		fprintf(stderr, "Sending NetSync header (6 bytes)\n");
-		debug_dump(stderr, "NET >>>", outbuf, NETSYNC_HDR_LEN);
-	}
-
-	/* Send the packet data */
-	NET_TRACE(5)
-	{
-		fprintf(stderr, "Sending NetSync data (%d bytes)\n", len);
-		debug_dump(stderr, "NET >>>", buf, len);
-	}
-
-
-	want = len+6;
-	sent = 0;
-	while (sent < want)
-	{
-		err = PConn_write(pconn, outbuf+sent, want-sent);
-		if (err < 0)
+		while (iovcnt > 0 && (size_t) err >= iovp->iov_len)
 		{
-			perror("netsync_write: write");
-			free(outbuf);
-			return -1;
+			err -= iovp->iov_len;
+			iovp++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iovp->iov_base = (char *) iovp->iov_base + err;
+			iovp->iov_len -= err;
 		}
-		sent += err;
 	}
 
-	free(outbuf);
-
 	return len;		/* Success */
 }
 
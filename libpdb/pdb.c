@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/param.h>		/* For MAXPATHLEN */
+#include <sys/stat.h>		/* For fstat() */
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
@@ -85,13 +86,17 @@ int pdb_trace = 0;		/* Debugging level for PDB stuff */
 static uword get_file_length(int fd);
 int pdb_LoadHeader(int fd, struct pdb *db);
 			/* pdb_LoadHeader() is visible to other files */
-static int pdb_LoadRecListHeader(int fd, struct pdb *db);
+int pdb_LoadRecListHeader(int fd, struct pdb *db);
 static int pdb_LoadRsrcIndex(int fd, struct pdb *db);
 static int pdb_LoadRecIndex(int fd, struct pdb *db);
 static int pdb_LoadAppBlock(int fd, struct pdb *db);
 static int pdb_LoadSortBlock(int fd, struct pdb *db);
 static int pdb_LoadResources(int fd, struct pdb *db);
 static int pdb_LoadRecords(int fd, struct pdb *db);
+static udword pdb_EncodeHeader(const struct pdb *db, ubyte *buf,
+			       udword offset);
+static int pdb_WriteIndexEntry(struct pdb_writer *w, const ubyte *entry,
+			       const int len);
 
 /* merge_attributes
  * Takes a record's flags and category, and merges them into a single byte,
@@ -378,6 +383,51 @@ pdb_Read(int fd)
 	return retval;			/* Success */
 }
 
+/* pdb_EncodeHeader
+ * Construct the file header for 'db' in 'buf', which must be
+ * PDB_HEADER_LEN bytes long. 'offset' is the offset in the file at which
+ * the AppInfo block, if any, goes. Returns the offset of whatever follows
+ * the AppInfo and sort blocks.
+ */
+static udword
+pdb_EncodeHeader(const struct pdb *db,
+		 ubyte *buf,
+		 udword offset)
+{
+	ubyte *wptr;		/* Pointer into buffers, for writing */
+
+	wptr = buf;
+	memcpy(wptr, db->name, PDB_DBNAMELEN);
+	wptr += PDB_DBNAMELEN;
+	put_uword(&wptr, (db->attributes & ~PDB_ATTR_OPEN));
+				/* Clear the 'open' flag before writing */
+	put_uword(&wptr, db->version);
+	put_udword(&wptr, db->ctime);
+	put_udword(&wptr, db->mtime);
+	put_udword(&wptr, db->baktime);
+	put_udword(&wptr, db->modnum);
+	if (db->appinfo == NULL)	/* Write the AppInfo block, if any */
+		/* This database doesn't have an AppInfo block */
+		put_udword(&wptr, 0L);
+	else {
+		/* This database has an AppInfo block */
+		put_udword(&wptr, offset);
+		offset += db->appinfo_len;
+	}
+	if (db->sortinfo == NULL)	/* Write the sort block, if any */
+		/* This database doesn't have a sort block */
+		put_udword(&wptr, 0L);
+	else {
+		put_udword(&wptr, offset);
+		offset += db->sortinfo_len;
+	}
+	put_udword(&wptr, db->type);
+	put_udword(&wptr, db->creator);
+	put_udword(&wptr, db->uniqueIDseed);
+
+	return offset;
+}
+
 /* pdb_Write
  * Write 'db' to the file descriptor 'fd'. This must already have been
  * opened for writing.
@@ -428,34 +478,7 @@ pdb_Write(const struct pdb *db,
 	/** Write the database header **/
 
 	/* Construct the header in 'header_buf' */
-	wptr = header_buf;
-	memcpy(wptr, db->name, PDB_DBNAMELEN);
-	wptr += PDB_DBNAMELEN;
-	put_uword(&wptr, (db->attributes & ~PDB_ATTR_OPEN));
-				/* Clear the 'open' flag before writing */
-	put_uword(&wptr, db->version);
-	put_udword(&wptr, db->ctime);
-	put_udword(&wptr, db->mtime);
-	put_udword(&wptr, db->baktime);
-	put_udword(&wptr, db->modnum);
-	if (db->appinfo == NULL)	/* Write the AppInfo block, if any */
-		/* This database doesn't have an AppInfo block */
-		put_udword(&wptr, 0L);
-	else {
-		/* This database has an AppInfo block */
-		put_udword(&wptr, offset);
-		offset += db->appinfo_len;
-	}
-	if (db->sortinfo == NULL)	/* Write the sort block, if any */
-		/* This database doesn't have a sort block */
-		put_udword(&wptr, 0L);
-	else {
-		put_udword(&wptr, offset);
-		offset += db->sortinfo_len;
-	}
-	put_udword(&wptr, db->type);
-	put_udword(&wptr, db->creator);
-	put_udword(&wptr, db->uniqueIDseed);
+	offset = pdb_EncodeHeader(db, header_buf, offset);
 
 	/* Write the database header */
 	if (write(fd, header_buf, PDB_HEADER_LEN) != PDB_HEADER_LEN)
@@ -673,6 +696,380 @@ pdb_Write(const struct pdb *db,
 	return 0;		/* Success */
 }
 
+/* pdb_writer
+ * State for writing a database to a file one record (or resource) at a
+ * time. See pdb_WriteStart().
+ */
+struct pdb_writer
+{
+	int fd;			/* File being written */
+	Bool rsrc;		/* Is this a resource database? */
+	uword numrecs;		/* # of records/resources promised */
+	uword count;		/* # of records/resources written so far */
+	udword offset;		/* Offset of the next record's data */
+	ubyte *index;		/* Record/resource index, filled in as
+				 * records are written */
+	ubyte *ixptr;		/* Next index entry in 'index' */
+};
+
+/* pdb_WriteStart
+ * Begin writing 'db' to 'fd', without having its records in memory.
+ * 'db' must have its header, AppInfo and sort blocks filled in, and
+ * 'db->numrecs' must say how many records or resources will follow.
+ * These are then given, in order, to pdb_WriteRecord() or
+ * pdb_WriteResource(), and their data goes straight to the file. Only the
+ * index (8 or 10 bytes per entry) is kept in memory. Each index entry is
+ * also written to its place in the file as soon as its record is, so
+ * that if the writing is interrupted, pdb_WriteResume() can tell how far
+ * it got.
+ * 'fd' must be seekable (i.e., a file, not a pipe or socket).
+ *
+ * Returns a new pdb_writer, or NULL in case of error.
+ */
+struct pdb_writer *
+pdb_WriteStart(const struct pdb *db,
+	       int fd)
+{
+	struct pdb_writer *w;
+	static ubyte header_buf[PDB_HEADER_LEN];
+				/* Buffer for writing database header */
+	static ubyte rlheader_buf[PDB_RECORDLIST_LEN];
+				/* Buffer for writing the record list header */
+	ubyte *wptr;		/* Pointer into buffers, for writing */
+	udword ix_len;		/* Length of the record/resource index */
+	udword offset;
+
+	if ((w = (struct pdb_writer *) malloc(sizeof(struct pdb_writer)))
+	    == NULL)
+		return NULL;
+	w->fd = fd;
+	w->rsrc = IS_RSRC_DB(db) ? True : False;
+	w->numrecs = db->numrecs;
+	w->count = 0;
+
+	ix_len = db->numrecs *
+		(w->rsrc ? PDB_RESOURCEIX_LEN : PDB_RECORDIX_LEN);
+	if ((w->index = (ubyte *) calloc(1, ix_len + 2)) == NULL)
+	{
+		free(w);
+		return NULL;
+	}
+	w->ixptr = w->index;
+
+	/* Same layout as pdb_Write(): header, record list header, index,
+	 * two NULs, AppInfo block, sort block, data.
+	 */
+	offset = PDB_HEADER_LEN + PDB_RECORDLIST_LEN + ix_len + 2;
+	w->offset = pdb_EncodeHeader(db, header_buf, offset);
+
+	wptr = rlheader_buf;
+	put_udword(&wptr, 0L);	/* nextID */
+	put_uword(&wptr, db->numrecs);
+
+	/* Write everything up to the first record. The index is all
+	 * zeros for now; pdb_WriteRecord() and pdb_WriteResource() fill
+	 * it in. The two NULs after it come from the end of the same
+	 * buffer.
+	 */
+	if (write(fd, header_buf, PDB_HEADER_LEN) != PDB_HEADER_LEN ||
+	    write(fd, rlheader_buf, PDB_RECORDLIST_LEN) !=
+		PDB_RECORDLIST_LEN ||
+	    write(fd, w->index, ix_len + 2) != (int) (ix_len + 2) ||
+	    (db->appinfo != NULL &&
+	     write(fd, db->appinfo, db->appinfo_len) != db->appinfo_len) ||
+	    (db->sortinfo != NULL &&
+	     write(fd, db->sortinfo, db->sortinfo_len) != db->sortinfo_len))
+	{
+		fprintf(stderr, _("%s: can't write database header for "
+				  "\"%.*s\".\n"),
+			"pdb_WriteStart",
+			PDB_DBNAMELEN, db->name);
+		perror("write");
+		free(w->index);
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+/* pdb_WriteResume
+ * Like pdb_WriteStart(), but 'fd' may hold what an earlier writer for
+ * the same database left behind when it was interrupted. The records or
+ * resources that made it to the file are kept, and '*done' is set to the
+ * number of them: the next one given to pdb_WriteRecord() or
+ * pdb_WriteResource() is the one after those.
+ * The old file is only used if it's for the same version of 'db' (same
+ * name, modification number and time, and number of records), and its
+ * data begins where 'db''s would. For record databases, 'ids' lists the
+ * record IDs in the order in which the records will be written, and only
+ * the old records that match it are kept. For resource databases, 'ids'
+ * is NULL.
+ * The last record or resource in the old index is always dropped: its
+ * length isn't recorded anywhere, so there's no telling whether all of
+ * its data made it.
+ * 'fd' must be open for both reading and writing.
+ *
+ * Returns a new pdb_writer, or NULL in case of error.
+ */
+struct pdb_writer *
+pdb_WriteResume(const struct pdb *db,
+		int fd,
+		const udword *ids,	/* Record IDs, or NULL */
+		uword *done)		/* # of records kept */
+{
+	struct pdb_writer *w;
+	struct pdb old;		/* The old file's header */
+	struct stat statbuf;
+	ubyte *oldindex = NULL;	/* The old file's index */
+	int entlen;		/* Length of an index entry */
+	int ix_len;		/* Length of the index */
+	udword first;		/* Offset of the first record's data */
+	udword end;		/* End of the data that's kept */
+	uword n = 0;		/* # of good entries in the old index */
+	int i;
+
+	*done = 0;
+	entlen = IS_RSRC_DB(db) ? PDB_RESOURCEIX_LEN : PDB_RECORDIX_LEN;
+	ix_len = db->numrecs * entlen;
+	first = PDB_HEADER_LEN + PDB_RECORDLIST_LEN + ix_len + 2 +
+		(db->appinfo == NULL ? 0 : db->appinfo_len) +
+		(db->sortinfo == NULL ? 0 : db->sortinfo_len);
+	end = first;
+
+	/* See whether there's anything worth keeping */
+	if (ix_len > 0 &&
+	    fstat(fd, &statbuf) == 0 &&
+	    statbuf.st_size >= (off_t) first &&
+	    lseek(fd, 0L, SEEK_SET) == 0 &&
+	    pdb_LoadHeader(fd, &old) == 0 &&
+	    pdb_LoadRecListHeader(fd, &old) == 0 &&
+	    strncmp(old.name, db->name, PDB_DBNAMELEN) == 0 &&
+	    /* Only the bottom 32 bits of these are in the file */
+	    ((old.modnum ^ db->modnum) & 0xffffffffL) == 0 &&
+	    ((old.mtime ^ db->mtime) & 0xffffffffL) == 0 &&
+	    old.numrecs == db->numrecs &&
+	    IS_RSRC_DB(&old) == IS_RSRC_DB(db) &&
+	    (oldindex = (ubyte *) malloc(ix_len)) != NULL &&
+	    read(fd, oldindex, ix_len) == ix_len)
+	{
+		udword prev = first;
+
+		/* An entry is good if it has been written (its offset
+		 * isn't zero), its data follows the previous entry's, and
+		 * it's for the record we expect.
+		 */
+		for (i = 0; i < db->numrecs; i++)
+		{
+			const ubyte *rptr = oldindex + i * entlen;
+			udword offset;
+
+			if (ids == NULL)
+			{
+				rptr += 6;	/* Skip type and ID */
+				offset = get_udword(&rptr);
+			} else {
+				udword id;
+
+				offset = get_udword(&rptr);
+				rptr++;		/* Skip attributes */
+				id = ((udword) get_ubyte(&rptr)) << 16;
+				id |= ((udword) get_ubyte(&rptr)) << 8;
+				id |= get_ubyte(&rptr);
+				if (id != (ids[i] & 0x00ffffff))
+					break;
+			}
+			if ((i == 0 && offset != first) ||
+			    offset < prev ||
+			    offset > (udword) statbuf.st_size)
+				break;
+			prev = offset;
+			n++;
+		}
+
+		/* Drop the last one: its data ends where it ends */
+		if (n > 0)
+		{
+			n--;
+			end = prev;
+		}
+	}
+
+	if (lseek(fd, 0L, SEEK_SET) != 0 ||
+	    (w = pdb_WriteStart(db, fd)) == NULL)
+	{
+		if (oldindex != NULL)
+			free(oldindex);
+		return NULL;
+	}
+
+	/* pdb_WriteStart() has zeroed the index in the file. Put back the
+	 * entries that are being kept, and get rid of anything after them.
+	 */
+	if (n > 0)
+	{
+		memcpy(w->index, oldindex, n * entlen);
+		w->ixptr = w->index + n * entlen;
+		w->count = n;
+		w->offset = end;
+	}
+	if (oldindex != NULL)
+		free(oldindex);
+	if ((n > 0 &&
+	     pdb_WriteIndexEntry(w, w->index, n * entlen) < 0) ||
+	    ftruncate(fd, end) < 0 ||
+	    lseek(fd, end, SEEK_SET) != (off_t) end)
+	{
+		fprintf(stderr, _("%s: Can't reuse \"%.*s\".\n"),
+			"pdb_WriteResume",
+			PDB_DBNAMELEN, db->name);
+		perror("ftruncate");
+		pdb_WriteAbort(w);
+		return NULL;
+	}
+
+	*done = n;
+	return w;
+}
+
+/* pdb_WriteIndexEntry
+ * Write the 'len' bytes of index at 'entry' (part of 'w->index') to
+ * their place in the file, and go back to the end of the data.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+pdb_WriteIndexEntry(struct pdb_writer *w,
+		    const ubyte *entry,
+		    const int len)
+{
+	off_t pos;
+
+	pos = PDB_HEADER_LEN + PDB_RECORDLIST_LEN + (entry - w->index);
+	if (lseek(w->fd, pos, SEEK_SET) != pos ||
+	    write(w->fd, entry, len) != len ||
+	    lseek(w->fd, w->offset, SEEK_SET) != (off_t) w->offset)
+		return -1;
+	return 0;
+}
+
+/* pdb_WriteRecord
+ * Write the next record through the writer 'w'. The record is not freed.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+int
+pdb_WriteRecord(struct pdb_writer *w,
+		const struct pdb_record *rec)
+{
+	ubyte *entry = w->ixptr;	/* This record's index entry */
+
+	if (w->rsrc || w->count >= w->numrecs)
+	{
+		fprintf(stderr, _("%s: Too many records.\n"),
+			"pdb_WriteRecord");
+		return -1;
+	}
+
+	if (write(w->fd, rec->data, rec->data_len) != rec->data_len)
+	{
+		fprintf(stderr, _("%s: Can't write record data.\n"),
+			"pdb_WriteRecord");
+		perror("write");
+		return -1;
+	}
+
+	put_udword(&w->ixptr, w->offset);
+	put_ubyte(&w->ixptr, merge_attributes(rec->flags, rec->category));
+	put_ubyte(&w->ixptr, (char) ((rec->id >> 16) & 0xff));
+	put_ubyte(&w->ixptr, (char) ((rec->id >> 8) & 0xff));
+	put_ubyte(&w->ixptr, (char) (rec->id & 0xff));
+
+	w->offset += rec->data_len;
+	if (pdb_WriteIndexEntry(w, entry, PDB_RECORDIX_LEN) < 0)
+	{
+		fprintf(stderr, _("%s: Can't write index entry.\n"),
+			"pdb_WriteRecord");
+		perror("write");
+		return -1;
+	}
+	w->count++;
+	return 0;
+}
+
+/* pdb_WriteResource
+ * Write the next resource through the writer 'w'. The resource is not
+ * freed.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+int
+pdb_WriteResource(struct pdb_writer *w,
+		  const struct pdb_resource *rsrc)
+{
+	ubyte *entry = w->ixptr;	/* This resource's index entry */
+
+	if (!w->rsrc || w->count >= w->numrecs)
+	{
+		fprintf(stderr, _("%s: Too many resources.\n"),
+			"pdb_WriteResource");
+		return -1;
+	}
+
+	if (write(w->fd, rsrc->data, rsrc->data_len) != rsrc->data_len)
+	{
+		fprintf(stderr, _("%s: Can't write resource data.\n"),
+			"pdb_WriteResource");
+		perror("write");
+		return -1;
+	}
+
+	put_udword(&w->ixptr, rsrc->type);
+	put_uword(&w->ixptr, rsrc->id);
+	put_udword(&w->ixptr, w->offset);
+
+	w->offset += rsrc->data_len;
+	if (pdb_WriteIndexEntry(w, entry, PDB_RESOURCEIX_LEN) < 0)
+	{
+		fprintf(stderr, _("%s: Can't write index entry.\n"),
+			"pdb_WriteResource");
+		perror("write");
+		return -1;
+	}
+	w->count++;
+	return 0;
+}
+
+/* pdb_WriteEnd
+ * Finish writing a database, and free 'w'. The index is already in the
+ * file. The file descriptor is not closed.
+ * Returns 0 if successful, or -2 if fewer records were written than
+ * pdb_WriteStart() was promised. In the latter case, nothing is printed:
+ * it's up to the caller to say what went wrong.
+ */
+int
+pdb_WriteEnd(struct pdb_writer *w)
+{
+	int err = 0;
+
+	if (w->count != w->numrecs)
+		err = -2;
+
+	free(w->index);
+	free(w);
+	return err;
+}
+
+/* pdb_WriteAbort
+ * Give up on writing a database, e.g., because the connection to the
+ * Palm was lost, and free 'w'. The file is incomplete, but
+ * pdb_WriteResume() can pick it up again. The file descriptor is not
+ * closed.
+ */
+void
+pdb_WriteAbort(struct pdb_writer *w)
+{
+	free(w->index);
+	free(w);
+}
+
 /* pdb_FindRecordByID
  * Find the record in 'db' whose ID is 'id'. Return a pointer to it. If no
  * such record exists, or in case of error, returns NULL.
@@ -1290,9 +1687,9 @@ pdb_LoadHeader(int fd,
 
 /* pdb_LoadRecListHeader
  * Load the record list header from a pdb file, and fill in the appropriate
- * fields in 'db'.
+ * fields in 'db'. This must be called right after pdb_LoadHeader().
  */
-static int
+int
 pdb_LoadRecListHeader(int fd,
 		      struct pdb *db)
 {
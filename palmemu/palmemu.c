@@ -0,0 +1,2911 @@
+/* palmemu.c
+ *
+ * Pretend to be a Palm. palmemu loads a directory of .pdb and .prc
+ * files and serves them to ColdSync over DLP, the way a handheld in its
+ * cradle would. This makes it possible to run, and time, complete syncs
+ * on a machine with no Palm attached.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * The connection to ColdSync is selected with -t:
+ *
+ *	net	Send a NetSync wakeup packet to the host given with -a
+ *		(127.0.0.1 by default), then connect to it over TCP.
+ *		ColdSync must already be listening on a "listen net"
+ *		block.
+ *	pty	Create a pseudo-tty, and speak the full CMP/PADP/SLP stack
+ *		on its master side, like a Palm in a serial cradle. The
+ *		name of the slave side is printed on stdout; in <command>,
+ *		the argument "{}" is replaced by it.
+ *	pair	Create a socketpair, and speak the "simple" (NetSync-
+ *		framed) stack over it. <command> is run with the other end
+ *		as its stdin and stdout, e.g.:
+ *
+ *		palmemu -t pair -D ./dbs -- \
+ *			coldsync -p stdin -t serial -P simple -mb /tmp/bak
+ *
+ * -l, -b and -L inject latency, a bandwidth limit and (for "pty" only,
+ * since SLP can recover from it) packet loss on everything palmemu
+ * sends. -s seeds the loss generator, so that runs are repeatable. -k
+ * hangs up in the middle of each sync, to test recovery from a lost
+ * connection.
+ *
+ * Read-only databases in the directory are reported as being in ROM, so
+ * they only show up when ColdSync is run with -R.
+ *
+ * Changes that ColdSync makes to the databases are kept in memory, and
+ * last for as many syncs as -n asks for. With -w, they are also written
+ * back to the directory.
+ *
+ * $Id$
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>		/* For malloc(), atoi(), rand() */
+#include <unistd.h>		/* For getopt(), fork(), dup2() */
+#include <fcntl.h>		/* For open() */
+#include <errno.h>		/* For errno. Duh. */
+#include <signal.h>		/* For kill() */
+#include <dirent.h>		/* For opendir() */
+#include <sys/types.h>
+#include <sys/socket.h>		/* For socketpair(), sendto() */
+#include <sys/wait.h>		/* For waitpid() */
+#include <sys/uio.h>		/* For struct iovec */
+#include <netinet/in.h>		/* For struct sockaddr_in */
+#include <arpa/inet.h>		/* For inet_addr() */
+#include <netdb.h>		/* For getservbyname() */
+
+#if STDC_HEADERS
+#  include <string.h>		/* For strerror(), memcpy() */
+#endif	/* STDC_HEADERS */
+
+#if HAVE_SYS_SELECT_H
+#  include <sys/select.h>	/* For select() */
+#endif	/* HAVE_SYS_SELECT_H */
+
+#if TIME_WITH_SYS_TIME
+#  include <sys/time.h>
+#  include <time.h>
+#else
+#  if HAVE_SYS_TIME_H
+#    include <sys/time.h>
+#  else
+#    include <time.h>
+#  endif
+#endif
+
+#if HAVE_LIBINTL_H
+#  include <libintl.h>		/* For i18n */
+#endif	/* HAVE_LIBINTL_H */
+
+#include "pconn/pconn.h"
+#include "pdb.h"
+
+/* Declarations of everything related to getopt(), for those OSes that
+ * don't have it already (Windows NT). Note that not all of these are used.
+ */
+extern int getopt(int argc, char * const *argv, const char *optstring);
+extern char *optarg;
+extern int optind;
+extern int optopt;
+extern int opterr;
+extern int optreset;
+
+void usage(int argc, char *argv[]);
+void print_version(void);
+
+int emu_trace = 0;			/* Debugging level */
+
+#define EMU_TRACE(n)	if (emu_trace >= (n))
+
+#define EMU_MAXOPEN	12	/* Max. # of databases open at once */
+#define EMU_DBLIST_MAX	16	/* Max. # of dbinfos per ReadDBList */
+#define EMU_IDLIST_MAX	500	/* Max. # of IDs per ReadRecordIDList,
+				 * like PalmOS 3.3 */
+#define EMU_RAM_SIZE	(8L * 1024 * 1024)
+				/* Size of the emulated Palm's RAM */
+#define EMU_ROM_SIZE	(2L * 1024 * 1024)
+				/* Size of the emulated Palm's ROM, if it
+				 * has any ROM databases */
+#define EMU_ROM_VERSION	0x04003000L
+				/* PalmOS 4.0, release */
+#define EMU_WAKEUP_TRIES	3	/* # of NetSync wakeup packets to
+					 * send before giving up */
+
+typedef enum {
+	EMU_NET,		/* NetSync over TCP */
+	EMU_PTY,		/* Full stack over a pseudo-tty */
+	EMU_PAIR		/* Simple stack over a socketpair */
+} emu_transport_t;
+
+/* emu_db
+ * A database on the emulated Palm.
+ */
+struct emu_db
+{
+	struct pdb *pdb;	/* The database itself */
+	char *fname;		/* File it lives in, or NULL if it was
+				 * created during a sync */
+	int open;		/* # of handles open on it */
+	Bool dirty;		/* Modified since it was last saved */
+};
+
+/* emu_handle
+ * An open database handle.
+ */
+struct emu_handle
+{
+	struct emu_db *db;	/* Open database, or NULL if free */
+	struct pdb_record *cursor;
+				/* Next record to look at, for the
+				 * ReadNext*Rec* family */
+	uword cursor_ix;	/* Index of 'cursor' */
+};
+
+/* emu_resp
+ * A DLP response under construction. Each argument's data is
+ * malloc()ed, and freed once the response has been sent.
+ */
+struct emu_resp
+{
+	struct dlp_resp_header header;
+	struct dlp_arg argv[2];
+};
+
+typedef dlp_stat_t (*emu_handler)(const struct dlp_req_header *req,
+				  const struct dlp_arg *argv,
+				  struct emu_resp *resp);
+
+/* emu_cmd
+ * An entry in the table of DLP commands that palmemu understands.
+ */
+struct emu_cmd
+{
+	ubyte id;		/* DLPCMD_* */
+	const char *name;	/* For tracing */
+	emu_handler handler;
+	long count;		/* # of times it was called */
+};
+
+/* Options */
+static emu_transport_t transport = EMU_PAIR;
+static const char *dbdir = NULL;	/* Database directory */
+static const char *hostaddr = "127.0.0.1";
+					/* NetSync server's address */
+static int num_syncs = 1;		/* How many syncs to serve */
+static Bool writeback = False;		/* Save changes to 'dbdir'? */
+static char **command = NULL;		/* Desktop command to run */
+static FILE *report;			/* Where to print timings */
+
+/* Faults to inject into outgoing traffic */
+static struct {
+	long latency;		/* Microseconds to wait before each write */
+	long bandwidth;		/* Bytes per second. 0 == unlimited */
+	int loss;		/* Percentage of writes to drop */
+	int hangup;		/* Hang up after this many requests.
+				 * 0 == never */
+	int (*io_write)(struct PConnection *p, unsigned const char *buf,
+			const int len);
+	int (*io_writev)(struct PConnection *p, const struct iovec *iov,
+			 const int iovcnt);
+} fault = { 0L, 0L, 0, 0, NULL, NULL };
+
+/* The emulated Palm */
+static struct {
+	udword userid;
+	udword viewerid;
+	udword lastsyncPC;
+	udword lastgoodsync;	/* In Palm time */
+	udword lastsync;	/* In Palm time */
+	char username[DLPCMD_USERNAME_LEN];
+} user = { 1L, 0L, 0L, 0L, 0L, "palmemu" };
+
+static struct emu_db **dbs = NULL;	/* Databases, in ReadDBList order */
+static int num_dbs = 0;
+static int max_dbs = 0;
+static struct emu_handle handles[EMU_MAXOPEN];
+static int find_ix = 0;			/* FindDB search position */
+static Bool end_of_sync;		/* Set by EndOfSync */
+static Bool hung_up;			/* Set when we hang up on purpose */
+
+static int load_dbs(const char *dir);
+static int save_db(struct emu_db *db);
+static int run_sync(const int n);
+static int serve(PConnection *pconn);
+static void install_faults(PConnection *pconn);
+static struct emu_cmd *find_cmd(const ubyte id);
+
+/* palm_now
+ * Returns the current time, in Palm format.
+ */
+static udword
+palm_now(void)
+{
+	return (udword) time(NULL) + EPOCH_1904;
+}
+
+/* put_dlptime
+ * Write the Palm time 'palmt' to a DLP buffer. Zero (never) is written as
+ * all zeros, the way PalmOS does it.
+ */
+static void
+put_dlptime(ubyte **wptr, const udword palmt)
+{
+	struct dlp_time t;
+
+	if (palmt == 0L)
+		memset(&t, 0, sizeof(t));
+	else
+		time_palmtime2dlp(palmt, &t);
+
+	put_uword(wptr, t.year);
+	put_ubyte(wptr, t.month);
+	put_ubyte(wptr, t.day);
+	put_ubyte(wptr, t.hour);
+	put_ubyte(wptr, t.minute);
+	put_ubyte(wptr, t.second);
+	put_ubyte(wptr, 0);		/* Padding */
+}
+
+/* get_dlptime
+ * Read a DLP time from a buffer, and return it in Palm format.
+ */
+static udword
+get_dlptime(const ubyte **rptr)
+{
+	struct dlp_time t;
+
+	t.year   = get_uword(rptr);
+	t.month  = get_ubyte(rptr);
+	t.day    = get_ubyte(rptr);
+	t.hour   = get_ubyte(rptr);
+	t.minute = get_ubyte(rptr);
+	t.second = get_ubyte(rptr);
+	get_ubyte(rptr);		/* Skip padding */
+
+	if (t.year == 0)
+		return 0L;
+	return time_dlp2palmtime(&t);
+}
+
+/* req_arg
+ * Find the argument with ID 'id' in a request. Returns NULL if there is
+ * no such argument, or if it is shorter than 'minlen'.
+ */
+static const struct dlp_arg *
+req_arg(const struct dlp_req_header *req,
+	const struct dlp_arg *argv,
+	const uword id,
+	const udword minlen)
+{
+	int i;
+
+	for (i = 0; i < req->argc; i++)
+	{
+		if (argv[i].id != id)
+			continue;
+		if (argv[i].size < minlen)
+			return NULL;
+		return &argv[i];
+	}
+	return NULL;
+}
+
+/* resp_arg
+ * Add a 'size'-byte argument to a response. Returns a pointer to the
+ * argument's data, for the caller to fill in, or NULL if we're out of
+ * memory.
+ */
+static ubyte *
+resp_arg(struct emu_resp *resp, const uword id, const udword size)
+{
+	struct dlp_arg *arg;
+
+	arg = &resp->argv[resp->header.argc];
+	if ((arg->data = (ubyte *) malloc(size == 0 ? 1 : size)) == NULL)
+		return NULL;
+	arg->id = id;
+	arg->size = size;
+	resp->header.argc++;
+
+	return arg->data;
+}
+
+/* arg_name
+ * Copy the NUL-terminated name in an argument into 'name', which is
+ * DLPCMD_DBNAME_LEN bytes long.
+ */
+static void
+arg_name(char *name, const ubyte *rptr, const udword len)
+{
+	udword max;
+
+	max = len < DLPCMD_DBNAME_LEN-1 ? len : DLPCMD_DBNAME_LEN-1;
+	memcpy(name, rptr, max);
+	name[max] = '\0';
+}
+
+/* find_db
+ * Look up a database by name. Returns its index in 'dbs', or -1.
+ */
+static int
+find_db(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_dbs; i++)
+		if (strncmp(dbs[i]->pdb->name, name, PDB_DBNAMELEN) == 0)
+			return i;
+	return -1;
+}
+
+/* get_handle
+ * Returns the open handle numbered 'h', or NULL if 'h' isn't open.
+ * Handles are numbered from 1.
+ */
+static struct emu_handle *
+get_handle(const ubyte h)
+{
+	if (h < 1 || h > EMU_MAXOPEN || handles[h-1].db == NULL)
+		return NULL;
+	return &handles[h-1];
+}
+
+/* open_handle
+ * Allocate a handle for 'db'. Returns the handle number, or 0 if there
+ * are too many open databases.
+ */
+static ubyte
+open_handle(struct emu_db *db)
+{
+	int i;
+
+	for (i = 0; i < EMU_MAXOPEN; i++)
+	{
+		if (handles[i].db != NULL)
+			continue;
+		handles[i].db = db;
+		handles[i].cursor = IS_RSRC_DB(db->pdb) ?
+			NULL : db->pdb->rec_index.rec;
+		handles[i].cursor_ix = 0;
+		db->open++;
+		return i+1;
+	}
+	return 0;
+}
+
+/* close_handle
+ * Release a handle, and save its database if it was the last one and
+ * we're writing changes back.
+ */
+static void
+close_handle(struct emu_handle *h)
+{
+	struct emu_db *db = h->db;
+
+	h->db = NULL;
+	h->cursor = NULL;
+	if (--db->open == 0 && writeback && db->dirty)
+		save_db(db);
+}
+
+/* touch_db
+ * Note that a database has been modified.
+ */
+static void
+touch_db(struct emu_db *db)
+{
+	db->dirty = True;
+	db->pdb->modnum++;
+	db->pdb->mtime = palm_now();
+}
+
+/* forget_record
+ * Called before 'rec' is removed from 'db': moves any cursors pointing
+ * at it to the next record.
+ */
+static void
+forget_record(struct emu_db *db, struct pdb_record *rec)
+{
+	int i;
+
+	for (i = 0; i < EMU_MAXOPEN; i++)
+		if (handles[i].db == db && handles[i].cursor == rec)
+			handles[i].cursor = rec->next;
+}
+
+/* find_record
+ * Find the record with ID 'id' in 'db'. Puts its index in '*index'.
+ */
+static struct pdb_record *
+find_record(const struct pdb *db, const udword id, uword *index)
+{
+	struct pdb_record *rec;
+	uword i;
+
+	for (rec = db->rec_index.rec, i = 0; rec != NULL;
+	     rec = rec->next, i++)
+		if (rec->id == id)
+		{
+			*index = i;
+			return rec;
+		}
+	return NULL;
+}
+
+/* new_id
+ * Pick an unused record ID for 'db'.
+ */
+static udword
+new_id(struct pdb *db)
+{
+	udword id;
+
+	do {
+		id = ++db->uniqueIDseed & 0x00ffffffL;
+	} while (id == 0L || pdb_FindRecordByID(db, id) != NULL);
+
+	return id;
+}
+
+/* put_record
+ * Write the response argument for a record: its header, followed by up
+ * to 'len' bytes of its data, starting at 'offset'.
+ */
+static dlp_stat_t
+put_record(struct emu_resp *resp, const uword id,
+	   const struct pdb_record *rec, const uword index,
+	   const uword offset, const uword len)
+{
+	ubyte *wptr;
+	uword n;
+
+	if (offset > rec->data_len)
+		return DLPSTAT_PARAM;
+	n = rec->data_len - offset;
+	if (n > len)
+		n = len;
+
+	if ((wptr = resp_arg(resp, id, DLPRETLEN_ReadRecord_Rec + n)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_udword(&wptr, rec->id);
+	put_uword(&wptr, index);
+	put_uword(&wptr, rec->data_len);
+	put_ubyte(&wptr, rec->flags);
+	put_ubyte(&wptr, rec->category);
+	if (n > 0)
+		memcpy(wptr, rec->data + offset, n);
+
+	return DLPSTAT_NOERR;
+}
+
+/* put_resource
+ * Like put_record(), but for resources.
+ */
+static dlp_stat_t
+put_resource(struct emu_resp *resp,
+	     const struct pdb_resource *rsrc, const uword index,
+	     const uword offset, const uword len)
+{
+	ubyte *wptr;
+	uword n;
+
+	if (offset > rsrc->data_len)
+		return DLPSTAT_PARAM;
+	n = rsrc->data_len - offset;
+	if (n > len)
+		n = len;
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadResource_Rsrc,
+			     DLPRETLEN_ReadResource_Rsrc + n)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_udword(&wptr, rsrc->type);
+	put_uword(&wptr, rsrc->id);
+	put_uword(&wptr, index);
+	put_uword(&wptr, rsrc->data_len);
+	if (n > 0)
+		memcpy(wptr, rsrc->data + offset, n);
+
+	return DLPSTAT_NOERR;
+}
+
+/* in_rom
+ * Read-only databases in the directory stand in for the ones in ROM.
+ */
+#define in_rom(db)	(((db)->pdb->attributes & PDB_ATTR_RO) != 0)
+
+/* dblist_ix
+ * Returns the index in 'dbs' of the 'n'th database that a ReadDBList
+ * with flags 'iflags' would return, or -1 if there isn't one. RAM
+ * databases come before ROM ones.
+ */
+static int
+dblist_ix(const ubyte iflags, int n)
+{
+	int pass;
+	int i;
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		if ((iflags & (pass == 0 ? DLPCMD_READDBLFLAG_RAM :
+			       DLPCMD_READDBLFLAG_ROM)) == 0)
+			continue;
+		for (i = 0; i < num_dbs; i++)
+		{
+			if ((in_rom(dbs[i]) ? 1 : 0) != pass)
+				continue;
+			if (n-- == 0)
+				return i;
+		}
+	}
+	return -1;
+}
+
+/* dbinfo_len
+ * Returns the length of the dlp_dbinfo for 'db' on the wire.
+ */
+static int
+dbinfo_len(const struct emu_db *db)
+{
+	int len;
+
+	len = DLPCMD_DBINFO_LEN + strlen(db->pdb->name) + 1;
+	return (len + 1) & ~1;		/* Round up to an even length */
+}
+
+/* put_dbinfo
+ * Write the dlp_dbinfo for 'db', the 'index'th database, to a buffer.
+ */
+static void
+put_dbinfo(ubyte **wptr, const struct emu_db *db, const uword index)
+{
+	const struct pdb *pdb = db->pdb;
+	int len = dbinfo_len(db);
+	int namelen = strlen(pdb->name);
+
+	put_ubyte(wptr, len);
+	put_ubyte(wptr, in_rom(db) ? 0 : DLPCMD_DBINFOFL_RAM);
+	put_uword(wptr, (pdb->attributes & ~PDB_ATTR_OPEN) |
+		  (db->open > 0 ? PDB_ATTR_OPEN : 0));
+	put_udword(wptr, pdb->type);
+	put_udword(wptr, pdb->creator);
+	put_uword(wptr, pdb->version);
+	put_udword(wptr, pdb->modnum);
+	put_dlptime(wptr, pdb->ctime);
+	put_dlptime(wptr, pdb->mtime);
+	put_dlptime(wptr, pdb->baktime);
+	put_uword(wptr, index);
+	memcpy(*wptr, pdb->name, namelen);
+	*wptr += namelen;
+	put_ubyte(wptr, 0);		/* Trailing NUL */
+	if ((DLPCMD_DBINFO_LEN + namelen + 1) & 1)
+		put_ubyte(wptr, 0);	/* Padding */
+}
+
+/* put_finddb
+ * Write the response to a FindDB request that found 'db'.
+ */
+static dlp_stat_t
+put_finddb(struct emu_resp *resp, const int ix)
+{
+	ubyte *wptr;
+
+	if ((wptr = resp_arg(resp, DLPRET_FindDB_Basic,
+			     10 + dbinfo_len(dbs[ix]))) == NULL)
+		return DLPSTAT_NOMEM;
+	put_ubyte(&wptr, 0);		/* Card number */
+	put_ubyte(&wptr, 0);		/* Reserved */
+	put_udword(&wptr, (udword) ix + 1);	/* Local ID */
+	put_udword(&wptr, 0L);		/* Open reference */
+	put_dbinfo(&wptr, dbs[ix], ix);
+
+	return DLPSTAT_NOERR;
+}
+
+/*** DLP command handlers ***/
+
+static dlp_stat_t
+emu_ReadUserInfo(const struct dlp_req_header *req,
+		 const struct dlp_arg *argv,
+		 struct emu_resp *resp)
+{
+	ubyte *wptr;
+	int namelen;
+
+	namelen = user.username[0] == '\0' ? 0 : strlen(user.username) + 1;
+	if ((wptr = resp_arg(resp, DLPRET_ReadUserInfo_Info,
+			     DLPRETLEN_ReadUserInfo_Info + namelen)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_udword(&wptr, user.userid);
+	put_udword(&wptr, user.viewerid);
+	put_udword(&wptr, user.lastsyncPC);
+	put_dlptime(&wptr, user.lastgoodsync);
+	put_dlptime(&wptr, user.lastsync);
+	put_ubyte(&wptr, namelen);
+	put_ubyte(&wptr, 0);		/* No password */
+	memcpy(wptr, user.username, namelen);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_WriteUserInfo(const struct dlp_req_header *req,
+		  const struct dlp_arg *argv,
+		  struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	udword userid, viewerid, lastsyncPC, lastsync;
+	ubyte modflags;
+	ubyte namelen;
+
+	if ((arg = req_arg(req, argv, DLPARG_WriteUserInfo_UserInfo,
+			   DLPARGLEN_WriteUserInfo_UserInfo)) == NULL)
+		return DLPSTAT_NOARG;
+
+	rptr = arg->data;
+	userid = get_udword(&rptr);
+	viewerid = get_udword(&rptr);
+	lastsyncPC = get_udword(&rptr);
+	lastsync = get_dlptime(&rptr);
+	modflags = get_ubyte(&rptr);
+	namelen = get_ubyte(&rptr);
+
+	if (modflags & DLPCMD_MODUIFLAG_USERID)
+		user.userid = userid;
+	if (modflags & DLPCMD_MODUIFLAG_VIEWERID)
+		user.viewerid = viewerid;
+	if (modflags & DLPCMD_MODUIFLAG_SYNCPC)
+		user.lastsyncPC = lastsyncPC;
+	if (modflags & DLPCMD_MODUIFLAG_SYNCDATE)
+		user.lastsync = user.lastgoodsync = lastsync;
+	if (modflags & DLPCMD_MODUIFLAG_USERNAME)
+	{
+		if (namelen > arg->size - DLPARGLEN_WriteUserInfo_UserInfo)
+			return DLPSTAT_ARGSIZE;
+		if (namelen > DLPCMD_USERNAME_LEN-1)
+			namelen = DLPCMD_USERNAME_LEN-1;
+		memcpy(user.username, rptr, namelen);
+		user.username[namelen] = '\0';
+	}
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadSysInfo(const struct dlp_req_header *req,
+		const struct dlp_arg *argv,
+		struct emu_resp *resp)
+{
+	ubyte *wptr;
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadSysInfo_Info,
+			     DLPRETLEN_ReadSysInfo_Info)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_udword(&wptr, EMU_ROM_VERSION);
+	put_udword(&wptr, 0L);		/* Localization */
+	put_ubyte(&wptr, 0);		/* Padding */
+	put_ubyte(&wptr, 4);		/* Product ID size */
+	put_udword(&wptr, 0L);		/* Product ID */
+
+	/* We speak DLP 1.2 */
+	if ((wptr = resp_arg(resp, DLPRET_ReadSysInfo_Ver,
+			     DLPRETLEN_ReadSysInfo_Ver)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_uword(&wptr, 1);		/* DLP version */
+	put_uword(&wptr, 2);
+	put_uword(&wptr, 1);		/* Product compatibility version */
+	put_uword(&wptr, 0);
+	put_udword(&wptr, 0xffffL);	/* Max. record size */
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_GetSysDateTime(const struct dlp_req_header *req,
+		   const struct dlp_arg *argv,
+		   struct emu_resp *resp)
+{
+	ubyte *wptr;
+
+	if ((wptr = resp_arg(resp, DLPRET_GetSysDateTime_Time,
+			     DLPRETLEN_GetSysDateTime_Time)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_dlptime(&wptr, palm_now());
+
+	return DLPSTAT_NOERR;
+}
+
+/* emu_NoOp
+ * For commands that need no more than an acknowledgment:
+ * SetSysDateTime, OpenConduit, ResetSystem, WriteAppPreference and
+ * WriteNetSyncInfo.
+ */
+static dlp_stat_t
+emu_NoOp(const struct dlp_req_header *req,
+	 const struct dlp_arg *argv,
+	 struct emu_resp *resp)
+{
+	return DLPSTAT_NOERR;
+}
+
+/* emu_NotFound
+ * For things the emulated Palm doesn't have: ReadFeature.
+ */
+static dlp_stat_t
+emu_NotFound(const struct dlp_req_header *req,
+	     const struct dlp_arg *argv,
+	     struct emu_resp *resp)
+{
+	return DLPSTAT_NOTFOUND;
+}
+
+static dlp_stat_t
+emu_ReadStorageInfo(const struct dlp_req_header *req,
+		    const struct dlp_arg *argv,
+		    struct emu_resp *resp)
+{
+	static const char cardname[] = "RAM";
+	static const char manufname[] = "palmemu";
+	const struct dlp_arg *arg;
+	ubyte *wptr;
+	int cinfo_len;			/* Length of the card info */
+	long used;			/* Bytes used by databases */
+	int rom_dbs;			/* # of databases in ROM */
+	int i;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadStorageInfo_Req,
+			   DLPARGLEN_ReadStorageInfo_Req)) == NULL)
+		return DLPSTAT_NOARG;
+	if (arg->data[0] != 0)
+		return DLPSTAT_NOTFOUND;	/* Only card 0 */
+
+	used = 0L;
+	rom_dbs = 0;
+	for (i = 0; i < num_dbs; i++)
+	{
+		if (in_rom(dbs[i]))
+			rom_dbs++;
+		else
+			used += dbs[i]->pdb->file_size;
+	}
+	if (used > EMU_RAM_SIZE)
+		used = EMU_RAM_SIZE;
+
+	cinfo_len = 24 + (sizeof(cardname)-1) + (sizeof(manufname)-1);
+	cinfo_len = (cinfo_len + 1) & ~1;
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadStorageInfo_Info,
+			     4 + cinfo_len)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_ubyte(&wptr, 0);		/* Last card */
+	put_ubyte(&wptr, 0);		/* More */
+	put_ubyte(&wptr, 0);		/* Padding */
+	put_ubyte(&wptr, 1);		/* # of cards returned */
+	put_ubyte(&wptr, cinfo_len);
+	put_ubyte(&wptr, 0);		/* Card number */
+	put_uword(&wptr, 1);		/* Card version */
+	put_dlptime(&wptr, palm_now());	/* Creation time */
+	put_udword(&wptr, rom_dbs > 0 ? EMU_ROM_SIZE : 0L);
+					/* ROM size */
+	put_udword(&wptr, EMU_RAM_SIZE);
+	put_udword(&wptr, EMU_RAM_SIZE - used);
+	put_ubyte(&wptr, sizeof(cardname)-1);
+	put_ubyte(&wptr, sizeof(manufname)-1);
+	memcpy(wptr, cardname, sizeof(cardname)-1);
+	wptr += sizeof(cardname)-1;
+	memcpy(wptr, manufname, sizeof(manufname)-1);
+	wptr += sizeof(manufname)-1;
+	if (cinfo_len & 1)
+		put_ubyte(&wptr, 0);
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadStorageInfo_Ext,
+			     DLPRETLEN_ReadStorageInfo_Ext)) == NULL)
+		return DLPSTAT_NOMEM;
+	memset(wptr, 0, DLPRETLEN_ReadStorageInfo_Ext);
+	put_uword(&wptr, rom_dbs);	/* ROM databases */
+	put_uword(&wptr, num_dbs - rom_dbs);
+					/* RAM databases */
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadDBList(const struct dlp_req_header *req,
+	       const struct dlp_arg *argv,
+	       struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	ubyte *wptr;
+	ubyte iflags;
+	ubyte card;
+	uword start;
+	int n;
+	int len;
+	int i;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadDBList_Req,
+			   DLPARGLEN_ReadDBList_Req)) == NULL)
+		return DLPSTAT_NOARG;
+	rptr = arg->data;
+	iflags = get_ubyte(&rptr);
+	card = get_ubyte(&rptr);
+	start = get_uword(&rptr);
+
+	/* All of our databases are on card 0 */
+	if (card != 0 || dblist_ix(iflags, start) < 0)
+		return DLPSTAT_NOTFOUND;
+
+	n = 1;
+	if (iflags & DLPCMD_READDBLFLAG_MULT)
+		n = EMU_DBLIST_MAX;
+	for (i = 1; i < n; i++)
+		if (dblist_ix(iflags, start + i) < 0)
+			break;
+	n = i;
+
+	len = DLPRETLEN_ReadDBList_Info;
+	for (i = start; i < start + n; i++)
+		len += dbinfo_len(dbs[dblist_ix(iflags, i)]);
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadDBList_Info, len)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_uword(&wptr, start + n - 1);
+	put_ubyte(&wptr, dblist_ix(iflags, start + n) >= 0 ?
+		  DLPRET_READDBLFLAG_MORE : 0);
+	put_ubyte(&wptr, n);
+	for (i = start; i < start + n; i++)
+		put_dbinfo(&wptr, dbs[dblist_ix(iflags, i)], i);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_OpenDB(const struct dlp_req_header *req,
+	   const struct dlp_arg *argv,
+	   struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	char name[DLPCMD_DBNAME_LEN];
+	ubyte *wptr;
+	ubyte h;
+	int ix;
+
+	if ((arg = req_arg(req, argv, DLPARG_OpenDB_DB,
+			   DLPARGLEN_OpenDB_DB + 1)) == NULL)
+		return DLPSTAT_NOARG;
+	arg_name(name, arg->data + DLPARGLEN_OpenDB_DB,
+		 arg->size - DLPARGLEN_OpenDB_DB);
+
+	if (arg->data[0] != 0 || (ix = find_db(name)) < 0)
+		return DLPSTAT_NOTFOUND;
+	if ((h = open_handle(dbs[ix])) == 0)
+		return DLPSTAT_TOOMANYOPEN;
+
+	if ((wptr = resp_arg(resp, DLPRET_OpenDB_DB,
+			     DLPRETLEN_OpenDB_DB)) == NULL)
+	{
+		close_handle(get_handle(h));
+		return DLPSTAT_NOMEM;
+	}
+	put_ubyte(&wptr, h);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_CreateDB(const struct dlp_req_header *req,
+	     const struct dlp_arg *argv,
+	     struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	ubyte *wptr;
+	struct pdb *pdb;
+	struct emu_db *db;
+	ubyte h;
+
+	if ((arg = req_arg(req, argv, DLPARG_CreateDB_DB,
+			   DLPARGLEN_CreateDB_DB + 1)) == NULL)
+		return DLPSTAT_NOARG;
+
+	if (num_dbs >= max_dbs)
+	{
+		struct emu_db **eptr;
+
+		if ((eptr = (struct emu_db **)
+		     realloc(dbs, (max_dbs + 16) * sizeof(*dbs))) == NULL)
+			return DLPSTAT_NOMEM;
+		dbs = eptr;
+		max_dbs += 16;
+	}
+	if ((db = (struct emu_db *) calloc(1, sizeof(*db))) == NULL)
+		return DLPSTAT_NOMEM;
+	if ((pdb = new_pdb()) == NULL)
+	{
+		free(db);
+		return DLPSTAT_NOMEM;
+	}
+
+	rptr = arg->data;
+	pdb->creator = get_udword(&rptr);
+	pdb->type = get_udword(&rptr);
+	get_ubyte(&rptr);		/* Card */
+	get_ubyte(&rptr);		/* Padding */
+	pdb->attributes = get_uword(&rptr);
+	pdb->version = get_uword(&rptr);
+	arg_name(pdb->name, rptr, arg->size - DLPARGLEN_CreateDB_DB);
+	pdb->ctime = pdb->mtime = palm_now();
+
+	if (find_db(pdb->name) >= 0)
+	{
+		free_pdb(pdb);
+		free(db);
+		return DLPSTAT_EXISTS;
+	}
+
+	db->pdb = pdb;
+	db->dirty = True;
+	dbs[num_dbs++] = db;
+
+	if ((h = open_handle(db)) == 0)
+		return DLPSTAT_TOOMANYOPEN;
+	if ((wptr = resp_arg(resp, DLPRET_CreateDB_DB,
+			     DLPRETLEN_CreateDB_DB)) == NULL)
+	{
+		close_handle(get_handle(h));
+		return DLPSTAT_NOMEM;
+	}
+	put_ubyte(&wptr, h);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_CloseDB(const struct dlp_req_header *req,
+	    const struct dlp_arg *argv,
+	    struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	struct emu_handle *h;
+	int i;
+
+	if (req_arg(req, argv, DLPARG_CloseDB_All, 0) != NULL)
+	{
+		for (i = 0; i < EMU_MAXOPEN; i++)
+			if (handles[i].db != NULL)
+				close_handle(&handles[i]);
+		return DLPSTAT_NOERR;
+	}
+
+	if ((arg = req_arg(req, argv, DLPARG_CloseDB_Update,
+			   DLPARGLEN_CloseDB_Update)) != NULL)
+	{
+		if ((h = get_handle(arg->data[0])) == NULL)
+			return DLPSTAT_PARAM;
+		if (arg->data[1] & DLPCMD_CLOSEFL_UPBACKUP)
+		{
+			h->db->pdb->baktime = palm_now();
+			h->db->dirty = True;
+		}
+		if (arg->data[1] & DLPCMD_CLOSEFL_UPMOD)
+			touch_db(h->db);
+		close_handle(h);
+		return DLPSTAT_NOERR;
+	}
+
+	if ((arg = req_arg(req, argv, DLPARG_CloseDB_One,
+			   DLPARGLEN_CloseDB_One)) == NULL)
+		return DLPSTAT_NOARG;
+	if ((h = get_handle(arg->data[0])) == NULL)
+		return DLPSTAT_PARAM;
+	close_handle(h);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_DeleteDB(const struct dlp_req_header *req,
+	     const struct dlp_arg *argv,
+	     struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	char name[DLPCMD_DBNAME_LEN];
+	struct emu_db *db;
+	int ix;
+
+	if ((arg = req_arg(req, argv, DLPARG_DeleteDB_DB,
+			   DLPARGLEN_DeleteDB_DB + 1)) == NULL)
+		return DLPSTAT_NOARG;
+	arg_name(name, arg->data + DLPARGLEN_DeleteDB_DB,
+		 arg->size - DLPARGLEN_DeleteDB_DB);
+
+	if ((ix = find_db(name)) < 0)
+		return DLPSTAT_NOTFOUND;
+	db = dbs[ix];
+	if (db->open > 0)
+		return DLPSTAT_DBOPEN;
+
+	if (writeback && db->fname != NULL && unlink(db->fname) < 0)
+		fprintf(stderr, _("Can't delete \"%s\": %s.\n"),
+			db->fname, strerror(errno));
+
+	memmove(&dbs[ix], &dbs[ix+1], (num_dbs - ix - 1) * sizeof(*dbs));
+	num_dbs--;
+	free_pdb(db->pdb);
+	if (db->fname != NULL)
+		free(db->fname);
+	free(db);
+
+	return DLPSTAT_NOERR;
+}
+
+/* read_block
+ * Common code for ReadAppBlock and ReadSortBlock.
+ */
+static dlp_stat_t
+read_block(const struct dlp_arg *arg, const Bool sort,
+	   struct emu_resp *resp)
+{
+	const ubyte *rptr;
+	ubyte *wptr;
+	struct emu_handle *h;
+	const struct pdb *pdb;
+	const ubyte *data;
+	long data_len;
+	uword offset;
+	uword len;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL)
+		return DLPSTAT_PARAM;
+	get_ubyte(&rptr);		/* Padding */
+	offset = get_uword(&rptr);
+	len = get_uword(&rptr);
+
+	pdb = h->db->pdb;
+	data = (const ubyte *) (sort ? pdb->sortinfo : pdb->appinfo);
+	data_len = sort ? pdb->sortinfo_len : pdb->appinfo_len;
+	if (data == NULL || data_len == 0)
+		return DLPSTAT_NOTFOUND;
+	if (offset > data_len)
+		return DLPSTAT_PARAM;
+	if (len > data_len - offset)
+		len = data_len - offset;
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadAppBlock_Blk,
+			     DLPRETLEN_ReadAppBlock_Blk + len)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_uword(&wptr, len);
+	memcpy(wptr, data + offset, len);
+
+	return DLPSTAT_NOERR;
+}
+
+/* write_block
+ * Common code for WriteAppBlock and WriteSortBlock.
+ */
+static dlp_stat_t
+write_block(const struct dlp_arg *arg, const Bool sort)
+{
+	const ubyte *rptr;
+	struct emu_handle *h;
+	struct pdb *pdb;
+	void *data = NULL;
+	uword len;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL)
+		return DLPSTAT_PARAM;
+	get_ubyte(&rptr);		/* Unused */
+	len = get_uword(&rptr);
+	if (len > arg->size - DLPARGLEN_WriteAppBlock_Block)
+		return DLPSTAT_ARGSIZE;
+
+	if (len > 0)
+	{
+		if ((data = malloc(len)) == NULL)
+			return DLPSTAT_NOMEM;
+		memcpy(data, rptr, len);
+	}
+
+	pdb = h->db->pdb;
+	if (sort)
+	{
+		if (pdb->sortinfo != NULL)
+			free(pdb->sortinfo);
+		pdb->sortinfo = data;
+		pdb->sortinfo_len = len;
+	} else {
+		if (pdb->appinfo != NULL)
+			free(pdb->appinfo);
+		pdb->appinfo = data;
+		pdb->appinfo_len = len;
+		pdb->attributes |= PDB_ATTR_APPINFODIRTY;
+	}
+	touch_db(h->db);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadAppBlock(const struct dlp_req_header *req,
+		 const struct dlp_arg *argv,
+		 struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadAppBlock_Req, 6)) == NULL)
+		return DLPSTAT_NOARG;
+	return read_block(arg, False, resp);
+}
+
+static dlp_stat_t
+emu_WriteAppBlock(const struct dlp_req_header *req,
+		  const struct dlp_arg *argv,
+		  struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv, DLPARG_WriteAppBlock_Block,
+			   DLPARGLEN_WriteAppBlock_Block)) == NULL)
+		return DLPSTAT_NOARG;
+	return write_block(arg, False);
+}
+
+static dlp_stat_t
+emu_ReadSortBlock(const struct dlp_req_header *req,
+		  const struct dlp_arg *argv,
+		  struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadSortBlock_Req, 6)) == NULL)
+		return DLPSTAT_NOARG;
+	return read_block(arg, True, resp);
+}
+
+static dlp_stat_t
+emu_WriteSortBlock(const struct dlp_req_header *req,
+		   const struct dlp_arg *argv,
+		   struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv, DLPARG_WriteSortBlock_Block,
+			   DLPARGLEN_WriteSortBlock_Block)) == NULL)
+		return DLPSTAT_NOARG;
+	return write_block(arg, True);
+}
+
+/* next_record
+ * Common code for the ReadNext*Rec* commands: return the next record
+ * after the handle's cursor that is modified (if 'modified' is true) and
+ * in category 'category' (unless it is negative).
+ */
+static dlp_stat_t
+next_record(const ubyte handle, const int category, const Bool modified,
+	    const uword ret_id, struct emu_resp *resp)
+{
+	struct emu_handle *h;
+	struct pdb_record *rec;
+
+	if ((h = get_handle(handle)) == NULL ||
+	    IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+
+	while ((rec = h->cursor) != NULL)
+	{
+		h->cursor = rec->next;
+		h->cursor_ix++;
+		if (modified && (rec->flags & PDB_REC_DIRTY) == 0)
+			continue;
+		if (category >= 0 && rec->category != category)
+			continue;
+		return put_record(resp, ret_id, rec, h->cursor_ix - 1,
+				  0, 0xffff);
+	}
+	return DLPSTAT_NOTFOUND;
+}
+
+static dlp_stat_t
+emu_ReadNextModifiedRec(const struct dlp_req_header *req,
+			const struct dlp_arg *argv,
+			struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadNextModifiedRec_Req,
+			   DLPARGLEN_ReadNextModifiedRec_Req)) == NULL)
+		return DLPSTAT_NOARG;
+	return next_record(arg->data[0], -1, True,
+			   DLPRET_ReadNextModifiedRec_Rec, resp);
+}
+
+static dlp_stat_t
+emu_ReadNextRecInCategory(const struct dlp_req_header *req,
+			  const struct dlp_arg *argv,
+			  struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadNextRecInCategory_Rec,
+			   DLPARGLEN_ReadNextRecInCategory_Rec)) == NULL)
+		return DLPSTAT_NOARG;
+	return next_record(arg->data[0], arg->data[1], False,
+			   DLPRET_ReadNextRecInCategory_Rec, resp);
+}
+
+static dlp_stat_t
+emu_ReadNextModifiedRecInCategory(const struct dlp_req_header *req,
+				  const struct dlp_arg *argv,
+				  struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv,
+			   DLPARG_ReadNextModifiedRecInCategory_Rec,
+			   DLPARGLEN_ReadNextModifiedRecInCategory_Rec))
+	    == NULL)
+		return DLPSTAT_NOARG;
+	return next_record(arg->data[0], arg->data[1], True,
+			   DLPRET_ReadNextModifiedRecInCategory_Rec, resp);
+}
+
+static dlp_stat_t
+emu_ResetRecordIndex(const struct dlp_req_header *req,
+		     const struct dlp_arg *argv,
+		     struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	struct emu_handle *h;
+
+	if ((arg = req_arg(req, argv, DLPARG_ResetRecordIndex_DB,
+			   DLPARGLEN_ResetRecordIndex_DB)) == NULL)
+		return DLPSTAT_NOARG;
+	if ((h = get_handle(arg->data[0])) == NULL ||
+	    IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+
+	h->cursor = h->db->pdb->rec_index.rec;
+	h->cursor_ix = 0;
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadRecord(const struct dlp_req_header *req,
+	       const struct dlp_arg *argv,
+	       struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	struct emu_handle *h;
+	struct pdb_record *rec;
+	uword index;
+	uword offset;
+	uword len;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadRecord_ByID,
+			   DLPARGLEN_ReadRecord_ByID)) != NULL)
+	{
+		udword id;
+
+		rptr = arg->data;
+		if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+		    IS_RSRC_DB(h->db->pdb))
+			return DLPSTAT_PARAM;
+		get_ubyte(&rptr);	/* Padding */
+		id = get_udword(&rptr);
+		offset = get_uword(&rptr);
+		len = get_uword(&rptr);
+
+		if ((rec = find_record(h->db->pdb, id, &index)) == NULL)
+			return DLPSTAT_NOTFOUND;
+		return put_record(resp, DLPRET_ReadRecord_Rec, rec, index,
+				  offset, len);
+	}
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadRecord_ByIndex,
+			   DLPARGLEN_ReadRecord_ByIndex)) == NULL)
+		return DLPSTAT_NOARG;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+	    IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+	get_ubyte(&rptr);		/* Padding */
+	index = get_uword(&rptr);
+	offset = get_uword(&rptr);
+	len = get_uword(&rptr);
+
+	if ((rec = pdb_FindRecordByIndex(h->db->pdb, index)) == NULL)
+		return DLPSTAT_NOTFOUND;
+	return put_record(resp, DLPRET_ReadRecord_Rec, rec, index,
+			  offset, len);
+}
+
+static dlp_stat_t
+emu_WriteRecord(const struct dlp_req_header *req,
+		const struct dlp_arg *argv,
+		struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	ubyte *wptr;
+	struct emu_handle *h;
+	struct pdb *pdb;
+	struct pdb_record *rec;
+	udword id;
+	ubyte attributes;
+	ubyte category;
+	udword len;
+	uword index;
+
+	if ((arg = req_arg(req, argv, DLPARG_WriteRecord_Rec,
+			   DLPARGLEN_WriteRecord_Rec)) == NULL)
+		return DLPSTAT_NOARG;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+	    IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+	get_ubyte(&rptr);		/* Flags */
+	id = get_udword(&rptr);
+	attributes = get_ubyte(&rptr);
+	category = get_ubyte(&rptr);
+	len = arg->size - DLPARGLEN_WriteRecord_Rec;
+	if (len > 0xffffL)
+		return DLPSTAT_LIMIT;
+
+	pdb = h->db->pdb;
+	if (id != 0L && (rec = find_record(pdb, id, &index)) != NULL)
+	{
+		/* Replace an existing record */
+		ubyte *data = NULL;
+
+		if (len > 0)
+		{
+			if ((data = (ubyte *) malloc(len)) == NULL)
+				return DLPSTAT_NOMEM;
+			memcpy(data, rptr, len);
+		}
+		if (rec->data != NULL)
+			free(rec->data);
+		rec->data = data;
+		rec->data_len = len;
+		rec->flags = attributes;
+		rec->category = category;
+	} else {
+		if (id == 0L)
+			id = new_id(pdb);
+		if ((rec = new_Record(attributes, category, id, len, rptr))
+		    == NULL)
+			return DLPSTAT_NOMEM;
+		pdb_AppendRecord(pdb, rec);
+
+		/* A cursor that had run off the end now has something
+		 * to look at.
+		 */
+		{
+			int i;
+
+			for (i = 0; i < EMU_MAXOPEN; i++)
+				if (handles[i].db == h->db &&
+				    handles[i].cursor == NULL &&
+				    handles[i].cursor_ix == pdb->numrecs - 1)
+					handles[i].cursor = rec;
+		}
+	}
+	touch_db(h->db);
+
+	if ((wptr = resp_arg(resp, DLPRET_WriteRecord_Rec,
+			     DLPRETLEN_WriteRecord_Rec)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_udword(&wptr, id);
+
+	return DLPSTAT_NOERR;
+}
+
+/* delete_records
+ * Delete every record in 'db' for which 'match' returns true.
+ */
+static void
+delete_records(struct emu_db *db,
+	       Bool (*match)(const struct pdb_record *rec, const int arg),
+	       const int arg)
+{
+	struct pdb_record *rec;
+	struct pdb_record *next;
+
+	for (rec = db->pdb->rec_index.rec; rec != NULL; rec = next)
+	{
+		next = rec->next;
+		if (!(*match)(rec, arg))
+			continue;
+		forget_record(db, rec);
+		pdb_DeleteRecordByID(db->pdb, rec->id);
+	}
+}
+
+static Bool
+match_all(const struct pdb_record *rec, const int arg)
+{
+	return True;
+}
+
+static Bool
+match_category(const struct pdb_record *rec, const int arg)
+{
+	return rec->category == arg;
+}
+
+static Bool
+match_deleted(const struct pdb_record *rec, const int arg)
+{
+	return (rec->flags & (PDB_REC_DELETED | PDB_REC_ARCHIVE |
+			      PDB_REC_EXPUNGED)) != 0;
+}
+
+static dlp_stat_t
+emu_DeleteRecord(const struct dlp_req_header *req,
+		 const struct dlp_arg *argv,
+		 struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	struct emu_handle *h;
+	struct pdb_record *rec;
+	ubyte flags;
+	udword id;
+	uword index;
+
+	if ((arg = req_arg(req, argv, DLPARG_DeleteRecord_Rec,
+			   DLPARGLEN_DeleteRecord_Rec)) == NULL)
+		return DLPSTAT_NOARG;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+	    IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+	flags = get_ubyte(&rptr);
+	id = get_udword(&rptr);
+
+	if (flags & DLPCMD_DELRECFLAG_ALL)
+		delete_records(h->db, match_all, 0);
+	else if (flags & DLPCMD_DELRECFLAG_CATEGORY)
+		/* The category is in the low byte of the ID */
+		delete_records(h->db, match_category, (int) (id & 0xff));
+	else {
+		if ((rec = find_record(h->db->pdb, id, &index)) == NULL)
+			return DLPSTAT_NOTFOUND;
+		forget_record(h->db, rec);
+		pdb_DeleteRecordByID(h->db->pdb, id);
+	}
+	touch_db(h->db);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_CleanUpDatabase(const struct dlp_req_header *req,
+		    const struct dlp_arg *argv,
+		    struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	struct emu_handle *h;
+
+	if ((arg = req_arg(req, argv, DLPARG_CleanUpDatabase_DB,
+			   DLPARGLEN_CleanUpDatabase_DB)) == NULL)
+		return DLPSTAT_NOARG;
+	if ((h = get_handle(arg->data[0])) == NULL)
+		return DLPSTAT_PARAM;
+
+	if (!IS_RSRC_DB(h->db->pdb))
+	{
+		delete_records(h->db, match_deleted, 0);
+		touch_db(h->db);
+	}
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ResetSyncFlags(const struct dlp_req_header *req,
+		   const struct dlp_arg *argv,
+		   struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	struct emu_handle *h;
+	struct pdb_record *rec;
+
+	if ((arg = req_arg(req, argv, DLPARG_ResetSyncFlags_DB,
+			   DLPARGLEN_ResetSyncFlags_DB)) == NULL)
+		return DLPSTAT_NOARG;
+	if ((h = get_handle(arg->data[0])) == NULL)
+		return DLPSTAT_PARAM;
+
+	if (!IS_RSRC_DB(h->db->pdb))
+		for (rec = h->db->pdb->rec_index.rec; rec != NULL;
+		     rec = rec->next)
+			rec->flags &= ~PDB_REC_DIRTY;
+	h->db->pdb->attributes &= ~PDB_ATTR_APPINFODIRTY;
+	h->db->pdb->baktime = palm_now();
+	h->db->dirty = True;
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadResource(const struct dlp_req_header *req,
+		 const struct dlp_arg *argv,
+		 struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	struct emu_handle *h;
+	struct pdb_resource *rsrc;
+	uword index;
+	uword offset;
+	uword len;
+	uword i;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadResource_ByIndex,
+			   DLPARGLEN_ReadResource_ByIndex)) != NULL)
+	{
+		rptr = arg->data;
+		if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+		    !IS_RSRC_DB(h->db->pdb))
+			return DLPSTAT_PARAM;
+		get_ubyte(&rptr);	/* Padding */
+		index = get_uword(&rptr);
+		offset = get_uword(&rptr);
+		len = get_uword(&rptr);
+
+		rsrc = h->db->pdb->rec_index.rsrc;
+		for (i = 0; rsrc != NULL && i < index; i++)
+			rsrc = rsrc->next;
+		if (rsrc == NULL)
+			return DLPSTAT_NOTFOUND;
+		return put_resource(resp, rsrc, index, offset, len);
+	}
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadResource_ByType,
+			   DLPARGLEN_ReadResource_ByType)) == NULL)
+		return DLPSTAT_NOARG;
+
+	{
+		udword type;
+		uword id;
+
+		rptr = arg->data;
+		if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+		    !IS_RSRC_DB(h->db->pdb))
+			return DLPSTAT_PARAM;
+		get_ubyte(&rptr);	/* Padding */
+		type = get_udword(&rptr);
+		id = get_uword(&rptr);
+		offset = get_uword(&rptr);
+		len = get_uword(&rptr);
+
+		for (rsrc = h->db->pdb->rec_index.rsrc, index = 0;
+		     rsrc != NULL;
+		     rsrc = rsrc->next, index++)
+			if (rsrc->type == type && rsrc->id == id)
+				break;
+		if (rsrc == NULL)
+			return DLPSTAT_NOTFOUND;
+		return put_resource(resp, rsrc, index, offset, len);
+	}
+}
+
+/* emu_ReadAppPreference
+ * Preferences are resources in "Saved Preferences" or "Unsaved
+ * Preferences", if there's such a database in the directory. The type of
+ * each resource is the creator of the application, and its data starts
+ * with the preference's version.
+ */
+static dlp_stat_t
+emu_ReadAppPreference(const struct dlp_req_header *req,
+		      const struct dlp_arg *argv,
+		      struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	ubyte *wptr;
+	struct pdb_resource *rsrc;
+	udword creator;
+	uword id;
+	uword len;
+	ubyte flags;
+	uword size;
+	int ix;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadAppPreference_Pref,
+			   DLPARGLEN_ReadAppPreference_Pref)) == NULL)
+		return DLPSTAT_NOARG;
+	rptr = arg->data;
+	creator = get_udword(&rptr);
+	id = get_uword(&rptr);
+	len = get_uword(&rptr);
+	flags = get_ubyte(&rptr);
+
+	if ((ix = find_db((flags & DLPC_READAPPFL_BACKEDUP) ?
+			  "Saved Preferences" :
+			  "Unsaved Preferences")) < 0 ||
+	    !IS_RSRC_DB(dbs[ix]->pdb))
+		return DLPSTAT_NOTFOUND;
+	for (rsrc = dbs[ix]->pdb->rec_index.rsrc;
+	     rsrc != NULL;
+	     rsrc = rsrc->next)
+		if (rsrc->type == creator && rsrc->id == id)
+			break;
+	if (rsrc == NULL || rsrc->data_len < 2)
+		return DLPSTAT_NOTFOUND;
+
+	size = rsrc->data_len - 2;
+	if (len > size)
+		len = size;
+	if ((wptr = resp_arg(resp, DLPRET_ReadAppPreference_Pref,
+			     DLPRETLEN_ReadAppPreference_Pref + len)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_uword(&wptr, (rsrc->data[0] << 8) | rsrc->data[1]);
+	put_uword(&wptr, size);
+	put_uword(&wptr, len);
+	if (len > 0)
+		memcpy(wptr, rsrc->data + 2, len);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_WriteResource(const struct dlp_req_header *req,
+		  const struct dlp_arg *argv,
+		  struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	struct emu_handle *h;
+	struct pdb_resource *rsrc;
+	udword type;
+	uword id;
+	uword size;
+
+	if ((arg = req_arg(req, argv, DLPARG_WriteResource_Rsrc,
+			   DLPARGLEN_WriteResource_Rsrc)) == NULL)
+		return DLPSTAT_NOARG;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+	    !IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+	get_ubyte(&rptr);		/* Padding */
+	type = get_udword(&rptr);
+	id = get_uword(&rptr);
+	size = get_uword(&rptr);
+	if (size > arg->size - DLPARGLEN_WriteResource_Rsrc)
+		return DLPSTAT_ARGSIZE;
+
+	for (rsrc = h->db->pdb->rec_index.rsrc; rsrc != NULL;
+	     rsrc = rsrc->next)
+		if (rsrc->type == type && rsrc->id == id)
+			break;
+
+	if (rsrc != NULL)
+	{
+		ubyte *data = NULL;
+
+		if (size > 0)
+		{
+			if ((data = (ubyte *) malloc(size)) == NULL)
+				return DLPSTAT_NOMEM;
+			memcpy(data, rptr, size);
+		}
+		if (rsrc->data != NULL)
+			free(rsrc->data);
+		rsrc->data = data;
+		rsrc->data_len = size;
+	} else {
+		if ((rsrc = new_Resource(type, id, size, rptr)) == NULL)
+			return DLPSTAT_NOMEM;
+		pdb_AppendResource(h->db->pdb, rsrc);
+	}
+	touch_db(h->db);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_DeleteResource(const struct dlp_req_header *req,
+		   const struct dlp_arg *argv,
+		   struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	struct emu_handle *h;
+	struct pdb *pdb;
+	struct pdb_resource *rsrc;
+	struct pdb_resource **prev;
+	ubyte flags;
+	udword type;
+	uword id;
+	Bool found = False;
+
+	if ((arg = req_arg(req, argv, DLPARG_DeleteResource_Res,
+			   DLPARGLEN_DeleteResource_Res)) == NULL)
+		return DLPSTAT_NOARG;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+	    !IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+	flags = get_ubyte(&rptr);
+	type = get_udword(&rptr);
+	id = get_uword(&rptr);
+
+	pdb = h->db->pdb;
+	prev = &pdb->rec_index.rsrc;
+	while ((rsrc = *prev) != NULL)
+	{
+		if ((flags & DLPCMD_DELRSRCFLAG_ALL) == 0 &&
+		    (rsrc->type != type || rsrc->id != id))
+		{
+			prev = &rsrc->next;
+			continue;
+		}
+		*prev = rsrc->next;
+		pdb_FreeResource(rsrc);
+		pdb->numrecs--;
+		found = True;
+	}
+	if (!found && (flags & DLPCMD_DELRSRCFLAG_ALL) == 0)
+		return DLPSTAT_NOTFOUND;
+	touch_db(h->db);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadOpenDBInfo(const struct dlp_req_header *req,
+		   const struct dlp_arg *argv,
+		   struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	struct emu_handle *h;
+	ubyte *wptr;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadOpenDBInfo_DB,
+			   DLPARGLEN_ReadOpenDBInfo_DB)) == NULL)
+		return DLPSTAT_NOARG;
+	if ((h = get_handle(arg->data[0])) == NULL)
+		return DLPSTAT_PARAM;
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadOpenDBInfo_Info,
+			     DLPRETLEN_ReadOpenDBInfo_Info)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_uword(&wptr, h->db->pdb->numrecs);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadRecordIDList(const struct dlp_req_header *req,
+		     const struct dlp_arg *argv,
+		     struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	ubyte *wptr;
+	struct emu_handle *h;
+	struct pdb_record *rec;
+	uword start;
+	uword max;
+	uword n;
+
+	if ((arg = req_arg(req, argv, DLPARG_ReadRecordIDList_Req,
+			   DLPARGLEN_ReadRecordIDList_Req)) == NULL)
+		return DLPSTAT_NOARG;
+
+	rptr = arg->data;
+	if ((h = get_handle(get_ubyte(&rptr))) == NULL ||
+	    IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+	get_ubyte(&rptr);		/* Flags. We don't sort. */
+	start = get_uword(&rptr);
+	max = get_uword(&rptr);
+
+	n = 0;
+	if (start < h->db->pdb->numrecs)
+		n = h->db->pdb->numrecs - start;
+	if (n > max)
+		n = max;
+	if (n > EMU_IDLIST_MAX)
+		n = EMU_IDLIST_MAX;
+
+	if ((wptr = resp_arg(resp, DLPRET_ReadRecordIDList_List,
+			     2 + 4 * n)) == NULL)
+		return DLPSTAT_NOMEM;
+	put_uword(&wptr, n);
+
+	rec = pdb_FindRecordByIndex(h->db->pdb, start);
+	for (; n > 0 && rec != NULL; n--, rec = rec->next)
+		put_udword(&wptr, rec->id);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_MoveCategory(const struct dlp_req_header *req,
+		 const struct dlp_arg *argv,
+		 struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	struct emu_handle *h;
+	struct pdb_record *rec;
+
+	if ((arg = req_arg(req, argv, DLPARG_MoveCategory_Cat,
+			   DLPARGLEN_MoveCategory_Cat)) == NULL)
+		return DLPSTAT_NOARG;
+	if ((h = get_handle(arg->data[0])) == NULL ||
+	    IS_RSRC_DB(h->db->pdb))
+		return DLPSTAT_PARAM;
+
+	for (rec = h->db->pdb->rec_index.rec; rec != NULL; rec = rec->next)
+		if (rec->category == arg->data[1])
+			rec->category = arg->data[2];
+	touch_db(h->db);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_AddSyncLogEntry(const struct dlp_req_header *req,
+		    const struct dlp_arg *argv,
+		    struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+
+	if ((arg = req_arg(req, argv, DLPARG_AddSyncLogEntry_Msg, 0)) == NULL)
+		return DLPSTAT_NOARG;
+
+	EMU_TRACE(1)
+		fprintf(stderr, "Sync log: %.*s\n",
+			(int) arg->size, (const char *) arg->data);
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_EndOfSync(const struct dlp_req_header *req,
+	      const struct dlp_arg *argv,
+	      struct emu_resp *resp)
+{
+	end_of_sync = True;
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_ReadNetSyncInfo(const struct dlp_req_header *req,
+		    const struct dlp_arg *argv,
+		    struct emu_resp *resp)
+{
+	ubyte *wptr;
+
+	/* LAN sync is off, and there are no host name, address or netmask
+	 * (just their NULs).
+	 */
+	if ((wptr = resp_arg(resp, DLPRET_ReadNetSyncInfo_Info,
+			     DLPRETLEN_ReadNetSyncInfo_Info + 3)) == NULL)
+		return DLPSTAT_NOMEM;
+	memset(wptr, 0, DLPRETLEN_ReadNetSyncInfo_Info + 3);
+	wptr += 18;			/* lansync_on and reserved fields */
+	put_uword(&wptr, 1);		/* Host name size */
+	put_uword(&wptr, 1);		/* Host address size */
+	put_uword(&wptr, 1);		/* Netmask size */
+
+	return DLPSTAT_NOERR;
+}
+
+static dlp_stat_t
+emu_FindDB(const struct dlp_req_header *req,
+	   const struct dlp_arg *argv,
+	   struct emu_resp *resp)
+{
+	const struct dlp_arg *arg;
+	const ubyte *rptr;
+	struct emu_handle *h;
+	int ix;
+
+	if ((arg = req_arg(req, argv, DLPARG_FindDB_ByName,
+			   DLPARGLEN_FindDB_ByName - 1)) != NULL)
+	{
+		char name[DLPCMD_DBNAME_LEN];
+
+		arg_name(name, arg->data + 2, arg->size - 2);
+		if ((ix = find_db(name)) < 0)
+			return DLPSTAT_NOTFOUND;
+		return put_finddb(resp, ix);
+	}
+
+	if ((arg = req_arg(req, argv, DLPARG_FindDB_ByOpenHandle,
+			   DLPARGLEN_FindDB_ByOpenHandle)) != NULL)
+	{
+		if ((h = get_handle(arg->data[1])) == NULL)
+			return DLPSTAT_PARAM;
+		for (ix = 0; ix < num_dbs; ix++)
+			if (dbs[ix] == h->db)
+				break;
+		return put_finddb(resp, ix);
+	}
+
+	if ((arg = req_arg(req, argv, DLPARG_FindDB_ByTypeCreator,
+			   DLPARGLEN_FindDB_ByTypeCreator)) != NULL)
+	{
+		ubyte srchflags;
+		udword type;
+		udword creator;
+
+		rptr = arg->data;
+		get_ubyte(&rptr);	/* Option flags */
+		srchflags = get_ubyte(&rptr);
+		type = get_udword(&rptr);
+		creator = get_udword(&rptr);
+
+		if (srchflags & DLPCMD_FindDB_SrchFlag_NewSearch)
+			find_ix = 0;
+		for (; find_ix < num_dbs; find_ix++)
+		{
+			const struct pdb *pdb = dbs[find_ix]->pdb;
+
+			if ((type == 0L || pdb->type == type) &&
+			    (creator == 0L || pdb->creator == creator))
+				return put_finddb(resp, find_ix++);
+		}
+		return DLPSTAT_NOTFOUND;
+	}
+
+	return DLPSTAT_NOARG;
+}
+
+/* Table of DLP commands, and the functions that implement them. Anything
+ * not listed here gets DLPSTAT_ILLEGALREQ.
+ */
+static struct emu_cmd emu_cmds[] = {
+	{ DLPCMD_ReadUserInfo,	"ReadUserInfo",	emu_ReadUserInfo },
+	{ DLPCMD_WriteUserInfo,	"WriteUserInfo", emu_WriteUserInfo },
+	{ DLPCMD_ReadSysInfo,	"ReadSysInfo",	emu_ReadSysInfo },
+	{ DLPCMD_GetSysDateTime, "GetSysDateTime", emu_GetSysDateTime },
+	{ DLPCMD_SetSysDateTime, "SetSysDateTime", emu_NoOp },
+	{ DLPCMD_ReadStorageInfo, "ReadStorageInfo", emu_ReadStorageInfo },
+	{ DLPCMD_ReadDBList,	"ReadDBList",	emu_ReadDBList },
+	{ DLPCMD_OpenDB,	"OpenDB",	emu_OpenDB },
+	{ DLPCMD_CreateDB,	"CreateDB",	emu_CreateDB },
+	{ DLPCMD_CloseDB,	"CloseDB",	emu_CloseDB },
+	{ DLPCMD_DeleteDB,	"DeleteDB",	emu_DeleteDB },
+	{ DLPCMD_ReadAppBlock,	"ReadAppBlock",	emu_ReadAppBlock },
+	{ DLPCMD_WriteAppBlock,	"WriteAppBlock", emu_WriteAppBlock },
+	{ DLPCMD_ReadSortBlock,	"ReadSortBlock", emu_ReadSortBlock },
+	{ DLPCMD_WriteSortBlock, "WriteSortBlock", emu_WriteSortBlock },
+	{ DLPCMD_ReadNextModifiedRec, "ReadNextModifiedRec",
+	  emu_ReadNextModifiedRec },
+	{ DLPCMD_ReadRecord,	"ReadRecord",	emu_ReadRecord },
+	{ DLPCMD_WriteRecord,	"WriteRecord",	emu_WriteRecord },
+	{ DLPCMD_DeleteRecord,	"DeleteRecord",	emu_DeleteRecord },
+	{ DLPCMD_ReadResource,	"ReadResource",	emu_ReadResource },
+	{ DLPCMD_WriteResource,	"WriteResource", emu_WriteResource },
+	{ DLPCMD_DeleteResource, "DeleteResource", emu_DeleteResource },
+	{ DLPCMD_CleanUpDatabase, "CleanUpDatabase", emu_CleanUpDatabase },
+	{ DLPCMD_ResetSyncFlags, "ResetSyncFlags", emu_ResetSyncFlags },
+	{ DLPCMD_ResetSystem,	"ResetSystem",	emu_NoOp },
+	{ DLPCMD_AddSyncLogEntry, "AddSyncLogEntry", emu_AddSyncLogEntry },
+	{ DLPCMD_ReadOpenDBInfo, "ReadOpenDBInfo", emu_ReadOpenDBInfo },
+	{ DLPCMD_MoveCategory,	"MoveCategory",	emu_MoveCategory },
+	{ DLPCMD_OpenConduit,	"OpenConduit",	emu_NoOp },
+	{ DLPCMD_EndOfSync,	"EndOfSync",	emu_EndOfSync },
+	{ DLPCMD_ResetRecordIndex, "ResetRecordIndex", emu_ResetRecordIndex },
+	{ DLPCMD_ReadRecordIDList, "ReadRecordIDList", emu_ReadRecordIDList },
+	{ DLPCMD_ReadNextRecInCategory, "ReadNextRecInCategory",
+	  emu_ReadNextRecInCategory },
+	{ DLPCMD_ReadNextModifiedRecInCategory,
+	  "ReadNextModifiedRecInCategory",
+	  emu_ReadNextModifiedRecInCategory },
+	{ DLPCMD_ReadAppPreference, "ReadAppPreference",
+	  emu_ReadAppPreference },
+	{ DLPCMD_WriteAppPreference, "WriteAppPreference", emu_NoOp },
+	{ DLPCMD_ReadNetSyncInfo, "ReadNetSyncInfo", emu_ReadNetSyncInfo },
+	{ DLPCMD_WriteNetSyncInfo, "WriteNetSyncInfo", emu_NoOp },
+	{ DLPCMD_ReadFeature,	"ReadFeature",	emu_NotFound },
+	{ DLPCMD_FindDB,	"FindDB",	emu_FindDB },
+	{ 0, NULL, NULL }
+};
+
+static struct emu_cmd *
+find_cmd(const ubyte id)
+{
+	struct emu_cmd *cmd;
+
+	for (cmd = emu_cmds; cmd->name != NULL; cmd++)
+		if (cmd->id == id)
+			return cmd;
+	return NULL;
+}
+
+/* serve
+ * Answer DLP requests on 'pconn' until the desktop sends EndOfSync.
+ * Returns the number of requests answered, or -1 in case of error.
+ */
+static int
+serve(PConnection *pconn)
+{
+	int err;
+	int i;
+	int nreqs = 0;
+	struct dlp_req_header req;
+	const struct dlp_arg *argv;
+	struct emu_resp resp;
+	struct emu_cmd *cmd;
+
+	end_of_sync = False;
+	hung_up = False;
+	while (!end_of_sync)
+	{
+		err = dlp_recv_req(pconn, &req, &argv);
+		if (err < 0)
+		{
+			if (PConn_get_palmerrno(pconn) == PALMERR_EOF)
+				fprintf(stderr,
+					_("The desktop hung up before the "
+					  "end of the sync.\n"));
+			else
+				fprintf(stderr,
+					_("Error reading DLP request: %s.\n"),
+					_(palm_strerror(
+						PConn_get_palmerrno(pconn))));
+			return -1;
+		}
+		nreqs++;
+
+		if (fault.hangup > 0 && nreqs > fault.hangup)
+		{
+			hung_up = True;
+			return nreqs - 1;
+		}
+
+		resp.header.id = req.id;
+		resp.header.argc = 0;
+		if ((cmd = find_cmd(req.id)) == NULL)
+		{
+			EMU_TRACE(1)
+				fprintf(stderr,
+					"Unsupported DLP request 0x%02x\n",
+					req.id);
+			resp.header.error = DLPSTAT_ILLEGALREQ;
+		} else {
+			cmd->count++;
+			resp.header.error = (*cmd->handler)(&req, argv, &resp);
+			EMU_TRACE(2)
+				fprintf(stderr, "%s: %d\n",
+					cmd->name, resp.header.error);
+		}
+
+		/* PalmOS sends no arguments with an error */
+		if (resp.header.error != DLPSTAT_NOERR)
+		{
+			for (i = 0; i < resp.header.argc; i++)
+				free(resp.argv[i].data);
+			resp.header.argc = 0;
+		}
+
+		err = dlp_send_resp(pconn, &resp.header, resp.argv);
+		for (i = 0; i < resp.header.argc; i++)
+			free(resp.argv[i].data);
+		if (err < 0)
+		{
+			fprintf(stderr, _("Error sending DLP response.\n"));
+			return -1;
+		}
+	}
+
+	return nreqs;
+}
+
+/*** Fault injection ***/
+
+/* fault_delay
+ * Wait as long as it takes to send 'len' bytes over the emulated link.
+ */
+static void
+fault_delay(const long len)
+{
+	long usecs;
+	struct timeval tv;
+
+	usecs = fault.latency;
+	if (fault.bandwidth > 0)
+		usecs += (long) ((double) len * 1000000.0 / fault.bandwidth);
+	if (usecs <= 0)
+		return;
+
+	tv.tv_sec = usecs / 1000000;
+	tv.tv_usec = usecs % 1000000;
+	select(0, NULL, NULL, NULL, &tv);
+}
+
+/* fault_drop
+ * Returns true if the current packet should be lost.
+ */
+static Bool
+fault_drop(void)
+{
+	return fault.loss > 0 && (rand() % 100) < fault.loss;
+}
+
+static int
+fault_write(PConnection *p, unsigned const char *buf, const int len)
+{
+	fault_delay(len);
+	if (fault_drop())
+	{
+		EMU_TRACE(3)
+			fprintf(stderr, "Dropping %d bytes\n", len);
+		return len;
+	}
+	return (*fault.io_write)(p, buf, len);
+}
+
+static int
+fault_writev(PConnection *p, const struct iovec *iov, const int iovcnt)
+{
+	int i;
+	long len = 0L;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	fault_delay(len);
+	if (fault_drop())
+	{
+		EMU_TRACE(3)
+			fprintf(stderr, "Dropping %ld bytes\n", len);
+		return len;
+	}
+	return (*fault.io_writev)(p, iov, iovcnt);
+}
+
+/* install_faults
+ * Interpose the fault injectors on 'pconn's output methods.
+ */
+static void
+install_faults(PConnection *pconn)
+{
+	if (fault.latency == 0 && fault.bandwidth == 0 && fault.loss == 0)
+		return;
+
+	fault.io_write = pconn->io_write;
+	pconn->io_write = fault_write;
+	fault.io_writev = pconn->io_writev;
+	if (pconn->io_writev != NULL)
+		pconn->io_writev = fault_writev;
+}
+
+/*** Transports ***/
+
+/* spawn
+ * Run 'command', with "{}" replaced by 'device'. If 'fd' isn't -1, it
+ * becomes the child's stdin and stdout. Returns the child's PID, or -1.
+ */
+static pid_t
+spawn(const char *device, const int fd)
+{
+	pid_t pid;
+	int i;
+
+	if ((pid = fork()) < 0)
+	{
+		perror("fork");
+		return -1;
+	}
+	if (pid > 0)
+		return pid;
+
+	/* Child */
+	if (fd >= 0)
+	{
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		if (fd != STDIN_FILENO && fd != STDOUT_FILENO)
+			close(fd);
+	}
+	for (i = 0; command[i] != NULL; i++)
+		if (device != NULL && strcmp(command[i], "{}") == 0)
+			command[i] = (char *) device;
+	execvp(command[0], command);
+	fprintf(stderr, _("Can't run \"%s\": %s.\n"),
+		command[0], strerror(errno));
+	_exit(127);
+}
+
+/* open_pair
+ * Run the desktop command at the other end of a socketpair, and speak
+ * the simple protocol stack to it.
+ */
+static PConnection *
+open_pair(pid_t *child)
+{
+	int sv[2];
+	PConnection *pconn;
+
+	if (command == NULL)
+	{
+		fprintf(stderr, _("The \"pair\" transport needs a command "
+				  "to run.\n"));
+		return NULL;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+	{
+		perror("socketpair");
+		return NULL;
+	}
+	/* Don't let the child inherit our end, or it would never see
+	 * EOF.
+	 */
+	fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+	if ((*child = spawn(NULL, sv[1])) < 0)
+	{
+		close(sv[0]);
+		close(sv[1]);
+		return NULL;
+	}
+	close(sv[1]);
+
+	/* The serial transport knows how to talk over stdin and stdout.
+	 * Keep the real stdout for the report.
+	 */
+	if (report == stdout)
+	{
+		int fd;
+
+		fflush(stdout);
+		if ((fd = dup(STDOUT_FILENO)) < 0 ||
+		    (report = fdopen(fd, "w")) == NULL)
+		{
+			perror("dup");
+			report = stdout;
+			close(sv[0]);
+			return NULL;
+		}
+	}
+	dup2(sv[0], STDIN_FILENO);
+	dup2(sv[0], STDOUT_FILENO);
+	close(sv[0]);
+
+	pconn = new_PConnection("stdin", LISTEN_SERIAL, PCONN_STACK_SIMPLE,
+				PCONNFL_EMULATEPALM);
+	if (pconn == NULL)
+		return NULL;
+	install_faults(pconn);
+
+	if (PConn_accept(pconn) < 0)
+	{
+		fprintf(stderr, _("Can't establish connection.\n"));
+		PConnClose(pconn);
+		return NULL;
+	}
+	return pconn;
+}
+
+#if HAVE_GRANTPT
+/* open_pty
+ * Create a pseudo-tty, and act like a Palm in a serial cradle on its
+ * master side.
+ */
+static PConnection *
+open_pty(pid_t *child, int *slave)
+{
+	PConnection *pconn;
+	char *device;
+
+	pconn = new_PConnection("/dev/ptmx", LISTEN_SERIAL, PCONN_STACK_FULL,
+				PCONNFL_EMULATEPALM);
+	if (pconn == NULL)
+		return NULL;
+
+	if (grantpt(pconn->fd) < 0 || unlockpt(pconn->fd) < 0 ||
+	    (device = ptsname(pconn->fd)) == NULL)
+	{
+		perror("ptsname");
+		PConnClose(pconn);
+		return NULL;
+	}
+
+	/* Hold the slave side open ourselves, so that the master doesn't
+	 * see a hangup if ColdSync closes and reopens it.
+	 */
+	if ((*slave = open(device, O_RDWR | O_NOCTTY)) < 0)
+	{
+		perror(device);
+		PConnClose(pconn);
+		return NULL;
+	}
+
+	printf("%s\n", device);
+	fflush(stdout);
+
+	if (command != NULL && (*child = spawn(device, -1)) < 0)
+	{
+		PConnClose(pconn);
+		return NULL;
+	}
+	install_faults(pconn);
+
+	pconn->speed = 0L;		/* Let the desktop pick */
+	if (PConn_accept(pconn) < 0)
+	{
+		fprintf(stderr, _("Can't establish connection.\n"));
+		PConnClose(pconn);
+		return NULL;
+	}
+	return pconn;
+}
+#endif	/* HAVE_GRANTPT */
+
+/* net_wakeup
+ * Send NetSync wakeup packets from the UDP socket 'fd' to 'servaddr',
+ * until one is acknowledged.
+ */
+static int
+net_wakeup(int fd, struct sockaddr_in *servaddr)
+{
+	ubyte buf[1024];
+	ubyte *wptr;
+	int i;
+	int len;
+	struct servent *service;
+
+	service = getservbyname("netsync-wakeup", "udp");
+	servaddr->sin_port = (service == NULL ?
+			      htons(NETSYNC_WAKEUP_PORT) :
+			      service->s_port);
+
+	wptr = buf;
+	put_uword(&wptr, NETSYNC_WAKEUP_MAGIC);
+	put_ubyte(&wptr, 1);		/* Wakeup */
+	put_ubyte(&wptr, 0);
+	put_udword(&wptr, ntohl(servaddr->sin_addr.s_addr));
+	put_udword(&wptr, 0xffffff00L);
+	memcpy(wptr, "palmemu", 8);
+	wptr += 8;
+
+	for (i = 0; i < EMU_WAKEUP_TRIES; i++)
+	{
+		fd_set fds;
+		struct timeval tv;
+
+		EMU_TRACE(2)
+			fprintf(stderr, "Sending wakeup packet\n");
+		if (sendto(fd, (const char *) buf, wptr - buf, 0,
+			   (struct sockaddr *) servaddr,
+			   sizeof(*servaddr)) < 0)
+		{
+			perror("sendto");
+			return -1;
+		}
+
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		tv.tv_sec = 2;
+		tv.tv_usec = 0;
+		if (select(fd+1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		len = recv(fd, (char *) buf, sizeof(buf), 0);
+		if (len >= 4 && buf[0] == (NETSYNC_WAKEUP_MAGIC >> 8) &&
+		    buf[1] == (NETSYNC_WAKEUP_MAGIC & 0xff) && buf[2] == 2)
+			return 0;
+	}
+
+	fprintf(stderr, _("No answer to NetSync wakeup from %s.\n"),
+		hostaddr);
+	return -1;
+}
+
+/* open_net
+ * Wake up a NetSync server, and connect to it.
+ */
+static PConnection *
+open_net(void)
+{
+	PConnection *pconn;
+	struct sockaddr_in servaddr;
+
+	memset(&servaddr, 0, sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	if ((servaddr.sin_addr.s_addr = inet_addr(hostaddr)) ==
+	    (in_addr_t) -1)
+	{
+		fprintf(stderr, _("Bad address \"%s\".\n"), hostaddr);
+		return NULL;
+	}
+
+	pconn = new_PConnection(NULL, LISTEN_NET, PCONN_STACK_NET,
+				PCONNFL_EMULATEPALM);
+	if (pconn == NULL)
+		return NULL;
+
+	/* The new PConnection comes with a UDP socket, for the wakeup.
+	 * net_connect() replaces it with the TCP data socket.
+	 */
+	if (net_wakeup(pconn->fd, &servaddr) < 0)
+	{
+		PConnClose(pconn);
+		return NULL;
+	}
+	close(pconn->fd);
+	pconn->fd = -1;
+
+	install_faults(pconn);
+	if (PConn_connect(pconn, &servaddr, sizeof(servaddr)) < 0)
+	{
+		PConnClose(pconn);
+		return NULL;
+	}
+	return pconn;
+}
+
+/* run_sync
+ * Connect to the desktop, and serve one sync. 'n' is the sync's number,
+ * for the report. Returns 0 if successful, or -1 in case of error.
+ */
+static int
+run_sync(const int n)
+{
+	PConnection *pconn = NULL;
+	pid_t child = -1;
+	int slave = -1;
+	int nreqs;
+	int status;
+	long msecs;
+	struct timeval start, end;
+
+	switch (transport)
+	{
+	    case EMU_NET:
+		pconn = open_net();
+		break;
+	    case EMU_PTY:
+#if HAVE_GRANTPT
+		pconn = open_pty(&child, &slave);
+#endif	/* HAVE_GRANTPT */
+		break;
+	    case EMU_PAIR:
+		pconn = open_pair(&child);
+		break;
+	}
+
+	if (pconn != NULL)
+	{
+		gettimeofday(&start, NULL);
+		nreqs = serve(pconn);
+		gettimeofday(&end, NULL);
+
+		msecs = (end.tv_sec - start.tv_sec) * 1000L +
+			(end.tv_usec - start.tv_usec) / 1000L;
+		if (hung_up)
+			fprintf(report, "sync %d: hung up after %ld.%03ld s, "
+				"%d requests\n",
+				n, msecs / 1000, msecs % 1000, nreqs);
+		else if (nreqs >= 0)
+			fprintf(report, "sync %d: %ld.%03ld s, %d requests, "
+				"%d bytes in, %d bytes out\n",
+				n, msecs / 1000, msecs % 1000, nreqs,
+				pconn->bytes_read, pconn->bytes_write);
+		fflush(report);
+
+		PConnClose(pconn);
+		if (transport == EMU_PAIR)
+		{
+			/* Let go of our end of the socketpair, so that the
+			 * desktop sees EOF. PConnClose() closed stdin, so
+			 * plug both descriptors, lest the next socketpair
+			 * land on them.
+			 */
+			int fd;
+
+			if ((fd = open("/dev/null", O_RDWR)) >= 0)
+			{
+				dup2(fd, STDIN_FILENO);
+				dup2(fd, STDOUT_FILENO);
+				if (fd > STDOUT_FILENO)
+					close(fd);
+			}
+		}
+	} else
+		nreqs = -1;
+
+	if (slave >= 0)
+		close(slave);
+	if (child > 0)
+	{
+		if (nreqs < 0)
+			kill(child, SIGTERM);
+		while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+			;
+		if (nreqs >= 0 && !hung_up &&
+		    (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+			fprintf(stderr, _("Warning: \"%s\" exited with "
+					  "status %d.\n"),
+				command[0], status);
+	}
+
+	return nreqs < 0 ? -1 : 0;
+}
+
+/*** Databases ***/
+
+/* load_dbs
+ * Load every .pdb and .prc file in 'dir'. Returns the number of databases
+ * loaded, or -1 in case of error.
+ */
+static int
+load_dbs(const char *dir)
+{
+	DIR *dirp;
+	struct dirent *de;
+	char fname[MAXPATHLEN+1];
+	struct emu_db *db;
+	struct pdb *pdb;
+	int fd;
+	int len;
+
+	if ((dirp = opendir(dir)) == NULL)
+	{
+		fprintf(stderr, _("Can't open \"%s\": %s.\n"),
+			dir, strerror(errno));
+		return -1;
+	}
+
+	while ((de = readdir(dirp)) != NULL)
+	{
+		len = strlen(de->d_name);
+		if (len < 5 ||
+		    (strcasecmp(de->d_name + len - 4, ".pdb") != 0 &&
+		     strcasecmp(de->d_name + len - 4, ".prc") != 0))
+			continue;
+
+		snprintf(fname, sizeof(fname), "%s/%s", dir, de->d_name);
+		if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0)
+		{
+			fprintf(stderr, _("Can't open \"%s\": %s.\n"),
+				fname, strerror(errno));
+			continue;
+		}
+		pdb = pdb_Read(fd);
+		close(fd);
+		if (pdb == NULL)
+		{
+			fprintf(stderr, _("Can't load \"%s\".\n"), fname);
+			continue;
+		}
+		if (find_db(pdb->name) >= 0)
+		{
+			fprintf(stderr, _("Warning: \"%s\" is a duplicate of "
+					  "\"%s\". Ignored.\n"),
+				fname, pdb->name);
+			free_pdb(pdb);
+			continue;
+		}
+
+		if (num_dbs >= max_dbs)
+		{
+			struct emu_db **eptr;
+
+			if ((eptr = (struct emu_db **)
+			     realloc(dbs, (max_dbs + 16) * sizeof(*dbs)))
+			    == NULL)
+			{
+				closedir(dirp);
+				return -1;
+			}
+			dbs = eptr;
+			max_dbs += 16;
+		}
+		if ((db = (struct emu_db *) calloc(1, sizeof(*db))) == NULL ||
+		    (db->fname = strdup(fname)) == NULL)
+		{
+			closedir(dirp);
+			return -1;
+		}
+		db->pdb = pdb;
+		dbs[num_dbs++] = db;
+
+		EMU_TRACE(3)
+			fprintf(stderr, "Loaded \"%s\" from %s\n",
+				pdb->name, fname);
+	}
+	closedir(dirp);
+
+	return num_dbs;
+}
+
+/* save_db
+ * Write 'db' back to its file, or to a new one in the database directory
+ * if it was created during the sync.
+ */
+static int
+save_db(struct emu_db *db)
+{
+	char tmpname[MAXPATHLEN+1];
+	int fd;
+	int err;
+
+	if (db->fname == NULL)
+	{
+		char fname[MAXPATHLEN+1];
+		char *p;
+
+		snprintf(fname, sizeof(fname), "%s/%s%s", dbdir,
+			 db->pdb->name,
+			 IS_RSRC_DB(db->pdb) ? ".prc" : ".pdb");
+		/* Database names may contain slashes */
+		for (p = fname + strlen(dbdir) + 1; *p != '\0'; p++)
+			if (*p == '/')
+				*p = '_';
+		if ((db->fname = strdup(fname)) == NULL)
+			return -1;
+	}
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", db->fname);
+	if ((fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+		       0644)) < 0)
+	{
+		fprintf(stderr, _("Can't create \"%s\": %s.\n"),
+			tmpname, strerror(errno));
+		return -1;
+	}
+	err = pdb_Write(db->pdb, fd);
+	close(fd);
+	if (err < 0 || rename(tmpname, db->fname) < 0)
+	{
+		fprintf(stderr, _("Can't save \"%s\".\n"), db->fname);
+		unlink(tmpname);
+		return -1;
+	}
+	db->dirty = False;
+
+	EMU_TRACE(3)
+		fprintf(stderr, "Saved \"%s\" to %s\n",
+			db->pdb->name, db->fname);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int arg;			/* Current option */
+	int oldoptind;			/* Previous value of 'optind', to
+					 * allow us to figure out exactly
+					 * which argument was bogus, and
+					 * thereby print descriptive error
+					 * messages. */
+	int i;
+	int err = 0;
+	struct emu_cmd *cmd;
+
+	/* Parse command-line arguments */
+	opterr = 0;			/* Don't want getopt() writing to
+					 * stderr */
+	oldoptind = optind;		/* Initialize "last argument"
+					 * index.
+					 */
+	while ((arg = getopt(argc, argv, ":hVD:t:a:n:u:i:l:b:L:k:s:wd:"))
+	       != -1)
+	{
+		switch (arg)
+		{
+		    case 'h':	/* -h: Print usage message and exit */
+			usage(argc, argv);
+			exit(0);
+
+		    case 'V':	/* -V: Print version number and exit */
+			print_version();
+			exit(0);
+
+		    case 'D':	/* -D <dir>: Serve the databases in <dir> */
+			dbdir = optarg;
+			break;
+
+		    case 't':	/* -t <transport>: How to reach the
+				 * desktop */
+			if (strcasecmp(optarg, "net") == 0)
+				transport = EMU_NET;
+			else if (strcasecmp(optarg, "pty") == 0)
+				transport = EMU_PTY;
+			else if (strcasecmp(optarg, "pair") == 0)
+				transport = EMU_PAIR;
+			else {
+				fprintf(stderr,
+					_("Unknown transport: \"%s\".\n"),
+					optarg);
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+
+		    case 'a':	/* -a <addr>: NetSync server address */
+			hostaddr = optarg;
+			break;
+
+		    case 'n':	/* -n <count>: Number of syncs */
+			num_syncs = atoi(optarg);
+			break;
+
+		    case 'u':	/* -u <name>: User name */
+			strncpy(user.username, optarg,
+				DLPCMD_USERNAME_LEN-1);
+			user.username[DLPCMD_USERNAME_LEN-1] = '\0';
+			break;
+
+		    case 'i':	/* -i <id>: User ID */
+			user.userid = strtoul(optarg, NULL, 0);
+			break;
+
+		    case 'l':	/* -l <msecs>: Latency */
+			fault.latency = atol(optarg) * 1000L;
+			break;
+
+		    case 'b':	/* -b <bytes/sec>: Bandwidth */
+			fault.bandwidth = atol(optarg);
+			break;
+
+		    case 'L':	/* -L <percent>: Packet loss */
+			fault.loss = atoi(optarg);
+			break;
+
+		    case 'k':	/* -k <count>: Hang up after <count>
+				 * requests */
+			fault.hangup = atoi(optarg);
+			break;
+
+		    case 's':	/* -s <seed>: Seed for packet loss */
+			srand((unsigned int) strtoul(optarg, NULL, 0));
+			break;
+
+		    case 'w':	/* -w: Save changes */
+			writeback = True;
+			break;
+
+		    case 'd':	/* -d <level>: Set debugging level */
+			emu_trace = atoi(optarg);
+			break;
+
+		    case ':':	/* An argument required an option, but none
+				 * was given (e.g., "-u" instead of "-u
+				 * daemon").
+				 */
+			fprintf(stderr,
+				_("Missing option argument after \"%s\".\n"),
+				argv[oldoptind]);
+			usage(argc, argv);
+			exit(1);
+
+		    default:	/* Unknown option */
+			fprintf(stderr, _("Unrecognized option: \"%s\".\n"),
+				argv[oldoptind]);
+			usage(argc, argv);
+			exit(1);
+		}
+
+		oldoptind = optind;	/* Update for next iteration */
+	}
+	if (optind < argc)
+		command = argv + optind;
+
+	if (dbdir == NULL)
+	{
+		fprintf(stderr, _("No database directory given.\n"));
+		usage(argc, argv);
+		exit(1);
+	}
+#if !HAVE_GRANTPT
+	if (transport == EMU_PTY)
+	{
+		fprintf(stderr, _("This system doesn't have pseudo-ttys.\n"));
+		exit(1);
+	}
+#endif	/* HAVE_GRANTPT */
+	if (fault.loss > 0 && transport != EMU_PTY)
+	{
+		/* Only SLP recovers from lost packets. Over a stream,
+		 * dropping a write would just corrupt the session.
+		 */
+		fprintf(stderr, _("Warning: packet loss only applies to "
+				  "the \"pty\" transport. Ignored.\n"));
+		fault.loss = 0;
+	}
+
+	report = stdout;
+	if (load_dbs(dbdir) < 0)
+		exit(1);
+	EMU_TRACE(1)
+		fprintf(stderr, "Serving %d databases from %s\n",
+			num_dbs, dbdir);
+
+	/* A dead desktop shouldn't kill us before we can report it */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 1; i <= num_syncs; i++)
+		if ((err = run_sync(i)) < 0)
+			break;
+
+	EMU_TRACE(1)
+	{
+		fprintf(stderr, "DLP requests:\n");
+		for (cmd = emu_cmds; cmd->name != NULL; cmd++)
+			if (cmd->count > 0)
+				fprintf(stderr, "\t%-30s %ld\n",
+					cmd->name, cmd->count);
+	}
+
+	/* Save whatever is still dirty, e.g., databases that were left
+	 * open at the end of the sync.
+	 */
+	if (writeback)
+		for (i = 0; i < num_dbs; i++)
+			if (dbs[i]->dirty)
+				save_db(dbs[i]);
+
+	exit(err < 0 ? 1 : 0);
+}
+
+void
+usage(int argc, char *argv[])
+{
+	/* One string per option, like coldsync's usage_msg[]: this keeps
+	 * each string under the 509 characters that C89 guarantees, and
+	 * makes life easier for translators.
+	 */
+	const char *usage_msg[] = {
+		N_("Options:\n"),
+		N_("\t-h:\t\tPrint this usage message and exit.\n"),
+		N_("\t-V:\t\tPrint version and exit.\n"),
+		N_("\t-D <dir>:\tServe the .pdb and .prc files in <dir>.\n"),
+		N_("\t-t <transport>:\tHow to reach the desktop "
+		   "[net|pty|pair].\n"),
+		N_("\t-a <addr>:\tNetSync server address "
+		   "(default 127.0.0.1).\n"),
+		N_("\t-n <count>:\tServe <count> syncs (default 1).\n"),
+		N_("\t-u <name>:\tUser name.\n"),
+		N_("\t-i <id>:\tUser ID.\n"),
+		N_("\t-l <msecs>:\tAdd <msecs> of latency to each packet.\n"),
+		N_("\t-b <bytes>:\tLimit bandwidth to <bytes> per second.\n"),
+		N_("\t-L <percent>:\tDrop <percent>% of packets (pty only).\n"),
+		N_("\t-k <count>:\tHang up after <count> requests.\n"),
+		N_("\t-s <seed>:\tSeed the packet loss generator.\n"),
+		N_("\t-w:\t\tWrite changes back to <dir>.\n"),
+		N_("\t-d <level>:\tSet debugging level.\n"),
+		NULL
+	};
+	int i;
+
+	printf(_("Usage: %s [options] -D <dir> [--] [command ...]\n"),
+	       argv[0]);
+	for (i = 0; usage_msg[i] != NULL; i++)
+		printf("%s", _(usage_msg[i]));
+}
+
+void
+print_version(void)
+{
+	printf(_("palmemu, part of %s version %s\n"),
+	       PACKAGE, VERSION);
+}
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
@@ -478,6 +478,15 @@ EndConduit returns zero on success.
 
 # EndConduit
 sub EndConduit
+{
+	&FinishConduit(@_);
+	exit 0;
+}
+
+# FinishConduit
+# Does the work of EndConduit, but doesn't exit. Persistent conduits
+# use this at the end of each database.
+sub FinishConduit
 {
 	my ($status,$msg) = @_;
 	($status,$msg) = (202,'Success!') if @_ < 2;
@@ -500,7 +509,7 @@ sub EndConduit
 	}
 
 	print STDOUT "$status $msg\n";
-	exit 0;
+	return 0;
 }
 
 =item ConduitMain(I<flavor> => \&I<function>, ...)
@@ -522,6 +531,16 @@ that all of the mandatory headers were given.
 It then calls the flavor-specific function given in the arguments, and
 finally cleans up in the same way as EndConduit().
 
+If the conduit is declared C<persistent> in F<.coldsyncrc>, ColdSync
+starts it only once per sync, and sends it a fresh set of headers
+(including C<Persistent: 1>) for each database. ConduitMain() handles
+this by calling the flavor-specific function once for each set of
+headers, with C<%HEADERS>, C<%PREFERENCES> and C<$PDB> set up anew
+each time, and exiting when ColdSync closes its standard input. Global
+variables in the conduit keep their values from one database to the
+next. Conduits written with StartConduit() and EndConduit() are run
+once per database, as usual.
+
 If the program is run not as a conduit but as a standalone program,
 ConduitMain() supports the C<-config> option: when this option is
 given, the program prints to STDOUT a set of sample configuration
@@ -587,6 +606,42 @@ sub ConduitMain
 		ReadHeaders;
 	}
 
+	if ($ARGV[0] eq "conduit" and $HEADERS{Persistent})
+	{
+		# ColdSync waits for the status of each database, so
+		# don't let it sit in a buffer.
+		$| = 1;
+
+		while (1)
+		{
+			# If the handler dies, the __DIE__ hook has
+			# already printed its status.
+			eval { &RunHandler($handler); };
+
+			# An empty line says we're done with this database
+			print STDOUT "\n";
+
+			# End of file means there are no more databases
+			last if eof(STDIN);
+			%HEADERS = ();
+			@HEADERS = ();
+			%PREFERENCES = ();
+			ReadHeaders;
+		}
+		exit 0;
+	}
+
+	&RunHandler($handler);
+	exit 0;
+}
+
+# RunHandler
+# Load the input database, call the flavor-specific function, and clean
+# up.
+sub RunHandler
+{
+	my $handler = shift;
+
 	# Read the input database, if one was specified. Note that the file
 	# won't exist if if wasn't already created by a fetch conduit or
 	# the generic sync/backup.
@@ -613,7 +668,7 @@ sub ConduitMain
 
 	&{$handler} or die "501 Conduit failed\n";
 
-	&EndConduit();
+	&FinishConduit();
 }
 
 1;
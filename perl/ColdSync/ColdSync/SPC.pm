@@ -50,7 +50,8 @@ Protocol (SPC) requests in ColdSync conduits.
 use ColdSync;
 use Exporter;
 
-use vars qw( $VERSION @ISA *SPC @EXPORT %EXPORT_TAGS );
+use vars qw( $VERSION @ISA *SPC *SPCSHM $shm_size $no_batch @EXPORT
+	%EXPORT_TAGS );
 
 # One liner, to allow MakeMaker to work.
 $VERSION = do { my @r = (q$Revision: 1.30 $ =~ /\d+/g); sprintf "%d."."%02d" x $#r, @r };
@@ -62,6 +63,9 @@ use constant SPCOP_NOP		=> 0;
 use constant SPCOP_DBINFO	=> 1;
 use constant SPCOP_DLPC		=> 2;
 use constant SPCOP_DLPR		=> 3;
+use constant SPCOP_BATCH	=> 4;
+use constant SPCOP_SHM		=> 0x4000;	# Flag: data is in shared
+						# memory
 
 use constant SPCERR_OK		=> 0;
 use constant SPCERR_BADOP	=> 1;
@@ -203,10 +207,12 @@ use constant DLPCMD_ReadRecordStream			=> 0x61;
 
 @EXPORT = qw( spc_req *SPC
 	dlp_req
+	dlp_batch
 	dlp_version
 	spc_get_dbinfo
 	spc_recv
 	spc_send
+	spc_batch
 	dlp_ReadSysInfo
 	dlp_OpenDB
 	dlp_CreateDB
@@ -222,6 +228,7 @@ use constant DLPCMD_ReadRecordStream			=> 0x61;
 	dlp_WriteUserInfo
 	dlp_ReadRecordByIndex
 	dlp_ReadRecordById
+	dlp_ReadRecordsByIndex
 	dlp_AddSyncLogEntry
 	dlp_DeleteRecord
 	dlp_DeleteAllRecords
@@ -253,6 +260,59 @@ sub spc_init
 	select SPC;
 	$| = 1;
 	select $old_selected;
+
+	# Assume ColdSync understands SPCOP_BATCH until it says
+	# otherwise.
+	undef $no_batch;
+
+	# If ColdSync set up shared memory for request and response
+	# data, use it.
+	undef $shm_size;
+	if (defined $HEADERS{SPCShm} and defined $HEADERS{SPCShmSize} and
+	    open SPCSHM, "+<&$HEADERS{SPCShm}")
+	{
+		binmode SPCSHM;
+		$shm_size = $HEADERS{SPCShmSize};
+	}
+}
+
+# shm_write
+# Write data to the start of the shared memory region.
+# This goes through the file descriptor with syswrite() rather than
+# mmap(), so the data is still copied; what we save is pushing it
+# through the SPC pipe.
+sub shm_write
+{
+	my $data = shift;
+	my $off = 0;
+	my $n;
+
+	sysseek SPCSHM, 0, 0 or return 0;
+	while ($off < length($data))
+	{
+		$n = syswrite SPCSHM, $data, length($data) - $off, $off;
+		return 0 if !defined($n) or $n == 0;
+		$off += $n;
+	}
+	return 1;
+}
+
+# shm_read
+# Read $len bytes from the shared memory region, starting at $offset.
+sub shm_read
+{
+	my $offset = shift;
+	my $len = shift;
+	my $buf = "";
+	my $n;
+
+	sysseek SPCSHM, $offset, 0 or return undef;
+	while (length($buf) < $len)
+	{
+		$n = sysread SPCSHM, $buf, $len - length($buf), length($buf);
+		return undef if !defined($n) or $n == 0;
+	}
+	return $buf;
 }
 
 # spc_send
@@ -269,9 +329,18 @@ sub spc_req
 #	print "spc_req, Header:\n";
 #	print sprintf "OP    : %02x\n", $op;
 
-	# Send the SPC request: header and data
-	$header = pack("n x2 N", $op, length($data));
-	print SPC $header, $data;
+	# Send the SPC request: header and data. If there's shared
+	# memory, the data goes there, and the header is followed by
+	# its offset and length.
+	if (defined $shm_size and length($data) <= $shm_size and
+	    &shm_write($data))
+	{
+		$header = pack("n x2 N", $op | SPCOP_SHM, 8);
+		print SPC $header, pack("N N", 0, length($data));
+	} else {
+		$header = pack("n x2 N", $op, length($data));
+		print SPC $header, $data;
+	}
 
 	# Read the reply
 	my $buf;
@@ -295,6 +364,16 @@ sub spc_req
 		read SPC, $buf, $len;
 	}
 
+	# If it's in shared memory, what we just read says where.
+	if ($op & SPCOP_SHM)
+	{
+		my $offset;
+
+		($offset, $len) = unpack("N N", $buf);
+		$buf = &shm_read($offset, $len);
+		return undef if !defined($buf);
+	}
+
 	return ($status, $buf, $len);
 }
 
@@ -326,6 +405,57 @@ sub spc_send
 	spc_req(SPCOP_DLPC, $data);
 }
 
+# spc_batch
+# Send several raw DLP requests in a single SPCOP_BATCH request, and
+# return the list of raw responses, in the same order. A request that
+# got no response gets undef.
+sub spc_batch
+{
+	my @reqs = @_;		# Raw DLP requests
+	my $data = "";		# Request data
+	my @retval;
+
+	return () if $#reqs < 0;
+
+	# Older versions of ColdSync don't know about SPCOP_BATCH. Send
+	# the requests one at a time.
+	if ($no_batch)
+	{
+		foreach my $req (@reqs)
+		{
+			my ($status, $resp) = spc_req(SPCOP_DLPC, $req);
+			push @retval, $resp;
+		}
+		return @retval;
+	}
+
+	# Each entry is tagged with its index in @reqs
+	for (my $i = 0; $i <= $#reqs; $i++)
+	{
+		$data .= pack("n x2 N", $i, length($reqs[$i])) . $reqs[$i];
+	}
+
+	my ($status, $buf, $len) = spc_req(SPCOP_BATCH, $data);
+	if (!defined($status))
+	{
+		$no_batch = 1;
+		return &spc_batch(@reqs);
+	}
+
+	# Pick the responses out of the reply
+	$#retval = $#reqs;
+	while (defined($buf) and length($buf) >= 8)
+	{
+		my ($tag, $estatus, $elen) = unpack("n n N", $buf);
+
+		$retval[$tag] = substr($buf, 8, $elen)
+			if $estatus == SPCERR_OK and $tag <= $#reqs;
+		$buf = substr($buf, 8 + $elen);
+	}
+
+	return @retval;
+}
+
 =head1 FUNCTIONS
 
 =head2 dlp_version
@@ -380,22 +510,70 @@ sub dlp_req
 	my $cmd = shift;	# DLP command
 	my @args = @_;		# All other arguments are DLP arguments
 
-	my $dlp_req;		# DLP request data
-
-	# Construct DLP header
-	$dlp_req = pack("C C", $cmd, $#_+1);
-
-	# Pack DLP arguments
-	$dlp_req .= pack_dlp_args(@args);
-
 	# Send it as an SPCOP_DLPC request
 	my $status;
 	my $data;
-	($status, $data) = spc_req(SPCOP_DLPC, $dlp_req);
+	($status, $data) = spc_req(SPCOP_DLPC, pack_dlp_req($cmd, @args));
 
 	return undef if !defined($status);
 
-	# Read results
+	return unpack_dlp_resp($data);
+}
+
+=head2 dlp_batch
+
+    @results = dlp_batch([$reqno, @args], [$reqno, @args], ...)
+
+Sends several DLP requests at once. Each argument is a reference to an
+array holding the arguments that would be passed to C<dlp_req>.
+ColdSync sends the requests to the Palm one after the other, without
+waiting for the conduit in between, which is much faster than calling
+C<dlp_req> in a loop when there are many requests to send.
+
+Returns a list with one element per request, in the same order. Each
+element is a reference to an array holding what C<dlp_req> would have
+returned: C<[$err, @argv]>. If a request failed altogether, its element
+is C<undef>.
+
+Since all of the requests are sent before any of the responses are
+examined, a request can't depend on the result of an earlier one in
+the same batch.
+
+=cut
+
+# dlp_batch
+# Send several DLP requests over SPC, in one batch.
+sub dlp_batch
+{
+	my @reqs = map { pack_dlp_req(@$_) } @_;
+	my @retval;
+
+	foreach my $resp (&spc_batch(@reqs))
+	{
+		push @retval, (defined($resp) ?
+			       [ unpack_dlp_resp($resp) ] : undef);
+	}
+
+	return @retval;
+}
+
+# pack_dlp_req
+# Takes a DLP command number and a set of arguments, as for dlp_req(),
+# and returns the raw DLP request.
+sub pack_dlp_req
+{
+	my $cmd = shift;	# DLP command
+	my @args = @_;		# DLP arguments
+
+	# DLP header, then the arguments
+	return pack("C C", $cmd, $#args+1) . pack_dlp_args(@args);
+}
+
+# unpack_dlp_resp
+# Takes a raw DLP response, and returns ($err, @argv), as for dlp_req().
+sub unpack_dlp_resp
+{
+	my $data = shift;
 
 	my ($code, $argc, $errno) = unpack("C C n", $data);
 			# $code should be $cmd | 0x80, but I'm not checking.
@@ -1328,6 +1506,41 @@ sub dlp_ReadRecordByIndex
 	return _dlp_ReadRecord(0, $dbh, $index, $offset, $numbytes);
 }
 
+=head2 dlp_ReadRecordsByIndex
+
+	@records = dlp_ReadRecordsByIndex($dbh, $first, $count);
+
+Reads the C<$count> records starting at index C<$first> in the database
+associated with the database handle C<$dbh>, using a single batch of
+DLP requests (see C<dlp_batch>). Returns a list of references to hashes,
+in the same format as C<dlp_ReadRecordByIndex>. Records that couldn't be
+read are returned as C<undef>.
+
+=cut
+#'
+
+sub dlp_ReadRecordsByIndex
+{
+	my $dbh		= shift;	# Database handle
+	my $first	= shift;	# Index of first record
+	my $count	= shift;	# Number of records to read
+	my @reqs;
+
+	for (my $i = $first; $i < $first + $count; $i++)
+	{
+		push @reqs, [ DLPCMD_ReadRecord,
+			      {
+				      id	=> dlpFirstArgID+1,
+				      data	=> pack("C x n n n",
+							$dbh, $i, 0, -1),
+			      } ];
+	}
+
+	return map { defined($_) && $_->[0] == dlpRespErrNone ?
+			     _unpackRecord(@$_[1..$#$_]) : undef }
+		&dlp_batch(@reqs);
+}
+
 sub _dlp_ReadRecord
 {
 	my $readbyid	= shift;	# Read record (1: by id, 0: by index)
@@ -13,8 +13,10 @@
 #include <stdio.h>
 #include <stdlib.h>		/* For malloc() */
 #include <fcntl.h>		/* For open() */
+#include <unistd.h>		/* For link(), unlink() */
 #include <string.h>		/* For strncpy(), strncat() */
 #include <ctype.h>		/* For isprint() */
+#include <errno.h>		/* For errno */
 
 #if HAVE_LIBINTL_H
 #  include <libintl.h>		/* For i18n */
@@ -25,8 +27,37 @@
 #include "coldsync.h"
 #include "cs_error.h"
 
-static int download_resources(PConnection *pconn, ubyte dbh, struct pdb *db);
-static int download_records(PConnection *pconn, ubyte dbh, struct pdb *db);
+/* Resumable backups
+ * A database that is being backed up is written to "<backup file>.part"
+ * as it is downloaded. This is an ordinary .pdb (or .prc) file in the
+ * making: each record's or resource's index entry is written along with
+ * its data (see pdb_WriteStart()). If the connection is lost, the file is
+ * left behind, and the next backup of the same database picks up where
+ * this one left off instead of starting over (see pdb_WriteResume()).
+ * Once the database is complete, the file is renamed to the backup file.
+ */
+
+static struct pdb *fetch_database(PConnection *pconn,
+				  const struct dlp_dbinfo *dbinfo,
+				  ubyte dbh,
+				  int outfd);
+static udword *read_recids(PConnection *pconn, ubyte dbh,
+			   const uword totalrecs);
+static int download_resources(PConnection *pconn, ubyte dbh, struct pdb *db,
+			      uword first,
+			      struct pdb_writer *out);
+static int download_records(PConnection *pconn, ubyte dbh, struct pdb *db,
+			    const udword *recids,
+			    uword first,
+			    struct pdb_writer *out);
+static int add_resource(struct pdb *db, struct pdb_writer *out,
+			struct pdb_resource *rsrc);
+static int add_record(struct pdb *db, struct pdb_writer *out,
+		      struct pdb_record *rec);
+static Bool ref_is_current(const struct dlp_dbinfo *dbinfo,
+			   char *reffname,
+			   uword *numrecs);
+static int reuse_backup(const char *reffname, const char *bakfname);
 
 /* download_database
  * Download a database from the Palm. The returned 'struct pdb' is
@@ -36,9 +67,32 @@ struct pdb *
 download_database(PConnection *pconn,
 		  const struct dlp_dbinfo *dbinfo,
 		  ubyte dbh)		/* Database handle */
+{
+	return fetch_database(pconn, dbinfo, dbh, -1);
+}
+
+/* fetch_database
+ * Does the work of download_database(). If 'outfd' is -1, the records or
+ * resources are kept in the returned 'struct pdb'. Otherwise, the
+ * database is written to 'outfd' as it is downloaded, and only its header
+ * (and AppInfo and sort blocks) are returned, so that a large database
+ * never has to fit in memory all at once. In that case, 'outfd' may hold
+ * what an earlier, interrupted download of the same database left
+ * behind, and only the rest is downloaded.
+ */
+static struct pdb *
+fetch_database(PConnection *pconn,
+	       const struct dlp_dbinfo *dbinfo,
+	       ubyte dbh,		/* Database handle */
+	       int outfd)		/* File to write to, or -1 */
 {
 	int err;
 	struct pdb *retval;
+	struct pdb_writer *out = NULL;
+				/* Writes the database to 'outfd' */
+	udword *recids = NULL;	/* Record IDs, for record databases */
+	uword done = 0;		/* # of records or resources that an
+				 * earlier download already wrote */
 	const ubyte *rptr;	/* Pointer into buffers, for reading */
 		/* These next two variables are here mainly to make the
 		 * types come out right.
@@ -215,11 +269,52 @@ download_database(PConnection *pconn,
 		return NULL;
 	}
 
+	/* A record database's record IDs are needed to tell whether an
+	 * earlier download can be picked up.
+	 */
+	if (!DBINFO_ISRSRC(dbinfo) && retval->numrecs > 0 &&
+	    (recids = read_recids(pconn, dbh, retval->numrecs)) == NULL)
+	{
+		DlpCloseDB(pconn, dbh, 0);	/* Don't really care if this fails */
+		free_pdb(retval);
+		return NULL;
+	}
+
+	/* Everything up to the first record is known now, so if we're
+	 * streaming, it can go out.
+	 */
+	if (outfd >= 0 &&
+	    (out = pdb_WriteResume(retval, outfd, recids, &done)) == NULL)
+	{
+		Error(_("%s: Can't write database header."),
+		      "download_database");
+		DlpCloseDB(pconn, dbh, 0);	/* Don't really care if this fails */
+		if (recids != NULL)
+			free(recids);
+		free_pdb(retval);
+		return NULL;
+	}
+	if (done > 0)
+		Verbose(1, _("Resuming backup of \"%s\" at %d of %d"),
+			retval->name, done, retval->numrecs);
+
 	/* Download the records/resources */
 	if (DBINFO_ISRSRC(dbinfo))
-		err = download_resources(pconn, dbh, retval);
+		err = download_resources(pconn, dbh, retval, done, out);
 	else
-		err = download_records(pconn, dbh, retval);
+		err = download_records(pconn, dbh, retval, recids, done, out);
+	if (recids != NULL)
+		free(recids);
+	if (out != NULL)
+	{
+		if (err < 0)
+			/* The file can be picked up again next time */
+			pdb_WriteAbort(out);
+		else if ((err = pdb_WriteEnd(out)) < 0)
+			Error(_("%s: \"%s\": Didn't get all of the records "
+				"or resources."),
+			      "download_database", dbinfo->name);
+	}
 	SYNC_TRACE(7)
 		fprintf(stderr,
 			"After download_{resources,records}; err == %d\n",
@@ -255,7 +350,9 @@ download_database(PConnection *pconn,
 static int
 download_resources(PConnection *pconn,
 		   ubyte dbh,
-		   struct pdb *db)
+		   struct pdb *db,
+		   uword first,			/* First one to download */
+		   struct pdb_writer *out)	/* Output file, or NULL */
 {
 	int i;
 	int err;
@@ -270,8 +367,10 @@ download_resources(PConnection *pconn,
 					 * name of convenience.
 					 */
 
-	/* Read each resource in turn */
-	for (i = 0; i < totalrsrcs; i++)
+	/* Read each resource in turn, skipping those that a previous,
+	 * interrupted backup already got.
+	 */
+	for (i = first; i < totalrsrcs; i++)
 	{
 		struct pdb_resource *rsrc;	/* The new resource */
 		struct dlp_resource resinfo;	/* Resource info will be
@@ -316,8 +415,10 @@ download_resources(PConnection *pconn,
 				debug_dump(stderr, "RSRC", rsrc->data, rsrc->data_len);
 
 			/* Append the resource to the database */
-			pdb_AppendResource(db, rsrc);	/* XXX - Error-checking */
+			err = add_resource(db, out, rsrc);
 			db->numrecs = totalrsrcs;	/* Kludge */
+			if (err < 0)
+				return -1;
 		}
 		else
 		{
@@ -329,37 +430,19 @@ download_resources(PConnection *pconn,
 	return 0;	/* Success */
 }
 
-static int
-download_records(PConnection *pconn,
-		 ubyte dbh,
-		 struct pdb *db)
+/* read_recids
+ * Read the list of IDs of the 'totalrecs' records in the open database
+ * 'dbh'. Returns a newly-allocated array, which the caller has to free,
+ * or NULL in case of error.
+ */
+static udword *
+read_recids(PConnection *pconn,
+	    ubyte dbh,
+	    const uword totalrecs)
 {
-	int i;
 	int err;
 	udword *recids;		/* Array of record IDs */
 	uword numrecs;		/* # record IDs actually read */
-	uword totalrecs;	/* The real number of records in the
-				 * database.
-				 */
-
-	totalrecs = db->numrecs;	/* Get the number of records in the
-					 * database. It is necessary to
-					 * remember this here because
-					 * pdb_AppendRecord() increments
-					 * db->numrecs in the name of
-					 * convenience.
-					 */
-
-	/* Handle the easy case first: if there aren't any records, don't
-	 * bother asking for their IDs.
-	 */
-	if (totalrecs == 0)
-	{
-		/* No records */
-		db->rec_index.rec = NULL;
-
-		return 0;
-	}
 
 	/* Allocate the array of record IDs.
 	 * This is somewhat brain-damaged: ideally, we'd like to just read
@@ -373,7 +456,7 @@ download_records(PConnection *pconn,
 	    == NULL)
 	{
 		fprintf(stderr, _("Can't allocate list of record IDs.\n"));
-		return -1;
+		return NULL;
 	}
 
 	/* Read the list of record IDs. DlpReadRecordIDList() might not be
@@ -402,7 +485,7 @@ download_records(PConnection *pconn,
 			print_latest_dlp_error(pconn);
 			free(recids);
 			/* XXX - Set cs_errno */
-			return -1;
+			return NULL;
 		}
 
 		/* Sanity check */
@@ -411,14 +494,56 @@ download_records(PConnection *pconn,
 			fprintf(stderr, _("DlpReadRecordIDList() read 0 "
 					  "records. What happened?\n"));
 			free(recids);
-			return -1;
+			return NULL;
 		}
 
 		numrecs += num_read;
 	}
 
-	/* Read each record in turn */
-	for (i = 0; i < totalrecs; i++)
+	return recids;
+}
+
+/* download_records
+ * Download a record database's records from the Palm, and put them in
+ * 'db'. 'recids' is the list of their IDs, from read_recids().
+ */
+static int
+download_records(PConnection *pconn,
+		 ubyte dbh,
+		 struct pdb *db,
+		 const udword *recids,		/* Record IDs */
+		 uword first,			/* First one to download */
+		 struct pdb_writer *out)	/* Output file, or NULL */
+{
+	int i;
+	int err;
+	uword totalrecs;	/* The real number of records in the
+				 * database.
+				 */
+
+	totalrecs = db->numrecs;	/* Get the number of records in the
+					 * database. It is necessary to
+					 * remember this here because
+					 * pdb_AppendRecord() increments
+					 * db->numrecs in the name of
+					 * convenience.
+					 */
+
+	/* Handle the easy case first: if there aren't any records, there's
+	 * nothing to download ('recids' is NULL, too).
+	 */
+	if (totalrecs == 0)
+	{
+		/* No records */
+		db->rec_index.rec = NULL;
+
+		return 0;
+	}
+
+	/* Read each record in turn, skipping those that a previous,
+	 * interrupted backup already got.
+	 */
+	for (i = first; i < totalrecs; i++)
 	{
 		struct pdb_record *rec;		/* The new resource */
 		struct dlp_recinfo recinfo;	/* Record info will be read
@@ -438,7 +563,6 @@ download_records(PConnection *pconn,
 		{
 			Error(_("Can't read record %d."), i);
 			print_latest_dlp_error(pconn);
-			free(recids);
 			/* XXX - Set cs_errno */
 			return -1;
 		}
@@ -467,24 +591,172 @@ download_records(PConnection *pconn,
 			}
 
 			/* Append the record to the database */
-			pdb_AppendRecord(db, rec);	/* XXX - Error-checking */
+			err = add_record(db, out, rec);
 			db->numrecs = totalrecs;	/* Kludge */
+			if (err < 0)
+				return -1;
 		}
 		else
 		{
 			/* XXX - Print something */
-			free(recids);
 			return -1;
 		}
 	}
 
-	free(recids);
-
 	return 0;	/* Success */
 }
 
+/* add_resource
+ * Add a newly-downloaded resource to 'db' or, if 'out' isn't NULL, write
+ * it to the backup file and free it.
+ */
+static int
+add_resource(struct pdb *db,
+	     struct pdb_writer *out,
+	     struct pdb_resource *rsrc)
+{
+	int err;
+
+	if (out == NULL)
+		return pdb_AppendResource(db, rsrc);
+
+	err = pdb_WriteResource(out, rsrc);
+	pdb_FreeResource(rsrc);
+	return err;
+}
+
+/* add_record
+ * Add a newly-downloaded record to 'db' or, if 'out' isn't NULL, write it
+ * to the backup file and free it.
+ */
+static int
+add_record(struct pdb *db,
+	   struct pdb_writer *out,
+	   struct pdb_record *rec)
+{
+	int err;
+
+	if (out == NULL)
+		return pdb_AppendRecord(db, rec);
+
+	err = pdb_WriteRecord(out, rec);
+	pdb_FreeRecord(rec);
+	return err;
+}
+
+/* ref_is_current
+ * In an incremental backup, look for the previous backup of 'dbinfo' in
+ * 'global_opts.ref_backupdir'. If it exists and has the same modification
+ * number and modification time as the database on the Palm, returns True,
+ * puts the backup's pathname in 'reffname' (MAXPATHLEN+1 bytes) and the
+ * number of records it holds in '*numrecs'. Otherwise, returns False.
+ */
+static Bool
+ref_is_current(const struct dlp_dbinfo *dbinfo,
+	       char *reffname,
+	       uword *numrecs)
+{
+	int fd;
+	struct pdb ref;		/* Header of the previous backup */
+
+	strncpy(reffname, mkpdbname(global_opts.ref_backupdir, dbinfo, True),
+		MAXPATHLEN);
+	reffname[MAXPATHLEN] = '\0';
+
+	if ((fd = open(reffname, O_RDONLY | O_BINARY)) < 0)
+	{
+		SYNC_TRACE(3)
+			fprintf(stderr, "No previous backup of \"%s\"\n",
+				dbinfo->name);
+		return False;
+	}
+	if (pdb_LoadHeader(fd, &ref) < 0 ||
+	    pdb_LoadRecListHeader(fd, &ref) < 0)
+	{
+		close(fd);
+		return False;
+	}
+	close(fd);
+
+	SYNC_TRACE(3)
+		fprintf(stderr, "\"%s\": modnum %ld/%ld, mtime %ld/%ld\n",
+			dbinfo->name,
+			dbinfo->modnum, ref.modnum,
+			time_dlp2palmtime(&dbinfo->mtime), ref.mtime);
+
+	if (ref.modnum != dbinfo->modnum ||
+	    ref.mtime != time_dlp2palmtime(&dbinfo->mtime))
+		return False;
+
+	*numrecs = ref.numrecs;
+	return True;
+}
+
+/* reuse_backup
+ * Put the previous backup 'reffname' in the new backup set as
+ * 'bakfname', instead of downloading the database again. This is a hard
+ * link if possible, and a copy otherwise (e.g., if the two backup
+ * directories are on different filesystems).
+ */
+static int
+reuse_backup(const char *reffname,
+	     const char *bakfname)
+{
+	int infd;
+	int outfd;
+	int len;
+	static char buf[8192];
+
+	if (link(reffname, bakfname) == 0)
+		return 0;
+
+	SYNC_TRACE(3)
+		fprintf(stderr, "Can't link \"%s\" (%s). Copying it.\n",
+			reffname, strerror(errno));
+
+	if ((infd = open(reffname, O_RDONLY | O_BINARY)) < 0)
+	{
+		Error(_("%s: Can't open \"%s\"."),
+		      "reuse_backup", reffname);
+		Perror("open");
+		return -1;
+	}
+	if ((outfd = open(bakfname, O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+			  0600)) < 0)
+	{
+		Error(_("%s: can't create new backup file %s.\n"
+			"It may already exist."),
+		      "reuse_backup", bakfname);
+		Perror("open");
+		close(infd);
+		return -1;
+	}
+
+	while ((len = read(infd, buf, sizeof(buf))) > 0)
+		if (write(outfd, buf, len) != len)
+		{
+			len = -1;
+			break;
+		}
+	close(infd);
+	if (len < 0 || close(outfd) < 0)
+	{
+		Error(_("%s: Can't copy \"%s\" to \"%s\"."),
+		      "reuse_backup", reffname, bakfname);
+		Perror("write");
+		unlink(bakfname);
+		return -1;
+	}
+
+	return 0;
+}
+
 /* XXX - Temporary name */
-/* Back up a single file */
+/* Back up a single file.
+ * If 'global_opts.ref_backupdir' is set, this is an incremental backup:
+ * if the database hasn't changed since it was backed up there, the old
+ * backup is reused instead of downloading the database again.
+ */
 int
 backup(PConnection *pconn,
        const struct dlp_dbinfo *dbinfo,
@@ -495,9 +767,21 @@ backup(PConnection *pconn,
 	int bakfd;			/* Backup file descriptor */
 	struct pdb *pdb;		/* Database downloaded from Palm */
 	ubyte dbh;			/* Database handle (on Palm) */
+	char reffname[MAXPATHLEN+1];	/* Previous backup of the database */
+	uword ref_numrecs;		/* # of records in previous backup */
+	Bool unchanged = False;		/* Previous backup still current? */
+	char partfname[MAXPATHLEN+1];	/* Partial backup file */
+	int partfd;			/* Partial backup file descriptor */
+
+	/* Check the previous backup first: mkpdbname() returns a static
+	 * buffer.
+	 */
+	if (global_opts.ref_backupdir != NULL)
+		unchanged = ref_is_current(dbinfo, reffname, &ref_numrecs);
 
 	bakfname = mkpdbname(dirname, dbinfo, True);
 				/* Construct the backup file name */
+	snprintf(partfname, sizeof(partfname), "%s.part", bakfname);
 
 	Verbose(1, _("Backing up \"%s\""), dbinfo->name);
 
@@ -565,8 +849,54 @@ backup(PConnection *pconn,
 		return -1;
 	}
 
-	/* Download the database from the Palm */
-	pdb = download_database(pconn, dbinfo, dbh);
+	if (unchanged)
+	{
+		struct dlp_opendbinfo opendbinfo;
+
+		/* The modification number and time match. As a last
+		 * check, make sure that the number of records does, too.
+		 */
+		err = DlpReadOpenDBInfo(pconn, dbh, &opendbinfo);
+		if (err == (int) DLPSTAT_NOERR &&
+		    opendbinfo.numrecs == ref_numrecs)
+		{
+			DlpCloseDB(pconn, dbh, 0);
+			close(bakfd);
+			unlink(bakfname);	/* Delete the zero-length
+						 * backup file */
+
+			Verbose(2, _("\"%s\" is unchanged"), dbinfo->name);
+			unlink(partfname);	/* In case an earlier
+						 * backup was interrupted */
+			err = reuse_backup(reffname, bakfname);
+			va_add_to_log(pconn, "%s %s - %s\n",
+				      _("Backup"), dbinfo->name,
+				      err < 0 ? _("Error") : _("OK"));
+			return err;
+		}
+		SYNC_TRACE(3)
+			fprintf(stderr, "\"%s\": record count changed\n",
+				dbinfo->name);
+	}
+
+	/* Download the database from the Palm, writing it to the partial
+	 * backup file as it comes in, or picking up where an earlier
+	 * backup left off.
+	 */
+	if ((partfd = open(partfname, O_RDWR | O_CREAT | O_BINARY,
+			   0600)) < 0)
+	{
+		Error(_("%s: Can't open \"%s\"."),
+		      "backup", partfname);
+		Perror("open");
+		DlpCloseDB(pconn, dbh, 0);
+		close(bakfd);
+		unlink(bakfname);
+		va_add_to_log(pconn, "%s %s - %s\n",
+			      _("Backup"), dbinfo->name, _("Error"));
+		return -1;
+	}
+	pdb = fetch_database(pconn, dbinfo, dbh, partfd);
 	if (pdb == NULL)
 	{
 		/* Error downloading the file.
@@ -575,8 +905,9 @@ backup(PConnection *pconn,
 		 * was lost.
 		 */
 		err = DlpCloseDB(pconn, dbh, 0);
-		unlink(bakfname);	/* Delete the zero-length backup
-					 * file */
+		close(partfd);		/* The partial backup file stays,
+					 * for next time. */
+		unlink(bakfname);	/* Delete the empty backup file */
 		close(bakfd);
 		va_add_to_log(pconn, "%s %s - %s\n",
 			      _("Backup"), dbinfo->name, _("Error"));
@@ -588,16 +919,18 @@ backup(PConnection *pconn,
 	SYNC_TRACE(7)
 		fprintf(stderr, "After DlpCloseDB\n");
 
-	/* Write the database to the backup file */
-	err = pdb_Write(pdb, bakfd);
-	if (err < 0)
+	/* The database is complete. Put it in place of the (empty) backup
+	 * file.
+	 */
+	if (close(partfd) < 0 ||
+	    rename(partfname, bakfname) < 0)
 	{
-		Error(_("%s: can't write database \"%s\" to \"%s\"."),
-		      "backup",
-		      dbinfo->name, bakfname);
-		err = DlpCloseDB(pconn, dbh, 0);
+		Error(_("%s: Can't rename \"%s\" to \"%s\"."),
+		      "backup", partfname, bakfname);
+		Perror("rename");
 		free_pdb(pdb);
 		close(bakfd);
+		unlink(bakfname);
 		va_add_to_log(pconn, "%s %s - %s\n",
 			      _("Backup"), dbinfo->name, _("Error"));
 		return -1;
@@ -98,6 +98,10 @@ main(int argc, char *argv[])
 	global_opts.install_first	= Undefined;	/* Defaults to True */
 	global_opts.verbosity		= 0;
 	global_opts.listen_name		= NULL;
+	global_opts.ref_backupdir	= NULL;
+	global_opts.incremental_restore	= False;
+	global_opts.dump_jobs		= 1;
+	global_opts.prefetch		= False;
 	global_opts.autoinit		= Undefined;	/* Default to False */
 
 	/* Initialize the debugging levels to 0 */
@@ -291,6 +295,9 @@ main(int argc, char *argv[])
 		    case mode_Info:
 			fprintf(stderr, "Info\n");
 			break;
+		    case mode_Profile:
+			fprintf(stderr, "Profile\n");
+			break;
 		    default:
 			fprintf(stderr, "* UNKNOWN *\n");
 			break;
@@ -321,6 +328,10 @@ main(int argc, char *argv[])
 			Bool3str(global_opts.autoinit));
 		fprintf(stderr, "\tuse_syslog: %s\n",
 			global_opts.use_syslog ? "True" : "False");
+		fprintf(stderr, "\tdump_jobs: %d\n",
+			global_opts.dump_jobs);
+		fprintf(stderr, "\tprefetch: %s\n",
+			global_opts.prefetch ? "True" : "False");
 		tmp = get_symbol("CS_LOGFILE");
 		fprintf(stderr, "\tlog_fname: \"%s\"\n",
 			(tmp == NULL ? "(null)" : tmp));
@@ -374,6 +385,9 @@ main(int argc, char *argv[])
 	    case mode_Info:
 		err = run_mode_Info(argc, argv);
 		break;
+	    case mode_Profile:
+		err = run_mode_Profile(argc, argv);
+		break;
 	    default:
 		/* This should never happen */
 		Error(_("Unknown mode: %d.\n"
@@ -69,7 +69,8 @@ typedef enum {
 				/* XXX - Still highly experimental. */
 	mode_Init,		/* Initialize a Palm */
 	mode_List,		/* List Palm databases */
-	mode_Info		/* Dump some info about the Palm */
+	mode_Info,		/* Dump some info about the Palm */
+	mode_Profile		/* Summarize the conduit history */
 } run_mode;
 
 /* cmd_opts Command-line options. This struct acts sort of like a C++
@@ -112,6 +113,21 @@ struct cmd_opts {
 				 */
 	char *listen_name;	/* Requested listen block name
 				 */				
+	char *ref_backupdir;	/* Previous backup, for incremental
+				 * backups: databases that haven't
+				 * changed since then are linked from
+				 * here instead of being downloaded.
+				 */
+	Bool incremental_restore;
+				/* If true, only restore databases that
+				 * differ from the copy on the Palm.
+				 */
+	int dump_jobs;		/* Max. # of databases whose Dump
+				 * conduits may run at the same time.
+				 */
+	Bool prefetch;		/* In daemon mode, run Fetch conduits
+				 * while waiting for the Palm.
+				 */
 };
 
 extern struct cmd_opts global_opts;	/* XXX - I'm not quite happy with
@@ -136,6 +152,10 @@ typedef struct listen_block
 	long speed;
 	unsigned short flags;	/* Flags. See LISTENFL_*, below */
 	char *name;		/* Name of this listen block. */
+	int sessions;		/* Max. # of simultaneous sessions in
+				 * daemon mode. 0 means one session at a
+				 * time, the old way.
+				 */
 } listen_block;
 
 #define LISTENFL_TRANSIENT	0x01	/* This device is transient: it
@@ -147,6 +167,8 @@ typedef struct listen_block
 					 */
 #define LISTENFL_PROMPT		0x02	/* Prompt for the HotSync button */
 #define LISTENFL_NOCHANGESPEED	0x04	/* This device is a modem */
+#define LISTENFL_TCP_NAGLE	0x08	/* Leave Nagle's algorithm on */
+#define LISTENFL_TCP_CORK	0x10	/* Cork NetSync writes */
 
 /* cond_header
  * A (name, value) pair that will be passed to a conduit.
@@ -262,6 +284,9 @@ typedef struct conduit_block
 #define CONDFL_FINAL	0x02	/* If this conduit matches, don't run any
 				 * other conduits for this database.
 				 */
+#define CONDFL_PERSISTENT 0x04	/* Start this conduit once, and keep
+				 * it running for the rest of the sync.
+				 */
 /* Conduit flavor flags. These are really bitmasks for
  * conduit_block.flavors.
  */
@@ -303,6 +328,15 @@ typedef struct pda_block
 					 * other pda_block matches.
 					 */
 
+/* Values for the 'install_order' option */
+#define INSTALL_ORDER_DIRECTORY	0	/* Whatever order readdir() gives */
+#define INSTALL_ORDER_SIZE	1	/* Smallest databases first */
+#define INSTALL_ORDER_TYPE	2	/* Applications first, then other
+					 * resource databases, then record
+					 * databases; smallest first within
+					 * each group.
+					 */
+
 /* sync_config
  * Holds everything that needs to be known once we're ready to synchronize
  * a particular Palm, belonging to a particular user. This will hold a lot
@@ -333,6 +367,44 @@ struct sync_config {
 					 * Palm has no internal serial number
 					 * (m125, Zire71)
 					 */
+		Bool3 stream_dblist;	/* If true, start running Sync
+					 * conduits while the list of
+					 * databases is still being read.
+					 */
+		int install_order;	/* Order in which to install new
+					 * databases: INSTALL_ORDER_*
+					 */
+		long install_deadline;	/* Stop installing after this many
+					 * seconds (0 == no limit), and
+					 * leave the rest for next time.
+					 */
+		Bool3 verify_install;	/* If true, check each newly-
+					 * installed database's record
+					 * count on the Palm.
+					 */
+		Bool3 sync_schedule;	/* If true, sync the databases in
+					 * order of priority and estimated
+					 * cost, rather than in the order
+					 * the Palm lists them.
+					 */
+		char *sync_priority;	/* Comma-separated list of
+					 * databases to sync first (NULL ==
+					 * the built-in applications).
+					 */
+		long sync_budget;	/* Put off non-priority databases
+					 * that won't be done within this
+					 * many seconds (0 == no limit).
+					 */
+		Bool3 save_prefs;	/* If true, save the preferences
+					 * read from the Palm, for conduits
+					 * that run without it.
+					 */
+		Bool3 profile_conduits;	/* If true, record what each run
+					 * of an external conduit cost.
+					 */
+		Bool3 profile_history;	/* If true, profile conduits, and
+					 * keep a history of the profiles.
+					 */
 		/* XXX - Perhaps allow "final" here, so that the sysadmin
 		 * can lock options in place.
 		 */
@@ -340,6 +412,10 @@ struct sync_config {
 	listen_block *listen;		/* List of listen blocks */
 	pda_block *pda;			/* List of known PDAs */
 	conduit_block *conduits;	/* List of all conduits */
+	struct cond_table *conduit_table;
+					/* Index of 'conduits', by flavor
+					 * and creator/type. See
+					 * condtable.h */
 };
 
 /* XXX - A lot of these variables need to be rethought */
@@ -377,6 +453,7 @@ extern int load_config(const Bool read_user_config);
 extern void print_version(FILE *outfile);
 extern int get_hostinfo(void);
 extern int get_hostaddrs(void);
+extern int get_userinfo(struct userinfo *userinfo);
 extern void free_hostaddrs(void);
 extern void print_pda_block(FILE *outfile,
 			    const pda_block *pda,
@@ -385,6 +462,8 @@ extern pda_block *find_pda_block(struct Palm *palm,
 				 const Bool check_user);
 extern listen_block * find_listen_block( char *name );
 
+extern int name2install_order(const char *str);
+extern void get_palmdir(const pda_block *pda, char *buf);
 extern int make_sync_dirs(const char *basedir);
 extern struct sync_config *new_sync_config(void);
 extern void free_sync_config(struct sync_config *config);
@@ -392,6 +471,7 @@ extern listen_block *new_listen_block(void);
 extern void free_listen_block(listen_block *l);
 extern int prepend_listen_block(char *devname, pconn_listen_t listen_type, pconn_proto_t protocol);
 extern pconn_listen_t name2listen_type(const char *str);
+extern int name2tcp_policy(const char *str);
 extern conduit_block *new_conduit_block(void);
 extern void free_conduit_block(conduit_block *c);
 extern pda_block *new_pda_block(void);
@@ -428,6 +508,8 @@ extern int restore_dir(PConnection *pconn,
 /* install.c */
 extern int upload_database(PConnection *pconn, struct pdb *db, Bool force);
 extern int NextInstallFile(struct dlp_dbinfo *dbinfo);
+extern void StageInstalls(void);
+extern void UnstageInstalls(void);
 extern int InstallNewFiles(struct Palm *palm,
 			   char *newdir,
 			   Bool deletep,
@@ -435,6 +517,8 @@ extern int InstallNewFiles(struct Palm *palm,
 
 /* log.c */
 extern int va_add_to_log(PConnection *pconn, const char *fmt, ...);
+extern int flush_log(PConnection *pconn);
+extern void discard_log(PConnection *pconn);
 
 /* parser.y */
 extern int parse_config_file(const char *fname, struct sync_config *config);
@@ -0,0 +1,1034 @@
+/* condio.c
+ *
+ * Event loop for talking to running conduits.
+ *
+ * run_conduit() used to read a conduit's stdout through stdio, calling
+ * select() before each line, and had SIGCHLD longjmp() out of wherever
+ * it happened to be when the conduit exited. That only works for one
+ * conduit at a time, and costs a few system calls per line.
+ *
+ * Here, each running conduit is described by a 'struct cond_io', which
+ * holds its (raw, non-blocking) file descriptors and buffers for each
+ * direction. condio_poll() waits, with epoll where available and
+ * select() elsewhere, until any of the conduits in the loop has
+ * something to say or is ready to be written to, or has exited. Then it
+ * does as much I/O as it can without blocking, and passes complete
+ * status lines and SPC requests to the callbacks given to
+ * condio_start().
+ *
+ * The SIGCHLD handler just writes a byte to a pipe that the loop
+ * watches (the "self-pipe trick"). Linux's pidfd and signalfd would do
+ * the same job, but they aren't portable.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>			/* For malloc(), realloc(), free() */
+#include <string.h>			/* For memchr(), memmove() */
+#include <sys/types.h>			/* For pid_t */
+#include <sys/time.h>			/* For select() */
+#include <sys/wait.h>			/* For waitpid(), wait4() */
+#include <sys/resource.h>		/* For struct rusage */
+#include <unistd.h>			/* For read(), write(), pipe() */
+#include <fcntl.h>			/* For fcntl() */
+#include <signal.h>			/* For signal(), kill() */
+#include <errno.h>			/* For errno. Duh */
+
+#if HAVE_SYS_SELECT_H
+#  include <sys/select.h>		/* To make select() work rationally
+					 * under AIX */
+#endif	/* HAVE_SYS_SELECT_H */
+
+#if HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>		/* For epoll_*() */
+#endif	/* HAVE_SYS_EPOLL_H */
+
+#if HAVE_LIBINTL_H
+#  include <libintl.h>			/* For i18n */
+#endif	/* HAVE_LIBINTL_H */
+
+#include "pconn/pconn.h"		/* For get_uword() and friends */
+#include "coldsync.h"
+#include "condio.h"
+
+typedef RETSIGTYPE (*sighandler) (int);	/* This is equivalent to FreeBSD's
+					 * 'sig_t', but that's a BSDism.
+					 */
+
+#define CONDIO_MAXEVENTS	16	/* Max # of events to handle per
+					 * epoll_wait() */
+
+/* What the event loop watches a file descriptor for */
+#define WATCH_READ	1
+#define WATCH_WRITE	2
+
+/* Indices into 'watching' in struct cond_io */
+#define FD_TOCHILD	0
+#define FD_FROMCHILD	1
+#define FD_SPC		2
+
+#define io_fd(io, which)	((which) == FD_TOCHILD ? (io)->tochild : \
+				 (which) == FD_FROMCHILD ? (io)->fromchild : \
+				 (io)->spcfd)
+
+/* Values of 'spc_state' in struct cond_io: what needs to be done next */
+#define SPC_IDLE		0	/* Nothing: not reading requests */
+#define SPC_READ_HEADER		1	/* Read (more of) the header of the
+					 * next request */
+#define SPC_READ_DATA		2	/* Read (more of) the data of a
+					 * request */
+#define SPC_WRITE_HEADER	3	/* Send (more of) the response
+					 * header */
+#define SPC_WRITE_DATA		4	/* Send (more of) the response
+					 * data */
+
+static struct cond_io *active = NULL;	/* Conduits in the event loop */
+static pid_t loop_pid = -1;		/* Process that set up the loop */
+static int chld_pipe[2] = { -1, -1 };	/* Written to by the SIGCHLD
+					 * handler */
+#if HAVE_SYS_EPOLL_H
+static int epfd = -1;
+#endif	/* HAVE_SYS_EPOLL_H */
+static sighandler old_sigchld;		/* Handlers to restore when the */
+static sighandler old_sigpipe;		/* loop is empty */
+
+static RETSIGTYPE condio_sigchld(int sig);
+static int init_loop(void);
+static void set_fd_flags(const int fd);
+static void watch(struct cond_io *io, const int which, const int what);
+static void close_fd(struct cond_io *io, const int which);
+static Bool has_line(const struct cond_io *io);
+static Bool deliver_lines(struct cond_io *io);
+static int read_output(struct cond_io *io);
+static void write_input(struct cond_io *io);
+static void spc_io(struct cond_io *io);
+static pid_t wait_child(struct cond_io *io, const int options);
+static Bool reap(struct cond_io *io);
+static void drain(struct cond_io *io);
+static void handle(struct cond_io *io, const int which);
+
+/* condio_sigchld
+ * SIGCHLD handler: wake up the event loop, which will find out which
+ * conduit exited.
+ */
+static RETSIGTYPE
+condio_sigchld(int sig)
+{
+	int old_errno = errno;
+
+	write(chld_pipe[1], "", 1);	/* If the pipe is full, the loop
+					 * is going to wake up anyway */
+	errno = old_errno;
+}
+
+/* init_loop
+ * Set up the SIGCHLD pipe and, if we have it, epoll, unless this process
+ * has already done so. A child process (e.g., a Dump job) that inherited
+ * the parent's has to start over, or the two would get each other's
+ * wakeups.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+init_loop(void)
+{
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	if (loop_pid == getpid())
+		return 0;
+
+	if (chld_pipe[0] >= 0)
+	{
+		close(chld_pipe[0]);
+		close(chld_pipe[1]);
+		chld_pipe[0] = chld_pipe[1] = -1;
+	}
+#if HAVE_SYS_EPOLL_H
+	if (epfd >= 0)
+	{
+		close(epfd);
+		epfd = -1;
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	if (pipe(chld_pipe) < 0)
+	{
+		Perror("pipe");
+		chld_pipe[0] = chld_pipe[1] = -1;
+		return -1;
+	}
+	set_fd_flags(chld_pipe[0]);
+	set_fd_flags(chld_pipe[1]);
+
+#if HAVE_SYS_EPOLL_H
+	if ((epfd = epoll_create(CONDIO_MAXEVENTS)) < 0)
+	{
+		Perror("epoll_create");
+		close(chld_pipe[0]);
+		close(chld_pipe[1]);
+		chld_pipe[0] = chld_pipe[1] = -1;
+		return -1;
+	}
+	fcntl(epfd, F_SETFD, FD_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.fd = chld_pipe[0];
+	epoll_ctl(epfd, EPOLL_CTL_ADD, chld_pipe[0], &ev);
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	loop_pid = getpid();
+	return 0;
+}
+
+/* set_fd_flags
+ * Make 'fd' non-blocking, and keep other conduits from inheriting it:
+ * a conduit would never see the end of its input if another one held
+ * the write end of its stdin.
+ */
+static void
+set_fd_flags(const int fd)
+{
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* condio_new
+ * Create a 'struct cond_io' for the conduit with process ID 'pid', whose
+ * stdin, stdout and SPC pipe (or -1 if it has none) are connected to the
+ * given file descriptors. These now belong to the new struct cond_io,
+ * and will be closed by condio_free().
+ * Returns the new struct cond_io, or NULL in case of error.
+ */
+struct cond_io *
+condio_new(const pid_t pid,
+	   const int tochild,
+	   const int fromchild,
+	   const int spcfd)
+{
+	struct cond_io *io;
+
+	if ((io = (struct cond_io *) calloc(1, sizeof(struct cond_io)))
+	    == NULL)
+	{
+		Error(_("%s: Out of memory."), "condio_new");
+		return NULL;
+	}
+
+	io->pid = pid;
+	io->tochild = tochild;
+	io->fromchild = fromchild;
+	io->spcfd = spcfd;
+	io->spc_state = (spcfd >= 0 ? SPC_READ_HEADER : SPC_IDLE);
+
+	set_fd_flags(tochild);
+	set_fd_flags(fromchild);
+	set_fd_flags(spcfd);
+
+	return io;
+}
+
+/* condio_free
+ * Take 'io' out of the event loop if necessary, close its file
+ * descriptors and free it. This doesn't wait for the conduit to exit.
+ */
+void
+condio_free(struct cond_io *io)
+{
+	if (io->active)
+		condio_stop(io);
+
+	close_fd(io, FD_TOCHILD);
+	close_fd(io, FD_FROMCHILD);
+	close_fd(io, FD_SPC);
+
+	if (io->out != NULL)
+		free(io->out);
+	if (io->spc_data != NULL)
+		free(io->spc_data);
+	free(io);
+}
+
+/* condio_write
+ * Queue 'len' bytes of 'data' to be sent to the conduit's stdin. They're
+ * actually sent by condio_poll(), as the conduit reads them.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+int
+condio_write(struct cond_io *io,
+	     const void *data,
+	     const long len)
+{
+	/* Move what's left to the start of the buffer */
+	if (io->outpos > 0)
+	{
+		memmove(io->out, io->out + io->outpos,
+			io->outlen - io->outpos);
+		io->outlen -= io->outpos;
+		io->outpos = 0;
+	}
+
+	if (io->outlen + len > io->outsize)
+	{
+		unsigned char *newout;
+		long newsize;
+
+		newsize = (io->outsize == 0 ? BUFSIZ : io->outsize);
+		while (newsize < io->outlen + len)
+			newsize *= 2;
+		if ((newout = (unsigned char *) realloc(io->out, newsize))
+		    == NULL)
+		{
+			Error(_("%s: Out of memory."), "condio_write");
+			return -1;
+		}
+		io->out = newout;
+		io->outsize = newsize;
+	}
+
+	memcpy(io->out + io->outlen, data, len);
+	io->outlen += len;
+	return 0;
+}
+
+/* condio_start
+ * Add 'io' to the event loop. From now on, condio_poll() calls
+ * 'on_line' with each line the conduit prints, and 'on_spc' (if not
+ * NULL) with each SPC request it sends. If 'on_line' asks to stop, the
+ * rest of the conduit's output stays in its buffer, and is passed to
+ * 'on_line' once 'io' is started again.
+ * The callbacks mustn't stop or free any struct cond_io.
+ */
+void
+condio_start(struct cond_io *io,
+	     condio_line_fn on_line,
+	     condio_spc_fn on_spc,
+	     void *arg)
+{
+	io->on_line = on_line;
+	io->on_spc = on_spc;
+	io->arg = arg;
+	if (io->active)
+		return;
+
+	if (active == NULL)
+	{
+		if (init_loop() < 0)
+			Error(_("%s: Can't watch for conduits exiting."),
+			      "condio_start");
+
+		/* A conduit that exits without reading its input
+		 * shouldn't take us with it.
+		 */
+		old_sigchld = signal(SIGCHLD, condio_sigchld);
+		old_sigpipe = signal(SIGPIPE, SIG_IGN);
+	}
+
+	io->active = True;
+	io->next = active;
+	active = io;
+
+	/* It may have exited before there was anyone to notice */
+	if (!io->exited && reap(io))
+		drain(io);
+}
+
+/* condio_stop
+ * Take 'io' out of the event loop. Whatever it has printed but hasn't
+ * been passed to the callback is kept for next time.
+ */
+void
+condio_stop(struct cond_io *io)
+{
+	struct cond_io **iop;
+
+	if (!io->active)
+		return;
+
+	for (iop = &active; *iop != NULL; iop = &((*iop)->next))
+	{
+		if (*iop == io)
+		{
+			*iop = io->next;
+			break;
+		}
+	}
+	io->next = NULL;
+	io->active = False;
+
+	/* Stop watching its file descriptors, so they don't wake the
+	 * loop up for nothing.
+	 */
+	watch(io, FD_TOCHILD, 0);
+	watch(io, FD_FROMCHILD, 0);
+	watch(io, FD_SPC, 0);
+
+	if (active == NULL)
+	{
+		signal(SIGCHLD, old_sigchld);
+		signal(SIGPIPE, old_sigpipe);
+	}
+}
+
+/* condio_finished
+ * Returns True iff the conduit has exited, and all of what it printed
+ * has been passed to the callback.
+ */
+Bool
+condio_finished(const struct cond_io *io)
+{
+	return (io->exited && io->fromchild < 0 && io->inlen == 0) ?
+		True : False;
+}
+
+/* condio_kill
+ * Kill the conduit (if it hasn't exited yet), wait for it, and pass
+ * whatever it printed before dying to the callback.
+ */
+void
+condio_kill(struct cond_io *io)
+{
+	if (!io->exited)
+	{
+		CONDUIT_TRACE(5)
+			fprintf(stderr, "Sending SIGTERM to %d\n",
+				(int) io->pid);
+		kill(io->pid, SIGTERM);
+			/* No error checking: if it's already gone, the
+			 * waitpid() below will say so.
+			 */
+		while (wait_child(io, 0) < 0 && errno == EINTR)
+			;
+		io->exited = True;
+	}
+	drain(io);
+	if (has_line(io))
+		deliver_lines(io);
+}
+
+/* condio_poll
+ * Wait up to 'timeout' milliseconds (forever, if 'timeout' is negative)
+ * for something to happen to the conduits in the event loop, and deal
+ * with it.
+ * Returns the number of events handled (0 if it timed out or was
+ * interrupted), or -1 in case of error.
+ */
+int
+condio_poll(const int timeout)
+{
+	int err;
+	int count = 0;
+	Bool chld = False;
+	struct cond_io *io;
+	struct cond_io *next;
+	char junk[64];
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event events[CONDIO_MAXEVENTS];
+	int i;
+	int which;
+#else	/* HAVE_SYS_EPOLL_H */
+	fd_set in_fds;
+	fd_set out_fds;
+	int max_fd;
+	int which;
+	int fd;
+	struct timeval tv;
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	if (active == NULL)
+		return 0;
+
+	/* First, the lines that were left for later */
+	for (io = active; io != NULL; io = next)
+	{
+		next = io->next;
+		if (!has_line(io))
+			continue;
+		deliver_lines(io);
+		count++;
+	}
+	if (count > 0)
+		return count;
+
+	/* Decide what to watch each file descriptor for. Only watch the
+	 * SPC pipe for reading or writing, not both: it's usually
+	 * writable, and we don't want to busy-wait.
+	 */
+	for (io = active; io != NULL; io = io->next)
+	{
+		watch(io, FD_TOCHILD,
+		      (io->tochild >= 0 && !io->exited &&
+		       io->outlen > io->outpos) ? WATCH_WRITE : 0);
+		watch(io, FD_FROMCHILD,
+		      io->fromchild >= 0 ? WATCH_READ : 0);
+		if (io->spcfd < 0 || io->exited)
+			watch(io, FD_SPC, 0);
+		else if (io->spc_state == SPC_READ_HEADER ||
+			 io->spc_state == SPC_READ_DATA)
+			watch(io, FD_SPC, WATCH_READ);
+		else if (io->spc_state == SPC_WRITE_HEADER ||
+			 io->spc_state == SPC_WRITE_DATA)
+			watch(io, FD_SPC, WATCH_WRITE);
+		else
+			watch(io, FD_SPC, 0);
+	}
+
+#if HAVE_SYS_EPOLL_H
+	err = epoll_wait(epfd, events, CONDIO_MAXEVENTS, timeout);
+#else	/* HAVE_SYS_EPOLL_H */
+	FD_ZERO(&in_fds);
+	FD_ZERO(&out_fds);
+	FD_SET(chld_pipe[0], &in_fds);
+	max_fd = chld_pipe[0];
+	for (io = active; io != NULL; io = io->next)
+	{
+		for (which = 0; which < 3; which++)
+		{
+			if (io->watching[which] == 0)
+				continue;
+			fd = io_fd(io, which);
+			if (io->watching[which] & WATCH_READ)
+				FD_SET(fd, &in_fds);
+			if (io->watching[which] & WATCH_WRITE)
+				FD_SET(fd, &out_fds);
+			if (fd > max_fd)
+				max_fd = fd;
+		}
+	}
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	err = select(max_fd+1, &in_fds, &out_fds, NULL,
+		     timeout < 0 ? NULL : &tv);
+#endif	/* HAVE_SYS_EPOLL_H */
+	CONDUIT_TRACE(7)
+		fprintf(stderr, "condio_poll: %d events\n", err);
+	if (err < 0)
+	{
+		if (errno == EINTR)
+			return 0;	/* Probably SIGCHLD. The pipe will
+					 * say so next time. */
+		Error(_("%s: Error waiting for conduits."),
+		      "condio_poll");
+		Perror("condio_poll");
+		return -1;
+	}
+
+#if HAVE_SYS_EPOLL_H
+	for (i = 0; i < err; i++)
+	{
+		if (events[i].data.fd == chld_pipe[0])
+		{
+			chld = True;
+			continue;
+		}
+		for (io = active; io != NULL; io = io->next)
+		{
+			for (which = 0; which < 3; which++)
+				if (io->watching[which] != 0 &&
+				    io_fd(io, which) == events[i].data.fd)
+					break;
+			if (which < 3)
+				break;
+		}
+		if (io == NULL)
+			continue;	/* Closed since then */
+		handle(io, which);
+		count++;
+	}
+#else	/* HAVE_SYS_EPOLL_H */
+	if (err > 0)
+	{
+		chld = FD_ISSET(chld_pipe[0], &in_fds);
+		for (io = active; io != NULL; io = io->next)
+		{
+			for (which = 0; which < 3; which++)
+			{
+				fd = io_fd(io, which);
+				if (io->watching[which] == 0 || fd < 0)
+					continue;
+				if (!FD_ISSET(fd, &in_fds) &&
+				    !FD_ISSET(fd, &out_fds))
+					continue;
+				handle(io, which);
+				count++;
+			}
+		}
+	}
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	if (chld)
+	{
+		/* Empty the pipe before looking, so that a conduit that
+		 * exits in the meantime will wake us up again.
+		 */
+		while (read(chld_pipe[0], junk, sizeof(junk)) > 0)
+			;
+		for (io = active; io != NULL; io = io->next)
+		{
+			if (io->exited || !reap(io))
+				continue;
+			drain(io);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* watch
+ * Tell the event loop to watch file descriptor 'which' of 'io' for
+ * 'what' (a combination of WATCH_READ and WATCH_WRITE, or 0 to not watch
+ * it at all).
+ */
+static void
+watch(struct cond_io *io, const int which, const int what)
+{
+#if HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+	int fd = io_fd(io, which);
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	if (io->watching[which] == what)
+		return;
+
+#if HAVE_SYS_EPOLL_H
+	ev.events = ((what & WATCH_READ) ? EPOLLIN : 0) |
+		((what & WATCH_WRITE) ? EPOLLOUT : 0);
+	ev.data.fd = fd;
+	if (io->watching[which] == 0)
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	else if (what == 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev);
+	else
+		epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	io->watching[which] = what;
+}
+
+/* close_fd
+ * Close file descriptor 'which' of 'io', if it's open.
+ */
+static void
+close_fd(struct cond_io *io, const int which)
+{
+	int fd = io_fd(io, which);
+
+	if (fd < 0)
+		return;
+	watch(io, which, 0);
+	CONDUIT_TRACE(7)
+		fprintf(stderr, "- Closing fd %d\n", fd);
+	close(fd);
+
+	switch (which)
+	{
+	    case FD_TOCHILD:
+		io->tochild = -1;
+		io->outlen = io->outpos = 0;
+		break;
+	    case FD_FROMCHILD:
+		io->fromchild = -1;
+		break;
+	    default:
+		io->spcfd = -1;
+		io->spc_state = SPC_IDLE;
+		break;
+	}
+}
+
+/* has_line
+ * Returns True iff 'io' has buffered output that's ready to be passed to
+ * the callback: a complete line, a line that's too long to wait for the
+ * end of, or whatever it printed last before closing its stdout.
+ */
+static Bool
+has_line(const struct cond_io *io)
+{
+	if (io->inlen == 0)
+		return False;
+	if (io->fromchild < 0 || io->inlen >= COND_MAXLINELEN ||
+	    memchr(io->in, '\n', io->inlen) != NULL)
+		return True;
+	return False;
+}
+
+/* deliver_lines
+ * Pass the lines in 'io's input buffer to the callback. Lines longer
+ * than COND_MAXLINELEN are split.
+ * Returns False if the callback asked to stop, True otherwise.
+ */
+static Bool
+deliver_lines(struct cond_io *io)
+{
+	static char line[COND_MAXLINELEN+1];
+	char *nl;
+	int len;		/* Length of the line */
+	int used;		/* # bytes of 'in' it takes up */
+
+	while (has_line(io))
+	{
+		nl = (char *) memchr(io->in, '\n', io->inlen);
+		len = (nl == NULL ? io->inlen : nl - io->in);
+		used = (nl == NULL ? len : len + 1);
+		if (len > COND_MAXLINELEN)
+			len = used = COND_MAXLINELEN;
+
+		memcpy(line, io->in, len);
+		line[len] = '\0';
+		io->inlen -= used;
+		memmove(io->in, io->in + used, io->inlen);
+
+		if (io->on_line != NULL &&
+		    (*io->on_line)(io, line, io->arg) != 0)
+			return False;
+	}
+	return True;
+}
+
+/* read_output
+ * Read as much of the conduit's stdout as will fit in its buffer. Closes
+ * 'fromchild' at end of file.
+ * Returns the number of bytes read, 0 at end of file, or -1 if there was
+ * nothing to read.
+ */
+static int
+read_output(struct cond_io *io)
+{
+	long len;
+
+	if (io->fromchild < 0)
+		return 0;
+	if (io->inlen >= CONDIO_INBUF_LEN)
+		return -1;	/* The callback isn't keeping up */
+
+	len = read(io->fromchild, io->in + io->inlen,
+		   CONDIO_INBUF_LEN - io->inlen);
+	if (len > 0)
+	{
+		CONDUIT_TRACE(6)
+			fprintf(stderr, "Read %ld bytes from conduit %d\n",
+				len, (int) io->pid);
+		io->inlen += len;
+		return len;
+	}
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return -1;
+
+	if (len < 0)
+		Perror("read_output");
+	CONDUIT_TRACE(5)
+		fprintf(stderr, "End of file from conduit %d\n",
+			(int) io->pid);
+	close_fd(io, FD_FROMCHILD);
+	return 0;
+}
+
+/* write_input
+ * Send as much of 'io's output buffer as the conduit will take.
+ */
+static void
+write_input(struct cond_io *io)
+{
+	long len;
+
+	len = write(io->tochild, io->out + io->outpos,
+		    io->outlen - io->outpos);
+	if (len < 0)
+	{
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+
+		/* Most likely EPIPE: it has closed its stdin. Either way,
+		 * it won't get the rest.
+		 */
+		if (errno != EPIPE)
+		{
+			Error(_("Couldn't send header to conduit."));
+			Perror("write");
+		}
+		CONDUIT_TRACE(3)
+			fprintf(stderr, "Conduit %d isn't reading its "
+				"input. Dropping %ld bytes.\n",
+				(int) io->pid, io->outlen - io->outpos);
+		io->outlen = io->outpos = 0;
+		return;
+	}
+
+	CONDUIT_TRACE(7)
+		fprintf(stderr, "Wrote %ld bytes to conduit %d\n",
+			len, (int) io->pid);
+	io->outpos += len;
+	if (io->outpos >= io->outlen)
+		io->outlen = io->outpos = 0;
+}
+
+/* spc_io
+ * Do whatever comes next in the SPC exchange with the conduit: read (some
+ * of) a request, or write (some of) the response. Once a request has
+ * been read in full, it's passed to the callback.
+ */
+static void
+spc_io(struct cond_io *io)
+{
+	long len;
+	const ubyte *rptr;
+	ubyte *wptr;
+	unsigned char *outbuf;
+
+	switch (io->spc_state)
+	{
+	    case SPC_READ_HEADER:
+		/* The header consists of an opcode, a status code
+		 * (ignored) and a length.
+		 */
+		len = read(io->spcfd, io->spc_hdr + io->spc_pos,
+			   SPC_HEADER_LEN - io->spc_pos);
+		if (len <= 0)
+			goto read_error;
+		io->spc_pos += len;
+		if (io->spc_pos < SPC_HEADER_LEN)
+			return;
+
+		rptr = io->spc_hdr;
+		io->spc_req.op = get_uword(&rptr);
+		io->spc_req.status = get_uword(&rptr);
+		io->spc_req.len = get_udword(&rptr);
+		CONDUIT_TRACE(5)
+			fprintf(stderr, "SPC request OP == %d, len == %ld\n",
+				io->spc_req.op, io->spc_req.len);
+
+		io->spc_pos = 0;
+		if (io->spc_req.len > 0 &&
+		    (io->spc_data = (unsigned char *)
+		     malloc(io->spc_req.len)) == NULL)
+		{
+			Error(_("%s: Out of memory."), "spc_io");
+			io->spc_state = SPC_IDLE;
+			return;
+		}
+		io->spc_state = SPC_READ_DATA;
+		if (io->spc_req.len > 0)
+			return;		/* Wait for the data */
+		/* No data: handle the request right away */
+		/* FALLTHROUGH */
+
+	    case SPC_READ_DATA:
+		if (io->spc_pos < io->spc_req.len)
+		{
+			len = read(io->spcfd, io->spc_data + io->spc_pos,
+				   io->spc_req.len - io->spc_pos);
+			if (len <= 0)
+				goto read_error;
+			io->spc_pos += len;
+			if (io->spc_pos < io->spc_req.len)
+				return;
+		}
+
+		/* We have the whole request */
+		outbuf = NULL;
+		if (io->on_spc == NULL ||
+		    (*io->on_spc)(io, &io->spc_req, io->spc_data, &outbuf,
+				  io->arg) < 0)
+		{
+			if (outbuf != NULL)
+				free(outbuf);
+			if (io->spc_data != NULL)
+				free(io->spc_data);
+			io->spc_data = NULL;
+			io->spc_state = SPC_IDLE;
+			return;
+		}
+		if (io->spc_data != NULL)
+			free(io->spc_data);
+		io->spc_data = outbuf;
+
+		CONDUIT_TRACE(5)
+			fprintf(stderr, "Sending SPC response OP == %d, "
+				"status == %d, len == %ld\n",
+				io->spc_req.op, io->spc_req.status,
+				io->spc_req.len);
+		wptr = io->spc_hdr;
+		put_uword(&wptr, io->spc_req.op);
+		put_uword(&wptr, io->spc_req.status);
+		put_udword(&wptr, io->spc_req.len);
+		io->spc_pos = 0;
+		io->spc_state = SPC_WRITE_HEADER;
+		/* The pipe is most likely writable. Don't wait to find
+		 * out.
+		 */
+		/* FALLTHROUGH */
+
+	    case SPC_WRITE_HEADER:
+		len = write(io->spcfd, io->spc_hdr + io->spc_pos,
+			    SPC_HEADER_LEN - io->spc_pos);
+		if (len < 0)
+			goto write_error;
+		io->spc_pos += len;
+		if (io->spc_pos < SPC_HEADER_LEN)
+			return;
+		io->spc_pos = 0;
+		io->spc_state = SPC_WRITE_DATA;
+		/* FALLTHROUGH */
+
+	    case SPC_WRITE_DATA:
+		if (io->spc_pos < io->spc_req.len)
+		{
+			len = write(io->spcfd, io->spc_data + io->spc_pos,
+				    io->spc_req.len - io->spc_pos);
+			if (len < 0)
+				goto write_error;
+			io->spc_pos += len;
+			if (io->spc_pos < io->spc_req.len)
+				return;
+		}
+
+		/* We're done sending the response */
+		if (io->spc_data != NULL)
+			free(io->spc_data);
+		io->spc_data = NULL;
+		io->spc_pos = 0;
+		io->spc_state = SPC_READ_HEADER;
+		return;
+
+	    default:
+		return;
+	}
+
+  read_error:
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len < 0)
+	{
+		Error(_("%s: Error reading SPC request from conduit."),
+		      "spc_io");
+		Perror("read");
+	}
+	/* Otherwise, it closed its end of the pipe. Either way, there
+	 * won't be any more requests.
+	 */
+	io->spc_state = SPC_IDLE;
+	return;
+
+  write_error:
+	if (errno == EAGAIN || errno == EINTR)
+		return;
+	if (errno != EPIPE)
+	{
+		Error(_("%s: Error sending SPC response."), "spc_io");
+		Perror("write");
+	}
+	io->spc_state = SPC_IDLE;
+}
+
+/* wait_child
+ * waitpid() for the conduit, and if the system can say what resources
+ * it used, record that in io->rusage, for the profiler.
+ */
+static pid_t
+wait_child(struct cond_io *io, const int options)
+{
+	pid_t p;
+
+#if HAVE_WAIT4
+	p = wait4(io->pid, &io->status, options, &io->rusage);
+	if (p > 0)
+		io->have_rusage = True;
+#else	/* HAVE_WAIT4 */
+	p = waitpid(io->pid, &io->status, options);
+#endif	/* HAVE_WAIT4 */
+	return p;
+}
+
+/* reap
+ * See whether the conduit has exited, and if so, record its status.
+ * Only registered conduits are waited for: other children (e.g., a
+ * Fetch job running in the background) are someone else's business.
+ * Returns True iff it has exited.
+ */
+static Bool
+reap(struct cond_io *io)
+{
+	pid_t p;
+
+	if (io->exited)
+		return True;
+
+	while ((p = wait_child(io, WNOHANG)) < 0 && errno == EINTR)
+		;
+	if (p == 0)
+		return False;		/* Still running */
+
+	if (p < 0)
+	{
+		Error(_("%s: Can't get child pid %d status."),
+		      "condio", (int) io->pid);
+		Perror("waitpid");
+		io->status = 0;
+	}
+	io->exited = True;
+
+	MISC_TRACE(5)
+	{
+		if (WIFEXITED(io->status))
+			fprintf(stderr, "Conduit %d exited with status %d\n",
+				(int) io->pid, WEXITSTATUS(io->status));
+		else if (WIFSIGNALED(io->status))
+			fprintf(stderr, "Conduit %d killed by signal %d%s\n",
+				(int) io->pid, WTERMSIG(io->status),
+				(WCOREDUMP(io->status) ?
+				 " (core dumped)" : ""));
+	}
+	return True;
+}
+
+/* drain
+ * The conduit has exited. Read what it printed before exiting, which is
+ * already in the pipe, and close its stdout. Don't wait for end of file:
+ * a process it left running in the background might still have the pipe
+ * open.
+ */
+static void
+drain(struct cond_io *io)
+{
+	if (io->fromchild < 0)
+		return;
+
+	while (read_output(io) > 0)
+		if (!deliver_lines(io))
+			break;
+	close_fd(io, FD_FROMCHILD);
+}
+
+/* handle
+ * File descriptor 'which' of 'io' is ready: do what needs to be done.
+ */
+static void
+handle(struct cond_io *io, const int which)
+{
+	switch (which)
+	{
+	    case FD_TOCHILD:
+		write_input(io);
+		break;
+	    case FD_FROMCHILD:
+		read_output(io);
+		deliver_lines(io);
+		break;
+	    default:
+		spc_io(io);
+		break;
+	}
+}
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
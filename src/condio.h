@@ -0,0 +1,118 @@
+/* condio.h
+ *
+ * Event loop for talking to running conduits: their stdin, stdout and
+ * SPC pipe, and their exit.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+#ifndef _condio_h_
+#define _condio_h_
+
+#include "config.h"
+#include <sys/types.h>			/* For pid_t */
+#include <sys/time.h>
+#include <sys/resource.h>		/* For struct rusage */
+#include "coldsync.h"
+#include "conduit.h"
+#include "spc.h"
+
+#define CONDIO_INBUF_LEN	4096	/* Size of the buffer for a
+					 * conduit's stdout. Each read()
+					 * fills as much of it as it can.
+					 */
+
+struct cond_io;
+
+/* condio_line_fn
+ * Called for each line the conduit prints on its stdout, with the
+ * trailing newline removed. Returns 0 to go on, or a nonzero value to
+ * leave the rest of what the conduit has printed for later (see
+ * condio_start()).
+ */
+typedef int (*condio_line_fn)(struct cond_io *io, char *line, void *arg);
+
+/* condio_spc_fn
+ * Called with each complete SPC request the conduit sends. On return,
+ * 'req' and '*outbuf' should hold the response; '*outbuf' will be
+ * free()d once it has been sent. Returns 0 if successful, or a negative
+ * value if the conduit should get no response (and no more SPC
+ * requests will be read from it).
+ */
+typedef int (*condio_spc_fn)(struct cond_io *io,
+			     struct spc_hdr *req,
+			     const unsigned char *inbuf,
+			     unsigned char **outbuf,
+			     void *arg);
+
+/* cond_io
+ * A running conduit, as seen by the event loop. All of its file
+ * descriptors are non-blocking; a file descriptor is -1 once it has
+ * been closed.
+ */
+struct cond_io
+{
+	struct cond_io *next;		/* Next conduit in the event loop */
+	Bool active;			/* Is it in the event loop? */
+	pid_t pid;			/* Its process ID */
+	Bool exited;			/* Has it exited? */
+	int status;			/* If so, its status, as set by
+					 * waitpid() */
+	Bool have_rusage;		/* Do we know what it used? */
+	struct rusage rusage;		/* If so, its CPU time etc. */
+	int tochild;			/* Its stdin */
+	int fromchild;			/* Its stdout. -1 at end of file */
+	int spcfd;			/* Our end of its SPC pipe, or -1 */
+
+	/* What's waiting to go to its stdin */
+	unsigned char *out;		/* Output buffer */
+	long outlen;			/* # bytes in 'out' */
+	long outsize;			/* Size of 'out' */
+	long outpos;			/* # bytes already written */
+
+	/* What it has printed on its stdout, but we haven't looked at */
+	char in[CONDIO_INBUF_LEN];
+	int inlen;			/* # bytes in 'in' */
+
+	/* SPC request or response in progress */
+	int spc_state;			/* What's being done; see condio.c */
+	unsigned char spc_hdr[SPC_HEADER_LEN];
+	struct spc_hdr spc_req;		/* Request, then response, header */
+	unsigned char *spc_data;	/* Request, then response, data */
+	unsigned long spc_pos;		/* # bytes of the header or data
+					 * read or written so far */
+
+	int watching[3];		/* What the event loop is watching
+					 * each file descriptor for */
+
+	condio_line_fn on_line;		/* Callbacks. See above */
+	condio_spc_fn on_spc;
+	void *arg;			/* Passed to the callbacks */
+};
+
+extern struct cond_io *condio_new(const pid_t pid,
+				  const int tochild,
+				  const int fromchild,
+				  const int spcfd);
+extern void condio_free(struct cond_io *io);
+extern int condio_write(struct cond_io *io,
+			const void *data,
+			const long len);
+extern void condio_start(struct cond_io *io,
+			 condio_line_fn on_line,
+			 condio_spc_fn on_spc,
+			 void *arg);
+extern void condio_stop(struct cond_io *io);
+extern Bool condio_finished(const struct cond_io *io);
+extern int condio_poll(const int timeout);
+extern void condio_kill(struct cond_io *io);
+
+#endif	/* _condio_h_ */
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
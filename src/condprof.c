@@ -0,0 +1,448 @@
+/* condprof.c
+ *
+ * Conduit profiling: which conduits make the sync slow, and why.
+ *
+ * When profiling is on, run_conduit() fills in a 'struct cond_prof' for
+ * each external conduit it runs, and condprof_record() appends it to
+ * <palmdir>/conduit-profile, which is started afresh at each sync. Dump
+ * conduits run with -j are recorded by the job processes, so each record
+ * is a single write() to a file opened with O_APPEND: lines from
+ * different processes can't get mixed up.
+ *
+ * At the end of the sync, condprof_close() can append the session's
+ * records to <palmdir>/conduit-history, which "coldsync -mp" summarizes
+ * by conduit.
+ *
+ * Both files are plain text. Lines that begin with '#' are comments;
+ * every other line is one run of a conduit, with the tab-separated
+ * fields
+ *	start time (seconds since the epoch), flavor, conduit, database,
+ *	status, wall time (ms), user CPU (ms), system CPU (ms), max. RSS
+ *	(KB), SPC requests, SPC bytes in, SPC bytes out, DLP time (ms)
+ * A value of -1 means the figure isn't known.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>			/* For malloc(), realloc(), free() */
+#include <string.h>			/* For strchr(), strcmp() */
+#include <sys/types.h>
+#include <sys/param.h>			/* For MAXPATHLEN */
+#include <fcntl.h>			/* For open() */
+#include <unistd.h>			/* For write(), close() */
+
+#if HAVE_LIBINTL_H
+#  include <libintl.h>			/* For i18n */
+#endif	/* HAVE_LIBINTL_H */
+
+#include "coldsync.h"
+#include "condprof.h"
+
+#define CONDPROF_NFIELDS	13	/* # of fields in a record */
+#define CONDPROF_LINELEN	(MAXPATHLEN + 256)
+					/* Longest record we'll write or
+					 * read */
+
+static const char condprof_header[] =
+	"#start\tflavor\tconduit\tdatabase\tstatus\twall_ms\tuser_ms\t"
+	"sys_ms\tmaxrss_kb\tspc_reqs\tspc_in\tspc_out\tdlp_ms\n";
+
+static int prof_fd = -1;		/* This sync's profile, if open */
+static char prof_fname[MAXPATHLEN+1];	/* ... and its pathname */
+
+/* prof_sum
+ * Totals for one conduit (path and flavor), for condprof_summary().
+ */
+struct prof_sum
+{
+	char *conduit;
+	char *flavor;
+	long runs;
+	double wall;			/* Total wall time, in seconds */
+	double wall_max;		/* Longest run */
+	char *slowest_db;		/* Database of the longest run */
+	double cpu;			/* Total known CPU time, or -1 */
+	long maxrss;			/* Largest known max. RSS */
+	long spc_reqs;
+	long spc_bytes;			/* SPC bytes in and out */
+	double dlp;			/* Total DLP time */
+	long failures;			/* # of runs with status >= 400 */
+};
+
+static int parse_record(char *line, struct cond_prof *prof);
+static int cmp_prof_sum(const void *a, const void *b);
+
+/* condprof_open
+ * Start this sync's conduit profile. Any previous one is overwritten.
+ * Returns 0 if successful, or -1 in case of error, in which case
+ * conduits aren't profiled.
+ */
+int
+condprof_open(void)
+{
+	if (prof_fd >= 0)
+		close(prof_fd);		/* Left over from a failed sync */
+	prof_fd = -1;
+
+	if (palmdir[0] == '\0')
+		return -1;
+
+	strncpy(prof_fname, mkfname(palmdir, "/conduit-profile", NULL),
+		MAXPATHLEN);
+	prof_fname[MAXPATHLEN] = '\0';
+
+	if ((prof_fd = open(prof_fname,
+			    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+			    0600)) < 0)
+	{
+		Warn(_("Can't open conduit profile \"%s\"."), prof_fname);
+		Perror("open");
+		return -1;
+	}
+	fcntl(prof_fd, F_SETFD, FD_CLOEXEC);
+
+	write(prof_fd, condprof_header, sizeof(condprof_header) - 1);
+
+	MISC_TRACE(3)
+		fprintf(stderr, "Profiling conduits to \"%s\"\n",
+			prof_fname);
+	return 0;
+}
+
+/* condprof_enabled
+ * Returns True iff conduits are being profiled.
+ */
+Bool
+condprof_enabled(void)
+{
+	return (prof_fd >= 0) ? True : False;
+}
+
+/* condprof_record
+ * Add 'prof' to this sync's conduit profile.
+ */
+void
+condprof_record(const struct cond_prof *prof)
+{
+	char buf[CONDPROF_LINELEN];
+	int len;
+
+	if (prof_fd < 0)
+		return;
+
+	len = snprintf(buf, sizeof(buf),
+		       "%ld\t%s\t%s\t%s\t%d\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t"
+		       "%ld\t%ld\n",
+		       (long) prof->start,
+		       prof->flavor,
+		       prof->conduit,
+		       prof->dbname,
+		       prof->status,
+		       prof->wall,
+		       prof->utime,
+		       prof->stime,
+		       prof->maxrss,
+		       prof->spc_reqs,
+		       prof->spc_in,
+		       prof->spc_out,
+		       prof->dlp);
+	if (len < 0 || len >= (int) sizeof(buf))
+		return;			/* Absurdly long conduit path */
+
+	CONDUIT_TRACE(3)
+		fprintf(stderr, "Profile: %s", buf);
+
+	/* One write(), so that it isn't interleaved with a record from
+	 * another process.
+	 */
+	write(prof_fd, buf, len);
+}
+
+/* condprof_close
+ * Finish this sync's conduit profile. Say which conduit took the
+ * longest, and if 'keep_history' is true, append the profile to the
+ * history file.
+ */
+void
+condprof_close(const Bool keep_history)
+{
+	FILE *infile;
+	FILE *histfile = NULL;
+	char line[CONDPROF_LINELEN];
+	char copy[CONDPROF_LINELEN];
+	struct cond_prof prof;
+	int runs = 0;
+	long total = 0L;		/* Total wall time */
+	long slowest = -1L;		/* Longest run */
+	char slowest_name[CONDPROF_LINELEN];
+
+	if (prof_fd < 0)
+		return;
+	close(prof_fd);
+	prof_fd = -1;
+
+	if ((infile = fopen(prof_fname, "r")) == NULL)
+		return;
+
+	if (keep_history &&
+	    (histfile = fopen(condprof_history_fname(), "a")) == NULL)
+	{
+		Warn(_("Can't append to conduit history \"%s\"."),
+		     condprof_history_fname());
+		Perror("fopen");
+	}
+
+	slowest_name[0] = '\0';
+	while (fgets(line, sizeof(line), infile) != NULL)
+	{
+		if (line[0] == '#')
+			continue;
+		if (histfile != NULL)
+			fputs(line, histfile);
+
+		strcpy(copy, line);
+		if (parse_record(copy, &prof) < 0)
+			continue;
+		runs++;
+		total += prof.wall;
+		if (prof.wall > slowest)
+		{
+			slowest = prof.wall;
+			snprintf(slowest_name, sizeof(slowest_name),
+				 "%s %s (%s)", prof.flavor, prof.conduit,
+				 prof.dbname);
+		}
+	}
+	fclose(infile);
+	if (histfile != NULL)
+		fclose(histfile);
+
+	if (runs > 0)
+		Verbose(1, _("Ran %d conduit(s) in %.2f s. Slowest: %s, "
+			     "%.2f s."),
+			runs, total / 1000.0,
+			slowest_name, slowest / 1000.0);
+}
+
+/* condprof_history_fname
+ * Returns the pathname of the conduit history file, in a static buffer.
+ */
+const char *
+condprof_history_fname(void)
+{
+	return mkfname(palmdir, "/conduit-history", NULL);
+}
+
+/* condprof_summary
+ * Read the conduit profile or history in 'fname', and print a summary
+ * to 'outfile': for each conduit and flavor, how many times it was run
+ * and what that cost, biggest total time first.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+int
+condprof_summary(const char *fname, FILE *outfile)
+{
+	FILE *infile;
+	char line[CONDPROF_LINELEN];
+	struct cond_prof prof;
+	struct prof_sum *sums = NULL;
+	int num_sums = 0;
+	int max_sums = 0;
+	long records = 0L;
+	int i;
+
+	if ((infile = fopen(fname, "r")) == NULL)
+	{
+		Error(_("Can't open \"%s\"."), fname);
+		Perror("fopen");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), infile) != NULL)
+	{
+		struct prof_sum *s;
+		double wall;
+
+		if (line[0] == '#' || parse_record(line, &prof) < 0)
+			continue;
+		records++;
+
+		for (i = 0; i < num_sums; i++)
+			if (strcmp(sums[i].conduit, prof.conduit) == 0 &&
+			    strcmp(sums[i].flavor, prof.flavor) == 0)
+				break;
+		if (i >= num_sums)
+		{
+			if (num_sums >= max_sums)
+			{
+				struct prof_sum *newsums;
+
+				max_sums = (max_sums == 0 ? 16 : max_sums*2);
+				if ((newsums = (struct prof_sum *)
+				     realloc(sums, max_sums *
+					     sizeof(struct prof_sum)))
+				    == NULL)
+				{
+					Error(_("%s: Out of memory."),
+					      "condprof_summary");
+					break;
+				}
+				sums = newsums;
+			}
+			s = &(sums[num_sums]);
+			memset(s, 0, sizeof(struct prof_sum));
+			s->conduit = strdup(prof.conduit);
+			s->flavor = strdup(prof.flavor);
+			s->slowest_db = strdup(prof.dbname);
+			s->cpu = -1.0;
+			s->maxrss = -1L;
+			if (s->conduit == NULL || s->flavor == NULL ||
+			    s->slowest_db == NULL)
+			{
+				Error(_("%s: Out of memory."),
+				      "condprof_summary");
+				break;
+			}
+			num_sums++;
+		}
+		s = &(sums[i]);
+
+		wall = prof.wall / 1000.0;
+		s->runs++;
+		s->wall += wall;
+		if (wall > s->wall_max)
+		{
+			char *db;
+
+			s->wall_max = wall;
+			if ((db = strdup(prof.dbname)) != NULL)
+			{
+				free(s->slowest_db);
+				s->slowest_db = db;
+			}
+		}
+		if (prof.utime >= 0 && prof.stime >= 0)
+		{
+			if (s->cpu < 0)
+				s->cpu = 0.0;
+			s->cpu += (prof.utime + prof.stime) / 1000.0;
+		}
+		if (prof.maxrss > s->maxrss)
+			s->maxrss = prof.maxrss;
+		s->spc_reqs += prof.spc_reqs;
+		s->spc_bytes += prof.spc_in + prof.spc_out;
+		if (prof.dlp > 0)
+			s->dlp += prof.dlp / 1000.0;
+		if (prof.status >= 400)
+			s->failures++;
+	}
+	fclose(infile);
+
+	if (num_sums > 0)
+		qsort(sums, num_sums, sizeof(struct prof_sum), cmp_prof_sum);
+
+	fprintf(outfile, _("%ld conduit runs in \"%s\".\n"), records, fname);
+	fprintf(outfile, "%6s %9s %8s %8s %8s %8s %7s %9s %8s %5s  %s\n",
+		_("Runs"), _("Total s"), _("Mean s"), _("Max s"),
+		_("CPU s"), _("RSS KB"), _("SPC"), _("SPC KB"),
+		_("DLP s"), _("Fail"), _("Flavor/Conduit (slowest DB)"));
+	for (i = 0; i < num_sums; i++)
+	{
+		fprintf(outfile,
+			"%6ld %9.2f %8.2f %8.2f %8.2f %8ld %7ld %9ld "
+			"%8.2f %5ld  %s %s (%s)\n",
+			sums[i].runs,
+			sums[i].wall,
+			sums[i].wall / sums[i].runs,
+			sums[i].wall_max,
+			sums[i].cpu,
+			sums[i].maxrss,
+			sums[i].spc_reqs,
+			sums[i].spc_bytes / 1024,
+			sums[i].dlp,
+			sums[i].failures,
+			sums[i].flavor,
+			sums[i].conduit,
+			sums[i].slowest_db);
+	}
+
+	for (i = 0; i < num_sums; i++)
+	{
+		free(sums[i].conduit);
+		free(sums[i].flavor);
+		free(sums[i].slowest_db);
+	}
+	if (sums != NULL)
+		free(sums);
+	return 0;
+}
+
+/* parse_record
+ * Split the profile record in 'line' (which is modified) into 'prof',
+ * whose strings point into 'line'.
+ * Returns 0 if successful, or -1 if 'line' isn't a valid record.
+ */
+static int
+parse_record(char *line, struct cond_prof *prof)
+{
+	char *field[CONDPROF_NFIELDS];
+	char *p;
+	char *nl;
+	int i;
+
+	if ((nl = strchr(line, '\n')) != NULL)
+		*nl = '\0';
+
+	p = line;
+	for (i = 0; i < CONDPROF_NFIELDS; i++)
+	{
+		field[i] = p;
+		if ((p = strchr(p, '\t')) == NULL)
+			break;
+		*p++ = '\0';
+	}
+	if (i != CONDPROF_NFIELDS-1)
+		return -1;		/* Wrong number of fields */
+
+	prof->start	= (time_t) atol(field[0]);
+	prof->flavor	= field[1];
+	prof->conduit	= field[2];
+	prof->dbname	= field[3];
+	prof->status	= atoi(field[4]);
+	prof->wall	= atol(field[5]);
+	prof->utime	= atol(field[6]);
+	prof->stime	= atol(field[7]);
+	prof->maxrss	= atol(field[8]);
+	prof->spc_reqs	= atol(field[9]);
+	prof->spc_in	= atol(field[10]);
+	prof->spc_out	= atol(field[11]);
+	prof->dlp	= atol(field[12]);
+	return 0;
+}
+
+/* cmp_prof_sum
+ * Comparison function for qsort(): biggest total time first.
+ */
+static int
+cmp_prof_sum(const void *a, const void *b)
+{
+	const struct prof_sum *sa = (const struct prof_sum *) a;
+	const struct prof_sum *sb = (const struct prof_sum *) b;
+
+	if (sa->wall > sb->wall)
+		return -1;
+	if (sa->wall < sb->wall)
+		return 1;
+	return strcmp(sa->conduit, sb->conduit);
+}
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
@@ -0,0 +1,55 @@
+/* condprof.h
+ *
+ * Profiling of external conduits: time, CPU and memory, and SPC
+ * traffic, per run.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+#ifndef _condprof_h_
+#define _condprof_h_
+
+#include "config.h"
+#include <stdio.h>
+#include <time.h>			/* For time_t */
+#include "coldsync.h"
+
+/* cond_prof
+ * What one run of a conduit cost. Times are in milliseconds. Figures
+ * that aren't known (e.g., the CPU time of a persistent conduit, which
+ * doesn't exit after each database) are -1.
+ */
+struct cond_prof
+{
+	time_t start;			/* When it was started */
+	const char *flavor;		/* Flavor it was run as */
+	const char *conduit;		/* Path to the conduit */
+	const char *dbname;		/* Database, or "" */
+	int status;			/* Status it returned */
+	long wall;			/* Elapsed time */
+	long utime;			/* User CPU time */
+	long stime;			/* System CPU time */
+	long maxrss;			/* Max. resident set size, in KB */
+	long spc_reqs;			/* # of SPC requests */
+	long spc_in;			/* # bytes of SPC requests */
+	long spc_out;			/* # bytes of SPC responses */
+	long dlp;			/* Time spent talking to the Palm
+					 * on its behalf */
+};
+
+extern int condprof_open(void);
+extern Bool condprof_enabled(void);
+extern void condprof_record(const struct cond_prof *prof);
+extern void condprof_close(const Bool keep_history);
+extern const char *condprof_history_fname(void);
+extern int condprof_summary(const char *fname, FILE *outfile);
+
+#endif	/* _condprof_h_ */
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
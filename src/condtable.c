@@ -0,0 +1,442 @@
+/* condtable.c
+ *
+ * Functions for indexing the conduit queue by flavor and creator/type.
+ *
+ * For every database, run_conduits() needs the conduits of one flavor
+ * whose creator/type pairs match the database, in the order in which
+ * they appear in the queue. Rather than search the whole queue each
+ * time, new_cond_table() sorts the conduits, once, into buckets keyed by
+ * flavor and creator/type pair, exactly as they were given in the config
+ * file. Then a database can only be matched by the buckets for its own
+ * creator/type, for its creator with a wildcard type, for its type with a
+ * wildcard creator, and for a wildcard creator and type. Each bucket
+ * lists the conduits' positions in the queue in ascending order, so
+ * merging those (at most) four lists gives the matching conduits in
+ * queue order.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>			/* For malloc(), realloc(), free() */
+
+#if HAVE_LIBINTL_H
+#  include <libintl.h>			/* For i18n */
+#endif	/* HAVE_LIBINTL_H */
+
+#include "coldsync.h"
+#include "condtable.h"
+
+/* cond_bucket
+ * The conduits of a given flavor that list a given creator/type pair.
+ */
+struct cond_bucket
+{
+	unsigned short flavor;		/* FLAVORFL_* (a single bit) */
+	udword creator;			/* Creator, or 0 for "any" */
+	udword type;			/* Type, or 0 for "any" */
+	unsigned char flags;		/* CREATYPEFL_* */
+	int *conduits;			/* Indices into the table's
+					 * 'conduits' array, in ascending
+					 * order */
+	int num;			/* # of entries in 'conduits' */
+	int slots;			/* Size of 'conduits' */
+};
+
+struct cond_table
+{
+	conduit_block **conduits;	/* The enabled conduits, in queue
+					 * order */
+	int num_conduits;		/* # of entries in 'conduits' */
+
+	struct cond_bucket *buckets;	/* Array of buckets */
+	int num_buckets;		/* # of entries in 'buckets' */
+	int buckets_slots;		/* Size of 'buckets' */
+
+	int *hash;			/* Hash table of indices into
+					 * 'buckets', or -1 */
+	int hash_size;			/* Size of 'hash'; a power of 2 */
+};
+
+static unsigned long bucket_hash(const unsigned short flavor,
+				 const udword creator,
+				 const udword type,
+				 const unsigned char flags);
+static int find_bucket(const struct cond_table *table,
+		       const unsigned short flavor,
+		       const udword creator,
+		       const udword type,
+		       const unsigned char flags);
+static int add_to_bucket(struct cond_table *table,
+			 const unsigned short flavor,
+			 const crea_type_t *ctype,
+			 const int index);
+static int rehash(struct cond_table *table);
+
+/* new_cond_table
+ * Build an index of the enabled conduits in the queue 'conduits'.
+ * Returns the new table, or NULL in case of error.
+ */
+struct cond_table *
+new_cond_table(conduit_block *conduits)
+{
+	struct cond_table *retval;
+	conduit_block *cond;
+	unsigned short flavor;
+	int n;
+	int i;
+
+	if ((retval = (struct cond_table *) malloc(sizeof(struct cond_table)))
+	    == NULL)
+		return NULL;
+	retval->conduits	= NULL;
+	retval->num_conduits	= 0;
+	retval->buckets		= NULL;
+	retval->num_buckets	= 0;
+	retval->buckets_slots	= 0;
+	retval->hash		= NULL;
+	retval->hash_size	= 0;
+
+	n = 0;
+	for (cond = conduits; cond != NULL; cond = cond->next)
+		n++;
+	if (n > 0 &&
+	    (retval->conduits = (conduit_block **)
+	     malloc(n * sizeof(conduit_block *))) == NULL)
+	{
+		free_cond_table(retval);
+		return NULL;
+	}
+
+	for (cond = conduits; cond != NULL; cond = cond->next)
+	{
+		if (!cond->enabled)
+			continue;
+
+		retval->conduits[retval->num_conduits] = cond;
+
+		for (flavor = 1; flavor != 0 && flavor <= cond->flavors;
+		     flavor <<= 1)
+		{
+			if ((cond->flavors & flavor) == 0)
+				continue;
+
+			for (i = 0; i < cond->num_ctypes; i++)
+				if (add_to_bucket(retval, flavor,
+						  &cond->ctypes[i],
+						  retval->num_conduits) < 0)
+				{
+					free_cond_table(retval);
+					return NULL;
+				}
+		}
+
+		retval->num_conduits++;
+	}
+
+	CONDUIT_TRACE(4)
+		fprintf(stderr, "new_cond_table: %d conduits, %d buckets\n",
+			retval->num_conduits, retval->num_buckets);
+
+	return retval;
+}
+
+/* free_cond_table
+ * Free a table allocated by new_cond_table(). The conduits themselves
+ * belong to the queue, and aren't freed.
+ */
+void
+free_cond_table(struct cond_table *table)
+{
+	int i;
+
+	if (table == NULL)
+		return;
+
+	for (i = 0; i < table->num_buckets; i++)
+		if (table->buckets[i].conduits != NULL)
+			free(table->buckets[i].conduits);
+	if (table->buckets != NULL)
+		free(table->buckets);
+	if (table->hash != NULL)
+		free(table->hash);
+	if (table->conduits != NULL)
+		free(table->conduits);
+	free(table);
+}
+
+/* cond_table_match
+ * Start a lookup in 'table' for the conduits of flavor 'flavor' (a single
+ * FLAVORFL_* bit) that apply to a database with the given creator and
+ * type. 'flags' are the CREATYPEFL_* flags the conduits' creator/type
+ * pairs must have, i.e., CREATYPEFL_ISNONE to find the conduits for "no
+ * database".
+ * Use cond_table_next() to get the conduits.
+ */
+void
+cond_table_match(const struct cond_table *table,
+		 struct cond_match *match,
+		 const unsigned short flavor,
+		 const udword creator,
+		 const udword type,
+		 const unsigned char flags)
+{
+	int b;
+
+	match->table = table;
+	match->nlists = 0;
+
+	/* Look for creator/type, creator / *, * /type and * / *. If the
+	 * creator or type is 0, some of these are the same bucket, and
+	 * mustn't be used twice.
+	 */
+#define ADD_BUCKET(c, t)						\
+	if ((b = find_bucket(table, flavor, (c), (t), flags)) >= 0)	\
+	{								\
+		match->list[match->nlists] = table->buckets[b].conduits; \
+		match->len[match->nlists] = table->buckets[b].num;	\
+		match->pos[match->nlists] = 0;				\
+		match->nlists++;					\
+	}
+
+	if (creator != 0L && type != 0L)
+		ADD_BUCKET(creator, type);
+	if (creator != 0L)
+		ADD_BUCKET(creator, 0L);
+	if (type != 0L)
+		ADD_BUCKET(0L, type);
+	ADD_BUCKET(0L, 0L);
+#undef ADD_BUCKET
+}
+
+/* cond_table_next
+ * Returns the next conduit found by the lookup 'match', or NULL if there
+ * are no more. The conduits are returned in queue order, each one only
+ * once, even if it has several creator/type pairs that match.
+ */
+conduit_block *
+cond_table_next(struct cond_match *match)
+{
+	int next = -1;		/* Lowest index at the head of a list */
+	int i;
+
+	for (i = 0; i < match->nlists; i++)
+	{
+		if (match->pos[i] >= match->len[i])
+			continue;
+		if (next < 0 || match->list[i][match->pos[i]] < next)
+			next = match->list[i][match->pos[i]];
+	}
+	if (next < 0)
+		return NULL;
+
+	/* Skip this conduit in every list it's in */
+	for (i = 0; i < match->nlists; i++)
+		if (match->pos[i] < match->len[i] &&
+		    match->list[i][match->pos[i]] == next)
+			match->pos[i]++;
+
+	return match->table->conduits[next];
+}
+
+/* bucket_hash
+ * Hash function for bucket keys (FNV-1a).
+ */
+static unsigned long
+bucket_hash(const unsigned short flavor,
+	    const udword creator,
+	    const udword type,
+	    const unsigned char flags)
+{
+	unsigned long h = 2166136261UL;
+	int i;
+
+	for (i = 24; i >= 0; i -= 8)
+	{
+		h ^= (creator >> i) & 0xff;
+		h *= 16777619UL;
+	}
+	for (i = 24; i >= 0; i -= 8)
+	{
+		h ^= (type >> i) & 0xff;
+		h *= 16777619UL;
+	}
+	h ^= flags;
+	h *= 16777619UL;
+	h ^= flavor;
+	h *= 16777619UL;
+	return h;
+}
+
+/* find_bucket
+ * Returns the index of the bucket with the given key, or -1 if there
+ * isn't one.
+ */
+static int
+find_bucket(const struct cond_table *table,
+	    const unsigned short flavor,
+	    const udword creator,
+	    const udword type,
+	    const unsigned char flags)
+{
+	unsigned long mask;
+	unsigned long h;
+	const struct cond_bucket *bucket;
+
+	if (table->hash_size == 0)
+		return -1;
+	mask = table->hash_size - 1;
+
+	for (h = bucket_hash(flavor, creator, type, flags) & mask;
+	     table->hash[h] >= 0;
+	     h = (h + 1) & mask)
+	{
+		bucket = &table->buckets[table->hash[h]];
+		if (bucket->flavor == flavor &&
+		    bucket->creator == creator &&
+		    bucket->type == type &&
+		    bucket->flags == flags)
+			return table->hash[h];
+	}
+	return -1;
+}
+
+/* add_to_bucket
+ * Add the conduit at 'index' in the table to the bucket for 'flavor' and
+ * 'ctype', creating the bucket if necessary. Conduits must be added in
+ * ascending order.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+add_to_bucket(struct cond_table *table,
+	      const unsigned short flavor,
+	      const crea_type_t *ctype,
+	      const int index)
+{
+	struct cond_bucket *bucket;
+	int b;
+
+	b = find_bucket(table, flavor, ctype->creator, ctype->type,
+			ctype->flags);
+	if (b < 0)
+	{
+		/* New bucket */
+		if (table->num_buckets >= table->buckets_slots)
+		{
+			struct cond_bucket *newbuckets;
+			int newslots;
+
+			newslots = table->buckets_slots == 0 ?
+				16 : 2 * table->buckets_slots;
+			if ((newbuckets = (struct cond_bucket *)
+			     realloc(table->buckets,
+				     newslots * sizeof(struct cond_bucket)))
+			    == NULL)
+				return -1;
+			table->buckets = newbuckets;
+			table->buckets_slots = newslots;
+		}
+
+		b = table->num_buckets;
+		bucket = &table->buckets[b];
+		bucket->flavor	= flavor;
+		bucket->creator	= ctype->creator;
+		bucket->type	= ctype->type;
+		bucket->flags	= ctype->flags;
+		bucket->conduits = NULL;
+		bucket->num	= 0;
+		bucket->slots	= 0;
+		table->num_buckets++;
+
+		/* Keep the hash table at most half full */
+		if (rehash(table) < 0)
+			return -1;
+	}
+	bucket = &table->buckets[b];
+
+	/* A conduit may list the same creator/type more than once. */
+	if (bucket->num > 0 && bucket->conduits[bucket->num-1] == index)
+		return 0;
+
+	if (bucket->num >= bucket->slots)
+	{
+		int *newconduits;
+		int newslots;
+
+		newslots = bucket->slots == 0 ? 4 : 2 * bucket->slots;
+		if ((newconduits = (int *)
+		     realloc(bucket->conduits, newslots * sizeof(int)))
+		    == NULL)
+			return -1;
+		bucket->conduits = newconduits;
+		bucket->slots = newslots;
+	}
+	bucket->conduits[bucket->num++] = index;
+
+	return 0;
+}
+
+/* rehash
+ * Make sure the hash table is at most half full, and that every bucket
+ * is in it.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+rehash(struct cond_table *table)
+{
+	unsigned long mask;
+	unsigned long h;
+	const struct cond_bucket *bucket;
+	int newsize;
+	int *newhash;
+	int i;
+
+	if (2 * table->num_buckets <= table->hash_size)
+	{
+		/* There's room. Just add the newest bucket. */
+		bucket = &table->buckets[table->num_buckets-1];
+		mask = table->hash_size - 1;
+		for (h = bucket_hash(bucket->flavor, bucket->creator,
+				     bucket->type, bucket->flags) & mask;
+		     table->hash[h] >= 0;
+		     h = (h + 1) & mask)
+			;
+		table->hash[h] = table->num_buckets - 1;
+		return 0;
+	}
+
+	for (newsize = 32; newsize < 2 * table->num_buckets; newsize *= 2)
+		;
+	if ((newhash = (int *) malloc(newsize * sizeof(int))) == NULL)
+		return -1;
+	if (table->hash != NULL)
+		free(table->hash);
+	table->hash = newhash;
+	table->hash_size = newsize;
+	for (i = 0; i < newsize; i++)
+		table->hash[i] = -1;
+
+	mask = newsize - 1;
+	for (i = 0; i < table->num_buckets; i++)
+	{
+		bucket = &table->buckets[i];
+		for (h = bucket_hash(bucket->flavor, bucket->creator,
+				     bucket->type, bucket->flags) & mask;
+		     table->hash[h] >= 0;
+		     h = (h + 1) & mask)
+			;
+		table->hash[h] = i;
+	}
+
+	return 0;
+}
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
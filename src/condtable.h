@@ -0,0 +1,54 @@
+/* condtable.h
+ *
+ * Index of the conduit queue, for finding the conduits that apply to a
+ * database without searching the whole queue.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+#ifndef _condtable_h_
+#define _condtable_h_
+
+#include "config.h"
+#include "coldsync.h"
+
+#define COND_MATCH_MAXLISTS	4	/* Max # of lists a lookup merges:
+					 * exact, creator/ *, * /type and
+					 * * / * */
+
+/* cond_match
+ * State of a lookup in a conduit table: the sorted lists of conduits
+ * that match, and how far along each one we are. The caller allocates
+ * this (typically on the stack); see cond_table_match() and
+ * cond_table_next().
+ */
+struct cond_match
+{
+	const struct cond_table *table;
+	int nlists;			/* # of lists in use */
+	const int *list[COND_MATCH_MAXLISTS];
+					/* Conduit indices, in ascending
+					 * order */
+	int len[COND_MATCH_MAXLISTS];	/* Length of each list */
+	int pos[COND_MATCH_MAXLISTS];	/* Next element of each list */
+};
+
+extern struct cond_table *new_cond_table(conduit_block *conduits);
+extern void free_cond_table(struct cond_table *table);
+extern void cond_table_match(const struct cond_table *table,
+			     struct cond_match *match,
+			     const unsigned short flavor,
+			     const udword creator,
+			     const udword type,
+			     const unsigned char flags);
+extern conduit_block *cond_table_next(struct cond_match *match);
+
+#endif	/* _condtable_h_ */
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
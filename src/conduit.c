@@ -17,21 +17,13 @@
 #include <pwd.h>			/* For getpwuid() */
 #include <sys/types.h>			/* For pid_t, for select(); write() */
 #include <sys/uio.h>			/* For write() */
-#include <sys/time.h>			/* For select() */
+#include <sys/time.h>			/* For select(), gettimeofday() */
 #include <sys/wait.h>			/* For waitpid() */
 #include <sys/socket.h>			/* For socketpair() */
 
-#if HAVE_SYS_PARAM_H
-#  include <sys/param.h>		/* For ntohs() and friends */
-#endif	/* HAVE_SYS_PARAM_H */
-#if HAVE_NETINET_IN_H
-#  include <netinet/in.h>		/* For ntohs() and friends, under
-					 * Linux */
-#endif	/* HAVE_NETINET_IN_H */
-
 #include <unistd.h>			/* For select(), write(), access() */
-#include <signal.h>			/* For signal() */
-#include <setjmp.h>			/* For sigsetjmp()/siglongjmp() */
+#include <fcntl.h>			/* For fcntl() */
+#include <signal.h>			/* For kill() */
 #include <errno.h>			/* For errno. Duh */
 #include <ctype.h>			/* For isdigit() and friends */
 
@@ -58,6 +50,10 @@
 #include "pref.h"
 #include "cs_error.h"
 #include "symboltable.h"
+#include "plugin.h"
+#include "condtable.h"
+#include "condio.h"
+#include "condprof.h"
 
 #include "conduits.h"
 
@@ -67,9 +63,10 @@
 				 * file descriptor leak.
 				 */
 
-typedef RETSIGTYPE (*sighandler) (int);	/* This is equivalent to FreeBSD's
-					 * 'sig_t', but that's a BSDism.
-					 */
+#define COND_EXIT_WAIT	5000	/* How long to wait (in ms) for a conduit
+				 * that has closed its stdout to exit,
+				 * before killing it.
+				 */
 
 static int run_conduits(struct Palm *palm,
 			const struct dlp_dbinfo *dbinfo,
@@ -78,22 +75,29 @@ static int run_conduits(struct Palm *palm,
 			const Bool with_spc,
 			pda_block *pda);
 static const char *find_in_path(const char *conduit);
+static struct cond_worker *find_worker(const conduit_block *conduit,
+				       const char *flavor,
+				       const Bool with_spc);
+static void drop_worker(struct cond_worker *worker);
 static pid_t spawn_conduit(const char *path,
                            const char *cwd,
 			   char * const argv[],
-			   FILE **tochild,
-			   FILE **fromchild,
+			   int *tochild,
+			   int *fromchild,
 			   const fd_set *openfds);
-static int cond_readline(char *buf,
-			 int len,
-			 FILE *fromchild);
-static int cond_readstatus(FILE *fromchild);
-static RETSIGTYPE sigchld_handler(int sig);
-static INLINE Bool crea_type_matches(
-	const conduit_block *cond,
-	const udword creator,
-	const udword type,
-	const unsigned char flags);
+static int cond_line(struct cond_io *io, char *line, void *arg);
+static int cond_spc(struct cond_io *io,
+		    struct spc_hdr *req,
+		    const unsigned char *inbuf,
+		    unsigned char **outbuf,
+		    void *arg);
+static int cond_status(char *buf, const Bool persistent);
+static long elapsed_ms(const struct timeval *start);
+struct conduit_run;
+static void profile_run(const struct conduit_run *run,
+			const struct cond_io *io,
+			const char *flavor,
+			const conduit_block *conduit);
 
 typedef int (*ConduitFunc)(PConnection *pconn,
 			   const struct dlp_dbinfo *dbinfo,
@@ -119,103 +123,69 @@ struct ConduitDef builtin_conduits[] = {
 };
 #define num_builtin_conduits	sizeof(builtin_conduits) / sizeof(builtin_conduits[0])
 
-/* The following variables describe the state of the conduit process. They
- * are global variables because this data is set and used in different
- * functions.
- * Currently, ColdSync only spawns one child at a time, so there is only
- * one of each. When and if it becomes possible to spawn multiple children
- * at a time, this will need to be updated.
- */
-static volatile pid_t conduit_pid = -1;	/* The PID of the currently-running
-					 * conduit.
-					 */
-static int conduit_status = 0;		/* Last known status of the
-					 * conduit, as set by waitpid().
-					 */
-static sigjmp_buf chld_jmpbuf;		/* Saved state for sigsetjmp() */
-static volatile sig_atomic_t canjump = 0;
-					/* Essentially a Bool: true iff the
-					 * SIGCHLD handler can safely call
-					 * longjmp() [*]
-					 */
-	/* [*] See Stevens, Richard W., "Advanced Programming in the UNIX
-	 * Environment", Addison-Wesley, 1993, section 10.15, "sigsetjmp
-	 * and siglongjmp Functions".
-	 */
-
-/* block_sigchld
- * Just a convenience function. This blocks SIGCHLD so that the current
- * process doesn't get interrupted by a signal at the wrong moment.
- *
- * The 'sigmask' argument gets filled in with a cookie that will later be
- * passed to unblock_sigchld() to unblock the signal.
- */
-static INLINE void
-block_sigchld(sigset_t *sigmask)
-{
-	sigset_t new_sigmask;
-
-	CONDUIT_TRACE(7)
-		fprintf(stderr, "Blocking SIGCHLD.\n");
-	sigemptyset(&new_sigmask);
-	sigaddset(&new_sigmask, SIGCHLD);
-	sigprocmask(SIG_BLOCK, &new_sigmask, sigmask);
-}
-
-/* unblock_sigchld
- * Just a convenience function. Unblocks SIGCHLD by restoring the process's
- * signal mask to what it was before block_sigchld() was called.
- * The 'old_sigmask' argument is the cookie that was filled in by
- * block_sigchld().
+/* conduit_run
+ * What run_conduit() knows about a running conduit. The event loop's
+ * callbacks, cond_line() and cond_spc(), update it.
  */
-static INLINE void
-unblock_sigchld(const sigset_t *old_sigmask)
+struct conduit_run
 {
-	CONDUIT_TRACE(7)
-		fprintf(stderr, "Unblocking SIGCHLD.\n");
-	sigprocmask(SIG_SETMASK, old_sigmask, NULL);
-}
+	struct Palm *palm;
+	const struct dlp_dbinfo *dbinfo;
+	struct spc_shm *shm;	/* Shared memory for SPC, or NULL */
+	Bool persistent;	/* Is this a persistent conduit? */
+	int laststatus;		/* The last status code printed by the
+				 * child. This is used as its exit status.
+				 */
+	enum { COND_RUNNING,	/* Still going */
+	       COND_REPLIED,	/* A persistent conduit is done with this
+				 * database */
+	       COND_FAILED	/* Gave up on the conduit */
+	} state;
+
+	/* For the profiler */
+	time_t start;		/* When it was started */
+	struct timeval started;	/* Ditto, more precisely */
+	long spc_reqs;		/* # of SPC requests */
+	long spc_in;		/* # bytes of SPC requests */
+	long spc_out;		/* # bytes of SPC responses */
+	long dlp;		/* Time spent in spc_send() (ms) */
+};
 
-/* poll_fd
- * Poll the file descriptor 'fd' to see if it's readable. If 'for_writing'
- * is True, check to see if 'fd' is writable.
- * Returns 1 if 'fd' is readable (or writable, if 'for_writing' is set), or
- * 0 if it isn't. Returns a negative value in case of error.
+/* Persistent conduits
+ * Normally, a conduit is run once for each database, and exits when it's
+ * done. A conduit block with the "persistent" flag is instead started
+ * the first time it is needed, and kept running for the rest of the
+ * sync. Each time it is needed after that, it is sent the same headers
+ * as a new conduit would get (plus "Persistent: 1") on its stdin. It
+ * reports its status as usual, and then prints an empty line to say
+ * that it's done with that database and is ready for the next one.
+ * When coldsync closes its stdin, it should exit.
+ * Each running instance is described by a 'struct cond_worker'. There
+ * is one per conduit and flavor, since the flavor is given on the
+ * command line.
  */
-static INLINE int
-poll_fd(const int fd, const Bool for_writing)
+struct cond_worker
 {
-	fd_set fds;
-	struct timeval timeout;
-	int err;
-
-	/* This works simply by calling select() with a timeout of 0. That
-	 * is, select() should simply see if the appropriate file
-	 * descriptor is readable (or writable).
-	 */
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-
-	timeout.tv_sec  = 0;
-	timeout.tv_usec = 0;
-
-	if (for_writing)
-		err = select(fd+1, NULL, &fds, NULL, &timeout);
-	else
-		err = select(fd+1, &fds, NULL, NULL, &timeout);
+	struct cond_worker *next;
+	char *path;		/* Conduit path */
+	char *cwd;		/* Conduit working directory, or NULL */
+	const char *flavor;	/* Flavor it was started as */
+	Bool with_spc;		/* Whether it has an SPC pipe */
+	pid_t pid;		/* Its PID */
+	struct cond_io *io;	/* Its stdin, stdout and our end of the
+				 * SPC pipe */
+	int spcfd;		/* Its end of the SPC pipe, if 'with_spc' */
+	struct spc_shm shm;	/* Shared memory for SPC payloads */
+};
 
-	if (err < 0)	return -1;	/* An error occurred */
-	if (err == 0)	return  0;	/* File descriptor not readable */
-	return 1;			/* File descriptor is readable */
-}
+static struct cond_worker *workers = NULL;
+				/* Persistent conduits that are running */
 
-/* The following two variables are for setvbuf's benefit, for when we make
- * the conduit's stdin and stdout be line-buffered.
- */
-#if 0	/* This isn't actually used anywhere */
-static char cond_stdin_buf[BUFSIZ];	/* Buffer for conduit's stdin */
-#endif	/* 0 */
-static char cond_stdout_buf[BUFSIZ];	/* Buffer for conduit's stdout */
+#define COND_ENDOFREPLY	1000	/* cond_status() return value: a
+				 * persistent conduit is done with the
+				 * current database. Real status codes are
+				 * between 0 and 999.
+				 */
 
 /* Add a new header to list, allocating memory as needed, and copying the
  * values passed in. Returns zero on success
@@ -338,61 +308,30 @@ run_conduit(struct Palm *palm,
 	int i;
 	static char * argv[4];	/* Conduit's argv */
 	pid_t pid;		/* Conduit's PID */
-	FILE *fromchild = NULL;	/* File handle to child's stdout */
-	FILE *tochild = NULL;	/* File handle to child's stdin */
+	int fromchild = -1;	/* Child's stdout */
+	int tochild = -1;	/* Child's stdin */
+	struct cond_io *io = NULL;
+				/* The conduit, as seen by the event loop */
+	struct conduit_run run;	/* State passed to the callbacks */
+	int exit_wait = 0;	/* How long we've waited for it to exit
+				 * after it closed its stdout (ms) */
 	const char *bakfname;	/* Path to backup file (backup or install) */
-	volatile int laststatus = 501;
-				/* The last status code printed by the
-				 * child. This is used as its exit status.
-				 * Defaults to 501, since that's a sane
-				 * return status if the conduit doesn't run
-				 * at all (e.g., it isn't executable).
-				 */
 	struct cond_header *hdr;	/* User-supplied header */
-	sighandler old_sigchld;		/* Previous SIGCHLD handler */
 	struct cond_header* headers = NULL; /* System headers */
 	unsigned int num_headers = 0;		/* Number of headers in list */
 	unsigned int max_headers = 0;		/* Amount of room in list */
 	int spcpipe[2];		/* Pipe for SPC-based communication */
-	static enum { SPC_Read_Header,  SPC_Read_Data,
-		      SPC_Write_Header, SPC_Write_Data
-	} spc_state;		/* This variable helps us implement a state
-				 * machine, by indicating what needs to be
-				 * done next:
-				 *	- read the header of the next SPC
-				 *	request from the conduit
-				 *	- read (more of) the data of an SPC
-				 *	request from the conduit
-				 *	- send the SPC response header to
-				 *	the conduit
-				 *	- send (more of) the SPC response
-				 *	data to the conduit
-				 */
-
-	struct spc_hdr spc_req;
-				/* SPC request header */
-	/* These next few variables are declared 'volatile' mainly to make
-	 * gcc shut up: it complains that they might get clobbered by
-	 * longjmp(). This is true, but we don't care.
-	 * Note the order for pointers, though: it is the pointer that is
-	 * volatile, not what it points to.
-	 */
-	unsigned char * volatile spc_inbuf = NULL;
-				/* SPC input buffer */
-	volatile unsigned long spc_toread = 0;
-				/* # bytes of an SPC request left to read */
-	unsigned char * volatile spc_outbuf = NULL;
-				/* SPC output buffer */
-	volatile unsigned long spc_towrite = 0;
-				/* # bytes of an SPC response left to write */
-	unsigned char * volatile spcp = NULL;
-				/* Pointer into spc_inbuf or spc_outbuf */
-	sigset_t sigmask;
-				/* Signal mask for {,un}block_sigchld() */
-	const struct pref_item ** volatile pref_list = NULL;
+	struct spc_shm spc_shm;	/* Shared memory for SPC payloads */
+	const struct pref_item **pref_list = NULL;
 				/* Array of pointers to preference items in
 				 * the cache */
 	char numbuf[16]; /* big enough for a fd value or a version */
+	const Bool persistent =
+		(conduit->flags & CONDFL_PERSISTENT) ? True : False;
+	struct cond_worker *worker = NULL;
+				/* Running instance of this conduit, if
+				 * it's persistent */
+	Bool reused = False;	/* Was 'worker' already running? */
 
 
 	if (conduit->path == NULL)
@@ -401,6 +340,25 @@ run_conduit(struct Palm *palm,
 		 */
 		return 201;		/* Success (trivially) */
 
+	run.palm = palm;
+	run.dbinfo = dbinfo;
+	run.shm = NULL;
+	run.persistent = persistent;
+	run.laststatus = 501;	/* Default to 501, since that's a sane
+				 * return status if the conduit doesn't
+				 * run at all (e.g., it isn't executable).
+				 */
+	run.state = COND_RUNNING;
+	run.start = time(NULL);
+	gettimeofday(&run.started, NULL);
+	run.spc_reqs = run.spc_in = run.spc_out = run.dlp = 0L;
+
+	/* If this is a persistent conduit, see whether it's already
+	 * running.
+	 */
+	if (persistent)
+		worker = find_worker(conduit, flavor, with_spc);
+
 	/* If this conduit might understand SPC, set up a pipe for the
 	 * child to communicate to the parent.
 	 */
@@ -412,8 +370,20 @@ run_conduit(struct Palm *palm,
 		 */
 		/* XXX - Check for the abort condition ;) */
 		DlpOpenConduit(palm_pconn(palm));
+	}
 
+	spc_shm.fd = -1;
+	spc_shm.base = NULL;
+	spc_shm.size = 0L;
 
+	if (with_spc && worker != NULL)
+	{
+		/* A persistent conduit keeps its SPC pipe */
+		spcpipe[0] = worker->spcfd;
+		spcpipe[1] = worker->io->spcfd;
+		spc_shm = worker->shm;
+	} else if (with_spc)
+	{
 		/* Set up a pair of pipes for talking SPC with the child */
 		if ((err = socketpair(AF_UNIX, SOCK_STREAM, 0, spcpipe)) < 0)
 		{
@@ -421,16 +391,15 @@ run_conduit(struct Palm *palm,
 			return 501;
 		}
 
-		/* XXX - Arrange for the parent end of the pipe to be
-		 * closed upon exec().
-		 */
-		/* XXX - Ditto for the Palm file descriptor */
-
-		/* XXX - Should this pipe be made unbuffered? (Probably
-		 * not, but it'd be nice to flush it after writing.)
-		 */
+		/* And shared memory for large requests, if we can. */
+		if (spc_shm_create(&spc_shm) < 0)
+		{
+			CONDUIT_TRACE(3)
+				fprintf(stderr, "No shared memory for SPC. "
+					"Using the pipe only.\n");
+		}
 
-		spc_state = SPC_Read_Header;	/* Next thing to do */
+		/* XXX - Ditto for the Palm file descriptor */
 
 		CONDUIT_TRACE(6)
 		{
@@ -454,91 +423,128 @@ run_conduit(struct Palm *palm,
 			return 502;
 		}
 	}
+	if (spc_shm.base != NULL)
+		run.shm = &spc_shm;
 
-	/* Set handler for SIGCHLD, so that we can keep track of what
-	 * happens to conduit child processes.
-	 */
-	old_sigchld = signal(SIGCHLD, sigchld_handler);
-	if (old_sigchld == SIG_ERR)
-	{
-		Error(_("%s: Can't set signal handler."),
-		      "run_conduit");
-		Perror("signal");
-		return 503;
-	}
-
-	/* Before all the jumping stuff, make sure the pref_list is
-	 * allocated.
-	 */
 	CONDUIT_TRACE(6)
 		fprintf(stderr, "run_conduit: %d prefs in this conduit\n",
 			conduit->num_prefs);
 	if (conduit->num_prefs > 0)
 		pref_list = calloc(conduit->num_prefs, sizeof *pref_list);
 
-	/* When the child exits, sigchld_handler() will longjmp() back to
-	 * here. This way, none of the other code has to worry about
-	 * whether the conduit is still running.
-	 */
-	if ((err = sigsetjmp(chld_jmpbuf, 1)) != 0)
-	{
-		/* NB: Both FreeBSD's and the Open Group's manual entries
-		 * say that longjmp() restores the environment saved by
-		 * _the most recent_ invocation of setjmp().
-		 *
-		 * Furthermore, Stevens says that you can't call longjmp()
-		 * if the function that called setjmp() has already
-		 * terminated.
-		 *
-		 * This implies that it's okay to call setjmp() multiple
-		 * times with the same jump buffer.
-		 */
-		CONDUIT_TRACE(6)
-			fprintf(stderr, "Returned from sigsetjmp(): %d\n",
-				err);
-		canjump = 0;
-		goto abort;
-	}
-
-	canjump = 1;			/* Tell the SIGCHLD signal handler
-					 * that it can call siglongjmp().
-					 */
-
 	argv[0] = conduit->path;	/* Path to conduit */
 	argv[1] = "conduit";		/* Mandatory argument */
 	argv[2] = flavor;		/* Flavor argument */
 	argv[3] = NULL;			/* Terminator */
 
-	pid = spawn_conduit(conduit->path,
-			    conduit->cwd,				
-			    argv,
-			    &tochild, &fromchild,
-			    NULL);
-	if (pid < 0)
+	if (worker != NULL)
 	{
-		Error(_("%s: Can't spawn conduit."),
-		      "run_conduit");
+		/* The conduit is already running */
+		io = worker->io;
+		pid = worker->pid;
+		reused = True;
+
+		CONDUIT_TRACE(3)
+			fprintf(stderr, "Reusing conduit %s, pid %d\n",
+				conduit->path, (int) pid);
+	} else {
+		fd_set keepfds;		/* Descriptors the conduit should
+					 * inherit */
+
+		/* The shared memory is close-on-exec, so that nothing else
+		 * inherits it. Let this conduit have it, though.
+		 */
+		FD_ZERO(&keepfds);
+		if (spc_shm.fd >= 0)
+			FD_SET(spc_shm.fd, &keepfds);
+
+		pid = spawn_conduit(conduit->path,
+				    conduit->cwd,
+				    argv,
+				    &tochild, &fromchild,
+				    &keepfds);
+		if (pid < 0)
+		{
+			Error(_("%s: Can't spawn conduit."),
+			      "run_conduit");
+
+			/* Let's hope that this isn't a fatal problem */
+			goto abort;
+		}
+
+		if ((io = condio_new(pid, tochild, fromchild,
+				     with_spc ? spcpipe[1] : -1)) == NULL)
+		{
+			kill(pid, SIGTERM);
+			waitpid(pid, NULL, 0);
+			close(tochild);
+			close(fromchild);
+			goto abort;
+		}
+
+		if (persistent &&
+		    (worker = (struct cond_worker *)
+		     calloc(1, sizeof(struct cond_worker))) != NULL)
+		{
+			worker->path = strdup(conduit->path);
+			worker->cwd = (conduit->cwd == NULL ? NULL :
+				       strdup(conduit->cwd));
+			worker->flavor = flavor;
+			worker->with_spc = with_spc;
+			worker->pid = pid;
+			worker->io = io;
+			worker->spcfd = with_spc ? spcpipe[0] : -1;
+			worker->shm = spc_shm;
+
+			/* Don't let other conduits inherit this one's
+			 * end of the SPC pipe: it would never see the end
+			 * of it.
+			 */
+			if (with_spc)
+				fcntl(spcpipe[0], F_SETFD, FD_CLOEXEC);
 
-		/* Let's hope that this isn't a fatal problem */
+			worker->next = workers;
+			workers = worker;
+		}
+	}
+
+	/* Start listening to it right away: a persistent conduit that
+	 * died since last time, or a new one that couldn't be exec()ed,
+	 * may already have exited.
+	 */
+	condio_start(io, cond_line, with_spc ? cond_spc : NULL, &run);
+	if (reused && io->exited)
+	{
+		Error(_("%s: Persistent conduit %s exited "
+			"unexpectedly."),
+		      "run_conduit", conduit->path);
 		goto abort;
 	}
 
 	/* Feed the various parameters to the child via 'tochild'. */
 
 	/* Initialize the standard header values */
-	block_sigchld(&sigmask);	/* Don't disturb me now */
-
 	add_header(&headers, &num_headers, &max_headers, "Daemon", PACKAGE);
 	add_header(&headers, &num_headers, &max_headers, "Version", VERSION);
 	add_header(&headers, &num_headers, &max_headers,
 		"SyncType", global_opts.force_slow || need_slow_sync ? "Slow" : "Fast");
-	add_header(&headers, &num_headers, &max_headers,
-		"PDA-Snum", palm_serial(palm));
-	add_header(&headers, &num_headers, &max_headers,
-		"PDA-Username", palm_username(palm));
-	sprintf(numbuf, "%d", (int) palm_userid(palm));
-	add_header(&headers, &num_headers, &max_headers,
-		"PDA-UID", numbuf);
+	if (palm != NULL)
+	{
+		/* Fetch conduits run ahead of time (see PrefetchConduits())
+		 * don't know which Palm they're for.
+		 */
+		add_header(&headers, &num_headers, &max_headers,
+			"PDA-Snum", palm_serial(palm));
+		add_header(&headers, &num_headers, &max_headers,
+			"PDA-Username", palm_username(palm));
+		sprintf(numbuf, "%d", (int) palm_userid(palm));
+		add_header(&headers, &num_headers, &max_headers,
+			"PDA-UID", numbuf);
+	}
+
+	if (persistent)
+		add_header(&headers, &num_headers, &max_headers,
+			"Persistent", "1");
 
 	if (pda)
 	{
@@ -625,6 +631,16 @@ run_conduit(struct Palm *palm,
 		add_header(&headers, &num_headers, &max_headers,
 			"SPCPipe", numbuf);
 
+		if (spc_shm.base != NULL)
+		{
+			sprintf(numbuf, "%d", spc_shm.fd);
+			add_header(&headers, &num_headers, &max_headers,
+				"SPCShm", numbuf);
+			sprintf(numbuf, "%ld", spc_shm.size);
+			add_header(&headers, &num_headers, &max_headers,
+				"SPCShmSize", numbuf);
+		}
+
 		/* provide DLP version numbers. We only bother when we've
 		 * got SPC enabled since it's useless otherwise.
 		 */
@@ -645,9 +661,10 @@ run_conduit(struct Palm *palm,
 	 */
 	headers[num_headers-1].next = conduit->headers;
 
-	unblock_sigchld(&sigmask);
-
-	/* Iterate over the list of headers */
+	/* Queue the headers, the empty line that ends them, and the
+	 * preferences' raw data. The event loop sends them as the conduit
+	 * reads them, while listening to whatever it has to say.
+	 */
 	for (hdr = headers; hdr != NULL; hdr = hdr->next)
 	{
 		static char buf[COND_MAXLINELEN+2];
@@ -655,10 +672,6 @@ run_conduit(struct Palm *palm,
 				 * send. The +2 is to hold a \n and a NUL
 				 * at the end.
 				 */
-		char *bufp;	/* Pointer to the part of 'buf' that should
-				 * be written next.
-				 */
-		int len;	/* How many bytes of 'bufp' to write */
 
 		/* Skip if the header value is NULL */
 		if (hdr->value == NULL)
@@ -673,528 +686,357 @@ run_conduit(struct Palm *palm,
 		snprintf(buf, COND_MAXLINELEN+1, "%.*s: %s\n",
 			 COND_MAXHFIELDLEN, hdr->name,
 			 hdr->value);
-		bufp = buf;
-		len = strlen(bufp);
 
-	  check_status:
-		/* Before proceeding, see if the child has written a status
-		 * message.
-		 */
-		err = poll_fd(fileno(fromchild), False);
-		if (err < 0)
-		{
-			/* An error occurred. I don't think we care at this
-			 * point.
-			 */
-			CONDUIT_TRACE(5)
-				Perror("poll_fd");
-		} else if (err > 0)
-		{
-			/* The child has printed something. Read it, then
-			 * check again.
-			 */
-			err = cond_readstatus(fromchild);
-			if (err > 0)
-				laststatus = err;
-			goto check_status;
-		}
-
-		/* Okay, now that the child has nothing to say, we can send
-		 * it the current header.
-		 */
 		CONDUIT_TRACE(4)
 			fprintf(stderr, ">>> %s: %s\n",
 				hdr->name,
 				hdr->value);
 
-		while (len > 0)
-		{
-			CONDUIT_TRACE(7)
-				fprintf(stderr, "writing chunk [%s] (%d)\n",
-					bufp, len);
-			err = write(fileno(tochild), bufp, len);
-			if (err < 0)
-			{
-				/* An error occurred */
-				Error(_("Couldn't send header to conduit."));
-				Perror("write");
-				goto abort;
-			}
-
-			/* write() might not have written all of 'bufp' */
-			len -= err;
-			bufp += err;
-		}
+		if (condio_write(io, buf, strlen(buf)) < 0)
+			goto abort;
 	}
 
-	/* Send an empty line to the child (end of headers) */
-	fprintf(tochild, "\n");
+	if (condio_write(io, "\n", 1) < 0)
+		goto abort;
 
-	/* Now write all the raw data to the child */
 	for(i = 0; i < conduit->num_prefs; i++)
 	{
-		int rc = fwrite(pref_list[i]->contents,
-			1,
-			pref_list[i]->contents_info->len,
-			tochild);
-		if (rc != pref_list[i]->contents_info->len)
+		if (condio_write(io, pref_list[i]->contents,
+				 pref_list[i]->contents_info->len) < 0)
 		{
 			Error(_("Couldn't send preference to conduit."));
 			goto abort;
 		}
 	}
-	fflush(tochild);
 
-	/* Listen for the child to either a) print a status message on its
-	 * stdout, or b) send an SPC request on its SPC file descriptor.
+	/* Run the event loop until the conduit exits (or, if it's
+	 * persistent, says it's done), or something goes wrong.
 	 */
-	while (1)
+	while (run.state == COND_RUNNING && !condio_finished(io))
 	{
-		fd_set in_fds;		/* Set of file descriptors to
-					 * listen to */
-		fd_set out_fds;		/* Set of file descriptors to
-					 * write to */
-		int max_fd;		/* Highest-numbered file descriptor
-					 * to listen to. */
-
-		FD_ZERO(&in_fds);
-		FD_ZERO(&out_fds);
-		FD_SET(fileno(fromchild), &in_fds);
-		max_fd = fileno(fromchild);
-		if (with_spc)
+		int timeout = -1;
+
+		if (io->fromchild < 0 && !io->exited)
 		{
-			/* Depending on the state of the SPC state machine,
-			 * we should either expect to read from or expect
-			 * to write to the SPC pipe, but not both.
-			 * This is because the SPC pipe will usually be
-			 * writable even if we have nothing to write to it,
-			 * and we don't want to busy-wait.
+			/* It has closed its stdout, so it ought to be
+			 * exiting. Don't wait forever, though.
 			 */
-			switch (spc_state)
-			{
-			    case SPC_Read_Header:
-			    case SPC_Read_Data:
-				FD_SET(spcpipe[1], &in_fds);
+			if (exit_wait >= COND_EXIT_WAIT)
 				break;
-			    case SPC_Write_Header:
-			    case SPC_Write_Data:
-				FD_SET(spcpipe[1], &out_fds);
-				break;
-			    default:
-				Error(_("%s: Conduit handler is in "
-					"an inconsistent state at\n"
-					"%s, line %d. Please notify the "
-					"maintainer."),
-				      "run_conduit", __FILE__, __LINE__);
-				goto abort;
-			}
-
-			if (spcpipe[1] > max_fd)
-				max_fd = spcpipe[1];
+			timeout = 100;
+			exit_wait += timeout;
 		}
 
-		/* XXX - This really ought to time out: a buggy conduit
-		 * might not send the right amount of data, in which case
-		 * this will currently hang forever.
-		 * The proper timeout depends on the context, of course:
-		 * for a Dump conduit, it might be okay to wait 30 seconds
-		 * for status info. In SPC_Read_Data state, 1 second should
-		 * be enough. Try to find some balance that's reasonable
-		 * but doesn't make the user wait forever.
-		 */
-		err = select(max_fd+1, &in_fds, &out_fds, NULL, NULL);
-		CONDUIT_TRACE(7)
-			fprintf(stderr,
-				"run_conduit: select() returned %d\n",
-				err);
+		if (condio_poll(timeout) < 0)
+			break;
+	}
+	condio_stop(io);
 
-		if (err < 0)
-		{
-			if (errno != EINTR)
-			{
-				Error(_("%s: Error in select()."),
-				      "run_conduit");
-				Perror("select");
+	if (run.state == COND_REPLIED)
+		goto done;
 
-				/* EINTR is harmless. All of the other ways
-				 * select() can return -1 are severe
-				 * errors. I don't know how to continue.
-				 */
-				goto abort;
-			}
-		}
-		if (err == 0)
-		{
-			/* This should never happen */
-			Warn(_("%s: select() returned 0. I'm puzzled."),
-			     "run_conduit");
-			continue;
-		}
-
-		/* Check fromchild, to see if the child has printed a
-		 * status message to stdout.
+  abort:
+	if (io != NULL)
+	{
+		/* If the conduit isn't dead, presumably there was an
+		 * internal error. Kill it, and see whether it had anything
+		 * to say.
 		 */
-		if (FD_ISSET(fileno(fromchild), &in_fds))
-		{
-			CONDUIT_TRACE(4)
-				fprintf(stderr,
-					"Child has printed to stdout.\n");
-
-			block_sigchld(&sigmask);
-			err = cond_readstatus(fromchild);
-			unblock_sigchld(&sigmask);
-
-			CONDUIT_TRACE(2)
-				fprintf(stderr,
-					"run_conduit: got status %d\n",
-					err);
-			if (err <= 0)
-				/* Got an end of file (or an error) */
-				goto abort;
-
-			/* cond_readstatus() got a legitimate status.
-			 * Remember it for later.
-			 */
-			laststatus = err;
-		}
+		condio_stop(io);
+		condio_kill(io);
+		profile_run(&run, io, flavor, conduit);
 
-		/* From here on in, everything has to do with SPC */
-		if (!with_spc)
-			continue;
-
-		/* Check the state of the SPC state machine, and figure out
-		 * what to do next.
-		 */
+		/* If this was a persistent conduit, it isn't anymore */
+		if (worker != NULL)
+			drop_worker(worker);
 
-		/* State 0: expecting to read a header */
-		if ((spc_state == SPC_Read_Header) &&
-		    FD_ISSET(spcpipe[1], &in_fds))
-		{
-			static unsigned char spc_header[SPC_HEADER_LEN];
+		CONDUIT_TRACE(6)
+			fprintf(stderr, "Closing child's file descriptors.\n");
+		condio_free(io);
+	} else {
+		if (with_spc)
+			close(spcpipe[1]);
+		profile_run(&run, NULL, flavor, conduit);
+	}
 
-			/* Read the SPC header. This consists of an opcode,
-			 * a status code (ignored), and a length.
-			 */
-			err = read(spcpipe[1], spc_header, SPC_HEADER_LEN);
-			if (err < 0)
-			{
-				Error(_("%s: Error reading SPC request "
-					"from conduit."),
-				      "run_conduit");
-				Perror("read");
-				/* XXX - What now? Abort? */
-			}
-			if (err != SPC_HEADER_LEN)
-			{
-				/* The child printed something, but it's
-				 * not the right length for an SPC request.
-				 */
-				/* XXX - Send a "bad request" header to the
-				 * child.
-				 */
-				Error(_("%s: Error header wrong length %ld."),
-				      "run_conduit",err);
-				Perror("read");
-				goto abort;
-			}
+	if (with_spc)
+	{
+		/* A Palm doesn't allow all that many open databases
+		 * at once. If a conduit terminates with a database open
+		 * (prematurely or otherwise) it can lock out any other conduits
+		 * that do DlpOpenDB calls. Since this includes essentially _all_
+		 * sync conduits, we want to prevent it by just closing all the
+		 * databases.
+		 */
 
-			/* Very crude parsing of the received header */
-			/* XXX - There should probably be a function to
-			 * parse this.
-			 */
-			spc_req.op = ntohs(*((unsigned short *) spc_header));
-			spc_req.len = ntohl(
-				* ((unsigned long *) (spc_header+4)));
-
-			CONDUIT_TRACE(5)
-				fprintf(stderr,
-					"SPC request OP == %d, "
-					"len == %ld\n",
-					spc_req.op,
-					spc_req.len);
-
-			spc_toread = spc_req.len;
-			if (spc_req.len > 0)
-			{
-				block_sigchld(&sigmask);
+		DlpCloseDB(palm_pconn(palm), DLPCMD_CLOSEALLDBS, 0);
 
-				spc_inbuf = malloc(spc_req.len);
-				/* XXX - Error-checking */
-				spcp = spc_inbuf;
+		close(spcpipe[0]);
+		spc_shm_destroy(&spc_shm);
+  	}
 
-				unblock_sigchld(&sigmask);
-			}
+	/* Let's not hog memory */
+	if (pref_list != NULL)
+		free(pref_list);
 
-			spc_state = SPC_Read_Data;
+	free_headers (&headers, &num_headers);
 
-			/* XXX - This is rather a gross hack: if there are
-			 * no data following the request, then we don't
-			 * want to wait on data that's not going to come.
-			 * By not continuing, we fall through directly to
-			 * the next case, which will immediately send the
-			 * request.
-			 */
-			if (spc_req.len > 0)
-				continue;
-		}
+	return run.laststatus;
 
-		/* State 1: Expecting to read SPC data. */
-		if ((spc_state == SPC_Read_Data) &&
-		    FD_ISSET(spcpipe[1], &in_fds))
-		{
-			/* Need to read (continue reading) SPC data */
+  done:
+	/* A persistent conduit has finished with this database. Leave it
+	 * running for the next one.
+	 */
+	profile_run(&run, NULL, flavor, conduit);
+	if (with_spc)
+		/* See above */
+		DlpCloseDB(palm_pconn(palm), DLPCMD_CLOSEALLDBS, 0);
 
-			if (spc_toread > 0)
-			{
-				/* Read the next chunk */
-				err = read(spcpipe[1], spcp, spc_toread);
+	if (pref_list != NULL)
+		free(pref_list);
 
-				if (err < 0)
-				{
-					Error(_("%s: Error reading SPC "
-						"request."),
-					      "run_conduit");
-					Perror("read");
-					/* XXX - What now? Abort or
-					 * something.
-					 */
-				}
+	free_headers (&headers, &num_headers);
 
-				spc_toread -= err;
-			}
+	return run.laststatus;
+}
 
-			if (spc_toread > 0)
-				/* There's more left to read. Wait for it */
-				continue;
+/* cond_line
+ * condio callback: the conduit has printed a status line.
+ */
+static int
+cond_line(struct cond_io *io, char *line, void *arg)
+{
+	struct conduit_run *run = (struct conduit_run *) arg;
+	int err;
 
-			/* Now we've read all of the SPC request, and can
-			 * process it.
-			 */
-			block_sigchld(&sigmask);
-			err = spc_send(&spc_req,
-				       palm_pconn(palm),
-				       dbinfo,
-				       spc_inbuf,
-				       (unsigned char **) &spc_outbuf);
-				/* For error-checking, see below */
-				/* NB: The cast of '&spc_outbuf' is utterly
-				 * bogus, but is required to shut the
-				 * compiler up. The compiler is required to
-				 * complain by a technicality in the ANSI C
-				 * spec.
-				 * For more details, see Peter van der
-				 * Linden, "Expert C Programming: Deep C
-				 * Secrets", Prentice-Hall, 1994, Chap. 1,
-				 * "Reading the ANSI C Standard for Fun,
-				 * Pleasure, and Profit"
-				 */
-			unblock_sigchld(&sigmask);
+	err = cond_status(line, run->persistent);
+	CONDUIT_TRACE(2)
+		fprintf(stderr, "run_conduit: got status %d\n", err);
 
-			/* We're done with spc_inbuf */
-			if (spc_inbuf != NULL)
-			{
-				free(spc_inbuf);
-				spc_inbuf = NULL; /* Don't free it again. */
-			}
-			spc_towrite = spc_req.len;
+	if (err == COND_ENDOFREPLY)
+	{
+		/* A persistent conduit is done with this database. Any
+		 * more output is for the next one.
+		 */
+		run->state = COND_REPLIED;
+		return 1;
+	}
 
-			/* Error-checking */
-			if (err < 0)
-			{
-				switch (cs_errno)
-				{
-				    case CSE_NOCONN:
-					/* Lost connection to Palm */
-					return 402;
-				    default:
-					/* Unspecified error */
-					return 401;
-				}
-			}
+	/* Remember the status for later */
+	if (run->state == COND_RUNNING)
+		run->laststatus = err;
+	return 0;
+}
 
-			spc_state = SPC_Write_Header;
+/* cond_spc
+ * condio callback: the conduit has sent an SPC request. Pass it on to the
+ * Palm.
+ */
+static int
+cond_spc(struct cond_io *io,
+	 struct spc_hdr *req,
+	 const unsigned char *inbuf,
+	 unsigned char **outbuf,
+	 void *arg)
+{
+	struct conduit_run *run = (struct conduit_run *) arg;
+	struct timeval t0;	/* When the request was sent */
+	int err;
 
-			continue;
+	run->spc_reqs++;
+	run->spc_in += SPC_HEADER_LEN + req->len;
+	gettimeofday(&t0, NULL);
+	err = spc_send(req, palm_pconn(run->palm), run->dbinfo,
+		       inbuf, outbuf, run->shm);
+	run->dlp += elapsed_ms(&t0);
+	if (err < 0)
+	{
+		switch (cs_errno)
+		{
+		    case CSE_NOCONN:
+			/* Lost connection to Palm */
+			run->laststatus = 402;
+			break;
+		    default:
+			/* Unspecified error */
+			run->laststatus = 401;
+			break;
 		}
+		run->state = COND_FAILED;
+		return -1;
+	}
+	run->spc_out += SPC_HEADER_LEN + req->len;
+	return 0;
+}
 
-		/* State 2: Want to write the header of an SPC response */
-		if ((spc_state == SPC_Write_Header) &&
-		    FD_ISSET(spcpipe[1], &out_fds))
-		{
-			/* Need to send the SPC response header */
-			static unsigned char spc_header[SPC_HEADER_LEN];
-
-			CONDUIT_TRACE(5)
-				fprintf(stderr,
-					"Sending SPC response OP == %d, "
-					"status == %d, "
-					"len == %ld\n",
-					spc_req.op,
-					spc_req.status,
-					spc_req.len);
-
-			/* Write the header to 'spc_header' */
-			/* XXX - This is very crude. There ought to be a
-			 * function to do it.
-			 */
-			*((unsigned short *) spc_header) = htons(spc_req.op);
-			*((unsigned short *) (spc_header+2)) =
-				htons(spc_req.status);
-			*((unsigned long *) (spc_header+4)) =
-				htonl(spc_req.len);
-
-			err = write(spcpipe[1], spc_header, SPC_HEADER_LEN);
-			if (err != SPC_HEADER_LEN)
-			{
-				Error(_("%s: error sending SPC response "
-					"header."),
-				      "run_conduit");
-				if (err < 0)
-					Perror("write");
-				/* XXX - What now? Abort? */
-			}
+/* elapsed_ms
+ * Returns the number of milliseconds since 'start'.
+ */
+static long
+elapsed_ms(const struct timeval *start)
+{
+	struct timeval now;
 
-			spc_towrite = spc_req.len;
-			spcp = spc_outbuf;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000L +
+		(now.tv_usec - start->tv_usec) / 1000L;
+}
 
-			spc_state = SPC_Write_Data;
-			continue;
-		}
+/* profile_run
+ * If conduits are being profiled, record what this run of 'conduit' cost.
+ * 'io' is the conduit, if it has exited; its CPU time and memory use
+ * are only known then, and only if it did this database alone.
+ */
+static void
+profile_run(const struct conduit_run *run,
+	    const struct cond_io *io,
+	    const char *flavor,
+	    const conduit_block *conduit)
+{
+	struct cond_prof prof;
 
-		/* State 3: Want to write the data of an SPC response */
-		if ((spc_state == SPC_Write_Data) &&
-		    FD_ISSET(spcpipe[1], &out_fds))
-		{
-			/* Need to send (continue sending) SPC response
-			 * data.
-			 */
+	if (!condprof_enabled())
+		return;
 
-			if (spc_towrite > 0)
-			{
-				CONDUIT_TRACE(5)
-					fprintf(stderr, "Sending SPC data\n");
+	prof.start = run->start;
+	prof.flavor = flavor;
+	prof.conduit = conduit->path;
+	prof.dbname = (run->dbinfo == NULL ? "" : run->dbinfo->name);
+	prof.status = run->laststatus;
+	prof.wall = elapsed_ms(&run->started);
+	prof.utime = prof.stime = prof.maxrss = -1L;
+	if (io != NULL && io->exited && io->have_rusage && !run->persistent)
+	{
+		prof.utime = io->rusage.ru_utime.tv_sec * 1000L +
+			io->rusage.ru_utime.tv_usec / 1000L;
+		prof.stime = io->rusage.ru_stime.tv_sec * 1000L +
+			io->rusage.ru_stime.tv_usec / 1000L;
+		prof.maxrss = io->rusage.ru_maxrss;
+	}
+	prof.spc_reqs = run->spc_reqs;
+	prof.spc_in = run->spc_in;
+	prof.spc_out = run->spc_out;
+	prof.dlp = run->dlp;
 
-				/* Send the next chunk */
-				err = write(spcpipe[1], spcp, spc_towrite);
+	condprof_record(&prof);
+}
 
-				if (err < 0)
-				{
-					Error(_("%s: Error sending SPC "
-						"response data."),
-					      "run_conduit");
-					Perror("write");
-					/* XXX - What now? Abort? */
-				}
+/* find_worker
+ * Find the running instance of the persistent conduit 'conduit', started
+ * as 'flavor'. Returns NULL if there isn't one, or it has died.
+ */
+static struct cond_worker *
+find_worker(const conduit_block *conduit,
+	    const char *flavor,
+	    const Bool with_spc)
+{
+	struct cond_worker *w;
 
-				spc_towrite -= err;
-				spcp += err;
-			}
+	for (w = workers; w != NULL; w = w->next)
+	{
+		if (strcmp(w->path, conduit->path) != 0 ||
+		    strcmp(w->flavor, flavor) != 0 ||
+		    w->with_spc != with_spc)
+			continue;
+		if ((w->cwd == NULL) != (conduit->cwd == NULL) ||
+		    (w->cwd != NULL && strcmp(w->cwd, conduit->cwd) != 0))
+			continue;
 
-			if (spc_towrite <= 0)
+		/* See whether it's still alive */
+		if (w->io->exited || waitpid(w->pid, NULL, WNOHANG) != 0)
+		{
+			CONDUIT_TRACE(3)
+				fprintf(stderr, "Persistent conduit %s "
+					"(pid %d) has exited\n",
+					w->path, (int) w->pid);
+			condio_free(w->io);
+			if (w->with_spc)
 			{
-				/* We're done sending the request */
-				free(spc_outbuf);
-				spc_state = SPC_Read_Header;
+				close(w->spcfd);
+				spc_shm_destroy(&w->shm);
 			}
- 
-			continue;
+			drop_worker(w);
+			return NULL;
 		}
+		return w;
 	}
 
-  abort:
-	if (conduit_pid > 0)
-	{
-		/* Presumably, we're here because there was an internal
-		 * error, but the conduit isn't dead. Kill it.
-		 */
-		CONDUIT_TRACE(5)
-			fprintf(stderr, "Sending SIGTERM to %d\n", conduit_pid);
-		kill(conduit_pid, SIGTERM);
-				/* No error checking, at least for now,
-				 * since there was an internal error, and
-				 * we have bigger things to worry about
-				 * than whether the conduit caught its
-				 * SIGTERM.
-				 */
-	}
+	return NULL;
+}
 
-	/* The conduit has exited */
+/* drop_worker
+ * Remove 'worker' from the list of running persistent conduits, and
+ * free it. Its file descriptors are left alone.
+ */
+static void
+drop_worker(struct cond_worker *worker)
+{
+	struct cond_worker **wp;
 
-	/* See if there is anything pending on 'fromchild' */
-	while (1)
+	for (wp = &workers; *wp != NULL; wp = &((*wp)->next))
 	{
-		err = poll_fd(fileno(fromchild), False);
-
-		if (err < 0)
+		if (*wp == worker)
 		{
-			/* An error occurred. I don't think we care */
-			CONDUIT_TRACE(5)
-				Perror("select");
+			*wp = worker->next;
 			break;
 		}
-
-		if (err == 0)
-			/* Nothing was printed to 'fromchild' */
-			break;
-
-		/* If we get here, then something was printed to 'fromchild' */
-		err = cond_readstatus(fromchild);
-		if (err > 0)
-			laststatus = err;
-		else
-			break;
 	}
 
-	/* Restore previous SIGCHLD handler */
-	signal(SIGCHLD, old_sigchld);
+	free(worker->path);
+	if (worker->cwd != NULL)
+		free(worker->cwd);
+	free(worker);
+}
 
-	CONDUIT_TRACE(6)
-		fprintf(stderr, "Closing child's file descriptors.\n");
-	if (tochild != NULL)
-	{
-		CONDUIT_TRACE(7)
-			fprintf(stderr, "- Closing fd %d\n", fileno(tochild));
-		fpurge(tochild);	/* Just drop whatever may be
-					 * lingering in the file handle, in
-					 * case fclose() tries to write it
-					 * to the now-dead child.
-					 */
-		fclose(tochild);
-	}
-	if (fromchild != NULL)
+/* stop_persistent_conduits
+ * Tell the persistent conduits that the sync is over, by closing their
+ * stdin, and wait for them to exit. Any that haven't exited after a few
+ * seconds get killed.
+ */
+void
+stop_persistent_conduits(void)
+{
+	struct cond_worker *w;
+	int i;
+
+	for (w = workers; w != NULL; w = w->next)
 	{
-		CONDUIT_TRACE(7)
-			fprintf(stderr, "- Closing fd %d\n",
-				fileno(fromchild));
-		fpurge(fromchild);	/* Just drop whatever may be
-					 * lingering in the file handle.
-					 */
-		fclose(fromchild);
+		CONDUIT_TRACE(3)
+			fprintf(stderr, "Stopping conduit %s (pid %d)\n",
+				w->path, (int) w->pid);
+		if (w->io->exited)
+			w->pid = -1;	/* Already reaped */
+		condio_free(w->io);
+		w->io = NULL;
+		if (w->with_spc)
+		{
+			close(w->spcfd);
+			spc_shm_destroy(&w->shm);
+		}
 	}
 
-	if (with_spc)
+	while ((w = workers) != NULL)
 	{
-		/* A Palm doesn't allow all that many open databases
-		 * at once. If a conduit terminates with a database open
-		 * (prematurely or otherwise) it can lock out any other conduits
-		 * that do DlpOpenDB calls. Since this includes essentially _all_
-		 * sync conduits, we want to prevent it by just closing all the
-		 * databases.
-		 */
-
-		DlpCloseDB(palm_pconn(palm), DLPCMD_CLOSEALLDBS, 0);
-
-		close(spcpipe[0]);
-		close(spcpipe[1]);
-  	}
-
-	/* Let's not hog memory */
-	if (pref_list != NULL)
-		free(pref_list);
+		for (i = 0; w->pid > 0 && i < 50; i++)
+		{
+			struct timeval delay;
 
-	free_headers (&headers, &num_headers);
+			if (waitpid(w->pid, NULL, WNOHANG) != 0)
+				break;
 
-	return laststatus;
+			delay.tv_sec = 0;
+			delay.tv_usec = 100000;
+			select(0, NULL, NULL, NULL, &delay);
+		}
+		if (i >= 50)
+		{
+			Warn(_("Conduit %s didn't exit. Killing it."),
+			     w->path);
+			kill(w->pid, SIGTERM);
+			waitpid(w->pid, NULL, 0);
+		}
+		drop_worker(w);
+	}
 }
 
 /* run_conduits
@@ -1222,6 +1064,8 @@ run_conduits(struct Palm *palm,
 					 * was found.
 					 */
 	struct ConduitDef *builtin;
+	struct cond_match match;	/* Lookup in the conduit table */
+	PConnection *pconn;		/* Connection to the Palm, if any */
 
 	udword creator, type;		/* DB creator, type and flags */
 	unsigned char flags;
@@ -1230,6 +1074,7 @@ run_conduits(struct Palm *palm,
 
 	def_conduit = NULL;		/* No default conduit yet */
 	found_conduit = False;
+	pconn = (palm == NULL ? NULL : palm_pconn(palm));
 
 
 	/* If dbinfo == NULL, we must execute "type: none" conduits. */ 
@@ -1246,47 +1091,28 @@ run_conduits(struct Palm *palm,
 	}
 	
 
-	/* Walk the queue */
-	for (conduit = sync_config->conduits;
-	     conduit != NULL;
-	     conduit = conduit->next)
-	{
-		CONDUIT_TRACE(3)
-			fprintf(stderr, "Trying conduit %s...\n",
-				(conduit->path == NULL ? "(null)" :
-				 conduit->path));
-
-		if (!conduit->enabled)
-		{
-			CONDUIT_TRACE(3)
-				fprintf(stderr, "  Not enabled.\n");
-			continue;
-		}
-
-		/* See if the flavor matches */
-		if ((conduit->flavors & flavor_mask) == 0)
-		{
-			CONDUIT_TRACE(5)
-				fprintf(stderr, "  Flavor set 0x%02x doesn't "
-					"match %#x\n\t=>Not applicable.\n",
-					conduit->flavors,
-					flavor_mask);
-			continue;
-		}
-
-		/* See if any of the creator/type pairs match */
-		if (!crea_type_matches(conduit,
-				       creator,
-				       type,
-				       flags))
-		{
-			CONDUIT_TRACE(5)
-				fprintf(stderr,
-					"  Creator/Type doesn't match\n"
-					"\t=>Not applicable.\n");
-			continue;
-		}
+	/* Walk the enabled conduits of this flavor whose creator/type
+	 * pairs match, in queue order. The conduit table was built when
+	 * the config was loaded; see condtable.c.
+	 */
+	CONDUIT_TRACE(7)
+		fprintf(stderr, "run_conduits: looking up "
+			"[%c%c%c%c/%c%c%c%c] (0x%08lx/0x%08lx) "
+			"(flags: %02x)\n",
+			(char) ((creator >>24) & 0xff),
+			(char) ((creator >>16) & 0xff),
+			(char) ((creator >> 8) & 0xff),
+			(char) (creator & 0xff),
+			(char) ((type >>24) & 0xff),
+			(char) ((type >>16) & 0xff),
+			(char) ((type >> 8) & 0xff),
+			(char) (type & 0xff),
+			creator, type, flags);
 
+	cond_table_match(sync_config->conduit_table, &match,
+			 flavor_mask, creator, type, flags);
+	while ((conduit = cond_table_next(&match)) != NULL)
+	{
 		/* This conduit matches */
 		CONDUIT_TRACE(2)
 			fprintf(stderr, "  This conduit matches. "
@@ -1309,8 +1135,11 @@ run_conduits(struct Palm *palm,
 
 		found_conduit = True;
 
-		/* See if it's a built-in conduit */
-		if ((builtin = findConduitByName(conduit->path)) == NULL)
+		/* See if it's a plugin or a built-in conduit */
+		if (is_plugin(conduit->path))
+			err = run_plugin(pconn, dbinfo,
+					 flavor, flavor_mask, conduit, pda);
+		else if ((builtin = findConduitByName(conduit->path)) == NULL)
 			/* It's an external program. Run it */
 			err = run_conduit(palm, dbinfo, flavor, flavor_mask,
 					  conduit, with_spc, pda);
@@ -1327,7 +1156,7 @@ run_conduits(struct Palm *palm,
 				continue;
 			}
 
-			err = (*builtin->func)(palm_pconn(palm), dbinfo, conduit, pda);
+			err = (*builtin->func)(pconn, dbinfo, conduit, pda);
 		}
 
 		/* Error-checking */
@@ -1368,8 +1197,11 @@ run_conduits(struct Palm *palm,
 		CONDUIT_TRACE(4)
 			fprintf(stderr, "Running default conduit\n");
 
-		/* See if it's a built-in conduit */
-		if ((builtin = findConduitByName(def_conduit->path)) == NULL)
+		/* See if it's a plugin or a built-in conduit */
+		if (is_plugin(def_conduit->path))
+			err = run_plugin(pconn, dbinfo,
+					 flavor, flavor_mask, def_conduit, pda);
+		else if ((builtin = findConduitByName(def_conduit->path)) == NULL)
 			/* It's an external program. Run it */
 			err = run_conduit(palm, dbinfo, flavor, flavor_mask,
 					  def_conduit, with_spc, pda);
@@ -1386,7 +1218,7 @@ run_conduits(struct Palm *palm,
 				return -1;
 			}
 
-			err = (*builtin->func)(palm_pconn(palm), dbinfo, def_conduit, pda);
+			err = (*builtin->func)(pconn, dbinfo, def_conduit, pda);
 		}
 
 		/* Error-checking */
@@ -1411,6 +1243,79 @@ run_conduits(struct Palm *palm,
 	return 0;
 }
 
+/* have_conduits
+ * Returns True iff any enabled conduit implements any of 'flavors' (a
+ * bitmap of FLAVORFL_*).
+ */
+Bool
+have_conduits(const unsigned short flavors)
+{
+	const conduit_block *conduit;
+
+	for (conduit = sync_config->conduits;
+	     conduit != NULL;
+	     conduit = conduit->next)
+	{
+		if (conduit->enabled && (conduit->flavors & flavors) != 0)
+			return True;
+	}
+
+	return False;
+}
+
+/* have_conduits_for
+ * Returns True iff any enabled conduit of flavor 'flavor' (a single
+ * FLAVORFL_* bit) applies to the database 'dbinfo', i.e., if running the
+ * conduits of that flavor on it would run anything at all.
+ */
+Bool
+have_conduits_for(const unsigned short flavor,
+		  const struct dlp_dbinfo *dbinfo)
+{
+	struct cond_match match;
+
+	cond_table_match(sync_config->conduit_table, &match, flavor,
+			 dbinfo->creator, dbinfo->type, 0);
+	return cond_table_next(&match) != NULL ? True : False;
+}
+
+/* conduits_need_palm
+ * Returns True iff any enabled conduit of flavor 'flavor' that applies to
+ * 'dbinfo' can't be run without the Palm: either it asks for preferences
+ * that aren't in the cache (see LoadPrefCache()), or it's a plugin, which
+ * gets a connection to the Palm whether it's a Fetch conduit or not. Used
+ * when running Fetch conduits before the Palm is connected.
+ * If 'uses_prefs' isn't NULL, it is set to True iff any of the conduits
+ * will be given cached preferences.
+ */
+Bool
+conduits_need_palm(const unsigned short flavor,
+		   const struct dlp_dbinfo *dbinfo,
+		   Bool *uses_prefs)
+{
+	struct cond_match match;
+	conduit_block *conduit;
+	int i;
+
+	if (uses_prefs != NULL)
+		*uses_prefs = False;
+	cond_table_match(sync_config->conduit_table, &match, flavor,
+			 dbinfo->creator, dbinfo->type, 0);
+	while ((conduit = cond_table_next(&match)) != NULL)
+	{
+		if (is_plugin(conduit->path))
+			return True;
+		for (i = 0; i < conduit->num_prefs; i++)
+		{
+			if (!PrefItemCached(&conduit->prefs[i]))
+				return True;
+			if (uses_prefs != NULL)
+				*uses_prefs = True;
+		}
+	}
+	return False;
+}
+
 /* run_Fetch_conduits
  * Go through the list of Fetch conduits and run whichever ones are
  * applicable for the database 'dbinfo'.
@@ -1679,15 +1584,14 @@ mychdir(const char *directory)
  * command-line arguments (including argv[0], the name of the program)
  * given by 'argv'.
  *
- * spawn_conduit() opens file handles connected to the conduit's stdin and
- * stdout, and returns these as *tochild and *fromchild, respectively. The
- * conduit's stdout is set to be line-buffered. The conduit's stdin has the
- * default buffering. The conduit's stderr remains untouched: it goes to
- * the display, or wherever you've redirected it.
+ * spawn_conduit() returns file descriptors connected to the conduit's
+ * stdin and stdout as *tochild and *fromchild, respectively. They're
+ * normally handed to condio_new(). The conduit's stderr remains
+ * untouched: it goes to the display, or wherever you've redirected it.
  *
- * In the child, all file descriptors are closed, except for stdin, stdout,
- * stderr, and any that are set in 'openfds'. This is so that Sync conduits
- * have a file descriptor to the Palm, but Fetch and Dump conduits don't.
+ * Any descriptors set in 'openfds' have their close-on-exec flag
+ * cleared in the child, so that the conduit inherits them even though
+ * ColdSync's other children don't.
  *
  * If the conduit is successfully started, spawn_conduit() returns the pid
  * of the conduit process, or a negative value otherwise.
@@ -1697,18 +1601,16 @@ spawn_conduit(
 	const char *path,	/* Path to program to run */
 	const char *cwd,		/* Conduit working directory */
 	char * const argv[],	/* Child's command-line arguments */
-	FILE **tochild,		/* File descriptor to child's stdin */
-	FILE **fromchild,	/* File descriptor to child's stdout */
+	int *tochild,		/* File descriptor to child's stdin */
+	int *fromchild,		/* File descriptor to child's stdout */
 	const fd_set *openfds)	/* Set of other file descriptors that
 				 * should remain open.
 				 */
 {
 	int err;
+	pid_t pid;
 	int inpipe[2];		/* Pipe for child's stdin */
 	int outpipe[2];		/* Pipe for child's stdout */
-	FILE *fh;		/* Temporary file handle */
-	sigset_t sigmask;	/* Mask of signals to block. Used by
-				 * {,un}block_sigchld() */
 	const char *fname;	/* (Usually full) pathname to conduit */
 
 	/* Set up the pipes for communication with the child */
@@ -1722,23 +1624,6 @@ spawn_conduit(
 		fprintf(stderr, "spawn_conduit: inpipe == %d, %d\n",
 			inpipe[0], inpipe[1]);
 
-	/* Turn this file descriptor into a file handle */
-	CONDUIT_TRACE(5)
-		fprintf(stderr, "spawn_conduit: tochild fd == %d\n",
-			inpipe[1]);
-
-	if ((fh = fdopen(inpipe[1], "wb")) == NULL)
-	{
-		Error(_("%s: Can't create file handle to child's stdin."),
-		      "spawn_conduit");
-		Perror("fdopen");
-
-		close(inpipe[0]);
-		close(inpipe[1]);
-		return -1;
-	}
-	*tochild = fh;
-
 	/* Child's stdout */
 	if ((err = pipe(outpipe)) < 0)
 	{
@@ -1751,71 +1636,38 @@ spawn_conduit(
 	CONDUIT_TRACE(6)
 		fprintf(stderr, "spawn_conduit: outpipe == %d, %d\n",
 			outpipe[0], outpipe[1]);
-	CONDUIT_TRACE(5)
-		fprintf(stderr, "spawn_conduit: fromchild fd == %d\n",
-			outpipe[0]);
-
-	if ((fh = fdopen(outpipe[0], "rb")) == NULL)
-	{
-		Error(_("%s: Can't create file handle to child's stdout."),
-		      "spawn_conduit");
-		Perror("fdopen");
 
-		close(inpipe[0]);
-		close(inpipe[1]);
-		close(outpipe[0]);
-		close(outpipe[1]);
-		return -1;
-	}
-
-	/* Make the child's stdout be line-buffered. This is because the
-	 * child will be reporting status back on stdout, so we want to
-	 * hear about it as soon as it happens.
+	/* The conduit might die immediately (e.g., the file doesn't exist,
+	 * or isn't executable, or dumps core immediately). That's all
+	 * right: the caller will find out when it starts listening to it.
 	 */
-	err = setvbuf(fh, cond_stdout_buf, _IOLBF, sizeof(cond_stdout_buf));
-	if (err < 0)
+	if ((pid = fork()) < 0)
 	{
-		Error(_("%s: Can't make child's stdout be line-buffered."),
-		      "spawn_conduit");
-		Perror("setvbuf");
+		Perror("fork");
 
 		close(inpipe[0]);
 		close(inpipe[1]);
 		close(outpipe[0]);
 		close(outpipe[1]);
 		return -1;
-	}
-	*fromchild = fh;
-
-	/* Here begins the critical section. The conduit might die
-	 * immediately (e.g., the file doesn't exist, or isn't executable,
-	 * or dumps core immediately). However, we don't want to get a
-	 * SIGCHLD before spawn_conduit() has finished cleaning up from the
-	 * fork(). Hence, we block SIGCHLD until we're done.
-	 */
-	block_sigchld(&sigmask);
-
-	if ((conduit_pid = fork()) < 0)
-	{
-		Perror("fork");
-		return -1;
-	} else if (conduit_pid != 0)
+	} else if (pid != 0)
 	{
 		/* This is the parent */
 		CONDUIT_TRACE(5)
-			fprintf(stderr, "Conduit PID == %d\n",
-				(int) conduit_pid);
+			fprintf(stderr, "Conduit PID == %d\n", (int) pid);
 
 		/* Close the unused ends of the pipes */
 		close(inpipe[0]);
 		close(outpipe[1]);
 
-		/* Here ends the critical section of the parent. Unblock
-		 * SIGCHLD.
-		 */
-		unblock_sigchld(&sigmask);
+		CONDUIT_TRACE(5)
+			fprintf(stderr, "spawn_conduit: tochild fd == %d, "
+				"fromchild fd == %d\n",
+				inpipe[1], outpipe[0]);
+		*tochild = inpipe[1];
+		*fromchild = outpipe[0];
 
-		return conduit_pid;
+		return pid;
 	}
 
 	/* This is the child */
@@ -1853,9 +1705,6 @@ spawn_conduit(
 		close(outpipe[1]);
 	}
 
-	/* Unblock SIGCHLD in the child as well. */
-	unblock_sigchld(&sigmask);
-
 	/* Find pathname to executable */
 	fname = find_in_path(path);
 	if (fname == NULL)
@@ -1910,6 +1759,15 @@ spawn_conduit(
 			mychdir(cwd);
 	}
 
+	if (openfds != NULL)
+	{
+		int fd;
+
+		for (fd = 0; fd < FD_SETSIZE; fd++)
+			if (FD_ISSET(fd, openfds))
+				fcntl(fd, F_SETFD, 0);
+	}
+
 	err = execv(fname, argv);
 				/* Use execv(), not execvp(): don't look in
 				 * $PATH. We've already checked. */
@@ -1924,217 +1782,9 @@ spawn_conduit(
 				 */
 }
 
-/* cond_readline
- * Read a line of input from the conduit. Data from the conduit, up to the
- * first newline (inclusive). The conduit's data is assumed to be ASCII; in
- * particular, it may not contain NULs.
- * XXX - Should arbitrary data be allowed?
- * Returns the number of characters read, if successful. Returns 0 in case
- * of end of file, or if the conduit exited with status 0. Returns a
- * negative value in case of error, or if the conduit exited with a status
- * other than 0, or because of a signal.
- * XXX - Make it possible to differentiate all these cases.
- */
-/* XXX - EOF and the conduit exiting with status 0 should be treated
- * identically, since the conduit is expected to print a status message
- * immediately before exiting. Any conduit that closes its stdout before
- * exiting gets what it deserves.
- */
-static int
-cond_readline(char *buf,	/* Buffer to read into */
-	      int len,		/* Max # characters to read */
-	      FILE *fromchild)	/* File descriptor to child's stdout */
-{
-	int err;
-	fd_set infds;		/* File descriptors we'll read from */
-	int fromchild_fd;	/* File descriptor corresponding to
-				 * 'fromchild' */
-
-	if (fromchild == NULL)	/* Sanity check */
-		return -1;
-
-	fromchild_fd = fileno(fromchild);
-
-	while (1)
-	{
-		/* Set things up for select() */
-		FD_ZERO(&infds);
-		FD_SET(fromchild_fd, &infds);
-
-		CONDUIT_TRACE(5)
-			fprintf(stderr, "cond_readline: About to select()\n");
-
-		err = select(fromchild_fd+1, &infds, NULL, NULL, NULL);
-
-		CONDUIT_TRACE(5)
-			fprintf(stderr,
-				"cond_readline: select() returned %d\n",
-				err);
-
-
-		/* Several things may have happened at this point: err < 0:
-		 * means that select() was interrupted (maybe by SIGCHLD,
-		 * maybe not); the conduit may or may not still be running,
-		 * and it may or may not have printed anything.
-		 *
-		 * err == 0: This should never happen.
-		 *
-		 * err > 0: there are 'err' ready file descriptors. From
-		 * experimenting, it looks as if the conduit may or may not
-		 * be running. It may have exited before the select().
-		 */
-
-		if (err < 0)
-		{
-			struct timeval zerotime;
-					/* Used to make select() poll */
-
-			if (errno != EINTR)
-			{
-				/* Something happened other than select()
-				 * being interrupted by a signal. What the
-				 * hell happened?
-				 */
-				Error(_("%s: select() returned an "
-					"unexpected error. This should "
-					"never happen."),
-				      "cond_readline");
-				Perror("select");
-				return -1;
-			}
-
-			/* select() was interrupted */
-			if (conduit_pid > 0)
-			{
-				CONDUIT_TRACE(5)
-					fprintf(stderr,
-						"cond_readline: select() just "
-						"got spooked, is all.\n");
-				continue;
-			}
-
-			/* Poll the child to see if it printed something
-			 * before exiting.
-			 */
-			/* XXX - Use poll_fd() */
-			zerotime.tv_sec = 0;
-			zerotime.tv_usec = 0;
-			FD_ZERO(&infds);
-			FD_SET(fromchild_fd, &infds);
-
-			CONDUIT_TRACE(6)
-				fprintf(stderr, "cond_readline: About to "
-					"check for dying message\n");
-
-			err = select(fromchild_fd+1, &infds, NULL, NULL,
-				     &zerotime);
-			if (!FD_ISSET(fromchild_fd, &infds))
-				goto abort;
-			/* Otherwise, if the child has printed something,
-			 * fall through to the next case.
-			 */
-		} else if (err == 0)
-		{
-			/* This should only ever happen if select() times
-			 * out.
-			 */
-			Error(_("%s: select() returned 0. This should never "
-				"happen. Please notify the maintainer."),
-			      "cond_sendline");
-			return -1;
-		}
-
-		/* See if the child has printed something. */
-		if (FD_ISSET(fromchild_fd, &infds))
-		{
-			char *s;
-			int s_len;	/* Length of string read */
-
-			CONDUIT_TRACE(6)
-				fprintf(stderr,
-					"Child has written something\n");
-
-			s = fgets(buf, len, fromchild);
-			if (s == NULL)
-			{
-				CONDUIT_TRACE(6)
-					fprintf(stderr, "cond_readline: "
-						"fgets() returned NULL\n");
-
-				/* Error or end of file */
-				if (feof(fromchild))
-				{
-					CONDUIT_TRACE(6)
-						fprintf(stderr,
-							"cond_readline: "
-							"End of file\n");
-
-					/* End of file */
-					return 0;
-				}
-
-				/* File error */
-				CONDUIT_TRACE(4)
-					fprintf(stderr, "cond_readline: "
-						"error in fgets()\n");
-				Perror("cond_readline: fgets");
-
-				return -1;
-			}
-
-			s_len = strlen(buf);
-			/* XXX - If fgets() didn't read a full line, but
-			 * read fewer than 'len' characters, ought to loop
-			 * back and try again. Watch out, though: the child
-			 * may have already exited.
-			 */
-			return s_len;
-		}
-
-		/* Can't get here */
-		Error(_("%s: Conduit is running happily, but hasn't printed "
-			"anything.\n"
-			"And yet, I was notified. This is a bug. Please "
-			"notify the maintainer."),
-		      "cond_readline");
-	}
-
-  abort:
-	/* The conduit is dead. This is bad. */
-	Error(_("%s: Conduit exited unexpectedly."),
-	      "cond_sendline");
-
-	CONDUIT_TRACE(2)
-	{
-		if (WIFEXITED(conduit_status))
-			/* XXX - If conduit_status != 0, this fact ought to
-			 * be reported to the user.
-			 */
-			fprintf(stderr, "Conduit exited with status %d%s\n",
-				WEXITSTATUS(conduit_status),
-				(WCOREDUMP(conduit_status) ?
-				 " (core dumped)" : ""));
-		else if (WIFSIGNALED(conduit_status))
-			fprintf(stderr, "Conduit killed by signal %d%s\n",
-				WTERMSIG(conduit_status),
-				(WCOREDUMP(conduit_status) ?
-				 " (core dumped)" : ""));
-		else
-			fprintf(stderr, "I have no idea how this happened\n");
-	}
-
-	if (WIFEXITED(conduit_status) &&
-	    (WEXITSTATUS(conduit_status) == 0))
-		/* Conduit exited normally */
-		return 0;
-
-	return -1;
-}
-
-/* cond_readstatus
- * Read a status line from the child, and process it. 'fromchild' is
- * assumed to have already been found to be readable. The line is expected
- * to be of the form
+/* cond_status
+ * Process a status line from the child, without the trailing newline.
+ * The line is expected to be of the form
  *	\d{3}[- ].*
  * That is, it starts with a three-digit status code; then follows either a
  * space or a dash; then a text message for humans' benefit. ColdSync
@@ -2152,46 +1802,30 @@ cond_readline(char *buf,	/* Buffer to read into */
  *	4yz - ColdSync (caller) Error
  *	5yz - Conduit Error
  *
- * Returns 0 at end of file, or -1 in case of error. Otherwise, returns the
- * error code; if none was given (i.e., the line doesn't match the pattern
- * given above), assume an error code of 501.
+ * If 'persistent' is true, an empty line means that the conduit is done
+ * with the current database, and COND_ENDOFREPLY is returned.
+ *
+ * Otherwise, returns the error code; if none was given (i.e., the line
+ * doesn't match the pattern given above), assume an error code of 501.
  */
 static int
-cond_readstatus(FILE *fromchild)
+cond_status(char *buf, const Bool persistent)
 {
-	int err;			/* Internal error status */
 	int errcode;			/* Error code */
 	char *errmsg;			/* Error message, for humans */
 	int msglen;			/* Length of 'errmsg' */
-	static char buf[COND_MAXLINELEN+1];	/* Input buffer */
 
-	/* Read a line from the child */
-	err = cond_readline(buf, COND_MAXLINELEN, fromchild);
-	if (err < 0)
-	{
-		/* Error in cond_readline(), or child exited unexpectedly */
-		/* XXX - Differentiate these cases */
-		CONDUIT_TRACE(3)
-			fprintf(stderr, "cond_readstatus: Child exited "
-				"unexpectedly(?)\n");
-		return -1;
-	} else if (err == 0)
+	msglen = strlen(buf);
+
+	if (persistent && buf[0] == '\0')
 	{
-		/* End of file, or child exited normally */
-		CONDUIT_TRACE(3)
-			fprintf(stderr, "cond_readstatus: Child exited "
-				"normally\n");
-		return 0;
+		CONDUIT_TRACE(5)
+			fprintf(stderr, "cond_status: end of reply\n");
+		return COND_ENDOFREPLY;
 	}
 
-	/* Chop off the trailing \n, if any */
-	msglen = strlen(buf);
-		/* XXX - Is 'buf' guaranteed to be NUL-terminated? */
-	if (buf[msglen-1] == '\n')
-		buf[msglen-1] = '\0';
-
 	CONDUIT_TRACE(5)
-		fprintf(stderr, "cond_readstatus: <<< \"%s\"\n", buf);
+		fprintf(stderr, "cond_status: <<< \"%s\"\n", buf);
 
 	/* See if the line is of the correct form */
 	if ((msglen >= 4) &&
@@ -2220,202 +1854,6 @@ cond_readstatus(FILE *fromchild)
 	return errcode; 
 }
 
-/* sigchld_handler
- * Handler for SIGCHLD signal. It records the state of a child as soon as
- * it changes; that way, we have up-to-date information in other parts of
- * the code, and avoid nasty timing bugs.
- *
- * NB: When modifying this function, make sure that it contains only
- * reentrant functions (Stevens, AUP, 10.6)
- */
-/* XXX - I think there are OSes that reset the signal handler to its
- * default value once a signal has been received. Find out about this, and
- * cope with it.
- */
-static RETSIGTYPE
-sigchld_handler(int sig)
-{
-	pid_t p;	/* Temporary variable. Return value from waitpid() */
-	int old_errno;
-
-	/* Save the old value of 'errno', in case this signal interrupted
-	 * something that uses it.
-	 */
-	old_errno = errno;
-
-	MISC_TRACE(4)
-		fprintf(stderr, "Got a SIGCHLD\n");
-
-	if (canjump != 1)
-	{
-		/* Unexpected signal. Ignore it */
-		CONDUIT_TRACE(5)
-			fprintf(stderr, "Unexpected signal. Ignoring.\n");
-		errno = old_errno;	/* Restore old errno */
-		return;
-	}
-
-	if (conduit_pid <= 0)
-	{
-		/* Got a SIGCHLD, but there's no conduit currently running.
-		 * This shouldn't happen, but it's not our responsibility.
-		 * I guess this might happen if a conduit spawns a
-		 * background process, then exits, and then the background
-		 * process exits.
-		 */
-		MISC_TRACE(5)
-			fprintf(stderr,
-				"Got a SIGCHLD, but conduit_pid == %d. "
-				"Ignoring.\n", (int) conduit_pid);
-		errno = old_errno;	/* Restore old errno */
-		return;
-	}
-
-	/* Find out what just happened */
-	/* WUNTRACED not specified. This means we won't find out about
-	 * stopped processes.
-	 */
-	p = waitpid(conduit_pid, &conduit_status, WNOHANG);
-	if (p < 0)
-	{
-		Error(_("%s: Can't get child pid %d status."),
-		      "sigchld_handler", conduit_pid );
-		Perror("waitpid");
-
-		conduit_pid = -1;
-
-		CONDUIT_TRACE(4)
-			fprintf(stderr, "siglongjmp(1)ing out of SIGCHLD.\n");
-		errno = old_errno;	/* Restore old errno */
-		siglongjmp(chld_jmpbuf, 1);
-	}
-
-	/* Find out whether the conduit process is still running */
-	/* If WUNTRACED is ever deemed to be a good thing, we'll need to
-	 * check WIFSTOPPED here as well.
-	 */
-	/* The check for p is there because p==0 is a valid return code when
-	 * WNOHANG is used. p==0 usually indicates a spurious SIGCHLD of some
-	 * sort. */
-	if (p > 0 && (WIFEXITED(conduit_status) || WIFSIGNALED(conduit_status)))
-	{
-		MISC_TRACE(4)
-			fprintf(stderr, "Conduit pid %d is no longer running.\n", p );
-		MISC_TRACE(5)
-		{
-			if (WIFEXITED(conduit_status))
-				fprintf(stderr,
-					"Conduit exited with status %d\n",
-					WEXITSTATUS(conduit_status));
-			else if (WIFSIGNALED(conduit_status))
-				fprintf(stderr,
-					"Conduit killed by signal %d%s\n",
-					WTERMSIG(conduit_status),
-					(WCOREDUMP(conduit_status) ?
-					 " (core dumped)" : ""));
-		}
-
-		conduit_pid = -1;
-
-		CONDUIT_TRACE(4)
-			fprintf(stderr, "siglongjmp(1)ing out of SIGCHLD.\n");
-		errno = old_errno;	/* Restore old errno */
-		siglongjmp(chld_jmpbuf, 1);
-	}
-	MISC_TRACE(5)
-		fprintf(stderr, "Conduit pid %d is still running.\n", p);
-
-	errno = old_errno;	/* Restore old errno */
-	return;			/* Nothing to do */
-}
-
-/* crea_type_matches
- * Given a conduit_block, a conduit and a type, crea_type_matches() returns
- * True iff at least one entry in the array of acceptable creator/type
- * pairs in the conduit_block matches the given creator and type.
- */
-static INLINE Bool
-crea_type_matches(const conduit_block *cond,
-		  const udword creator,
-		  const udword type,
-		  const unsigned char flags)
-{
-	int i;
-	Bool retval;
-
-	retval = False;			/* Start by assuming that it
-					 * doesn't match.
-					 */
-
-	CONDUIT_TRACE(7)
-		fprintf(stderr, "crea_type_matches: "
-			"conduit \"%s\",\n"
-			"\tcreator: [%c%c%c%c] (0x%08lx) / "
-			"type: [%c%c%c%c] (0x%08lx)\n"
-			"\tflags: 0x%02x\n",
-
-			cond->path,
-
-			(char) ((creator >>24) & 0xff),
-			(char) ((creator >>16) & 0xff),
-			(char) ((creator >> 8) & 0xff),
-			(char) (creator & 0xff),
-			creator,
-
-			(char) ((type >>24) & 0xff),
-			(char) ((type >>16) & 0xff),
-			(char) ((type >> 8) & 0xff),
-			(char) (type & 0xff),
-			type,
-			flags);
-
-	/* Iterate over the array of creator/type pairs defined in the
-	 * conduit_block.
-	 */
-	for (i = 0; i < cond->num_ctypes; i++)
-	{
-		/* Both the creator and the type need to match. However,
-		 * either one may be a wildcard (0), which matches
-		 * anything.
-		 */
-		CONDUIT_TRACE(7)
-			fprintf(stderr, "crea_type_matches: Comparing "
-				"[%c%c%c%c/%c%c%c%c] (0x%08lx/0x%08lx) (flags: %02x)\n",
-
-				(char) ((cond->ctypes[i].creator >>24) & 0xff),
-				(char) ((cond->ctypes[i].creator >>16) & 0xff),
-				(char) ((cond->ctypes[i].creator >> 8) & 0xff),
-				(char) (cond->ctypes[i].creator & 0xff),
-
-				(char) ((cond->ctypes[i].type >>24) & 0xff),
-				(char) ((cond->ctypes[i].type >>16) & 0xff),
-				(char) ((cond->ctypes[i].type >> 8) & 0xff),
-				(char) (cond->ctypes[i].type & 0xff),
-
-				cond->ctypes[i].creator,
-				cond->ctypes[i].type,
-				cond->ctypes[i].flags);
-
-		if(cond->ctypes[i].flags != flags)
-			continue;
-
-		if (((cond->ctypes[i].creator == creator) ||
-		     (cond->ctypes[i].creator == 0L)) &&
-		    ((cond->ctypes[i].type == type) ||
-		     (cond->ctypes[i].type == 0L)))
-		{
-			CONDUIT_TRACE(7)
-				fprintf(stderr, "crea_type_matches: "
-					"Found a match.\n");
-			return True;
-		}
-	}
-
-	CONDUIT_TRACE(7)
-		fprintf(stderr, "crea_type_matches: No match found.\n");
-	return False;
-}
-
 struct ConduitDef *
 findConduitByName(const char *name)
 {
@@ -67,6 +67,13 @@ extern int run_Sync_conduits(struct Palm *palm, const struct dlp_dbinfo *dbinfo,
 			     pda_block *pda);
 extern int run_Install_conduits(struct Palm *palm, struct dlp_dbinfo *dbinfo, pda_block *pda);
 extern int run_Init_conduits(struct Palm *palm);
+extern Bool have_conduits(const unsigned short flavors);
+extern Bool have_conduits_for(const unsigned short flavor,
+			      const struct dlp_dbinfo *dbinfo);
+extern Bool conduits_need_palm(const unsigned short flavor,
+			       const struct dlp_dbinfo *dbinfo,
+			       Bool *uses_prefs);
+extern void stop_persistent_conduits(void);
 
 #endif	/* _conduit_h_ */
 
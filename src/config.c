@@ -56,6 +56,7 @@ struct rtentry;
 #include "parser.h"		/* For config file parser stuff */
 #include "symboltable.h"
 #include "cs_error.h"
+#include "condtable.h"
 
 #ifndef MAXHOSTNAMELEN
 #define MAXHOSTNAMELEN	256
@@ -117,7 +118,6 @@ static void usage(int argc, char *argv[]);
 static pconn_proto_t name2protocol(const char *str);
 static int get_fullname(char *buf, const int buflen,
 			const struct passwd *pwent);
-static int get_userinfo(struct userinfo *userinfo);
 
 /* parse_args
  * Parse command-line arguments.
@@ -159,6 +159,10 @@ parse_args(int argc, char *argv[])
 		{"debug",		required_argument,	NULL, 'd'},
 		{"auto-init",		no_argument,		NULL, 'a'},
 		{"listen-block",	required_argument,	NULL, 'n'},
+		{"incremental",		required_argument,	NULL, 'B'},
+		{"changed-only",	no_argument,		NULL, 'C'},
+		{"jobs",		required_argument,	NULL, 'j'},
+		{"prefetch",		no_argument,		NULL, 'e'},
 		{0, 0, 0, 0},
 		/* XXX - Would it be possible to have translated versions
 		 * of the long options here as well? In some cases, the
@@ -201,11 +205,11 @@ parse_args(int argc, char *argv[])
 					 * stderr */
 
 #if HAVE_GETOPT_LONG
-	while ((arg = getopt_long(argc, argv, ":hvVSFRIaszf:l:m:p:t:P:d:n:",
+	while ((arg = getopt_long(argc, argv, ":hvVSFRIaszCef:l:m:p:t:P:d:n:B:j:",
 			&longopts[0], NULL))
 	       != -1)
 #else
-	while ((arg = getopt(argc, argv, ":hvVSFRIaszf:l:m:p:t:P:d:n:"))
+	while ((arg = getopt(argc, argv, ":hvVSFRIaszCef:l:m:p:t:P:d:n:B:j:"))
 	       != -1)
 #endif
 	{
@@ -323,6 +327,35 @@ parse_args(int argc, char *argv[])
 		    	global_opts.listen_name = optarg;
 		    	break;
 
+		    case 'B':	/* -B <dir>: Incremental backup against the
+				 * backup in <dir>.
+				 */
+			global_opts.ref_backupdir = optarg;
+			break;
+
+		    case 'C':	/* -C: Incremental restore */
+			global_opts.incremental_restore = True;
+			break;
+
+		    case 'e':	/* -e: Run Fetch conduits before the Palm
+				 * shows up.
+				 */
+			global_opts.prefetch = True;
+			break;
+
+		    case 'j':	/* -j <n>: Run Dump conduits for up to <n>
+				 * databases at once.
+				 */
+			global_opts.dump_jobs = atoi(optarg);
+			if (global_opts.dump_jobs < 1)
+			{
+				Error(_("Invalid number of jobs: \"%s\"."),
+				      optarg);
+				usage(argc, argv);
+				return -1;
+			}
+			break;
+
 
 		    case '?':	/* Unknown option */
 			Error(_("Unrecognized option: \"%s\"."),
@@ -379,6 +412,16 @@ load_config(const Bool read_user_config)
 	sync_config->options.autorescue		= False;
 	sync_config->options.filter_dbs		= False;
 	sync_config->options.use_card_serial	= False;
+	sync_config->options.stream_dblist	= False;
+	sync_config->options.install_order	= INSTALL_ORDER_DIRECTORY;
+	sync_config->options.install_deadline	= 0;
+	sync_config->options.verify_install	= False;
+	sync_config->options.sync_schedule	= False;
+	sync_config->options.sync_priority	= NULL;
+	sync_config->options.sync_budget	= 0;
+	sync_config->options.save_prefs		= False;
+	sync_config->options.profile_conduits	= False;
+	sync_config->options.profile_history	= False;
 								 /* We don't have an equivalent cmd line option
 								  * for the last options, so they default to 
 								  * False here.
@@ -613,6 +656,18 @@ load_config(const Bool read_user_config)
 #endif
 	}
 
+	/* Index the conduits, so that finding the ones that apply to a
+	 * database doesn't mean searching the whole queue.
+	 */
+	if ((sync_config->conduit_table =
+	     new_cond_table(sync_config->conduits)) == NULL)
+	{
+		Error(_("Can't index conduits."));
+		free_sync_config(sync_config);
+		sync_config = NULL;
+		return -1;
+	}
+
 	SYNC_TRACE(4)
 	{
 		/* Dump a summary of the config file */
@@ -703,6 +758,8 @@ load_config(const Bool read_user_config)
 				fprintf(stderr, "\tDEFAULT\n");
 			if ((c->flags & CONDFL_FINAL) != 0)
 				fprintf(stderr, "\tFINAL\n");
+			if ((c->flags & CONDFL_PERSISTENT) != 0)
+				fprintf(stderr, "\tPERSISTENT\n");
 			fprintf(stderr, "\tHeaders:\n");
 			for (hdr = c->headers; hdr != NULL; hdr = hdr->next)
 			{
@@ -860,6 +917,10 @@ set_mode(const char *str)
 			global_opts.mode = mode_List;
 			return 0;
 
+		    case 'p':		/* Profile summary mode */
+			global_opts.mode = mode_Profile;
+			return 0;
+
 		    default:
 			Error(_("Unknown mode: \"%s\"."), str);
 			return -1;
@@ -912,6 +973,11 @@ set_mode(const char *str)
 			global_opts.mode = mode_List;
 			return 0;
 		}
+		else if (strcmp(str,"profile") == 0)
+		{
+			global_opts.mode = mode_Profile;
+			return 0;
+		}
 		else
 		{
 			Error(_("Unknown mode: \"%s\"."), str);
@@ -992,6 +1058,7 @@ usage(int argc, char *argv[])
 		   "\t\tPerform a backup to <dir>.\n"),
 		N_("\t-mr <file|dir>...\n"
 		   "\t\tRestore or install new databases.\n"),
+		N_("\t-mp [file]:\tSummarize the conduit history.\n"),
 		N_("Options:\n"),
 		N_("\t-h:\t\tPrint this help message and exit.\n"),
 		N_("\t-V:\t\tPrint version and exit.\n"),
@@ -1010,6 +1077,14 @@ usage(int argc, char *argv[])
 		   "<file>.\n"),
 		N_("\t-v:\t\tIncrease verbosity.\n"),
 		N_("\t-n <listen-block>:\tChoice the named listen block.\n"),
+		N_("\t-B <dir>:\tWith -mb, reuse unchanged databases from "
+		   "the backup in <dir>.\n"),
+		N_("\t-C:\t\tWith -mr, only restore databases that differ "
+		   "from the Palm's.\n"),
+		N_("\t-j <n>:\t\tRun Dump conduits for up to <n> databases "
+		   "at once.\n"),
+		N_("\t-e:\t\tWith -md, run Fetch conduits while waiting for "
+		   "the Palm.\n"),
 		N_("\t-d <fac[:level]>:\tSet debugging level.\n"),
 		NULL
 	};
@@ -1474,6 +1549,52 @@ name2protocol(const char *str)
 	return PCONN_STACK_NONE;		/* None of the above */
 }
 
+/* name2install_order
+ * Convert the name of an install order ("directory", "size" or "type")
+ * to the corresponding INSTALL_ORDER_* value. Returns -1 if 'str' isn't
+ * a known order.
+ */
+int
+name2install_order(const char *str)
+{
+	if (strcasecmp(str, "directory") == 0)
+		return INSTALL_ORDER_DIRECTORY;
+	if (strcasecmp(str, "size") == 0)
+		return INSTALL_ORDER_SIZE;
+	if (strcasecmp(str, "type") == 0)
+		return INSTALL_ORDER_TYPE;
+	return -1;			/* None of the above */
+}
+
+/* get_palmdir
+ * Figure out the base sync directory for the PDA 'pda' (which may be
+ * NULL), and write it to 'buf', which must hold at least MAXPATHLEN+1
+ * characters. This is the directory given in the PDA block, if any; or
+ * else $CS_DOTPALM, if set; or else ~/.palm.
+ */
+void
+get_palmdir(const pda_block *pda, char *buf)
+{
+	char *dotpalm;
+
+	if ((pda != NULL) && (pda->directory != NULL))
+	{
+		/* Use the directory specified in the config file */
+		strncpy(buf, pda->directory, MAXPATHLEN);
+	} else if ((dotpalm = get_symbol("CS_DOTPALM")) != NULL)
+	{
+		strncpy(buf, dotpalm, MAXPATHLEN);
+
+		/* Free our copy of the symbol. */
+		free(dotpalm);
+	} else {
+		strncpy(buf,
+			mkfname(userinfo.homedir, "/.palm", NULL),
+			MAXPATHLEN);
+	}
+	buf[MAXPATHLEN] = '\0';
+}
+
 /* make_sync_dirs
  * Make sure that the various directories that ColdSync will be using for
  * the PDA 'pda' exist; create them if necessary:
@@ -1672,6 +1793,8 @@ new_sync_config()
 	retval->listen		= NULL;
 	retval->pda		= NULL;
 	retval->conduits	= NULL;
+	retval->conduit_table	= NULL;
+	retval->options.sync_priority = NULL;
 
 	MISC_TRACE(5)
 		fprintf(stderr,
@@ -1710,12 +1833,16 @@ free_sync_config(struct sync_config *config)
 	}
 
 	/* Free conduits */
+	free_cond_table(config->conduit_table);
 	for (c = config->conduits, nextc = NULL; c != NULL; c = nextc)
 	{
 		nextc = c->next;
 		free_conduit_block(c);
 	}
 
+	if (config->options.sync_priority != NULL)
+		free(config->options.sync_priority);
+
 	/* Free the config itself */
 	free(config);
 }
@@ -1725,7 +1852,7 @@ free_sync_config(struct sync_config *config)
  * Fill in the specified 'struct userinfo' structure.
  * XXX - In daemon mode, need to setuid() _before_ calling this.
  */
-static int
+int
 get_userinfo(struct userinfo *userinfo)
 {
 	uid_t uid;		/* Current (real) uid */
@@ -32,7 +32,10 @@
 # endif
 #endif
 
+#include <stdlib.h>		/* For malloc(), free() */
 #include <string.h>		/* For strrchr() */
+#include <sys/stat.h>		/* For fstat() */
+#include <sys/time.h>		/* For gettimeofday() */
 
 #if HAVE_STRINGS_H
 #  include <strings.h>		/* For strcasecmp() under AIX */
@@ -44,6 +47,7 @@
 
 #include "coldsync.h"
 #include "pdb.h"		/* For pdb_Read() */
+#include "palm.h"		/* For MAKE_CHUNKID() */
 #include "cs_error.h"
 
 /* upload_database
@@ -64,6 +68,7 @@ upload_database(PConnection *pconn, struct pdb *db, Bool force)
 	ubyte dbh;			/* Database handle */
 	struct dlp_createdbreq newdb;	/* Argument for creating a new
 					 * database */
+	int nrecs;			/* # records/resources uploaded */
 
 	SYNC_TRACE(1)
 		fprintf(stderr, "Uploading \"%s\"\n", db->name);
@@ -170,6 +175,7 @@ upload_database(PConnection *pconn, struct pdb *db, Bool force)
 	}
 
 	/* Upload each record/resource in turn */
+	nrecs = 0;
 	if (IS_RSRC_DB(db))
 	{
 		/* It's a resource database */
@@ -204,6 +210,7 @@ upload_database(PConnection *pconn, struct pdb *db, Bool force)
 				err = DlpCloseDB(pconn, dbh, 0);
 				return -1;
 			}
+			nrecs++;
 		}
 	} else {
 		/* It's a record database */
@@ -253,6 +260,33 @@ upload_database(PConnection *pconn, struct pdb *db, Bool force)
 
 			/* Update the ID assigned to this record */
 			rec->id = newid;
+			nrecs++;
+		}
+	}
+
+	/* If asked to, make sure everything arrived. Asking the Palm how
+	 * many records the database has is a lot cheaper than reading
+	 * them back.
+	 */
+	if (sync_config->options.verify_install == True3)
+	{
+		struct dlp_opendbinfo opendbinfo;
+
+		err = DlpReadOpenDBInfo(pconn, dbh, &opendbinfo);
+		if (err != (int) DLPSTAT_NOERR)
+		{
+			Error(_("DlpReadOpenDBInfo failed."));
+			print_latest_dlp_error(pconn);
+			err = DlpCloseDB(pconn, dbh, 0);
+			return -1;
+		}
+		if (opendbinfo.numrecs != nrecs)
+		{
+			Error(_("\"%s\": uploaded %d records, but the Palm "
+				"has %d."),
+			      db->name, nrecs, opendbinfo.numrecs);
+			err = DlpCloseDB(pconn, dbh, 0);
+			return -1;
 		}
 	}
 
@@ -475,6 +509,579 @@ NextInstallFile(struct dlp_dbinfo *dbinfo)
 	return -1;
 }	
 
+/* Staged installs
+ * Reading and parsing the databases in the install and rescue
+ * directories can take a while, and there's no reason to make the user
+ * wait for it with the Palm in the cradle. StageInstalls() does it ahead
+ * of time, before we start listening for the Palm, and keeps the parsed
+ * databases in 'staged'. InstallNewFiles() then takes them from there
+ * instead of reading the file again, provided the file hasn't changed
+ * since it was staged, and that we're still running as the user who
+ * staged it: the daemon only knows whose Palm it is once it connects.
+ */
+struct staged_db
+{
+	struct staged_db *next;
+	char *fname;			/* Full pathname of the file */
+	dev_t dev;			/* These identify the file as it */
+	ino_t ino;			/* was when it was staged */
+	off_t size;
+	time_t mtime;
+	struct pdb *pdb;		/* The parsed database */
+};
+
+static struct staged_db *staged = NULL;
+static uid_t staged_uid;		/* User who staged them */
+
+static void
+free_staged_db(struct staged_db *s)
+{
+	if (s->pdb != NULL)
+		free_pdb(s->pdb);
+	if (s->fname != NULL)
+		free(s->fname);
+	free(s);
+}
+
+/* stage_dir
+ * Read and parse each database in 'dir', and add it to 'staged'. Files
+ * that can't be read or aren't valid databases are skipped:
+ * InstallNewFiles() will complain about them when it gets to them.
+ */
+static void
+stage_dir(const char *dir)
+{
+	DIR *dirp;
+	struct dirent *file;
+	static char fname[MAXPATHLEN+1];
+	int count = 0;
+
+	if ((dirp = opendir(dir)) == NULL)
+		return;		/* Nothing to stage */
+
+	while ((file = readdir(dirp)) != NULL)
+	{
+		int fd;
+		struct stat statbuf;
+		struct staged_db *s;
+
+		if (!is_database_name(file->d_name))
+			continue;
+
+		snprintf(fname, MAXPATHLEN, "%s/%s", dir, file->d_name);
+
+		/* Don't stage the same file twice */
+		for (s = staged; s != NULL; s = s->next)
+			if (strcmp(s->fname, fname) == 0)
+				break;
+		if (s != NULL)
+			continue;
+
+		if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0)
+			continue;
+		if ((fstat(fd, &statbuf) < 0) || !S_ISREG(statbuf.st_mode))
+		{
+			close(fd);
+			continue;
+		}
+
+		if ((s = (struct staged_db *) malloc(sizeof(struct staged_db)))
+		    == NULL)
+		{
+			close(fd);
+			break;
+		}
+		s->dev = statbuf.st_dev;
+		s->ino = statbuf.st_ino;
+		s->size = statbuf.st_size;
+		s->mtime = statbuf.st_mtime;
+		s->fname = strdup(fname);
+		s->pdb = pdb_Read(fd);
+		close(fd);
+
+		if ((s->fname == NULL) || (s->pdb == NULL))
+		{
+			SYNC_TRACE(4)
+				fprintf(stderr, "Can't stage \"%s\"\n", fname);
+			free_staged_db(s);
+			continue;
+		}
+
+		s->next = staged;
+		staged = s;
+		count++;
+	}
+	closedir(dirp);
+
+	SYNC_TRACE(3)
+		fprintf(stderr, "Staged %d database(s) from \"%s\"\n",
+			count, dir);
+}
+
+/* stage_base
+ * Stage the install and rescue directories under the base sync directory
+ * 'basedir'.
+ */
+static void
+stage_base(const char *basedir)
+{
+	char dir[MAXPATHLEN+1];
+
+	snprintf(dir, MAXPATHLEN, "%s/install", basedir);
+	stage_dir(dir);
+
+	if (sync_config->options.autorescue == True3)
+	{
+		snprintf(dir, MAXPATHLEN, "%s/rescue", basedir);
+		stage_dir(dir);
+	}
+}
+
+/* StageInstalls
+ * Read, parse and validate the databases waiting to be installed, before
+ * the Palm is connected. We don't know yet which PDA block will apply, so
+ * stage the directories of all of them, as well as the default.
+ */
+void
+StageInstalls(void)
+{
+	pda_block *pda;
+	char basedir[MAXPATHLEN+1];
+
+	staged_uid = getuid();
+
+	/* The daemon doesn't look up the user until the Palm connects.
+	 * Stage for whoever we're running as.
+	 */
+	if ((userinfo.homedir[0] == '\0') && (get_userinfo(&userinfo) < 0))
+		return;
+
+	get_palmdir(NULL, basedir);
+	stage_base(basedir);
+
+	for (pda = sync_config->pda; pda != NULL; pda = pda->next)
+	{
+		if (pda->directory == NULL)
+			continue;	/* Same as the default */
+		get_palmdir(pda, basedir);
+		stage_base(basedir);
+	}
+}
+
+/* UnstageInstalls
+ * Free whatever staged databases didn't get installed.
+ */
+void
+UnstageInstalls(void)
+{
+	struct staged_db *s;
+
+	while ((s = staged) != NULL)
+	{
+		staged = s->next;
+		free_staged_db(s);
+	}
+}
+
+/* load_install_file
+ * Load the database in 'fname', and put the file's status in 'statbuf'.
+ * If it has been staged, and the file hasn't changed since, take the
+ * staged copy; otherwise, read the file.
+ * The caller is responsible for freeing the returned database. Returns
+ * NULL in case of error.
+ */
+static struct pdb *
+load_install_file(const char *fname, struct stat *statbuf)
+{
+	int fd;
+	struct pdb *pdb;
+	struct staged_db **sp;
+
+	if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0)
+	{
+		Error(_("%s: Can't open \"%s\"."),
+		      "InstallNewFiles",
+		      fname);
+		return NULL;
+	}
+	if (fstat(fd, statbuf) < 0)
+	{
+		Error(_("%s: Can't stat \"%s\"."),
+		      "InstallNewFiles",
+		      fname);
+		Perror("fstat");
+		close(fd);
+		return NULL;
+	}
+
+	if ((staged != NULL) && (getuid() != staged_uid))
+	{
+		SYNC_TRACE(3)
+			fprintf(stderr, "Staged for another user. "
+				"Ignoring.\n");
+		UnstageInstalls();
+	}
+
+	for (sp = &staged; *sp != NULL; sp = &(*sp)->next)
+		if (strcmp((*sp)->fname, fname) == 0)
+			break;
+
+	if (*sp != NULL)
+	{
+		struct staged_db *s = *sp;
+
+		*sp = s->next;		/* Either way, it's done with */
+		if ((statbuf->st_dev == s->dev) &&
+		    (statbuf->st_ino == s->ino) &&
+		    (statbuf->st_size == s->size) &&
+		    (statbuf->st_mtime == s->mtime))
+		{
+			SYNC_TRACE(5)
+				fprintf(stderr, "Using staged \"%s\"\n",
+					fname);
+			close(fd);
+			pdb = s->pdb;
+			s->pdb = NULL;
+			free_staged_db(s);
+			return pdb;
+		}
+
+		SYNC_TRACE(5)
+			fprintf(stderr, "\"%s\" changed since staging\n",
+				fname);
+		free_staged_db(s);
+	}
+
+	/* Read the database from the file */
+	pdb = pdb_Read(fd);
+	if (pdb == NULL)
+		Error(_("%s: Can't load database \"%s\"."),
+		      "InstallNewFiles",
+		      fname);
+	close(fd);
+
+	return pdb;
+}
+
+/* read_install_header
+ * Read just the header of the database in 'fname' into 'hdr', and put
+ * the file's status in 'statbuf'. Returns 0 if successful, or -1 in case
+ * of error.
+ */
+static int
+read_install_header(const char *fname,
+		    struct pdb *hdr,
+		    struct stat *statbuf)
+{
+	int fd;
+	int err;
+
+	if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0)
+	{
+		Error(_("%s: Can't open \"%s\"."),
+		      "InstallNewFiles",
+		      fname);
+		return -1;
+	}
+
+	memset(hdr, 0, sizeof(struct pdb));
+	if ((err = fstat(fd, statbuf)) == 0)
+		err = pdb_LoadHeader(fd, hdr);
+	close(fd);
+
+	if (err < 0)
+		Error(_("%s: Can't load database \"%s\"."),
+		      "InstallNewFiles",
+		      fname);
+	return err;
+}
+
+/* Upload engine
+ * InstallNewFiles() works in two passes. First, it reads the header of
+ * each database in the directory and decides whether it needs to be
+ * installed. Then it sorts the ones that do according to the
+ * 'install_order' option, and uploads them one at a time, reporting
+ * progress as it goes.
+ * The first pass only keeps what it needs to put the databases in order;
+ * each database is loaded right before it's uploaded, so there's never
+ * more than one of them in memory at a time. If the file has changed in
+ * between, it's left for the next sync.
+ */
+struct pending_install
+{
+	char *fname;			/* Full pathname of the file */
+	char name[PDB_DBNAMELEN];	/* Database name */
+	dev_t dev;			/* These identify the file as it */
+	ino_t ino;			/* was in the first pass */
+	off_t fsize;
+	time_t mtime;
+	Bool exists;			/* Is there already a copy on the
+					 * Palm? */
+	long size;			/* # bytes to upload. This is the
+					 * file's size until the database
+					 * is loaded, then the size of its
+					 * data. */
+	int rank;			/* Group, for INSTALL_ORDER_TYPE */
+	int seq;			/* Position in the directory */
+};
+
+/* pdb_datalen
+ * Returns the number of bytes of data in 'db'. This is what an upload
+ * costs, give or take a few bytes of overhead per record.
+ */
+static long
+pdb_datalen(const struct pdb *db)
+{
+	long len;
+
+	len = db->appinfo_len + db->sortinfo_len;
+	if (IS_RSRC_DB(db))
+	{
+		struct pdb_resource *rsrc;
+
+		for (rsrc = db->rec_index.rsrc; rsrc != NULL;
+		     rsrc = rsrc->next)
+			len += rsrc->data_len;
+	} else {
+		struct pdb_record *rec;
+
+		for (rec = db->rec_index.rec; rec != NULL; rec = rec->next)
+			len += rec->data_len;
+	}
+	return len;
+}
+
+/* install_rank
+ * Returns the group that 'db' falls into for INSTALL_ORDER_TYPE:
+ * applications come first, since that's what the user is waiting for;
+ * then other resource databases (libraries, panels, and the like); and
+ * finally record databases, which are usually the applications' data.
+ */
+static int
+install_rank(const struct pdb *db)
+{
+	if (!IS_RSRC_DB(db))
+		return 2;
+	if (db->type == MAKE_CHUNKID('a','p','p','l'))
+		return 0;
+	return 1;
+}
+
+/* cmp_pending_install
+ * qsort() comparison function for pending installs, for
+ * INSTALL_ORDER_SIZE and INSTALL_ORDER_TYPE.
+ */
+static int
+cmp_pending_install(const void *a, const void *b)
+{
+	const struct pending_install *pa = (const struct pending_install *) a;
+	const struct pending_install *pb = (const struct pending_install *) b;
+
+	if (pa->rank != pb->rank)
+		return pa->rank - pb->rank;
+	if (pa->size != pb->size)
+		return pa->size < pb->size ? -1 : 1;
+	return pa->seq - pb->seq;	/* Keep things stable */
+}
+
+/* elapsed
+ * Returns the number of seconds since 'start'.
+ */
+static double
+elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/* install_one
+ * Upload one pending database, 'pdb', to the Palm, save a copy in the
+ * backup directory if there isn't one already, and delete the file if
+ * 'deletep' is true.
+ * Returns 0 if successful, a positive value if this database couldn't be
+ * installed but it's worth going on with the others, or a negative
+ * value in case of a fatal error.
+ */
+static int
+install_one(struct Palm *palm,
+	    struct pending_install *p,
+	    struct pdb *pdb,
+	    Bool deletep,
+	    Bool force_install)
+{
+	int err;
+	const char *bakfname;	/* The database's full pathname in the
+				 * backup directory.
+				 */
+	int outfd;		/* File descriptor for writing the database
+				 * to the backup directory.
+				 */
+
+	/* XXX - Before installing, make sure to check the
+	 * PDB_ATTR_OKNEWER flag: don't overwrite open databases
+	 * (typically "Graffiti Shortcuts") unless it's okay to do
+	 * so.
+	 */
+	SYNC_TRACE(5)
+		fprintf(stderr, "InstallNewFiles: Uploading \"%s\"\n",
+			pdb->name);
+
+	if (p->exists)
+	{
+		/* Delete the existing database */
+		err = DlpDeleteDB(palm_pconn(palm), CARD0, pdb->name);
+
+		/* A failure to delete isn't critical. If we've reached this
+		 * point with an existing database the force_install flag is
+		 * set or we're installing a newer version.
+		 *
+		 * upload_database() will get rid of it.
+		 */
+	}
+
+	err = upload_database(palm_pconn(palm), pdb,
+			      force_install || p->exists);
+	if (err < 0)
+	{
+		Error(_("%s: Error uploading \"%s\"."),
+		      "InstallNewFiles",
+		      pdb->name);
+		va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
+			      _("Install"),
+			      pdb->name,
+			      _("Error"));
+
+		switch (cs_errno)
+		{
+			/* Fatal errors that we know of */
+		    case CSE_CANCEL:
+		    case CSE_NOCONN:
+			return -1;
+
+			/* All other errors */
+		    default:
+			return 1;
+		}
+	}
+
+	/* Add the newly-uploaded database to the list of databases
+	 * in 'palm'.
+	 */
+	SYNC_TRACE(4)
+		fprintf(stderr,
+			"InstallNewFiles: see if this db exists\n");
+	if (palm_find_dbentry(palm, pdb->name) == NULL)
+	{
+		/* It doesn't exist yet. Good */
+		SYNC_TRACE(4)
+			fprintf(stderr, "InstallNewFiles: "
+				"appending db to palm->dbinfo\n");
+
+		if (palm_append_pdbentry(palm, pdb) < 0)
+			return -1;
+	}
+
+	/* Check to see whether this file exists in the backup
+	 * directory. If it does, then let the conduit deal with
+	 * the newly-uploaded version when the sync continues.
+	 * XXX - Actually, it might be better to sync with the
+	 * database now, no?
+	 * If the database doesn't yet exist in the backup
+	 * directory, write it there now.
+	 */
+	/* Construct the pathname to this database in the backup
+	 * directory.
+	 */
+	{
+		struct dlp_dbinfo dummy;
+			/* Gross hack. mkbakfname() is very
+			 * convenient, but takes a struct
+			 * dlp_dbinfo. Use a dummy with the
+			 * relevant fields filled in.
+			 */
+
+		strncpy(dummy.name, pdb->name, DLPCMD_DBNAME_LEN);
+		dummy.db_flags = pdb->attributes;
+		bakfname = mkbakfname(&dummy);
+	}
+
+	SYNC_TRACE(5)
+		fprintf(stderr, "Checking for \"%s\"\n",
+			bakfname);
+
+	/* If the file exists already, don't overwrite it */
+	err = 0;
+	outfd = open((const char *) bakfname,
+		     O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
+		     0600);
+	if (outfd < 0)
+	{
+		if (errno == EEXIST)
+		{
+			/* File already exists. This isn't a problem */
+			va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
+				      _("Install"),
+				      pdb->name,
+				      _("OK"));
+		} else {
+			Error(_("Error opening \"%s\"."),
+			      bakfname);
+			Perror("open");
+			va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
+				      _("Install"),
+				      pdb->name,
+				      _("Problem"));
+			err = -1;	/* XXX */
+		}
+		SYNC_TRACE(5)
+			fprintf(stderr,
+				"\"%s\" already exists, maybe\n",
+				bakfname);
+	} else {
+		/* The file doesn't yet exist. Save the database to
+		 * it.
+		 */
+		SYNC_TRACE(4)
+			fprintf(stderr, "Writing \"%s\"\n",
+				bakfname);
+		err = pdb_Write(pdb, outfd);
+		if (err < 0)
+			va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
+				      _("Install"),
+				      pdb->name,
+				      _("Error"));
+		else
+			va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
+				      _("Install"),
+				      pdb->name,
+				      _("OK"));
+	}
+
+	/* XXX - Run Install conduits:
+	 * err = run_Install_conduits(pdb);
+	 */
+
+	/* Delete the newly-uploaded file, if appropriate */
+	if (deletep && (err == 0))
+	{
+		SYNC_TRACE(4)
+			fprintf(stderr, "Deleting \"%s\"\n",
+				p->fname);
+		err = unlink(p->fname);
+		if (err < 0)
+		{
+			Warn(_("Error deleting \"%s\"."),
+			     p->fname);
+			Perror("unlink");
+		}
+	}
+
+	return 0;
+}
+
 /* InstallNewFiles
  * Go through the giiven directory. If there are any databases there
  * that don't exist on the Palm, install them.
@@ -486,8 +1093,17 @@ InstallNewFiles(struct Palm *palm,
 		Bool force_install)	/* Flag: force install */
 {
 	int err;
+	int i;
 	DIR *dir;
 	struct dirent *file;
+	struct pending_install *pending = NULL;
+					/* Databases that need installing */
+	int npending = 0;		/* # entries in 'pending' */
+	int pending_size = 0;		/* # entries allocated */
+	int ninstalled = 0;		/* # databases installed */
+	long bytes = 0L;		/* # bytes uploaded */
+	struct timeval start;		/* When the uploads started */
+	double secs;
 
 	MISC_TRACE(1)
 		fprintf(stderr, "Installing new databases from \"%s\"\n",
@@ -503,21 +1119,15 @@ InstallNewFiles(struct Palm *palm,
 	/* Check each file in the directory in turn */
 	while ((file = readdir(dir)) != NULL)
 	{
-		int fd;			/* Database file descriptor */
-		struct pdb *pdb;	/* The database */
+		struct pdb hdr;		/* The database's header */
+		struct stat statbuf;	/* The file's status */
 		static char fname[MAXPATHLEN+1];
 					/* The database's full pathname */
-		const char *bakfname;	/* The database's full pathname in
-					 * the backup directory.
-					 */
-		int outfd;		/* File descriptor for writing the
-					 * database to the backup
-					 * directory.
-					 */
 		const struct dlp_dbinfo *dbinfo;
 					/* Local information about the
 					 * database
 					 */
+		struct pending_install *p;
 
 		/* Make sure this file has the proper extension for a Palm
 		 * database of some sort. If not, ignore it.
@@ -539,31 +1149,16 @@ InstallNewFiles(struct Palm *palm,
 		/* Construct the file's full pathname */
 		snprintf(fname, MAXPATHLEN, "%s/%s", newdir, file->d_name);
 
-		/* Open the file, and load it as a Palm database */
-		if ((fd = open(fname, O_RDONLY | O_BINARY)) < 0)
-		{
-			Error(_("%s: Can't open \"%s\"."),
-			      "InstallNewFiles",
-			      fname);
-			continue;
-		}
-
-		/* Read the database from the file */
-		pdb = pdb_Read(fd);
-		if (pdb == NULL)
-		{
-			Error(_("%s: Can't load database \"%s\"."),
-			      "InstallNewFiles",
-			      fname);
-			close(fd);
+		/* Read the database's header. That's all we need to
+		 * decide whether to install it.
+		 */
+		if (read_install_header(fname, &hdr, &statbuf) < 0)
 			continue;
-		}
-		close(fd);
 
 		/* See if we want to install this database */
 
 		/* See if the database already exists on the Palm */
-		dbinfo = palm_find_dbentry(palm, pdb->name);
+		dbinfo = palm_find_dbentry(palm, hdr.name);
 		if ((dbinfo != NULL) && (!force_install))
 		{
 			/* The database exists. Check its modification
@@ -574,199 +1169,154 @@ InstallNewFiles(struct Palm *palm,
 			SYNC_TRACE(4)
 				fprintf(stderr,
 					"Database \"%s\" already exists\n",
-					pdb->name);
+					hdr.name);
 			SYNC_TRACE(5)
 			{
 				fprintf(stderr, "  Existing modnum:   %ld\n",
 					dbinfo->modnum);
 				fprintf(stderr, "  New file's modnum: %ld\n",
-					pdb->modnum);
+					hdr.modnum);
 			}
 
-			if (pdb->modnum <= dbinfo->modnum)
+			if (hdr.modnum <= dbinfo->modnum)
 			{
 				SYNC_TRACE(4)
 					fprintf(stderr, "This isn't a new version\n");
-				free_pdb(pdb);
 				continue;
 			}
 		}
-		/* XXX - Before installing, make sure to check the
-		 * PDB_ATTR_OKNEWER flag: don't overwrite open databases
-		 * (typically "Graffiti Shortcuts") unless it's okay to do
-		 * so.
-		 */
-		SYNC_TRACE(5)
-			fprintf(stderr, "InstallNewFiles: Uploading \"%s\"\n",
-				pdb->name);
 
-		if (dbinfo != NULL)
+		/* Add it to the list of databases to install */
+		if (npending >= pending_size)
 		{
-			/* Delete the existing database */
-			err = DlpDeleteDB(palm_pconn(palm), CARD0, pdb->name);
-
-			/* A failure to delete isn't critical. If we've reached this
-			 * point with an existing database the force_install flag is
-			 * set or we're installing a newer version.
-			 *
-			 * upload_database() will get rid of it.
-			 */
-		}
+			struct pending_install *newpending;
 
-		err = upload_database(palm_pconn(palm), pdb, force_install || dbinfo);
-		if (err < 0)
+			newpending = (struct pending_install *)
+				realloc(pending,
+					(pending_size + 16) *
+					sizeof(struct pending_install));
+			if (newpending == NULL)
+			{
+				Error(_("%s: Out of memory."),
+				      "InstallNewFiles");
+				break;
+			}
+			pending = newpending;
+			pending_size += 16;
+		}
+		p = &pending[npending];
+		if ((p->fname = strdup(fname)) == NULL)
 		{
-			Error(_("%s: Error uploading \"%s\"."),
-			      "InstallNewFiles",
-			      pdb->name);
-			va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
-				      _("Install"),
-				      pdb->name,
-				      _("Error"));
+			Error(_("%s: Out of memory."),
+			      "InstallNewFiles");
+			break;
+		}
+		memcpy(p->name, hdr.name, PDB_DBNAMELEN);
+		p->dev = statbuf.st_dev;
+		p->ino = statbuf.st_ino;
+		p->fsize = statbuf.st_size;
+		p->mtime = statbuf.st_mtime;
+		p->exists = (dbinfo != NULL);
+		p->size = (long) statbuf.st_size;
+		p->rank = (sync_config->options.install_order ==
+			   INSTALL_ORDER_TYPE ? install_rank(&hdr) : 0);
+		p->seq = npending;
+		npending++;
+	}
 
-			/* XXX - This is rather ugly, due in part to the
-			 * fact that pdb_Upload (upload_database) isn't in
-			 * the main ColdSync code (yet).
-			 */
-			/* XXX - So now that it is, what's to be done about
-			 * it?
-			 */
-			free_pdb(pdb);
+	closedir(dir);
 
-			switch (cs_errno)
-			{
-				/* Fatal errors that we know of */
-			    case CSE_CANCEL:
-			    case CSE_NOCONN:
-				return -1;
+	/* Decide what order to install them in */
+	switch (sync_config->options.install_order)
+	{
+	    case INSTALL_ORDER_TYPE:
+	    case INSTALL_ORDER_SIZE:
+		qsort(pending, npending, sizeof(struct pending_install),
+		      cmp_pending_install);
+		break;
+	    case INSTALL_ORDER_DIRECTORY:
+	    default:
+		break;
+	}
 
-				/* All other errors */
-			    default:
-				continue;
-			}
-		}
+	/* Upload them */
+	err = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < npending; i++)
+	{
+		struct pending_install *p = &pending[i];
+		struct pdb *pdb;	/* The database */
+		struct stat statbuf;	/* The file's status */
+		struct timeval t0;	/* When this upload started */
+		int status;
 
-		/* Add the newly-uploaded database to the list of databases
-		 * in 'palm'.
-		 */
-		SYNC_TRACE(4)
-			fprintf(stderr,
-				"InstallNewFiles: see if this db exists\n");
-		if (palm_find_dbentry(palm, pdb->name) == NULL)
+		if ((sync_config->options.install_deadline > 0) &&
+		    (elapsed(&start) >=
+		     sync_config->options.install_deadline))
 		{
-			/* It doesn't exist yet. Good */
-			SYNC_TRACE(4)
-				fprintf(stderr, "InstallNewFiles: "
-					"appending db to palm->dbinfo\n");
-
-			if (palm_append_pdbentry(palm, pdb) < 0)
-			{
-				free_pdb(pdb);
-				return -1;
-			}
+			Verbose(1, _("Install deadline reached. %d "
+				     "database(s) left for the next sync."),
+				npending - i);
+			break;
 		}
 
-		/* Check to see whether this file exists in the backup
-		 * directory. If it does, then let the conduit deal with
-		 * the newly-uploaded version when the sync continues.
-		 * XXX - Actually, it might be better to sync with the
-		 * database now, no?
-		 * If the database doesn't yet exist in the backup
-		 * directory, write it there now.
-		 */
-		/* Construct the pathname to this database in the backup
-		 * directory.
+		/* Load the database, and make sure it's still the one we
+		 * decided to install.
 		 */
+		if ((pdb = load_install_file(p->fname, &statbuf)) == NULL)
+			continue;
+		if ((statbuf.st_dev != p->dev) ||
+		    (statbuf.st_ino != p->ino) ||
+		    (statbuf.st_size != p->fsize) ||
+		    (statbuf.st_mtime != p->mtime))
 		{
-			struct dlp_dbinfo dummy;
-				/* Gross hack. mkbakfname() is very
-				 * convenient, but takes a struct
-				 * dlp_dbinfo. Use a dummy with the
-				 * relevant fields filled in.
-				 */
-
-			strncpy(dummy.name, pdb->name, DLPCMD_DBNAME_LEN);
-			dummy.db_flags = pdb->attributes;
-			bakfname = mkbakfname(&dummy);
+			Warn(_("\"%s\" changed during the sync. Leaving it "
+			       "for the next one."),
+			     p->fname);
+			free_pdb(pdb);
+			continue;
 		}
+		p->size = pdb_datalen(pdb);
 
-		SYNC_TRACE(5)
-			fprintf(stderr, "Checking for \"%s\"\n",
-				bakfname);
+		Verbose(2, _("Installing \"%s\" (%d of %d, %ld bytes)"),
+			p->name, i+1, npending, p->size);
 
-		/* If the file exists already, don't overwrite it */
-		err = 0;
-		outfd = open((const char *) bakfname,
-			     O_WRONLY | O_CREAT | O_EXCL | O_BINARY,
-			     0600);
-		if (outfd < 0)
+		gettimeofday(&t0, NULL);
+		status = install_one(palm, p, pdb, deletep, force_install);
+		free_pdb(pdb);
+		if (status < 0)
 		{
-			if (errno == EEXIST)
-			{
-				/* File already exists. This isn't a problem */
-				va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
-					      _("Install"),
-					      pdb->name,
-					      _("OK"));
-			} else {
-				Error(_("Error opening \"%s\"."),
-				      bakfname);
-				Perror("open");
-				va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
-					      _("Install"),
-					      pdb->name,
-					      _("Problem"));
-				err = -1;	/* XXX */
-			}
-			SYNC_TRACE(5)
-				fprintf(stderr,
-					"\"%s\" already exists, maybe\n",
-					bakfname);
-		} else {
-			/* The file doesn't yet exist. Save the database to
-			 * it.
-			 */
-			SYNC_TRACE(4)
-				fprintf(stderr, "Writing \"%s\"\n",
-					bakfname);
-			err = pdb_Write(pdb, outfd);
-			if (err < 0)
-				va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
-					      _("Install"),
-					      pdb->name,
-					      _("Error"));
-			else
-				va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
-					      _("Install"),
-					      pdb->name,
-					      _("OK"));
+			err = -1;
+			break;
 		}
+		if (status > 0)
+			continue;
 
-		/* XXX - Run Install conduits:
-		 * err = run_Install_conduits(pdb);
-		 */
+		secs = elapsed(&t0);
+		Verbose(2, _("Installed \"%s\": %ld bytes in %.2f s "
+			     "(%.1f KB/s)"),
+			p->name, p->size, secs,
+			(secs > 0 ? p->size / secs / 1024 : 0.0));
 
-		/* Delete the newly-uploaded file, if appropriate */
-		if (deletep && (err == 0))
-		{
-			SYNC_TRACE(4)
-				fprintf(stderr, "Deleting \"%s\"\n",
-					fname);
-			err = unlink(fname);
-			if (err < 0)
-			{
-				Warn(_("Error deleting \"%s\"."),
-				     fname);
-				Perror("unlink");
-			}
-		}
+		ninstalled++;
+		bytes += p->size;
+	}
 
-		free_pdb(pdb);
+	if (ninstalled > 0)
+	{
+		secs = elapsed(&start);
+		Verbose(1, _("Installed %d database(s), %ld bytes in %.2f s "
+			     "(%.1f KB/s)"),
+			ninstalled, bytes, secs,
+			(secs > 0 ? bytes / secs / 1024 : 0.0));
 	}
 
-	closedir(dir);
+	for (i = 0; i < npending; i++)
+		free(pending[i].fname);
+	if (pending != NULL)
+		free(pending);
 
-	return 0;		/* XXX */
+	return err;
 }
 
 /* This is for Emacs's benefit:
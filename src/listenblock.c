@@ -83,6 +83,23 @@ name2listen_type(const char *str)
 	return LISTEN_NONE;		/* None of the above */
 }
 
+/* name2tcp_policy
+ * Convert the name of a TCP write policy ("nodelay", "cork" or "nagle")
+ * to the corresponding LISTENFL_TCP_* flags. Returns -1 if 'str' isn't a
+ * known policy.
+ */
+int
+name2tcp_policy(const char *str)
+{
+	if (strcasecmp(str, "nodelay") == 0)
+		return 0;
+	if (strcasecmp(str, "cork") == 0)
+		return LISTENFL_TCP_CORK;
+	if (strcasecmp(str, "nagle") == 0)
+		return LISTENFL_TCP_NAGLE;
+	return -1;			/* None of the above */
+}
+
 /* Finds the named listen_block or gives back a default one if name == NULL */
 
 listen_block *
@@ -140,6 +157,7 @@ new_listen_block()
 	retval->device		= NULL;
 	retval->speed		= 0L;
 	retval->flags		= LISTENFL_PROMPT;
+	retval->sessions	= 0;
 
 	return retval;
 }
@@ -21,9 +21,21 @@
 #include "pconn/pconn.h"
 #include "coldsync.h"
 
+/* The sync log is not sent to the Palm a line at a time: each
+ * DlpAddSyncLogEntry() costs a round trip, and a sync with a few hundred
+ * databases would spend a noticeable amount of time just writing the
+ * log. Instead, messages are collected in 'logbuf', and sent in as few
+ * requests as will fit: when the buffer fills up, when a conduit writes
+ * to the log itself, and before the connection is closed (see
+ * flush_log()).
+ */
+static char logbuf[DLPC_MAXLOGLEN];	/* Messages not yet sent */
+static int loglen = 0;			/* Length of 'logbuf' */
+static PConnection *log_pconn = NULL;	/* Connection 'logbuf' is for */
+
 /* va_add_to_log
- * Takes a printf()-style-formatted log message, and sends it to the
- * Palm on 'pconn'.
+ * Takes a printf()-style-formatted log message, and queues it to be
+ * sent to the Palm on 'pconn'.
  * Returns 0 if successful, or a negative value in case of error.
  */
 /* XXX - DLPC_MAXLOGLEN is the maximum length for the entire log on
@@ -36,12 +48,14 @@ int
 va_add_to_log(PConnection *pconn, const char *fmt, ...)
 {
 	int err;
+	int len;
 	va_list ap;
 	static char buf[DLPC_MAXLOGLEN];
 
 	/* Format and print the message to 'buf' */
 	va_start(ap, fmt);
 	err = vsnprintf(buf, DLPC_MAXLOGLEN, fmt, ap);
+	va_end(ap);
 
 	SYNC_TRACE(8)
 		fprintf(stderr,
@@ -51,8 +65,74 @@ va_add_to_log(PConnection *pconn, const char *fmt, ...)
 	if (err < 0)
 		return err;
 
-	/* Send the message to the Palm */
-	return DlpAddSyncLogEntry(pconn, buf);
+	/* vsnprintf() returns the length the message would have had if
+	 * there had been room for it.
+	 */
+	len = strlen(buf);
+
+	/* If there's a message for some other connection still waiting,
+	 * send it first.
+	 */
+	if ((log_pconn != NULL) && (log_pconn != pconn))
+		flush_log(log_pconn);
+
+	/* Make room for the new message, if need be. The buffer has to
+	 * hold a terminating NUL as well.
+	 */
+	if (loglen + len >= DLPC_MAXLOGLEN &&
+	    (err = flush_log(pconn)) < 0)
+		return err;
+
+	memcpy(logbuf + loglen, buf, len + 1);
+	loglen += len;
+	log_pconn = pconn;
+
+	return 0;
+}
+
+/* flush_log
+ * Send any log messages queued by va_add_to_log() to the Palm on
+ * 'pconn'. This must be called before the end of the sync, and
+ * before anyone else writes to the sync log, or messages will be lost
+ * or appear out of order.
+ * Returns 0 if successful, or a negative value in case of error.
+ */
+int
+flush_log(PConnection *pconn)
+{
+	int err;
+
+	if ((loglen == 0) || (pconn != log_pconn))
+		return 0;	/* Nothing to do */
+
+	SYNC_TRACE(6)
+		fprintf(stderr, "flush_log: sending %d bytes\n", loglen);
+
+	err = DlpAddSyncLogEntry(pconn, logbuf);
+
+	/* Whether or not that worked, the messages are gone: there's no
+	 * point in trying to send them again.
+	 */
+	loglen = 0;
+	logbuf[0] = '\0';
+	log_pconn = NULL;
+
+	return err;
+}
+
+/* discard_log
+ * Throw away any log messages queued for 'pconn'. This is for when the
+ * connection to the Palm has been lost, and they can't be sent.
+ */
+void
+discard_log(PConnection *pconn)
+{
+	if (pconn != log_pconn)
+		return;
+
+	loglen = 0;
+	logbuf[0] = '\0';
+	log_pconn = NULL;
 }
 
 /* This is for Emacs's benefit:
@@ -322,8 +322,361 @@ mkforw_addr(struct Palm *palm,
 	return -1;
 }
 
+/* RELAY_CHUNK
+ * Largest amount of data that the raw relay moves in one go. NetSync
+ * messages are rarely bigger than this, so most go through in one piece.
+ */
+#define RELAY_CHUNK	65536
+
+/* relay_dir
+ * State for one direction of a raw NetSync relay.
+ */
+struct relay_dir {
+	const char *name;	/* For trace messages */
+	PConnection *from;	/* Where the data comes from */
+	PConnection *to;	/* Where the data goes */
+	ubyte hdr[NETSYNC_HDR_LEN];
+				/* Header of the current frame */
+	int hdr_got;		/* # of header bytes read so far */
+	udword want;		/* # of payload bytes still to relay in
+				 * the current frame.
+				 */
+	int pipe[2];		/* Pipe for splice(), or -1 if splice()
+				 * isn't usable.
+				 */
+	long frames;		/* # of frames relayed */
+	long bytes;		/* # of payload bytes relayed */
+};
+
+/* can_relay_raw
+ * Returns True iff 'pconn' is a network connection that reads and writes
+ * NetSync frames directly on its socket, so that the raw relay can bypass
+ * it. The USB transports buffer their input internally, and the full
+ * protocol stack uses SLP/PADP framing. The serial transport doesn't
+ * always write to the descriptor it reads from (in stdin mode, it writes
+ * to stdout), and keeps byte counts that the relay would skip. All of
+ * those need the decoding relay.
+ */
+static Bool
+can_relay_raw(PConnection *pconn)
+{
+	if ((pconn->protocol != PCONN_STACK_NET) &&
+	    (pconn->protocol != PCONN_STACK_SIMPLE))
+		return False;
+
+	return (pconn->listen_type == LISTEN_NET);
+}
+
+/* relay_write_all
+ * Write all of 'len' bytes of 'buf' to 'fd'. If 'more' is true, tell the
+ * kernel that more of the same message is coming, so that a TCP_NODELAY
+ * socket doesn't send the header in a segment of its own.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+relay_write_all(int fd, const ubyte *buf, size_t len, Bool more)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+#ifdef MSG_MORE
+		if (more)
+		{
+			n = send(fd, buf, len, MSG_MORE);
+			if ((n < 0) && (errno == ENOTSOCK))
+				n = write(fd, buf, len);
+		} else
+#endif	/* MSG_MORE */
+			n = write(fd, buf, len);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+#if HAVE_SPLICE
+/* relay_splice
+ * Move up to 'len' bytes from d->from to d->to through d->pipe, without
+ * copying them into user space. Returns the number of bytes moved, 0 on
+ * EOF, or a negative value in case of error. If splice() can't be used on
+ * one of the descriptors, closes the pipe and returns -2 without having
+ * moved anything, so the caller can fall back on copying.
+ */
+static ssize_t
+relay_splice(struct relay_dir *d, size_t len, Bool more, ubyte *buf)
+{
+	ssize_t got;
+	ssize_t n;
+	size_t left;
+
+	got = splice(d->from->fd, NULL, d->pipe[1], NULL, len,
+		     SPLICE_F_MOVE);
+	if (got < 0)
+	{
+		if (errno != EINVAL)
+			return -1;
+
+		/* This descriptor doesn't support splice(). */
+		SYNC_TRACE(3)
+			fprintf(stderr, "%s: can't splice(); copying\n",
+				d->name);
+		close(d->pipe[0]);
+		close(d->pipe[1]);
+		d->pipe[0] = d->pipe[1] = -1;
+		return -2;
+	}
+	if (got == 0)
+		return 0;
+
+	for (left = got; left > 0; left -= n)
+	{
+		n = splice(d->pipe[0], NULL, d->to->fd, NULL, left,
+			   SPLICE_F_MOVE | (more ? SPLICE_F_MORE : 0));
+		if ((n < 0) && (errno == EINVAL))
+		{
+			/* The output side doesn't support splice(). Empty
+			 * the pipe the old-fashioned way, and copy from
+			 * now on.
+			 */
+			n = read(d->pipe[0], buf, left);
+			if ((n <= 0) ||
+			    (relay_write_all(d->to->fd, buf, n, more) < 0))
+				return -1;
+			close(d->pipe[0]);
+			close(d->pipe[1]);
+			d->pipe[0] = d->pipe[1] = -1;
+			continue;
+		}
+		if (n <= 0)
+			return -1;
+	}
+
+	return got;
+}
+#endif	/* HAVE_SPLICE */
+
+/* relay_pump
+ * Called when d->from is readable. Moves whatever is available, one
+ * header or one piece of payload at a time.
+ * NetSync frame boundaries are tracked only so that they can be logged,
+ * and so that a connection that closes in mid-frame can be noticed; the
+ * frames themselves go through untouched.
+ * Returns 1 if the relay should go on, 0 at end of file, or -1 in case
+ * of error.
+ */
+static int
+relay_pump(struct relay_dir *d, ubyte *buf)
+{
+	ssize_t n;
+	size_t chunk;
+	Bool more;
+
+	if (d->hdr_got < NETSYNC_HDR_LEN)
+	{
+		const ubyte *rptr;
+		ubyte cmd;
+		ubyte xid;
+
+		/* Read the (rest of the) header */
+		n = read(d->from->fd, d->hdr + d->hdr_got,
+			 NETSYNC_HDR_LEN - d->hdr_got);
+		if (n < 0)
+			return (errno == EINTR ? 1 : -1);
+		if (n == 0)
+		{
+			if (d->hdr_got > 0)
+				Warn(_("%s: connection closed in the middle "
+				       "of a NetSync header."),
+				     d->name);
+			return 0;
+		}
+		d->hdr_got += n;
+		if (d->hdr_got < NETSYNC_HDR_LEN)
+			return 1;
+
+		rptr = d->hdr;
+		cmd = get_ubyte(&rptr);
+		xid = get_ubyte(&rptr);
+		d->want = get_udword(&rptr);
+
+		SYNC_TRACE(5)
+			fprintf(stderr, "%s: frame %ld: cmd 0x%02x, "
+				"xid 0x%02x, %ld bytes\n",
+				d->name, d->frames, cmd, xid, d->want);
+
+		if (relay_write_all(d->to->fd, d->hdr, NETSYNC_HDR_LEN,
+				    d->want > 0) < 0)
+			return -1;
+
+		if (d->want == 0)
+		{
+			/* Empty frame */
+			d->hdr_got = 0;
+			d->frames++;
+		}
+		return 1;
+	}
+
+	/* Relay (part of) the payload */
+	chunk = (d->want > RELAY_CHUNK ? RELAY_CHUNK : d->want);
+	n = -2;
+#if HAVE_SPLICE
+	if (d->pipe[0] >= 0)
+	{
+		more = (chunk < d->want);
+		n = relay_splice(d, chunk, more, buf);
+	}
+#endif	/* HAVE_SPLICE */
+	if (n == -2)
+	{
+		/* Copy through user space */
+		n = read(d->from->fd, buf, chunk);
+		if ((n < 0) && (errno == EINTR))
+			return 1;
+		more = ((size_t) n < d->want);
+		if ((n > 0) &&
+		    (relay_write_all(d->to->fd, buf, n, more) < 0))
+			return -1;
+	}
+	if (n < 0)
+		return -1;
+	if (n == 0)
+	{
+		Warn(_("%s: connection closed in the middle of a "
+		       "NetSync message."),
+		     d->name);
+		return 0;
+	}
+
+	d->want -= n;
+	d->bytes += n;
+	if (d->want == 0)
+	{
+		/* End of frame */
+		d->hdr_got = 0;
+		d->frames++;
+	}
+	return 1;
+}
+
+/* forward_netsync_raw
+ * Relay NetSync traffic between two connections that both speak NetSync
+ * directly on their file descriptors. The bytes are passed along as-is
+ * (with splice(), where available), instead of being decoded and
+ * re-encoded. Both directions are serviced from the same select() loop.
+ *
+ * Passing the transaction IDs through unchanged is fine: the Palm has
+ * already been through the ritual exchange with us, and the remote host
+ * has been through the same exchange with us, so both ends have reached
+ * the same point in the XID sequence.
+ */
+static int
+forward_netsync_raw(PConnection *local, PConnection *remote)
+{
+	int err = 0;
+	int maxfd;
+	fd_set in_fds;
+	struct relay_dir dirs[2];
+	ubyte *buf;			/* Copy buffer */
+	int i;
+
+	if ((buf = (ubyte *) malloc(RELAY_CHUNK)) == NULL)
+	{
+		Error(_("%s: Out of memory."), "forward_netsync_raw");
+		return -1;
+	}
+
+	bzero((void *) dirs, sizeof(dirs));
+	dirs[0].name = "local->remote";
+	dirs[0].from = local;
+	dirs[0].to = remote;
+	dirs[1].name = "remote->local";
+	dirs[1].from = remote;
+	dirs[1].to = local;
+	for (i = 0; i < 2; i++)
+	{
+		dirs[i].pipe[0] = dirs[i].pipe[1] = -1;
+#if HAVE_SPLICE
+		if (pipe(dirs[i].pipe) < 0)
+		{
+			Perror("pipe");
+			dirs[i].pipe[0] = dirs[i].pipe[1] = -1;
+		}
+#endif	/* HAVE_SPLICE */
+	}
+
+	maxfd = local->fd;
+	if (remote->fd > maxfd)
+		maxfd = remote->fd;
+
+	for (;;)
+	{
+		FD_ZERO(&in_fds);
+		FD_SET(local->fd, &in_fds);
+		FD_SET(remote->fd, &in_fds);
+
+		err = select(maxfd+1, &in_fds, NULL, NULL, NULL);
+		if (err < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Perror("select");
+			break;
+		}
+
+		for (i = 0; i < 2; i++)
+		{
+			if (!FD_ISSET(dirs[i].from->fd, &in_fds))
+				continue;
+			if ((err = relay_pump(&dirs[i], buf)) <= 0)
+				break;
+		}
+		if (err < 0)
+		{
+			Perror(dirs[i].name);
+			break;
+		}
+		if (err == 0)
+		{
+			SYNC_TRACE(3)
+				fprintf(stderr, "%s: end of file.\n",
+					dirs[i].name);
+			break;
+		}
+	}
+
+	SYNC_TRACE(2)
+		for (i = 0; i < 2; i++)
+			fprintf(stderr, "%s: relayed %ld frames, "
+				"%ld bytes\n",
+				dirs[i].name, dirs[i].frames, dirs[i].bytes);
+
+	for (i = 0; i < 2; i++)
+	{
+		if (dirs[i].pipe[0] >= 0)
+		{
+			close(dirs[i].pipe[0]);
+			close(dirs[i].pipe[1]);
+		}
+	}
+	free(buf);
+
+	return (err < 0 ? -1 : 0);
+}
+
 /* forward_netsync
  * Listen for packets from either pconn, and forward them to the other.
+ * If both ends are NetSync sockets, use the raw relay. Otherwise, each
+ * message has to be decoded from one protocol stack and re-encoded in the
+ * other.
  */
 int
 forward_netsync(PConnection *local, PConnection *remote)
@@ -331,10 +684,19 @@ forward_netsync(PConnection *local, PConnection *remote)
 	int err = 0;
 	int maxfd;
 	fd_set in_fds;
-	fd_set out_fds;
 	const ubyte *inbuf;
 	uword inlen;
 
+	if (can_relay_raw(local) && can_relay_raw(remote))
+	{
+		SYNC_TRACE(2)
+			fprintf(stderr, "Using raw NetSync relay\n");
+		return forward_netsync_raw(local, remote);
+	}
+
+	SYNC_TRACE(2)
+		fprintf(stderr, "Using decoding relay\n");
+
 	/* Get highest-numbered file descriptor, for select() */
 	maxfd = local->fd;
 	if (remote->fd > maxfd)
@@ -345,11 +707,8 @@ forward_netsync(PConnection *local, PConnection *remote)
 		FD_ZERO(&in_fds);
 		FD_SET(local->fd, &in_fds);
 		FD_SET(remote->fd, &in_fds);
-		FD_ZERO(&out_fds);
-		FD_SET(local->fd, &out_fds);
-		FD_SET(remote->fd, &out_fds);
 
-		err = select(maxfd+1, &in_fds, /*&out_fds*/NULL, NULL, NULL);
+		err = select(maxfd+1, &in_fds, NULL, NULL, NULL);
 		SYNC_TRACE(5)
 			fprintf(stderr, "select() returned %d\n", err);
 
@@ -361,6 +720,12 @@ forward_netsync(PConnection *local, PConnection *remote)
 				Perror("read local");
 				break;
 			}
+			if (err == 0)
+			{
+				SYNC_TRACE(3)
+					fprintf(stderr, "EOF from local\n");
+				break;
+			}
 			SYNC_TRACE(5)
 				fprintf(stderr,
 					"Read %d-byte message from local. "
@@ -388,6 +753,12 @@ forward_netsync(PConnection *local, PConnection *remote)
 				Perror("read remote");
 				break;
 			}
+			if (err == 0)
+			{
+				SYNC_TRACE(3)
+					fprintf(stderr, "EOF from remote\n");
+				break;
+			}
 			SYNC_TRACE(5)
 				fprintf(stderr,
 					"Read %d-byte message from remote. "
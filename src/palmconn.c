@@ -71,6 +71,9 @@ Disconnect(PConnection *pconn, const ubyte status)
 	/* Terminate the sync, but check if we still have a connection */
 	if (PConn_isonline(pconn))
 	{
+		/* Send whatever is left of the sync log */
+		flush_log(pconn);
+
 		err = DlpEndOfSync(pconn, status);
 		if (err < 0)
 		{
@@ -80,6 +83,8 @@ Disconnect(PConnection *pconn, const ubyte status)
 		}
 	}
 
+	discard_log(pconn);
+
 	SYNC_TRACE(5)
 		fprintf(stderr, "===== Finished syncing\n");
 
@@ -88,13 +93,15 @@ Disconnect(PConnection *pconn, const ubyte status)
 	return err;
 }
 
-struct Palm *
-palm_Connect( void )
+/* open_pconn
+ * Set up a PConnection for the listen block that's in effect. Returns
+ * NULL in case of error.
+ */
+static PConnection *
+open_pconn(void)
 {
 	listen_block *listen;
 	PConnection *pconn;
-	struct Palm *palm;
-	int err;
 
 	/* Get listen block */
 	if ( (listen = find_listen_block(global_opts.listen_name)) == NULL )
@@ -119,6 +126,12 @@ palm_Connect( void )
 				      0) |
 				     (listen->flags &
 				      LISTENFL_NOCHANGESPEED ? PCONNFL_NOCHANGESPEED :
+				      0) |
+				     (listen->flags &
+				      LISTENFL_TCP_NAGLE ? PCONNFL_TCP_NAGLE :
+				      0) |
+				     (listen->flags &
+				      LISTENFL_TCP_CORK ? PCONNFL_TCP_CORK :
 				      0)
 		     ))
 	    == NULL)
@@ -131,14 +144,16 @@ palm_Connect( void )
 	pconn->dlp.io_complete = &update_cs_errno_dlp;
 	pconn->palm_errno_set_callback = &update_cs_errno_pconn;
 
-	/* Connect to the Palm */
-	if ((err = Connect(pconn)) < 0)
-	{
-		Error(_("Can't connect to Palm."));
-		/* XXX - Say why */
-		PConnClose(pconn);
-		return NULL;
-	}
+	return pconn;
+}
+
+/* connected_Palm
+ * Allocate a struct Palm for a freshly-connected PConnection.
+ */
+static struct Palm *
+connected_Palm(PConnection *pconn)
+{
+	struct Palm *palm;
 
 	/* Allocate a new Palm description */
 	if ((palm = new_Palm(pconn)) == NULL)
@@ -156,6 +171,54 @@ palm_Connect( void )
 	return palm;
 }
 
+struct Palm *
+palm_Connect( void )
+{
+	PConnection *pconn;
+	int err;
+
+	if ((pconn = open_pconn()) == NULL)
+		return NULL;
+
+	/* Connect to the Palm */
+	if ((err = Connect(pconn)) < 0)
+	{
+		Error(_("Can't connect to Palm."));
+		/* XXX - Say why */
+		PConnClose(pconn);
+		return NULL;
+	}
+
+	return connected_Palm(pconn);
+}
+
+/* palm_Attach
+ * Like palm_Connect(), but for a NetSync connection that has already been
+ * accepted by the daemon's event loop.
+ */
+struct Palm *
+palm_Attach(int data_sock)
+{
+	PConnection *pconn;
+
+	if ((pconn = open_pconn()) == NULL)
+	{
+		close(data_sock);
+		return NULL;
+	}
+
+	if (PConn_attach(pconn, data_sock) < 0)
+	{
+		Error(_("Can't connect to Palm."));
+		if (pconn->fd != data_sock)
+			close(data_sock);
+		PConnClose(pconn);
+		return NULL;
+	}
+
+	return connected_Palm(pconn);
+}
+
 
 void
 palm_Release(struct Palm *palm, ubyte status)
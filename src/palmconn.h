@@ -12,6 +12,7 @@
 #define _palmconn_h_  
 
 extern struct Palm * palm_Connect(void);
+extern struct Palm * palm_Attach(int data_sock);
 extern void palm_Disconnect(struct Palm *palm, ubyte status);
 extern void palm_Release(struct Palm *palm, ubyte status);
 extern void palm_CSDisconnect(struct Palm *palm);
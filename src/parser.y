@@ -91,16 +91,29 @@ static struct sync_config *file_config;	/* As the parser runs, it will fill
 %token CWD
 %token ENABLED
 %token PDA
+%token PERSISTENT
 %token PREFERENCE
 %token SAVED
+%token SESSIONS
 %token SPEED
 %token SNUM
+%token TCP_POLICY
 %token TRANSIENT
 %token NOCHANGESPEED
 %token NOPROMPT
 %token TYPE
 %token UNSAVED
 %token USE_CARD_SERIAL
+%token STREAM_DBLIST
+%token INSTALL_ORDER
+%token INSTALL_DEADLINE
+%token VERIFY_INSTALL
+%token SYNC_SCHEDULE
+%token SYNC_PRIORITY
+%token SYNC_BUDGET
+%token SAVE_PREFS
+%token PROFILE_CONDUITS
+%token PROFILE_HISTORY
 
 %token SERIAL
 %token USB
@@ -204,6 +217,8 @@ listen_stmt:
 				(cur_listen->device == NULL ? "(null)" :
 				 cur_listen->device));
 			fprintf(stderr, "\tSpeed: [%ld]\n", cur_listen->speed);
+			fprintf(stderr, "\tSessions: [%d]\n",
+				cur_listen->sessions);
 			fprintf(stderr, "\tProtocol: %d\n",
 				(int) cur_listen->protocol);
                         fprintf(stderr, "\tFlags:");  
@@ -211,6 +226,10 @@ listen_stmt:
                                 fprintf(stderr, " PROMPT");
 			if ((cur_listen->flags & LISTENFL_NOCHANGESPEED) != 0)
                                 fprintf(stderr, " NOCHANGESPEED");
+			if ((cur_listen->flags & LISTENFL_TCP_NAGLE) != 0)
+                                fprintf(stderr, " TCP_NAGLE");
+			if ((cur_listen->flags & LISTENFL_TCP_CORK) != 0)
+                                fprintf(stderr, " TCP_CORK");
                       	if ((cur_listen->flags & LISTENFL_TRANSIENT) != 0)
                                 fprintf(stderr, " TRANSIENT");
 		        fprintf(stderr, "\n");
@@ -340,6 +359,20 @@ listen_directive:
 
 		cur_listen->speed = $3;
 	}
+	| SESSIONS colon NUMBER semicolon
+	{
+		PARSE_TRACE(4)
+			fprintf(stderr, "\tListen: sessions %ld\n", $3);
+
+		if ($3 < 1)
+		{
+			Error(_("%s: %d: The number of sessions must be "
+				"positive."),
+			      conf_fname, lineno);
+			ANOTHER_ERROR;
+		} else
+			cur_listen->sessions = $3;
+	}
 	| PROTOCOL colon protocol_stack semicolon
 	{
 		PARSE_TRACE(4)
@@ -350,6 +383,32 @@ listen_directive:
 			 * the protocol has already been specified.
 			 */
 	}
+	| TCP_POLICY colon
+	{
+		lex_expect(LEX_BSTRING);
+	}
+	STRING semicolon
+	{
+		int policy;
+
+		PARSE_TRACE(4)
+			fprintf(stderr, "\tListen: tcp_policy [%s]\n", $4);
+
+		lex_expect(LEX_NONE);
+
+		if ((policy = name2tcp_policy($4)) < 0)
+		{
+			Error(_("%s: %d: Unrecognized TCP policy \"%s\"."),
+			      conf_fname, lineno, $4);
+			ANOTHER_ERROR;
+		} else {
+			cur_listen->flags &=
+				~(LISTENFL_TCP_NAGLE | LISTENFL_TCP_CORK);
+			cur_listen->flags |= policy;
+		}
+		free($4);
+		$4 = NULL;
+	}
 	| TRANSIENT semicolon
 	{
 		PARSE_TRACE(4)
@@ -424,6 +483,9 @@ conduit_stmt:	CONDUIT
 			if (cur_conduit->flags & CONDFL_DEFAULT)
 				fprintf(stderr, " default");
 
+			if (cur_conduit->flags & CONDFL_PERSISTENT)
+				fprintf(stderr, " persistent");
+
 			if (cur_conduit->flags == 0L)
 				fprintf(stderr, " none");
 
@@ -711,6 +773,16 @@ conduit_directive:
 		 */
 		cur_conduit->flags |= CONDFL_FINAL;
 	}
+	| PERSISTENT semicolon
+	{
+		PARSE_TRACE(4)
+			fprintf(stderr, "This is a persistent conduit\n");
+
+		/* Start this conduit only once, and send it all of the
+		 * databases it applies to.
+		 */
+		cur_conduit->flags |= CONDFL_PERSISTENT;
+	}
 	| error
 	{
 		Error(_("\tError near \"%s\"."),
@@ -975,6 +1047,131 @@ option:	FORCE_INSTALL colon boolean ';'
 			fprintf(stderr, "Option: use_card_serial.\n");
 		file_config->options.use_card_serial = True3;
 	}
+	| STREAM_DBLIST colon boolean ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: stream_dblist.\n");
+		file_config->options.stream_dblist = $3;
+	}
+	| STREAM_DBLIST ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: stream_dblist.\n");
+		file_config->options.stream_dblist = True3;
+	}
+	| INSTALL_ORDER colon
+	{
+		lex_expect(LEX_BSTRING);
+	}
+	STRING semicolon
+	{
+		int order;
+
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: install_order [%s]\n", $4);
+
+		lex_expect(LEX_VAR);
+
+		if ((order = name2install_order($4)) < 0)
+		{
+			Error(_("%s: %d: Unrecognized install order \"%s\"."),
+			      conf_fname, lineno, $4);
+			ANOTHER_ERROR;
+		} else
+			file_config->options.install_order = order;
+		free($4);
+		$4 = NULL;
+	}
+	| INSTALL_DEADLINE colon NUMBER semicolon
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: install_deadline: [%ld]\n",
+				$3);
+		file_config->options.install_deadline = $3;
+	}
+	| VERIFY_INSTALL colon boolean ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: verify_install.\n");
+		file_config->options.verify_install = $3;
+	}
+	| VERIFY_INSTALL ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: verify_install.\n");
+		file_config->options.verify_install = True3;
+	}
+	| SYNC_SCHEDULE colon boolean ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: sync_schedule.\n");
+		file_config->options.sync_schedule = $3;
+	}
+	| SYNC_SCHEDULE ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: sync_schedule.\n");
+		file_config->options.sync_schedule = True3;
+	}
+	| SYNC_PRIORITY colon
+	{
+		lex_expect(LEX_BSTRING);
+	}
+	STRING semicolon
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: sync_priority [%s]\n", $4);
+
+		lex_expect(LEX_VAR);
+
+		if (file_config->options.sync_priority != NULL)
+			free(file_config->options.sync_priority);
+		file_config->options.sync_priority = $4;
+		$4 = NULL;
+	}
+	| SYNC_BUDGET colon NUMBER semicolon
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: sync_budget: [%ld]\n",
+				$3);
+		file_config->options.sync_budget = $3;
+	}
+	| SAVE_PREFS colon boolean ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: save_prefs.\n");
+		file_config->options.save_prefs = $3;
+	}
+	| SAVE_PREFS ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: save_prefs.\n");
+		file_config->options.save_prefs = True3;
+	}
+	| PROFILE_CONDUITS colon boolean ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: profile_conduits.\n");
+		file_config->options.profile_conduits = $3;
+	}
+	| PROFILE_CONDUITS ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: profile_conduits.\n");
+		file_config->options.profile_conduits = True3;
+	}
+	| PROFILE_HISTORY colon boolean ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: profile_history.\n");
+		file_config->options.profile_history = $3;
+	}
+	| PROFILE_HISTORY ';'
+	{
+		PARSE_TRACE(3)
+			fprintf(stderr, "Option: profile_history.\n");
+		file_config->options.profile_history = True3;
+	}
 	| HOSTID colon NUMBER semicolon
 	{
 		PARSE_TRACE(3)
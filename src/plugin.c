@@ -0,0 +1,353 @@
+/* plugin.c
+ *
+ * Functions for loading conduits from shared objects, and running them.
+ * See plugin.h for the interface a plugin must provide.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>			/* For malloc(), free() */
+#include <string.h>			/* For strcmp(), strlen() */
+#include <signal.h>			/* For signal() */
+#include <setjmp.h>			/* For sigsetjmp()/siglongjmp() */
+#include <sys/types.h>			/* For pid_t */
+#include <unistd.h>			/* For getpid() */
+
+#if HAVE_DLFCN_H
+#  include <dlfcn.h>			/* For dlopen() and friends */
+#endif	/* HAVE_DLFCN_H */
+
+#if HAVE_LIBINTL_H
+#  include <libintl.h>			/* For i18n */
+#endif	/* HAVE_LIBINTL_H */
+
+#include "pconn/pconn.h"
+#include "coldsync.h"
+#include "plugin.h"
+#include "cs_error.h"
+
+#define PLUGIN_SUFFIX	".so"		/* A conduit path ending in this is
+					 * a plugin */
+
+typedef RETSIGTYPE (*sighandler) (int);
+
+/* plugin_entry
+ * A loaded (or unloadable) plugin. Plugins stay loaded until the end of
+ * the sync, so that each one is only loaded and initialized once no
+ * matter how many databases it handles. A plugin that fails to load, or
+ * crashes, stays on the list with 'broken' set, so that the problem is
+ * only reported once.
+ * A process forked during the sync (a Dump job, or the -e prefetch
+ * process) inherits the list, but the plugins' init and fini hooks
+ * belong to the process that loaded them: see unload_plugins().
+ */
+struct plugin_entry
+{
+	struct plugin_entry *next;
+	char *path;			/* Path the plugin was loaded from */
+	void *handle;			/* Handle returned by dlopen() */
+	const struct cs_plugin *plugin;	/* The plugin's description */
+	Bool broken;			/* Don't try to run this plugin */
+	pid_t loader;			/* Process that loaded it */
+};
+
+static struct plugin_entry *plugins = NULL;
+
+/* The following variables are used to recover from a plugin that crashes
+ * while it's running. See run_plugin().
+ */
+static sigjmp_buf crash_jmpbuf;		/* Saved state for sigsetjmp() */
+static volatile sig_atomic_t crash_canjump = 0;
+
+static struct plugin_entry *load_plugin(const char *path);
+static RETSIGTYPE crash_handler(int sig);
+
+/* is_plugin
+ * Returns True iff 'path' names a plugin conduit, i.e., a shared object,
+ * rather than a program or a built-in conduit.
+ */
+Bool
+is_plugin(const char *path)
+{
+	int len;
+
+	if (path == NULL)
+		return False;
+
+	len = strlen(path);
+	if (len <= (int) strlen(PLUGIN_SUFFIX))
+		return False;
+	return strcmp(path + len - strlen(PLUGIN_SUFFIX),
+		      PLUGIN_SUFFIX) == 0 ? True : False;
+}
+
+/* run_plugin
+ * Run the plugin conduit given by 'block' on the database 'dbinfo',
+ * loading the plugin first if necessary.
+ * If the plugin crashes (SIGSEGV and the like), the crash is reported, and
+ * the plugin is not run again during this sync. If there's still a Palm
+ * to talk to, any databases it left open are closed; if that fails, the
+ * plugin probably crashed in the middle of a DLP exchange, and the link
+ * is out of step, so the sync is ended with CSE_NOCONN. Dump conduits
+ * run after the Palm has been released, so there's nothing to close
+ * then. Since the plugin runs inside ColdSync, a crash may
+ * well have left ColdSync's own data in a bad state; this is a last-ditch
+ * effort to get the sync finished, not a substitute for running
+ * untrusted code in a separate process.
+ * Returns 0 if successful, or a negative value in case of error.
+ */
+int
+run_plugin(PConnection *pconn,
+	   const struct dlp_dbinfo *dbinfo,
+	   const char *flavor,
+	   unsigned short flavor_mask,
+	   const conduit_block *block,
+	   const pda_block *pda)
+{
+	int err;
+	struct plugin_entry * volatile entry;
+	sighandler old_sigsegv;
+	sighandler old_sigbus;
+	sighandler old_sigill;
+	sighandler old_sigfpe;
+
+	if ((entry = load_plugin(block->path)) == NULL)
+	{
+		return -1;
+	}
+	if (entry->broken)
+	{
+		CONDUIT_TRACE(3)
+			fprintf(stderr, "Plugin \"%s\" is broken. "
+				"Not running it.\n",
+				entry->path);
+		return -1;
+	}
+
+	/* Make sure the flavor is okay. */
+	if ((flavor_mask & entry->plugin->flavors) == 0)
+	{
+		Error(_("Conduit %s is not a %s conduit."),
+		      entry->plugin->name, flavor);
+		return -1;
+	}
+
+	CONDUIT_TRACE(2)
+		fprintf(stderr, "Running plugin \"%s\" (%s)\n",
+			entry->plugin->name, entry->path);
+
+	old_sigsegv = signal(SIGSEGV, crash_handler);
+	old_sigbus = signal(SIGBUS, crash_handler);
+	old_sigill = signal(SIGILL, crash_handler);
+	old_sigfpe = signal(SIGFPE, crash_handler);
+
+	if ((err = sigsetjmp(crash_jmpbuf, 1)) != 0)
+	{
+		/* The plugin crashed, and crash_handler() jumped back
+		 * here.
+		 */
+		crash_canjump = 0;
+		signal(SIGSEGV, old_sigsegv);
+		signal(SIGBUS, old_sigbus);
+		signal(SIGILL, old_sigill);
+		signal(SIGFPE, old_sigfpe);
+
+		Error(_("Plugin %s crashed (signal %d). "
+			"Not running it again during this sync."),
+		      entry->plugin->name, err);
+		entry->broken = True;
+
+		/* Don't leave any databases open behind it. By the time
+		 * Dump conduits run, 'pconn' has been closed.
+		 */
+		if ((pconn != NULL) && !(flavor_mask & FLAVORFL_DUMP) &&
+		    (DlpCloseDB(pconn, DLPCMD_CLOSEALLDBS, 0) < 0))
+		{
+			Error(_("Lost contact with the Palm after plugin %s "
+				"crashed."),
+			      entry->plugin->name);
+			cs_errno = CSE_NOCONN;
+		}
+
+		return -1;
+	}
+	crash_canjump = 1;
+
+	err = (*entry->plugin->run)(pconn, dbinfo, block, pda);
+
+	crash_canjump = 0;
+	signal(SIGSEGV, old_sigsegv);
+	signal(SIGBUS, old_sigbus);
+	signal(SIGILL, old_sigill);
+	signal(SIGFPE, old_sigfpe);
+
+	if (err < 0)
+	{
+		CONDUIT_TRACE(3)
+			fprintf(stderr, "Plugin \"%s\" returned %d\n",
+				entry->plugin->name, err);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* unload_plugins
+ * Call each loaded plugin's cleanup function, and unload it. This is
+ * called at the end of the sync, and by child processes before they
+ * exit. A child only calls the fini hook of the plugins that it loaded
+ * itself: the ones it inherited are the parent's to clean up.
+ */
+void
+unload_plugins(void)
+{
+	struct plugin_entry *entry;
+	pid_t me = getpid();
+
+	while (plugins != NULL)
+	{
+		entry = plugins;
+		plugins = entry->next;
+
+		CONDUIT_TRACE(4)
+			fprintf(stderr, "Unloading plugin \"%s\"\n",
+				entry->path);
+
+		if (entry->plugin != NULL && !entry->broken &&
+		    entry->plugin->fini != NULL && entry->loader == me)
+			(*entry->plugin->fini)();
+#if HAVE_DLOPEN
+		/* A broken plugin may have left signal handlers, atexit()
+		 * functions and such pointing into itself, so don't pull
+		 * it out from under them.
+		 */
+		if (entry->handle != NULL && !entry->broken)
+			dlclose(entry->handle);
+#endif	/* HAVE_DLOPEN */
+		free(entry->path);
+		free(entry);
+	}
+}
+
+/* load_plugin
+ * Find the plugin loaded from 'path', or load it if this is the first
+ * time it's needed.
+ * Returns the plugin's entry, or NULL in case of error. The returned
+ * entry may be marked broken.
+ */
+static struct plugin_entry *
+load_plugin(const char *path)
+{
+	struct plugin_entry *entry;
+#if HAVE_DLOPEN
+	union {
+		void *obj;		/* What dlsym() returns */
+		cs_plugin_entry func;	/* What it really is */
+	} entry_sym;
+#endif	/* HAVE_DLOPEN */
+
+	for (entry = plugins; entry != NULL; entry = entry->next)
+		if (strcmp(entry->path, path) == 0)
+			return entry;
+
+	if ((entry = (struct plugin_entry *)
+	     malloc(sizeof(struct plugin_entry))) == NULL)
+	{
+		Error(_("%s: Out of memory."), "load_plugin");
+		return NULL;
+	}
+	if ((entry->path = strdup(path)) == NULL)
+	{
+		Error(_("%s: Out of memory."), "load_plugin");
+		free(entry);
+		return NULL;
+	}
+	entry->handle = NULL;
+	entry->plugin = NULL;
+	entry->broken = True;		/* Until proven otherwise */
+	entry->loader = getpid();
+	entry->next = plugins;
+	plugins = entry;
+
+#if HAVE_DLOPEN
+	CONDUIT_TRACE(3)
+		fprintf(stderr, "Loading plugin \"%s\"\n", path);
+
+	if ((entry->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+	{
+		Error(_("Can't load plugin %s: %s"), path, dlerror());
+		return entry;
+	}
+
+	/* ANSI C doesn't allow casting a void * to a function pointer,
+	 * but that's what dlsym() returns, so go through a union.
+	 */
+	entry_sym.obj = dlsym(entry->handle, CS_PLUGIN_ENTRY);
+	if (entry_sym.obj == NULL)
+	{
+		Error(_("%s is not a ColdSync plugin, or was built for "
+			"another version of ColdSync (no %s)."),
+		      path, CS_PLUGIN_ENTRY);
+		return entry;
+	}
+
+	entry->plugin = (*entry_sym.func)();
+	if (entry->plugin == NULL ||
+	    entry->plugin->abi != CS_PLUGIN_ABI ||
+	    entry->plugin->name == NULL ||
+	    entry->plugin->run == NULL)
+	{
+		Error(_("Plugin %s has an invalid description."), path);
+		entry->plugin = NULL;
+		return entry;
+	}
+
+	if (entry->plugin->init != NULL &&
+	    (*entry->plugin->init)() < 0)
+	{
+		Error(_("Plugin %s failed to initialize."),
+		      entry->plugin->name);
+		return entry;
+	}
+
+	CONDUIT_TRACE(3)
+		fprintf(stderr, "Loaded plugin \"%s\" from \"%s\"\n",
+			entry->plugin->name, path);
+	entry->broken = False;
+#else	/* HAVE_DLOPEN */
+	Error(_("Can't load plugin %s: this copy of ColdSync was built "
+		"without plugin support."),
+	      path);
+#endif	/* HAVE_DLOPEN */
+
+	return entry;
+}
+
+/* crash_handler
+ * Catches fatal signals while a plugin is running, and jumps back to
+ * run_plugin().
+ */
+static RETSIGTYPE
+crash_handler(int sig)
+{
+	if (!crash_canjump)
+	{
+		/* Not in a plugin. Die the way we would have anyway. */
+		signal(sig, SIG_DFL);
+		raise(sig);
+		return;
+	}
+
+	crash_canjump = 0;
+	siglongjmp(crash_jmpbuf, sig);
+}
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
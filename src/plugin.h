@@ -0,0 +1,84 @@
+/* plugin.h
+ *
+ * Interface between ColdSync and conduits loaded as shared objects.
+ *
+ * A plugin conduit is a shared object named by the "path:" line of a
+ * conduit block. Instead of running it as a separate process and talking
+ * to it over pipes, ColdSync loads it with dlopen() and calls it directly,
+ * with the same arguments as a built-in conduit. A plugin can therefore
+ * use the DLP functions in libpconn on the connection it is given, rather
+ * than going through SPC.
+ *
+ * Each plugin exports a function named by CS_PLUGIN_ENTRY, which returns
+ * a pointer to a 'struct cs_plugin' describing the plugin. The version
+ * number is part of the function name, so that ColdSync won't call a
+ * plugin built for an incompatible version of this interface.
+ *
+ *	You may distribute this file under the terms of the Artistic
+ *	License, as specified in the README file.
+ *
+ * $Id$
+ */
+#ifndef _plugin_h_
+#define _plugin_h_
+
+#include "config.h"
+#include "pconn/pconn.h"
+#include "coldsync.h"
+
+#define CS_PLUGIN_ABI		1	/* Version of this interface */
+#define CS_PLUGIN_ENTRY		"coldsync_plugin_v1"
+					/* Name of the function that each
+					 * plugin must export */
+
+/* cs_plugin
+ * Description of a plugin conduit. The plugin keeps this structure in
+ * static storage; ColdSync never modifies or frees it.
+ */
+struct cs_plugin
+{
+	int abi;		/* Must be CS_PLUGIN_ABI */
+	const char *name;	/* Name of the plugin, for messages */
+	unsigned short flavors;	/* Flavors this plugin can be used as
+				 * (FLAVORFL_*) */
+
+	/* init: called once, after the plugin has been loaded. Returns 0
+	 * if successful, or a negative value if the plugin can't be used.
+	 * May be NULL.
+	 */
+	int (*init)(void);
+
+	/* run: called for every database the conduit applies to, with the
+	 * same arguments as a built-in conduit. Returns 0 if successful,
+	 * or a negative value in case of error.
+	 */
+	int (*run)(PConnection *pconn,
+		   const struct dlp_dbinfo *dbinfo,
+		   const conduit_block *block,
+		   const pda_block *pda);
+
+	/* fini: called once, at the end of the sync, before the plugin is
+	 * unloaded. May be NULL.
+	 */
+	void (*fini)(void);
+};
+
+/* The type of the function named by CS_PLUGIN_ENTRY */
+typedef const struct cs_plugin *(*cs_plugin_entry)(void);
+
+extern Bool is_plugin(const char *path);
+extern int run_plugin(PConnection *pconn,
+		      const struct dlp_dbinfo *dbinfo,
+		      const char *flavor,
+		      unsigned short flavor_mask,
+		      const conduit_block *block,
+		      const pda_block *pda);
+extern void unload_plugins(void);
+
+#endif	/* _plugin_h_ */
+
+/* This is for Emacs's benefit:
+ * Local Variables: ***
+ * fill-column:	75 ***
+ * End: ***
+ */
@@ -1,7 +1,8 @@
 /* pref.c
  *
  * Functions for creating the preference cache, retrieving the preferences
- * from the palm and writing the headers to the conduits.
+ * from the palm and writing the headers to the conduits, and saving them
+ * for later.
  *
  *	Copyright (C) 2000-2001, Sumant S.R. Oemrawsingh.
  *	You may distribute this file under the terms of the Artistic
@@ -13,6 +14,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>			/* For malloc and free */
+#include <sys/types.h>
+#include <sys/stat.h>			/* For stat() */
+#include <dirent.h>			/* For opendir(), readdir() */
+#include <unistd.h>			/* For unlink() */
 
 #if HAVE_LIBINTL_H
 #  include <libintl.h>			/* For i18n */
@@ -23,42 +28,156 @@
 
 extern struct pref_item *pref_cache;
 
-/* Creates the pref_cache from a given conduit block */
+/* The cache
+ * 'pref_cache' lists the preferences that the conduits ask for, in the
+ * order in which they first appear in the config file. So that each one
+ * can be found quickly, they are also indexed in 'pref_hash', an
+ * open-addressed hash table keyed by creator and ID, which is kept at
+ * most half full.
+ */
+static struct pref_item **pref_hash = NULL;
+static int pref_hash_size = 0;		/* Size of 'pref_hash'; a power of
+					 * 2 */
+static int pref_hash_count = 0;		/* # of items in 'pref_hash' */
+static struct pref_item *pref_tail = NULL;
+					/* Last item in 'pref_cache' */
+
+/* Saved preferences
+ * The cache can be saved to "<palmdir>/prefs.<serial>" at the end of a
+ * sync, for conduits that run later without the Palm (see
+ * SavePrefCache() and LoadPrefCache()). The file holds
+ *	magic		4 bytes		PREFS_MAGIC
+ *	serial length	1 byte
+ *	serial number	(serial length) bytes
+ * followed by an entry for each preference that was read:
+ *	creator		4 bytes
+ *	id		2 bytes
+ *	flags		1 byte		Where it was found (PREFDFL_*)
+ *	version		2 bytes
+ *	size		2 bytes
+ *	len		2 bytes
+ *	contents	(len) bytes
+ */
+#define PREFS_MAGIC		"CSpf"
+#define PREFS_FNAME		"/prefs."
+#define PREFS_ENTRY_LEN		13
+
+static unsigned long pref_hash_fn(const udword creator, const uword id);
+static int index_pref_item(struct pref_item *item);
+static int fetch_prefs(PConnection *pconn,
+		       struct pref_item **items,
+		       const int num_items);
+static const char *prefs_fname(const char *snum);
+
+/* pref_hash_fn
+ * FNV-1a hash of a preference's creator and ID.
+ */
+static unsigned long
+pref_hash_fn(const udword creator, const uword id)
+{
+	unsigned long h = 2166136261UL;
+	int i;
+
+	for (i = 24; i >= 0; i -= 8)
+	{
+		h ^= (creator >> i) & 0xff;
+		h *= 16777619UL;
+	}
+	h ^= (id >> 8) & 0xff;
+	h *= 16777619UL;
+	h ^= id & 0xff;
+	h *= 16777619UL;
+	return h;
+}
+
+/* index_pref_item
+ * Add 'item' to 'pref_hash', growing it if need be.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+index_pref_item(struct pref_item *item)
+{
+	unsigned long mask;
+	unsigned long h;
+
+	if (2 * (pref_hash_count + 1) > pref_hash_size)
+	{
+		struct pref_item **newhash;
+		struct pref_item *cursor;
+		int newsize;
+
+		for (newsize = 32; newsize < 2 * (pref_hash_count + 1);
+		     newsize *= 2)
+			;
+		if ((newhash = (struct pref_item **)
+		     calloc(newsize, sizeof(struct pref_item *))) == NULL)
+			return -1;
+		if (pref_hash != NULL)
+			free(pref_hash);
+		pref_hash = newhash;
+		pref_hash_size = newsize;
+
+		/* Put back everything that's already in the cache */
+		mask = newsize - 1;
+		for (cursor = pref_cache; cursor != NULL;
+		     cursor = cursor->next)
+		{
+			if (cursor == item)
+				continue;
+			for (h = pref_hash_fn(cursor->description.creator,
+					      cursor->description.id) & mask;
+			     pref_hash[h] != NULL;
+			     h = (h + 1) & mask)
+				;
+			pref_hash[h] = cursor;
+		}
+	}
+
+	mask = pref_hash_size - 1;
+	for (h = pref_hash_fn(item->description.creator,
+			      item->description.id) & mask;
+	     pref_hash[h] != NULL;
+	     h = (h + 1) & mask)
+		;
+	pref_hash[h] = item;
+	pref_hash_count++;
+
+	return 0;
+}
+
+/* Creates the pref_cache from a given conduit block, and, if 'pconn' is
+ * not NULL, reads all of the preferences from the Palm in one go, rather
+ * than one at a time in the middle of the sync, as the conduits ask for
+ * them.
+ */
 int
 CacheFromConduits(const conduit_block *conduits,
 		  PConnection *pconn)
 {
 	const conduit_block *conduit_cursor;
-	pref_item *pref_cursor;
 	pref_item *item;
+	struct pref_item **wanted;	/* Preferences to read */
+	int num_wanted;
 	int i;
 
-	/* Create a placeholder for first item */
-	/* XXX - Ugh. This seems convoluted */
-	if ((pref_cache = (pref_item *) malloc(sizeof *pref_cache))
-		== NULL)
-	    return -1; /* Failure */
-
-	pref_cursor = pref_cache;
-	pref_cursor->next = NULL;
-	pref_cursor->contents = NULL;
-	pref_cursor->contents_info = NULL;
-	pref_cursor->pconn = pconn;	/* Needed for run_conduit */
+	/* Start from scratch */
+	FreePrefList(pref_cache);
 
 	/* Look at each conduit's list of preferences in turn */
 	for (conduit_cursor = conduits;
 	     conduit_cursor != NULL;
 	     conduit_cursor = conduit_cursor->next)
 	{
-		if (conduit_cursor->path == NULL)
+		if ((conduit_cursor->path == NULL) ||
+		    !conduit_cursor->enabled)
 			continue;
 
 		for (i = 0;
 		     i < conduit_cursor->num_prefs;
 		     i++)
 		{
-			if ((item = FindPrefItem(&(conduit_cursor->prefs[i]),
-						 pref_cache)) != NULL)
+			if ((item = FindPrefItem(&(conduit_cursor->prefs[i])))
+			    != NULL)
 				/* This preference is already in the cache.
 				 * Skip it.
 				 */
@@ -74,272 +193,253 @@ CacheFromConduits(const conduit_block *conduits,
 					(char) conduit_cursor->prefs[i].creator & 0xff,
 					conduit_cursor->prefs[i].id);
 
-			item = (pref_item *) malloc(sizeof *item);
-			pref_cursor->next = item;
+			if ((item = (pref_item *) malloc(sizeof *item))
+			    == NULL)
+			{
+				Error(_("%s: Out of memory."),
+				      "CacheFromConduits");
+				return -1;
+			}
 			item->next = NULL;
 			item->contents = NULL;
 			item->contents_info = NULL;
 			item->description = conduit_cursor->prefs[i];
-			item->pconn = pconn;
-			pref_cursor = item;
+			item->pconn = pconn;	/* Needed for run_conduit */
+
+			if (pref_tail == NULL)
+				pref_cache = item;
+			else
+				pref_tail->next = item;
+			pref_tail = item;
+
+			if (index_pref_item(item) < 0)
+			{
+				Error(_("%s: Out of memory."),
+				      "CacheFromConduits");
+				return -1;
+			}
 		}
 	}
 
-	pref_cursor = pref_cache->next;
-	FreePrefItem(pref_cache);
-	pref_cache = pref_cursor;
+	if ((pconn == NULL) || (pref_hash_count == 0))
+		return 0;	/* Success */
+
+	/* Read them all now */
+	if ((wanted = (struct pref_item **)
+	     malloc(pref_hash_count * sizeof(struct pref_item *))) == NULL)
+	{
+		Error(_("%s: Out of memory."),
+		      "CacheFromConduits");
+		return -1;
+	}
+	num_wanted = 0;
+	for (item = pref_cache; item != NULL; item = item->next)
+		wanted[num_wanted++] = item;
+
+	MISC_TRACE(3)
+		fprintf(stderr, "Reading %d preference(s) from the Palm\n",
+			num_wanted);
+
+	/* If this fails, the conduits that want these preferences will
+	 * try again, and deal with the error.
+	 */
+	fetch_prefs(pconn, wanted, num_wanted);
+	free(wanted);
 
 	return 0;	/* Success */
 }
 
-/* Makes sure the pref_item is filled with the contents found in the specified
- * database (specified in the flags of the description structure of the
- * pref_item). If none is specified, looks in Saved first and if not found,
- * looks in Unsaved. If still not found, assumes to be empty. If found in
- * either one, the flags are changed to reflect where the item was actually
- * found. Returns 0 upon success.
+/* fetch_prefs
+ * Read the preferences 'items' from the Palm, with as few round trips as
+ * possible (see DlpReadAppPreferences()). Each preference is looked up
+ * in the database specified in the flags of its description. If none is
+ * specified, it is looked up in Saved first, and then, if not found, in
+ * Unsaved. If still not found, it is assumed to be empty. If found in
+ * either one, the flags are changed to reflect where the item was
+ * actually found.
+ * Items that already have their contents are left alone.
+ * Returns 0 if successful, or a negative value in case of error.
  */
-int
-FetchPrefItem(PConnection *pconn,
-	      struct pref_item *prefitem)
+static int
+fetch_prefs(PConnection *pconn,
+	    struct pref_item **items,
+	    const int num_items)
 {
-	ubyte flags;
 	int err;
+	struct dlp_apppref_req *reqs;	/* Requests to the Palm */
+	struct pref_item **asked;	/* Item for each request */
+	int num_reqs;
+	int pass;
+	int i;
 
-	if (prefitem == NULL)
-	    return -1;	/* Failiure, item doesn't exist */
-
-	if (prefitem->contents_info != NULL)
-		return 0;	/* Trivial success */
+	if (num_items == 0)
+		return 0;
 
-	/* We save the set flags, because we are going to change the flags
-	 * in the description to where we found the preference. If an error
-	 * occurs, or we don't find the preference, restore flags to the set
-	 * value.
-	 */
-	flags = prefitem->description.flags;
+	if (((reqs = (struct dlp_apppref_req *)
+	      malloc(num_items * sizeof(struct dlp_apppref_req))) == NULL) ||
+	    ((asked = (struct pref_item **)
+	      malloc(num_items * sizeof(struct pref_item *))) == NULL))
+	{
+		if (reqs != NULL)
+			free(reqs);
+		Error(_("%s: Out of memory."),
+		      "fetch_prefs");
+		return -1;
+	}
 
-	/* Either we must look in the saved preferences (whatever the unsaved
-	 * bit says), or the unsaved bit is not set (in which case it doesn't
-	 * matter what the saved bit says, since we must look inside the saved
-	 * database anyway.
+	/* First pass: look in Saved Preferences. Second pass: look in
+	 * Unsaved Preferences for those that weren't found.
 	 */
-	if ((flags & PREFDFL_SAVED) != 0 ||
-	    (flags & PREFDFL_UNSAVED) == 0)
+	for (pass = 0; pass < 2; pass++)
 	{
-		MISC_TRACE(4)
-			fprintf(stderr,"Downloading preference from Saved "
-				"Preferences: '%c%c%c%c' %u\n",
-				(char) (prefitem->description.creator >> 24) & 0xff,
-				(char) (prefitem->description.creator >> 16) & 0xff,
-				(char) (prefitem->description.creator >> 8) & 0xff,
-				(char) prefitem->description.creator & 0xff,
-				prefitem->description.id);
-		prefitem->description.flags = PREFDFL_SAVED;
-		if ((err = DownloadPrefItem(pconn,prefitem)) < 0)
+		ubyte want = (pass == 0 ? PREFDFL_SAVED : PREFDFL_UNSAVED);
+		ubyte other = (pass == 0 ? PREFDFL_UNSAVED : PREFDFL_SAVED);
+
+		num_reqs = 0;
+		for (i = 0; i < num_items; i++)
 		{
-			prefitem->description.flags = flags;
-			return err;
-		}
-	}
+			struct pref_item *item = items[i];
+			ubyte flags = item->description.flags;
+
+			if ((item->contents_info != NULL) &&
+			    ((pass == 0) ||
+			     (item->contents_info->version != 0)))
+				continue;	/* Already have it */
+
+			/* Either we must look in this database (whatever
+			 * the other bit says), or the other bit is not set
+			 * (in which case we must look in both).
+			 */
+			if (((flags & want) == 0) && ((flags & other) != 0))
+				continue;
 
-	/* Did we find it? */
-	if (prefitem->contents_info->version != 0)
-	    return 0;
+			MISC_TRACE(4)
+				fprintf(stderr, "Downloading preference from "
+					"%s Preferences: '%c%c%c%c' %u\n",
+					(pass == 0 ? "Saved" : "Unsaved"),
+					(char) (item->description.creator >> 24) & 0xff,
+					(char) (item->description.creator >> 16) & 0xff,
+					(char) (item->description.creator >> 8) & 0xff,
+					(char) item->description.creator & 0xff,
+					item->description.id);
+
+			reqs[num_reqs].creator = item->description.creator;
+			reqs[num_reqs].id = item->description.id;
+			reqs[num_reqs].flags =
+				(pass == 0 ? PREF_SAVED : PREF_UNSAVED);
+			reqs[num_reqs].data = NULL;
+			asked[num_reqs] = item;
+			num_reqs++;
+		}
+		if (num_reqs == 0)
+			continue;
 
-	/* Same reasoning as above */
-	if ((flags & PREFDFL_UNSAVED) != 0 ||
-	    (flags & PREFDFL_SAVED) == 0)
-	{
-		MISC_TRACE(4)
-			fprintf(stderr,"Downloading preference from Unsaved "
-				"Preferences: '%c%c%c%c' %u\n",
-				(char) (prefitem->description.creator >> 24) & 0xff,
-				(char) (prefitem->description.creator >> 16) & 0xff,
-				(char) (prefitem->description.creator >> 8) & 0xff,
-				(char) prefitem->description.creator & 0xff,
-				prefitem->description.id);
-		prefitem->description.flags = PREFDFL_SAVED;
-		prefitem->description.flags = PREFDFL_UNSAVED;
-		if ((err = DownloadPrefItem(pconn,prefitem)) < 0)
+		if ((err = DlpReadAppPreferences(pconn, num_reqs, reqs)) < 0)
 		{
-			prefitem->description.flags = flags;
+			for (i = 0; i < num_reqs; i++)
+				if (reqs[i].data != NULL)
+					free(reqs[i].data);
+			free(reqs);
+			free(asked);
 			return err;
 		}
-	}
 
-	/* If we didn't find it, restore the flags */
-	if (prefitem->contents == NULL)
-		prefitem->description.flags = flags;
+		for (i = 0; i < num_reqs; i++)
+		{
+			struct pref_item *item = asked[i];
+
+			if ((reqs[i].status != DLPSTAT_NOERR) &&
+			    (reqs[i].status != DLPSTAT_NOTFOUND))
+			{
+				/* XXX - What to do with other DLPSTAT_XXX? */
+				Warn(_("Can't read preference 0x%08lx/%d: %s."),
+				     item->description.creator,
+				     item->description.id,
+				     dlp_strerror(reqs[i].status));
+				continue;
+			}
 
+			if (item->contents_info == NULL &&
+			    (item->contents_info = (struct dlp_apppref *)
+			     malloc(sizeof(struct dlp_apppref))) == NULL)
+			{
+				free(reqs[i].data);
+				continue;
+			}
+			*(item->contents_info) = reqs[i].pref;
+
+			if (item->contents != NULL)
+				free(item->contents);
+			item->contents = reqs[i].data;
+
+			/* Did we find it? If not, leave the flags alone. */
+			if (reqs[i].pref.version != 0)
+			{
+				item->description.flags = want;
+
+				MISC_TRACE(3)
+					fprintf(stderr,
+						"Successfully downloaded %u "
+						"of %u bytes of preference "
+						"item '%c%c%c%c' %u\n",
+						item->contents_info->len,
+						item->contents_info->size,
+						(char) (item->description.creator >> 24) & 0xff,
+						(char) (item->description.creator >> 16) & 0xff,
+						(char) (item->description.creator >> 8) & 0xff,
+						(char) item->description.creator & 0xff,
+						item->description.id);
+			}
+		}
+	}
+
+	free(reqs);
+	free(asked);
 	return 0;	/* Success */
 }
 
-/* Downloads the preference item from the palm. Checks where to download from.
- * This routine shouldn't be called directly. Instead, call FetchPrefItem,
- * which determines where to look for the preference first.
- * The only thing that makes sense to download the prefs with just the right
- * memory, is to first download the preference into an array NULL with length
- * 0 (duh), so that DlpReadAppPreference can return the size of the preference.
- * Then we allocate the right amount of space and call it again, this time
- * with the exact size and an array that makes sense. Slower? Maybe, but it's
- * the only way to be sure you download all and not segfault.
- */
-/* XXX - It might be better to allocate, say, a 1Kb buffer to hold the
- * preference value, and tell DlpReadAppPreference() to download no more
- * than 1Kb. Then check the real size of the preference. If the preference
- * is longer than our buffer, reallocate the buffer and call
- * DlpReadAppPreference().
- * With a larger buffer size, you don't need to call DlpReadAppPreference()
- * a second time as often. OTOH, the penalty for not getting it all the
- * first time is worse with larger buffers.
+/* Makes sure the pref_item is filled with the contents found on the Palm.
+ * See fetch_prefs() for where it looks. Returns 0 upon success.
  */
 int
-DownloadPrefItem(PConnection *pconn,
-		 struct pref_item *prefitem)
+FetchPrefItem(PConnection *pconn,
+	      struct pref_item *prefitem)
 {
-	struct dlp_apppref *contents_info;
-	ubyte *contents;
-	ubyte flags;
-	int err;
-
-	if ((prefitem->description.flags & PREFDFL_SAVED) != 0)
-		flags = PREF_SAVED;
-	else
-		flags = PREF_UNSAVED;
+	if (prefitem == NULL)
+	    return -1;	/* Failiure, item doesn't exist */
 
 	if (prefitem->contents_info != NULL)
-	    contents_info = prefitem->contents_info;
-	else
-	if ((contents_info = malloc(sizeof *contents_info)) == NULL)
-	{
-		Error(_("%s: Out of memory."),
-		      "DownloadPrefItem");
-		return -1;
-	}
-
-	/* Now reset the info */
-	contents_info->len = 0;		/* Length of NULL */
-	contents_info->size = 0;
-	contents_info->version = 0;
-
-	/* First read. Let the routine write the real size into contents_info.
-	 */
-	err = DlpReadAppPreference(pconn,
-				   prefitem->description.creator,
-				   prefitem->description.id,
-				   contents_info->len,
-				   flags,
-				   contents_info,
-				   NULL);
-
-	/* Check for any errors */
-	/* XXX - What if we get any DLPSTAT_XXX here? */ 
-	if (err < 0)
-	{
-		/* If there was no error, contents_info doesn't exist,
-		 * because the preference was simply not found.
-		 */
-		free(contents_info);
-		return err;
-	}
-	MISC_TRACE(4)
-		fprintf(stderr,"Preference item '%c%c%c%c' %u has a size of "
-			"%u bytes\n",
-			(char) (prefitem->description.creator >> 24) & 0xff,
-			(char) (prefitem->description.creator >> 16) & 0xff,
-			(char) (prefitem->description.creator >> 8) & 0xff,
-			(char) prefitem->description.creator & 0xff,
-			prefitem->description.id,
-			contents_info->size);
-
-	/* Zero size? This means either the preference was not found (so the
-	 * size is 0 since we set it explicitly a few lines back), or it was
-	 * found but just had size 0. Either way, don't waste any more time and
-	 * just return.
-	 */
-	if (contents_info->size == 0)
-	{
-	    prefitem->contents_info = contents_info;
-	    if (prefitem->contents != NULL)
-		free(prefitem->contents);
-	    prefitem->contents = NULL;
-	    return 0;
-	}
-
-	/* Now we allocate the right amount of space */
-	if ((contents = calloc(contents_info->size, sizeof *contents)) == NULL)
-	{
-	    Error(_("%s: Out of memory."),
-		  "DownloadPrefItem");
-	    free(contents_info);
-	    return -1;
-	}
-
-	/* And here we go for the second and final run. */
-	err = DlpReadAppPreference(pconn,
-				   prefitem->description.creator,
-				   prefitem->description.id,
-				   contents_info->size,
-				   flags,
-				   contents_info,
-				   contents);
-
-	/* XXX - Check error more thoroughly */
-	if (err < 0)
-	{
-		free(contents_info);
-		free(contents);
-		return err;
-	}
-
-	MISC_TRACE(3)
-		fprintf(stderr,"Successfully downloaded %u of %u bytes of "
-			"preference item '%c%c%c%c' %u\n",
-			contents_info->len,
-			contents_info->size,
-			(char) (prefitem->description.creator >> 24) & 0xff,
-			(char) (prefitem->description.creator >> 16) & 0xff,
-			(char) (prefitem->description.creator >> 8) & 0xff,
-			(char) prefitem->description.creator & 0xff,
-			prefitem->description.id);
-
-	/* Be nice and give the man any memory back */
-	if (prefitem->contents != NULL)
-	{
-	    free(prefitem->contents);
-	    prefitem->contents = NULL;
-	}
+		return 0;	/* Trivial success */
 
-	prefitem->contents = contents;
-	prefitem->contents_info = contents_info;
+	if (pconn == NULL)
+		return -1;	/* There's no Palm to ask */
 
-	return 0;	/* Success */
+	return fetch_prefs(pconn, &prefitem, 1);
 }
 
 struct pref_item *
-FindPrefItem(const struct pref_desc *description,
-	     struct pref_item *list)
+FindPrefItem(const struct pref_desc *description)
 {
+	unsigned long mask;
+	unsigned long h;
+
 	SYNC_TRACE(4)
 		fprintf(stderr, "FindPrefItem: looking for 0x%08lx/%d\n",
 			description->creator, description->id);
 
-	/* Walk the list, looking for a pref_item that matches
-	 * 'description'
-	 */
-	for (; list != NULL; list = list->next)
+	if (pref_hash_size == 0)
+		return NULL;	/* Empty cache */
+
+	mask = pref_hash_size - 1;
+	for (h = pref_hash_fn(description->creator, description->id) & mask;
+	     pref_hash[h] != NULL;
+	     h = (h + 1) & mask)
 	{
-		SYNC_TRACE(4)
-			fprintf(stderr,
-				"FindPrefItem: comparing against 0x%08lx/%d\n",
-				list->description.creator,
-				list->description.id);
-
-		if ((description->creator == list->description.creator) &&
-		    (description->id == list->description.id))
+		if ((description->creator ==
+		     pref_hash[h]->description.creator) &&
+		    (description->id == pref_hash[h]->description.id))
 			/* Found it */
-			return list;
+			return pref_hash[h];
 	}
 	return NULL;	/* Didn't find it */
 }
@@ -350,7 +450,7 @@ GetPrefItem(struct pref_desc *description)
 {
     struct pref_item  *retval;
 
-    if ((retval = FindPrefItem(description, pref_cache)) == NULL)
+    if ((retval = FindPrefItem(description)) == NULL)
 	return NULL;
 
     if (FetchPrefItem(retval->pconn, retval) < 0)
@@ -359,6 +459,231 @@ GetPrefItem(struct pref_desc *description)
     return retval;
 }
 
+/* PrefItemCached
+ * Returns True iff the preference 'description' is in the cache, and
+ * has already been read, so that it can be given to a conduit without
+ * asking the Palm.
+ */
+Bool
+PrefItemCached(const struct pref_desc *description)
+{
+	struct pref_item *item;
+
+	if ((item = FindPrefItem(description)) == NULL)
+		return False;
+	return (item->contents_info != NULL) ? True : False;
+}
+
+/* prefs_fname
+ * Returns the pathname of the saved preferences for the Palm with serial
+ * number 'snum', or NULL if there's nowhere to put them.
+ */
+static const char *
+prefs_fname(const char *snum)
+{
+	if ((palmdir[0] == '\0') || (snum == NULL) || (snum[0] == '\0') ||
+	    (strchr(snum, '/') != NULL))
+		return NULL;
+	return mkfname(palmdir, PREFS_FNAME, snum, NULL);
+}
+
+/* SavePrefCache
+ * Write out the preferences that have been read from the Palm with serial
+ * number 'snum'. Failure isn't fatal: conduits that run without the Palm
+ * just won't be able to use them.
+ */
+void
+SavePrefCache(const char *snum)
+{
+	const char *fname;
+	char tmpfname[MAXPATHLEN+1];
+	FILE *fp;
+	ubyte buf[PREFS_ENTRY_LEN];
+	ubyte *wptr;
+	struct pref_item *item;
+	Bool ok;
+
+	if ((fname = prefs_fname(snum)) == NULL)
+	{
+		MISC_TRACE(2)
+			fprintf(stderr, "Not saving preferences: no serial "
+				"number\n");
+		return;
+	}
+
+	/* Write to a temporary file, then rename it, so that the file is
+	 * never half-written.
+	 */
+	snprintf(tmpfname, sizeof(tmpfname), "%s.tmp", fname);
+	if ((fp = fopen(tmpfname, "wb")) == NULL)
+	{
+		MISC_TRACE(2)
+			fprintf(stderr, "Can't create \"%s\"\n", tmpfname);
+		return;
+	}
+
+	ok = (fwrite(PREFS_MAGIC, 1, 4, fp) == 4 &&
+	      putc(strlen(snum), fp) != EOF &&
+	      fwrite(snum, 1, strlen(snum), fp) == strlen(snum));
+	for (item = pref_cache; ok && (item != NULL); item = item->next)
+	{
+		uword len;
+
+		if (item->contents_info == NULL)
+			continue;	/* Never read */
+		len = (item->contents == NULL ? 0 : item->contents_info->len);
+
+		wptr = buf;
+		put_udword(&wptr, item->description.creator);
+		put_uword(&wptr, item->description.id);
+		put_ubyte(&wptr, item->description.flags);
+		put_uword(&wptr, item->contents_info->version);
+		put_uword(&wptr, item->contents_info->size);
+		put_uword(&wptr, len);
+		ok = (fwrite(buf, 1, PREFS_ENTRY_LEN, fp) == PREFS_ENTRY_LEN &&
+		      (len == 0 ||
+		       fwrite(item->contents, 1, len, fp) == len));
+	}
+
+	if ((fclose(fp) != 0) || !ok || (rename(tmpfname, fname) < 0))
+	{
+		MISC_TRACE(2)
+			fprintf(stderr, "Can't write \"%s\"\n", fname);
+		unlink(tmpfname);
+		return;
+	}
+
+	MISC_TRACE(3)
+		fprintf(stderr, "Saved preferences to \"%s\"\n", fname);
+}
+
+/* LoadPrefCache
+ * Fill in the preferences in the cache that haven't been read yet from
+ * those saved for the Palm with serial number 'snum'. If 'snum' is NULL,
+ * use whichever Palm's preferences were saved last.
+ * Returns the serial number of the Palm whose preferences were used, or
+ * NULL if there weren't any.
+ */
+const char *
+LoadPrefCache(const char *snum)
+{
+	static char loaded[256];	/* Serial number we loaded */
+	char filesnum[256];		/* Serial number in the file */
+	const char *fname;
+	FILE *fp;
+	ubyte buf[PREFS_ENTRY_LEN];
+	const ubyte *rptr;
+	int count = 0;
+	int len;
+
+	if (snum == NULL)
+	{
+		/* Find the most recently saved preferences */
+		DIR *dir;
+		struct dirent *file;
+		struct stat statbuf;
+		time_t newest = 0;
+
+		if ((palmdir[0] == '\0') || ((dir = opendir(palmdir)) == NULL))
+			return NULL;
+		loaded[0] = '\0';
+		while ((file = readdir(dir)) != NULL)
+		{
+			const char *s;
+
+			if (strncmp(file->d_name, PREFS_FNAME + 1,
+				    strlen(PREFS_FNAME + 1)) != 0)
+				continue;
+			s = file->d_name + strlen(PREFS_FNAME + 1);
+			if ((strlen(s) >= sizeof(loaded)) ||
+			    (strstr(s, ".tmp") != NULL) ||
+			    ((fname = prefs_fname(s)) == NULL) ||
+			    (stat(fname, &statbuf) < 0) ||
+			    (statbuf.st_mtime < newest))
+				continue;
+			newest = statbuf.st_mtime;
+			strcpy(loaded, s);
+		}
+		closedir(dir);
+		if (loaded[0] == '\0')
+			return NULL;
+		snum = loaded;
+	}
+
+	if (((fname = prefs_fname(snum)) == NULL) ||
+	    ((fp = fopen(fname, "rb")) == NULL))
+		return NULL;		/* Nothing saved. That's okay */
+
+	/* Make sure the file is for this Palm */
+	if ((fread(buf, 1, 5, fp) != 5) ||
+	    (memcmp(buf, PREFS_MAGIC, 4) != 0) ||
+	    (buf[4] != strlen(snum)) ||
+	    (buf[4] >= sizeof(filesnum)) ||
+	    (fread(filesnum, 1, buf[4], fp) != buf[4]) ||
+	    (memcmp(filesnum, snum, buf[4]) != 0))
+	{
+		MISC_TRACE(3)
+			fprintf(stderr, "\"%s\" isn't a preference file for "
+				"this Palm\n", fname);
+		fclose(fp);
+		return NULL;
+	}
+	filesnum[buf[4]] = '\0';
+	strcpy(loaded, filesnum);
+
+	while (fread(buf, 1, PREFS_ENTRY_LEN, fp) == PREFS_ENTRY_LEN)
+	{
+		struct pref_desc desc;
+		struct pref_item *item;
+		struct dlp_apppref info;
+		ubyte *contents = NULL;
+
+		rptr = buf;
+		desc.creator = get_udword(&rptr);
+		desc.id = get_uword(&rptr);
+		desc.flags = get_ubyte(&rptr);
+		info.version = get_uword(&rptr);
+		info.size = get_uword(&rptr);
+		info.len = get_uword(&rptr);
+		len = info.len;
+
+		if (len > 0)
+		{
+			if ((contents = (ubyte *) malloc(len)) == NULL)
+				break;
+			if (fread(contents, 1, len, fp) != (size_t) len)
+			{
+				free(contents);
+				break;
+			}
+		}
+
+		/* Only fill in preferences that some conduit wants, and
+		 * that we don't already have.
+		 */
+		if (((item = FindPrefItem(&desc)) == NULL) ||
+		    (item->contents_info != NULL) ||
+		    ((item->contents_info = (struct dlp_apppref *)
+		      malloc(sizeof(struct dlp_apppref))) == NULL))
+		{
+			if (contents != NULL)
+				free(contents);
+			continue;
+		}
+		*(item->contents_info) = info;
+		item->contents = contents;
+		item->description.flags = desc.flags;
+		count++;
+	}
+	fclose(fp);
+
+	MISC_TRACE(3)
+		fprintf(stderr, "Loaded %d preference(s) from \"%s\"\n",
+			count, fname);
+
+	return loaded;
+}
+
 void
 FreePrefItem(struct pref_item *prefitem)
 {
@@ -384,6 +709,18 @@ FreePrefList(struct pref_item *list)
 {
     struct pref_item *cursor;
 
+    if ((list != NULL) && (list == pref_cache))
+    {
+	/* Drop the index as well */
+	if (pref_hash != NULL)
+	    free(pref_hash);
+	pref_hash = NULL;
+	pref_hash_size = 0;
+	pref_hash_count = 0;
+	pref_cache = NULL;
+	pref_tail = NULL;
+    }
+
     for (cursor = list;
 	 cursor != NULL;
 	 cursor = list)
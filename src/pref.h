@@ -49,11 +49,12 @@ typedef struct pref_item
 extern int CacheFromConduits(const conduit_block *conduits,
 			     PConnection *pconn);
 extern int FetchPrefItem(PConnection *pconn, pref_item *prefitem);
-extern int DownloadPrefItem(PConnection *pconn, pref_item *prefitem);
 extern struct pref_item *FindPrefItem(
-	const struct pref_desc *description,
-	struct pref_item *list);
+	const struct pref_desc *description);
 extern struct pref_item *GetPrefItem(struct pref_desc *description);
+extern Bool PrefItemCached(const struct pref_desc *description);
+extern void SavePrefCache(const char *snum);
+extern const char *LoadPrefCache(const char *snum);
 extern void FreePrefItem(struct pref_item *prefitem);
 extern void FreePrefList(struct pref_item *list);
 
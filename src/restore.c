@@ -11,6 +11,7 @@
  */
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>		/* For calloc(), free() */
 #include <fcntl.h>		/* For open() */
 #include <string.h>		/* For strlen() and friends */
 
@@ -128,6 +129,162 @@ is_database_restorable(PConnection *pconn,
 	return True;
 }
 
+/* same_records
+ * Compare the records in the open database 'dbh' with those in 'pdb'. The
+ * list of record IDs serves as a fingerprint: if the Palm has the same
+ * records, in the same order, returns True.
+ */
+static Bool
+same_records(PConnection *pconn,
+	     const ubyte dbh,
+	     const struct pdb *pdb)
+{
+	int err;
+	struct pdb_record *rec;
+	udword *recids;		/* Record IDs on the Palm */
+	udword numrecs;		/* # records we'd upload. A udword, since
+				 * we ask for one more than that */
+	udword got;		/* # record IDs read so far */
+	udword want;		/* # record IDs to ask for */
+	uword num_read;
+	udword i;
+	Bool same;
+
+	/* upload_database() skips zero-length records, so don't count
+	 * them.
+	 */
+	numrecs = 0;
+	for (rec = pdb->rec_index.rec; rec != NULL; rec = rec->next)
+		if (rec->data_len > 0)
+			numrecs++;
+
+	/* Ask for one more ID than we expect, to find out whether the
+	 * Palm has extra records.
+	 */
+	if ((recids = (udword *) calloc(numrecs + 1, sizeof(udword))) == NULL)
+		return False;
+
+	/* DlpReadRecordIDList() might not return all the IDs at once; see
+	 * download_records().
+	 */
+	got = 0;
+	while (got <= numrecs)
+	{
+		want = numrecs + 1 - got;
+		if (want > 0xffff)
+			want = 0xffff;	/* Most DlpReadRecordIDList() can
+					 * ask for */
+		err = DlpReadRecordIDList(pconn, dbh, 0,
+					  (uword) got, (uword) want,
+					  &num_read, recids + got);
+		if (err == (int) DLPSTAT_NOTFOUND)
+			break;		/* No more records */
+		if (err != (int) DLPSTAT_NOERR)
+		{
+			free(recids);
+			return False;
+		}
+		if (num_read == 0)
+			break;
+		got += num_read;
+	}
+
+	same = (got == numrecs);
+	for (i = 0, rec = pdb->rec_index.rec; same && rec != NULL;
+	     rec = rec->next)
+	{
+		if (rec->data_len == 0)
+			continue;
+		if (rec->id != recids[i++])
+			same = False;
+	}
+	free(recids);
+
+	SYNC_TRACE(6)
+		fprintf(stderr, " %ld records on the Palm, %ld here: %s\n",
+			(long) got, (long) numrecs,
+			same ? "same" : "different");
+	return same;
+}
+
+/* same_resources
+ * Compare the resources in the open database 'dbh' with those in 'pdb'.
+ * There's no cheap way to list the resources on the Palm, so this just
+ * compares the number of resources.
+ */
+static Bool
+same_resources(PConnection *pconn,
+	       const ubyte dbh,
+	       const struct pdb *pdb)
+{
+	int err;
+	struct dlp_opendbinfo opendbinfo;
+
+	err = DlpReadOpenDBInfo(pconn, dbh, &opendbinfo);
+	if (err != (int) DLPSTAT_NOERR)
+		return False;
+
+	SYNC_TRACE(6)
+		fprintf(stderr, " %d resources on the Palm, %d here\n",
+			opendbinfo.numrecs, pdb->numrecs);
+	return opendbinfo.numrecs == pdb->numrecs ? True : False;
+}
+
+/* palm_has_current
+ * For incremental restores: see whether the Palm already has the same
+ * version of 'pdb' as the file. That is, the database on the Palm has
+ * the same type, creator, version, modification number and modification
+ * time, and the same records (see same_records() and same_resources()).
+ * If so, there's no need to restore it.
+ */
+static Bool
+palm_has_current(PConnection *pconn,
+		 struct Palm *palm,
+		 const struct pdb *pdb)
+{
+	int err;
+	const struct dlp_dbinfo *dbinfo;
+	ubyte dbh;		/* Database handle */
+	Bool same;
+
+	if ((dbinfo = palm_find_dbentry(palm, pdb->name)) == NULL)
+		return False;
+
+	SYNC_TRACE(6)
+		fprintf(stderr, "comparing %s: modnum %ld/%ld, "
+			"mtime %ld/%ld\n",
+			pdb->name,
+			dbinfo->modnum, pdb->modnum,
+			time_dlp2palmtime(&dbinfo->mtime), pdb->mtime);
+
+	/* Check what we already know from the list of databases first:
+	 * that doesn't cost anything.
+	 */
+	if (dbinfo->type != pdb->type ||
+	    dbinfo->creator != pdb->creator ||
+	    dbinfo->version != pdb->version ||
+	    dbinfo->modnum != pdb->modnum ||
+	    time_dlp2palmtime(&dbinfo->mtime) != pdb->mtime ||
+	    ((dbinfo->db_flags & DLPCMD_DBFLAG_RESDB) ? True : False) !=
+	    (IS_RSRC_DB(pdb) ? True : False))
+		return False;
+
+	err = DlpOpenDB(pconn, CARD0, pdb->name,
+			DLPCMD_MODE_READ | DLPCMD_MODE_SECRET,
+			&dbh);
+	if (err != (int) DLPSTAT_NOERR)
+		return False;
+
+	if (IS_RSRC_DB(pdb))
+		same = same_resources(pconn, dbh, pdb);
+	else
+		same = same_records(pconn, dbh, pdb);
+
+	DlpCloseDB(pconn, dbh, 0);
+
+	return same;
+}
+
 /* restore_file
  * Restore an individual file.
  */
@@ -171,6 +328,20 @@ restore_file(PConnection *pconn,
 		return 0;
 	}
 
+	/* In an incremental restore, leave alone any database that the
+	 * Palm already has.
+	 */
+	if (global_opts.incremental_restore &&
+	    palm_has_current(pconn, palm, pdb))
+	{
+		Verbose(1, _("\"%s\" is unchanged. Not restoring it."),
+			pdb->name);
+		va_add_to_log(pconn, "%s %s - %s\n",
+			      _("Restore"), pdb->name, _("Unchanged"));
+		free_pdb(pdb);
+		return 0;
+	}
+
 	/* Call pdb_Upload() to install the file. Enable the force
 	 * option so that existing databases that aren't newer than
 	 * the one were trying to install are wiped first.
@@ -33,6 +33,12 @@
 #include <time.h>		/* For ctime() */
 #include <syslog.h>		/* For syslog() */
 #include <pwd.h>		/* For getpwent() */
+#include <signal.h>		/* For signal() */
+#include <sys/wait.h>		/* For waitpid() */
+
+#if HAVE_SYS_EPOLL_H
+#  include <sys/epoll.h>	/* For epoll_*() */
+#endif	/* HAVE_SYS_EPOLL_H */
 
 /* Include I18N-related stuff, if necessary */
 #if HAVE_LIBINTL_H
@@ -53,6 +59,7 @@
 #include "netsync.h"
 #include "palmconn.h"
 #include "sync.h"
+#include "condprof.h"
 
 
 int
@@ -67,10 +74,17 @@ run_mode_Standalone(int argc, char *argv[])
 	udword want_userid;		/* The userid we expect to see on
 					 * the Palm. */
 	time_t now;
+	int err;
+
+	/* Get the pending installs ready while we wait for the Palm */
+	StageInstalls();
 
 	/* Connect to the Palm */
 	if ((palm = palm_Connect()) == NULL )
+	{
+		UnstageInstalls();
 		return -1;
+	}
 
 	/* Figure out which Palm we're dealing with */
 	pda = find_pda_block(palm, True);
@@ -198,7 +212,10 @@ run_mode_Standalone(int argc, char *argv[])
 		return -1;
 	}
 
-	return do_sync(pda, palm);
+	err = do_sync(pda, palm);
+	UnstageInstalls();
+
+	return err;
 }
 
 int
@@ -696,18 +713,18 @@ run_mode_Init(int argc, char *argv[])
 	return 0;
 }
 
+static int daemon_sync(struct Palm *palm);
+static int netsync_daemon(const int max_sessions);
+
 int
 run_mode_Daemon(int argc, char *argv[])
 {
-	int err;
 	struct Palm *palm;
-	pda_block *pda;			/* The PDA we're syncing with. */
 	char *devname;			/* Name of device to open */
 	char devbuf[MAXPATHLEN];	/* In case we need to construct
 					 * device name */
-	const struct palment *palment;	/* /etc/palms entry */
-	struct passwd *pwent;		/* /etc/passwd entry */
-	char *conf_fname = NULL;	/* Config file name from /etc/palms */
+	listen_block *listen;
+	int err;
 
 	SYNC_TRACE(3)
 		fprintf(stderr, "Inside run_mode_Daemon()\n");
@@ -780,9 +797,69 @@ run_mode_Daemon(int argc, char *argv[])
 			fprintf(stderr, "Using port from config file.\n");
 	}
 
+	/* A NetSync listener can serve several Palms at once */
+	listen = find_listen_block(global_opts.listen_name);
+	if ((listen != NULL) &&
+	    (listen->listen_type == LISTEN_NET) &&
+	    (listen->sessions > 0))
+		return netsync_daemon(listen->sessions);
+
+	/* Run the Fetch conduits while we wait for the Palm. Not as root,
+	 * though: we don't know whose Palm it'll be yet, and the
+	 * conduits would run with root's privileges, and be thrown out
+	 * anyway once daemon_sync() setuid()s to the Palm's owner.
+	 */
+	if (global_opts.prefetch)
+	{
+		if (getuid() == 0)
+		{
+			SYNC_TRACE(2)
+				fprintf(stderr, "Running as root. "
+					"Not prefetching.\n");
+		} else
+			PrefetchConduits();
+	}
+
+	/* Get the pending installs ready while we wait for the Palm. Not
+	 * as root, for the same reason: we'd be reading some user's files
+	 * before we know whose Palm it is.
+	 */
+	if (getuid() == 0)
+	{
+		SYNC_TRACE(2)
+			fprintf(stderr, "Running as root. "
+				"Not staging installs.\n");
+	} else
+		StageInstalls();
+
 	/* Connect to the Palm */
 	if ((palm = palm_Connect()) == NULL )
+	{
+		UnstageInstalls();
+		UnprefetchConduits();
 		return -1;
+	}
+
+	err = daemon_sync(palm);
+	UnstageInstalls();
+	UnprefetchConduits();
+
+	return err;
+}
+
+/* daemon_sync
+ * Do the daemon-mode part of a sync with a freshly-connected Palm: figure
+ * out whose Palm it is, become that user, load their configuration, and
+ * sync.
+ */
+static int
+daemon_sync(struct Palm *palm)
+{
+	int err;
+	pda_block *pda;			/* The PDA we're syncing with. */
+	const struct palment *palment;	/* /etc/palms entry */
+	struct passwd *pwent;		/* /etc/passwd entry */
+	char *conf_fname = NULL;	/* Config file name from /etc/palms */
 
 	/* Check if this palm is uninitialized and if autoinit is true */
 	if (palm_userid(palm) == 0 && global_opts.autoinit == True)
@@ -927,6 +1004,189 @@ run_mode_Daemon(int argc, char *argv[])
 	return do_sync(pda, palm);
 }
 
+/* sigchld_handler
+ * Doesn't do anything: it's only there so that SIGCHLD interrupts the
+ * NetSync daemon's event loop, which then reaps the finished session.
+ */
+static RETSIGTYPE
+sigchld_handler(int sig)
+{
+}
+
+/* netsync_daemon
+ * Serve NetSync clients until killed, running up to 'max_sessions' syncs
+ * at once.
+ * A single event loop watches the wakeup and data ports: wakeup packets
+ * are acknowledged, and each TCP connection that follows is handed to a
+ * child process, which goes through the ritual exchange and the sync.
+ * Each session thus gets its own process, with its own configuration,
+ * user ID and global state, just as if it had been the only one.
+ * While all 'max_sessions' slots are busy, the listening sockets are left
+ * alone: wakeup packets and connections wait in the kernel's queues until
+ * a session finishes.
+ */
+static int
+netsync_daemon(const int max_sessions)
+{
+	int err;
+	int wakeup_fd;			/* UDP wakeup socket */
+	int data_fd;			/* Listening TCP socket */
+	int running = 0;		/* # of sessions in progress */
+	pid_t pid;
+	int status;
+#if HAVE_SYS_EPOLL_H
+	int epfd;
+	struct epoll_event ev;
+	struct epoll_event events[2];
+	int i;
+#else	/* HAVE_SYS_EPOLL_H */
+	fd_set in_fds;
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	SYNC_TRACE(1)
+		fprintf(stderr, "NetSync daemon: up to %d sessions\n",
+			max_sessions);
+
+	if (pconn_net_listen(&wakeup_fd, &data_fd, max_sessions) < 0)
+	{
+		Error(_("Can't listen for NetSync connections."));
+		return -1;
+	}
+
+#if HAVE_SYS_EPOLL_H
+	if ((epfd = epoll_create(2)) < 0)
+	{
+		Perror("epoll_create");
+		close(wakeup_fd);
+		close(data_fd);
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = wakeup_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakeup_fd, &ev);
+	ev.events = EPOLLIN;
+	ev.data.fd = data_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, data_fd, &ev);
+#endif	/* HAVE_SYS_EPOLL_H */
+
+	signal(SIGCHLD, sigchld_handler);
+
+	for (;;)
+	{
+		Bool wakeup_ready = False;
+		Bool data_ready = False;
+
+		/* Reap any sessions that have finished */
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+		{
+			running--;
+			SYNC_TRACE(2)
+				fprintf(stderr, "Session %ld finished, "
+					"status %d. %d running.\n",
+					(long) pid, status, running);
+		}
+
+		if (running >= max_sessions)
+		{
+			/* All slots busy. Wait for one to free up. */
+			if ((pid = waitpid(-1, &status, 0)) > 0)
+				running--;
+			continue;
+		}
+
+#if HAVE_SYS_EPOLL_H
+		err = epoll_wait(epfd, events, 2, -1);
+		for (i = 0; i < err; i++)
+		{
+			if (events[i].data.fd == wakeup_fd)
+				wakeup_ready = True;
+			else if (events[i].data.fd == data_fd)
+				data_ready = True;
+		}
+#else	/* HAVE_SYS_EPOLL_H */
+		FD_ZERO(&in_fds);
+		FD_SET(wakeup_fd, &in_fds);
+		FD_SET(data_fd, &in_fds);
+		err = select((wakeup_fd > data_fd ? wakeup_fd : data_fd) + 1,
+			     &in_fds, NULL, NULL, NULL);
+		if (err > 0)
+		{
+			wakeup_ready = FD_ISSET(wakeup_fd, &in_fds);
+			data_ready = FD_ISSET(data_fd, &in_fds);
+		}
+#endif	/* HAVE_SYS_EPOLL_H */
+		if (err < 0)
+		{
+			if (errno == EINTR)
+				continue;	/* Probably SIGCHLD */
+			Perror("netsync_daemon");
+			break;
+		}
+
+		/* Acknowledge all pending wakeup packets */
+		if (wakeup_ready)
+			while (pconn_net_answer_wakeup(wakeup_fd) > 0)
+				;
+
+		/* Hand each new connection to a child process */
+		while (data_ready && (running < max_sessions))
+		{
+			int data_sock;
+			struct Palm *palm;
+
+			if ((data_sock = accept(data_fd, NULL, NULL)) < 0)
+			{
+				if ((errno != EAGAIN) &&
+				    (errno != EWOULDBLOCK) &&
+				    (errno != EINTR))
+					Perror("accept");
+				break;
+			}
+
+			if ((pid = fork()) < 0)
+			{
+				Perror("fork");
+				close(data_sock);
+				break;
+			}
+
+			if (pid == 0)
+			{
+				/* Child: this process only deals with
+				 * this one Palm.
+				 */
+				signal(SIGCHLD, SIG_DFL);
+#if HAVE_SYS_EPOLL_H
+				close(epfd);
+#endif	/* HAVE_SYS_EPOLL_H */
+				close(wakeup_fd);
+				close(data_fd);
+
+				if ((palm = palm_Attach(data_sock)) == NULL)
+					exit(1);
+				exit(daemon_sync(palm) < 0 ? 1 : 0);
+			}
+
+			/* Parent */
+			close(data_sock);
+			running++;
+			SYNC_TRACE(2)
+				fprintf(stderr, "Started session %ld. "
+					"%d running.\n",
+					(long) pid, running);
+		}
+	}
+
+	signal(SIGCHLD, SIG_DFL);
+#if HAVE_SYS_EPOLL_H
+	close(epfd);
+#endif	/* HAVE_SYS_EPOLL_H */
+	close(wakeup_fd);
+	close(data_fd);
+
+	return -1;
+}
+
 int
 run_mode_List(int argc, char *argv[])
 {
@@ -985,6 +1245,32 @@ run_mode_Info(int argc, char *argv[])
 	return 0;
 }
 
+/* run_mode_Profile
+ * Summarize the conduit history in argv[0], or in the default palmdir's
+ * history file.
+ */
+int
+run_mode_Profile(int argc, char *argv[])
+{
+	const char *fname;
+
+	if (argc > 1)
+	{
+		Error(_("Too many arguments: only one history file, "
+			"please."));
+		return -1;
+	}
+
+	if (argc == 1)
+		fname = argv[0];
+	else {
+		get_palmdir(NULL, palmdir);
+		fname = condprof_history_fname();
+	}
+
+	return condprof_summary(fname, stdout);
+}
+
 
 /* snum_checksum
  * Calculate and return the checksum character for a checksum 'snum' of
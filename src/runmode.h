@@ -15,3 +15,4 @@ extern int run_mode_Init(int argc, char *argv[]);
 extern int run_mode_Daemon(int argc, char *argv[]);
 extern int run_mode_List(int argc, char *argv[]);
 extern int run_mode_Info(int argc, char *argv[]);
+extern int run_mode_Profile(int argc, char *argv[]);
@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <stdlib.h>		/* For malloc(), free() */
 #include <string.h>		/* For memcpy() */
+#include <sys/param.h>		/* For MAXPATHLEN */
+#include <unistd.h>		/* For unlink() */
 #include "coldsync.h"
 #include "cs_error.h"
 
@@ -39,6 +41,20 @@ static int fetch_netsyncinfo(struct Palm *palm);
 static int fetch_userinfo(struct Palm *palm);
 static int fetch_serial(struct Palm *palm);
 static int fetch_expcard_serial(struct Palm *palm);
+static int ListDBs(struct Palm *palm);
+static int list_begin(struct Palm *palm);
+static int list_batch(struct Palm *palm);
+static int more_DBs(struct Palm *palm);
+static int append_dbs(struct Palm *palm, const struct dlp_dbinfo *dbs,
+		      const int num);
+static struct dlp_dbinfo *new_dbentry(struct Palm *palm, const int hint);
+static int add_dbchunk(struct Palm *palm, const int size);
+static void free_dblist(struct Palm *palm);
+static int store_romdbs(struct Palm *palm, const int card);
+static int load_romdbs(struct Palm *palm);
+static void save_romdbs(struct Palm *palm);
+static void free_romdbs(struct Palm *palm);
+static int dbhash_find(struct Palm *palm, const char *name);
 
 /* special_snums
  * This exists mainly to accomodate the Handspring Visor: although it has a
@@ -96,7 +112,20 @@ new_Palm(PConnection *pconn)
 	retval->have_all_DBs_	= False;
 	retval->num_dbs_	= -1;
 	retval->dblist_		= NULL;
+	retval->dbs_slots_	= 0;
+	retval->dbchunks_	= NULL;
 	retval->dbit_		= 0;
+	retval->dbhash_		= NULL;
+	retval->dbhash_size_	= 0;
+	retval->dbhash_num_	= 0;
+	retval->romdbs_		= NULL;
+	retval->romdbs_changed_	= False;
+	retval->listing_DBs_	= False;
+	retval->list_card_	= 0;
+	retval->list_start_	= 0;
+	retval->list_left_	= 0;
+	retval->list_rom_	= False;
+	retval->list_first_	= 0;
 	retval->flags_		= 0;
 
 	return retval;
@@ -113,9 +142,12 @@ free_Palm(struct Palm *palm)
 		/* 'cardinfo' is an array. It gets freed all at once */
 		free(palm->cardinfo_);
 
-	if (palm->dblist_ != NULL)
-		/* 'dblist' is an array. It gets freed all at once */
-		free(palm->dblist_);
+	free_dblist(palm);
+
+	if (palm->dbhash_ != NULL)
+		free(palm->dbhash_);
+
+	free_romdbs(palm);
 
 	free(palm);
 }
@@ -596,14 +628,36 @@ fetch_expcard_serial(struct Palm *palm)
 
 /* ListDBs
  * Fetch the list of database info records from the Palm, both for ROM and
- * RAM.
+ * RAM. If palm_stream_DBs() has already started reading the list, this
+ * reads the rest of it.
  */
-/* XXX - This needs to be rewritten from scratch */
 static int
 ListDBs(struct Palm *palm)
+{
+	int err;
+
+	if (!palm->listing_DBs_ && (err = list_begin(palm)) < 0)
+		return -1;
+
+	while (!palm->have_all_DBs_)
+	{
+		if ((err = list_batch(palm)) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* list_begin
+ * Get ready to read the list of databases, but don't read any of it yet:
+ * that's up to list_batch().
+ */
+static int
+list_begin(struct Palm *palm)
 {
 	int err;
 	int card;		/* Memory card number */
+	int total = 0;		/* Total # of databases, on all cards */
 
 	/* Ask for sysinfo */
 	if (!palm->have_sysinfo_)
@@ -616,106 +670,334 @@ ListDBs(struct Palm *palm)
 			return -1;
 	}
 
-	/* Iterate over each memory card */
+	/* Get total # of databases */
 	for (card = 0; card < palm_num_cards(palm); card++)
 	{
-		int i;
-		ubyte iflags;		/* ReadDBList flags */
-		uword start;		/* Database index to start reading
-					 * at */
-		uword last_index;	/* Index of last database read */
-		ubyte oflags;
-		ubyte num = 0;
-
-		/* Get total # of databases */
-		palm->num_dbs_ =
-			palm->cardinfo_[card].ram_dbs;
+		total += palm->cardinfo_[card].ram_dbs;
 
 		if (global_opts.check_ROM)	/* Also considering ROM */
-			palm->num_dbs_ += palm->cardinfo_[card].rom_dbs;
+			total += palm->cardinfo_[card].rom_dbs;
+	}
 
-		if (palm->num_dbs_ <= 0)
-		{
-			/* XXX - Fix this */
-			Error(_("You have an old Palm, one that "
-				"doesn't say how many\n"
-				"databases it has. I can't cope with "
-				"this."));
-			return -1;
-		}
+	if (total <= 0)
+	{
+		/* XXX - Fix this */
+		Error(_("You have an old Palm, one that "
+			"doesn't say how many\n"
+			"databases it has. I can't cope with "
+			"this."));
+		return -1;
+	}
 
-		/* Allocate space for the array of database info blocks */
-		if ((palm->dblist_ = (struct dlp_dbinfo *)
-		     calloc(palm->num_dbs_, sizeof(struct dlp_dbinfo)))
-		    == NULL)
-			return -1;
+	/* Allocate space for the array of database info blocks */
+	free_dblist(palm);
+	if ((palm->dblist_ = (struct dlp_dbinfo **)
+	     calloc(total, sizeof(struct dlp_dbinfo *)))
+	    == NULL)
+		return -1;
+	palm->dbs_slots_ = total;
+	palm->num_dbs_ = 0;
+	palm->dbhash_num_ = 0;
+	if (add_dbchunk(palm, total) < 0)
+		return -1;
 
-		iflags = DLPCMD_READDBLFLAG_RAM;
+	/* If we're including ROM databases, see whether we already know
+	 * what they are.
+	 */
+	if (global_opts.check_ROM && load_romdbs(palm) < 0)
+		return -1;
 
-		/* XXX - Better have a function to check this condition */
-		if (palm_dlp_min_version(palm, 1, 2))
-			iflags |= DLPCMD_READDBLFLAG_MULT;
+	palm->listing_DBs_ = True;
+	palm->list_rom_ = False;
+	palm->list_card_ = -1;
+	palm->list_left_ = 0;		/* Start with card 0 */
 
-		if (global_opts.check_ROM)
-			iflags |= DLPCMD_READDBLFLAG_ROM;
-				/* Flags: read at least RAM databases. If
-				 * we're even considering the ROM ones,
-				 * grab those, too.
-				 */
+	return 0;
+}
 
-		start = 0;	/* Index at which to start reading */
+/* list_batch
+ * Read the next batch of databases (as many as the Palm will send in one
+ * DlpReadDBList() call) and append them to the list. When the last one
+ * has been read, 'palm->have_all_DBs_' is set.
+ */
+static int
+list_batch(struct Palm *palm)
+{
+	int err;
+	ubyte iflags;		/* ReadDBList flags */
+	uword last_index;	/* Index of last database read */
+	ubyte oflags;
+	ubyte num = 0;
+	static struct dlp_dbinfo batch[256];
+				/* A reply holds at most 255 databases */
+
+	/* Move on to the ROM databases, or the next card, if we're done
+	 * with this lot.
+	 */
+	while (palm->list_left_ <= 0)
+	{
+		int card = palm->list_card_;
 
-		/* Collect each database in turn. */
-		/* XXX - Should handle older devices that don't return the
-		 * number of databases. The easiest thing to do in this
-		 * case is probably to resize palm->dblist dynamically
-		 * (realloc()) as necessary. In this case, preallocating
-		 * its size above becomes just an optimization for the
-		 * special case where DLP >= 1.1.
-		 */
-		for (i = 0; i < palm->num_dbs_; i += num)
+		if (card >= 0 && palm->list_rom_)
 		{
-			err = DlpReadDBList(palm_pconn(palm), iflags, card,
-					    start, &last_index, &oflags,
-					    &num, &(palm->dblist_[i]));
-
-			/* XXX - What happens if we get any DLPSTAT_xxx here? */
-			if (err < 0)
-			{
-				MISC_TRACE(1)
-					fprintf(stderr, "ListDBs, err: %d\n", err);
+			/* Just finished reading this card's ROM databases.
+			 * Remember them for next time.
+			 */
+			if (store_romdbs(palm, card) < 0)
 				return -1;
-			}
-
-			/* Sanity check: if there are no more databases to
-			 * be read, stop reading now. This shouldn't
-			 * happen, but you never know.
+		} else if (card >= 0 && global_opts.check_ROM) {
+			/* Just finished this card's RAM databases. Now for
+			 * the ROM ones, unless we already have them.
 			 */
-			if ((oflags & DLPRET_READDBLFLAG_MORE) == 0)
+			if (palm->romdbs_[card].dbs == NULL)
 			{
-				MISC_TRACE(1)
-					fprintf(stderr, "ListDbs, No more databases!!\n");
-				/* There are no more databases */
-				break;
+				palm->list_rom_ = True;
+				palm->list_start_ = 0;
+				palm->list_first_ = palm->num_dbs_;
+				palm->list_left_ =
+					palm->cardinfo_[card].rom_dbs;
+				continue;
 			}
 
-			/* For the next iteration, set the start index to
-			 * the index of the database just read, plus one.
+			MISC_TRACE(3)
+				fprintf(stderr, "Using cached list of ROM "
+					"databases on card %d\n", card);
+			if (append_dbs(palm, palm->romdbs_[card].dbs,
+				       palm->romdbs_[card].num_dbs) < 0)
+				return -1;
+		}
+
+		palm->list_card_++;
+		if (palm->list_card_ >= palm_num_cards(palm))
+		{
+			/* Record the fact that we've fetched all of the
+			 * databases
+			 */
+			palm->listing_DBs_ = False;
+			palm->have_all_DBs_ = True;
+
+			if (palm->romdbs_changed_)
+				save_romdbs(palm);
+
+			/* Print out the list of databases, for
+			 * posterity
 			 */
-			start = last_index + 1;
+			SYNC_TRACE(2)
+				palm_print_dbs(palm, stderr);
+
+			return 0;
 		}
+
+		palm->list_start_ = 0;	/* Index at which to start
+					 * reading */
+		palm->list_rom_ = False;
+		palm->list_left_ = palm->cardinfo_[palm->list_card_].ram_dbs;
 	}
 
-	/* Record the fact that we've fetched all of the databases */
-	palm->have_all_DBs_ = True;
+	/* Flags: read RAM databases first, then ROM ones (if we're
+	 * considering those at all) separately, so that the latter can be
+	 * cached.
+	 */
+	iflags = palm->list_rom_ ? DLPCMD_READDBLFLAG_ROM :
+		DLPCMD_READDBLFLAG_RAM;
+
+	/* XXX - Better have a function to check this condition */
+	if (palm_dlp_min_version(palm, 1, 2))
+		iflags |= DLPCMD_READDBLFLAG_MULT;
+
+	err = DlpReadDBList(palm_pconn(palm), iflags, palm->list_card_,
+			    palm->list_start_, &last_index, &oflags,
+			    &num, batch);
+
+	/* XXX - What happens if we get any DLPSTAT_xxx here? */
+	if (err < 0)
+	{
+		MISC_TRACE(1)
+			fprintf(stderr, "ListDBs, err: %d\n", err);
+		return -1;
+	}
+	if (err != (int) DLPSTAT_NOERR)
+		num = 0;
+
+	/* Append this batch to the list */
+	if (append_dbs(palm, batch, num) < 0)
+		return -1;
+	palm->list_left_ -= num;
+
+	/* Sanity check: if there are no more databases to be read, stop
+	 * reading now. This shouldn't happen, but you never know.
+	 */
+	if (num == 0 || (oflags & DLPRET_READDBLFLAG_MORE) == 0)
+	{
+		MISC_TRACE(1)
+			if (palm->list_left_ > 0)
+				fprintf(stderr, "ListDbs, No more databases!!\n");
+		/* There are no more databases on this card */
+		palm->list_left_ = 0;
+	} else
+		/* For the next batch, set the start index to the index
+		 * of the database just read, plus one.
+		 */
+		palm->list_start_ = last_index + 1;
+
+	return 0;
+}
+
+/* append_dbs
+ * Append 'num' databases to the list. There should be room already, but
+ * the Palm might have been wrong about how many databases it has.
+ */
+static int
+append_dbs(struct Palm *palm,
+	   const struct dlp_dbinfo *dbs,
+	   const int num)
+{
+	int i;
+	struct dlp_dbinfo *dbinfo;
 
-	/* Print out the list of databases, for posterity */
-	SYNC_TRACE(2)
-		palm_print_dbs(palm, stderr);
+	for (i = 0; i < num; i++)
+	{
+		if ((dbinfo = new_dbentry(palm, num - i)) == NULL)
+			return -1;
+		*dbinfo = dbs[i];
+	}
 
 	return 0;
 }
 
+/* new_dbentry
+ * Add a new, blank entry to the end of the database list, and return a
+ * pointer to it, or NULL in case of error. If there's no room left in
+ * the current chunk, a new one is allocated with room for 'hint'
+ * entries: that's how many the caller expects to add.
+ * Only the 'dblist_' array of pointers is ever realloc()ed: the entries
+ * themselves don't move (see 'struct dbinfo_chunk').
+ */
+static struct dlp_dbinfo *
+new_dbentry(struct Palm *palm,
+	    const int hint)
+{
+	struct dbinfo_chunk *chunk = palm->dbchunks_;
+	int num = (hint > 0 ? hint : 1);
+
+	if (palm->num_dbs_ < 0)
+		palm->num_dbs_ = 0;
+
+	if (palm->num_dbs_ >= palm->dbs_slots_)
+	{
+		struct dlp_dbinfo **newdblist;
+
+		newdblist = (struct dlp_dbinfo **)
+			realloc(palm->dblist_,
+				(palm->num_dbs_ + num) *
+				sizeof(struct dlp_dbinfo *));
+		if (newdblist == NULL)
+		{
+			Error(_("Can't resize palm->dblist."));
+			return NULL;
+		}
+		palm->dblist_ = newdblist;
+		palm->dbs_slots_ = palm->num_dbs_ + num;
+	}
+
+	if (chunk == NULL || chunk->used >= chunk->size)
+	{
+		if (add_dbchunk(palm, num) < 0)
+			return NULL;
+		chunk = palm->dbchunks_;
+	}
+
+	palm->dblist_[palm->num_dbs_] = &(chunk->dbs[chunk->used++]);
+	return palm->dblist_[palm->num_dbs_++];
+}
+
+/* add_dbchunk
+ * Allocate storage for 'size' more entries in the database list.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+add_dbchunk(struct Palm *palm,
+	    const int size)
+{
+	struct dbinfo_chunk *chunk;
+
+	if ((chunk = (struct dbinfo_chunk *)
+	     calloc(1, sizeof(struct dbinfo_chunk) +
+		    (size - 1) * sizeof(struct dlp_dbinfo))) == NULL)
+	{
+		Error(_("Can't resize palm->dblist."));
+		return -1;
+	}
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = palm->dbchunks_;
+	palm->dbchunks_ = chunk;
+	return 0;
+}
+
+/* free_dblist
+ * Free the database list and the storage for its entries.
+ */
+static void
+free_dblist(struct Palm *palm)
+{
+	struct dbinfo_chunk *chunk;
+
+	if (palm->dblist_ != NULL)
+		free(palm->dblist_);
+	palm->dblist_ = NULL;
+	palm->dbs_slots_ = 0;
+
+	while ((chunk = palm->dbchunks_) != NULL)
+	{
+		palm->dbchunks_ = chunk->next;
+		free(chunk);
+	}
+}
+
+/* store_romdbs
+ * Having just read the list of ROM databases on 'card' from the Palm,
+ * make a copy of it for the cache.
+ */
+static int
+store_romdbs(struct Palm *palm,
+	     const int card)
+{
+	struct rom_dblist *rl = &(palm->romdbs_[card]);
+	int num = palm->num_dbs_ - palm->list_first_;
+	int i;
+
+	if (rl->dbs != NULL)
+		free(rl->dbs);
+	if ((rl->dbs = (struct dlp_dbinfo *)
+	     malloc((num > 0 ? num : 1) * sizeof(struct dlp_dbinfo))) == NULL)
+	{
+		Error(_("Out of memory."));
+		return -1;
+	}
+	for (i = 0; i < num; i++)
+		rl->dbs[i] = *(palm->dblist_[palm->list_first_ + i]);
+	rl->num_dbs = num;
+	rl->cardversion = palm->cardinfo_[card].cardversion;
+	rl->rom_size = palm->cardinfo_[card].rom_size;
+	palm->romdbs_changed_ = True;
+
+	return 0;
+}
+
+/* more_DBs
+ * Called when the caller has used up the databases read so far: read
+ * more, a batch at a time if palm_stream_DBs() has been called, or all
+ * of them otherwise.
+ */
+static int
+more_DBs(struct Palm *palm)
+{
+	if (palm->listing_DBs_)
+		return list_batch(palm);
+	return ListDBs(palm);
+}
+
 void
 palm_print_dbs(struct Palm *palm, FILE *fd)
 {
@@ -730,40 +1012,40 @@ palm_print_dbs(struct Palm *palm, FILE *fd)
 		fprintf(fd,
 			"%-*s %04x %c%c%c%c %c%c%c%c %3d %08lx\n",
 			PDB_DBNAMELEN,
-			palm->dblist_[i].name,
-			palm->dblist_[i].db_flags,
-			(char) (palm->dblist_[i].type >> 24),
-			(char) (palm->dblist_[i].type >> 16),
-			(char) (palm->dblist_[i].type >> 8),
-			(char) palm->dblist_[i].type,
-			(char) (palm->dblist_[i].creator >> 24),
-			(char) (palm->dblist_[i].creator >> 16),
-			(char) (palm->dblist_[i].creator >> 8),
-			(char) palm->dblist_[i].creator,
-			palm->dblist_[i].version,
-			palm->dblist_[i].modnum);
+			palm->dblist_[i]->name,
+			palm->dblist_[i]->db_flags,
+			(char) (palm->dblist_[i]->type >> 24),
+			(char) (palm->dblist_[i]->type >> 16),
+			(char) (palm->dblist_[i]->type >> 8),
+			(char) palm->dblist_[i]->type,
+			(char) (palm->dblist_[i]->creator >> 24),
+			(char) (palm->dblist_[i]->creator >> 16),
+			(char) (palm->dblist_[i]->creator >> 8),
+			(char) palm->dblist_[i]->creator,
+			palm->dblist_[i]->version,
+			palm->dblist_[i]->modnum);
 		fprintf(fd, "        "
 			"%02d:%02d:%02d %02d/%02d/%02d  "
 			"%02d:%02d:%02d %02d/%02d/%02d  "
 			"%02d:%02d:%02d %02d/%02d/%02d\n",
-			palm->dblist_[i].ctime.hour,
-			palm->dblist_[i].ctime.minute,
-			palm->dblist_[i].ctime.second,
-			palm->dblist_[i].ctime.day,
-			palm->dblist_[i].ctime.month,
-			palm->dblist_[i].ctime.year,
-			palm->dblist_[i].mtime.hour,
-			palm->dblist_[i].mtime.minute,
-			palm->dblist_[i].mtime.second,
-			palm->dblist_[i].mtime.day,
-			palm->dblist_[i].mtime.month,
-			palm->dblist_[i].mtime.year,
-			palm->dblist_[i].baktime.hour,
-			palm->dblist_[i].baktime.minute,
-			palm->dblist_[i].baktime.second,
-			palm->dblist_[i].baktime.day,
-			palm->dblist_[i].baktime.month,
-			palm->dblist_[i].baktime.year);
+			palm->dblist_[i]->ctime.hour,
+			palm->dblist_[i]->ctime.minute,
+			palm->dblist_[i]->ctime.second,
+			palm->dblist_[i]->ctime.day,
+			palm->dblist_[i]->ctime.month,
+			palm->dblist_[i]->ctime.year,
+			palm->dblist_[i]->mtime.hour,
+			palm->dblist_[i]->mtime.minute,
+			palm->dblist_[i]->mtime.second,
+			palm->dblist_[i]->mtime.day,
+			palm->dblist_[i]->mtime.month,
+			palm->dblist_[i]->mtime.year,
+			palm->dblist_[i]->baktime.hour,
+			palm->dblist_[i]->baktime.minute,
+			palm->dblist_[i]->baktime.second,
+			palm->dblist_[i]->baktime.day,
+			palm->dblist_[i]->baktime.month,
+			palm->dblist_[i]->baktime.year);
 	}
 }
 
@@ -1134,6 +1416,28 @@ palm_fetch_all_DBs(struct Palm *palm)
 	return 0;	/* Success */
 }
 
+/* palm_stream_DBs
+ * Start reading the list of databases on the Palm, but don't wait for all
+ * of it: from now on, palm_nextdb() reads the list one batch at a time,
+ * as it runs out of databases to return. That way, a loop like the one in
+ * conduits_sync() can start working on the first few databases while the
+ * rest of the list is still on the Palm.
+ * Anything that needs the whole list (palm_num_dbs(),
+ * palm_find_dbentry(), palm_fetch_all_DBs()) still gets it: these read
+ * whatever is left of the list first.
+ */
+int
+palm_stream_DBs(struct Palm *palm)
+{
+	MISC_TRACE(6)
+		fprintf(stderr, "Inside palm_stream_DBs\n");
+
+	if (palm->have_all_DBs_ || palm->listing_DBs_)
+		return 0;	/* Already started */
+
+	return list_begin(palm);
+}
+
 /* palm_num_dbs
  * Returns the total number of databases on the Palm.
  */
@@ -1149,9 +1453,10 @@ palm_num_dbs(struct Palm *palm)
 	if (!palm->have_all_DBs_)
 	{
 		if ((err = ListDBs(palm)) < 0)
-
+		{
 			palm->accessor_status_ = PALMACC_FAIL;
 			return -1;
+		}
 	}
 
 	return palm->num_dbs_;
@@ -1189,7 +1494,6 @@ palm_nextdb(struct Palm *palm)
 {
 	int err;
 	const struct dlp_dbinfo *retval;
-	int num_dbs;			/* # databases on Palm */
 
 	MISC_TRACE(12)
 		fprintf(stderr, "Palm database iterator++\n");
@@ -1204,22 +1508,19 @@ palm_nextdb(struct Palm *palm)
 	 * (if possible), and palm_nextdb() should content itself with
 	 * fetching only one at a time.
 	 * Presumably, if the caller knows that it will be iterating over
-	 * all databases, it will call palm_fetch_all_DBs().
+	 * all databases, it will call palm_fetch_all_DBs(), or
+	 * palm_stream_DBs() if it can get started on the first few while
+	 * the others are being fetched.
 	 */
-	/* Fetch list of databases, if we haven't done so yet */
-	if (!palm->have_all_DBs_)
+	/* Fetch (more of) the list of databases, if we need to */
+	while (palm->dbit_ >= palm->num_dbs_ && !palm->have_all_DBs_)
 	{
-		if ((err = ListDBs(palm)) < 0)
+		if ((err = more_DBs(palm)) < 0)
 			return NULL;
 	}
 
-	/* Find out how many databases there are */
-	num_dbs = palm_num_dbs(palm);
-	if (num_dbs < 0)
-		return NULL;
-
 	/* Have we reached the end of the list yet? */
-	if (palm->dbit_ > num_dbs - 1)
+	if (palm->dbit_ >= palm->num_dbs_)
 	{
 		MISC_TRACE(6)
 			fprintf(stderr, "Reached end of list\n");
@@ -1230,7 +1531,7 @@ palm_nextdb(struct Palm *palm)
 	MISC_TRACE(6)
 		fprintf(stderr, "Returning database %d\n", palm->dbit_);
 
-	retval = &(palm->dblist_[palm->dbit_]);
+	retval = palm->dblist_[palm->dbit_];
 	palm->dbit_++;
 	return retval;
 }
@@ -1244,20 +1545,404 @@ const struct dlp_dbinfo *
 palm_find_dbentry(struct Palm *palm,
 		  const char *name)
 {
-	const struct dlp_dbinfo *cur_db;	/* Database iterator */
+	int i;
 
-	palm_resetdb(palm);
-	while ((cur_db = palm_nextdb(palm)) != NULL)
+	/* This doesn't use palm_nextdb(), so as not to disturb any loop
+	 * that is using the iterator.
+	 */
+	for (;;)
 	{
-		if (strncmp(name, cur_db->name,
-			    DLPCMD_DBNAME_LEN) == 0)
+		if ((i = dbhash_find(palm, name)) >= 0)
 			/* Found it */
-			return cur_db;
+			return palm->dblist_[i];
+
+		/* It might be in the part of the list that hasn't been
+		 * read yet.
+		 */
+		if (palm->have_all_DBs_)
+			break;
+		if (more_DBs(palm) < 0)
+			return NULL;
 	}
 
 	return NULL;		/* Couldn't find it */
 }
 
+/* dbname_hash
+ * Hash function for database names (FNV-1a).
+ */
+static unsigned long
+dbname_hash(const char *name)
+{
+	unsigned long h = 2166136261UL;
+	int i;
+
+	for (i = 0; i < DLPCMD_DBNAME_LEN && name[i] != '\0'; i++)
+	{
+		h ^= (unsigned char) name[i];
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+/* dbhash_find
+ * Look up 'name' in the hash table of database names, after adding any
+ * databases that have been added to the list since the last lookup.
+ * Returns the database's index in 'palm->dblist_', or -1 if it isn't
+ * there (yet).
+ * The table uses open addressing and is kept at most half full. Each
+ * slot holds an index into 'palm->dblist_', or -1. Since it holds
+ * indices rather than pointers, it doesn't care if 'dblist_' gets
+ * realloc()ed.
+ */
+static int
+dbhash_find(struct Palm *palm,
+	    const char *name)
+{
+	unsigned long mask;
+	unsigned long h;
+	int i;
+
+	if (palm->num_dbs_ <= 0)
+		return -1;
+
+	/* Grow the table if it would become more than half full; all of
+	 * the databases then need to be rehashed.
+	 */
+	if (2 * palm->num_dbs_ > palm->dbhash_size_)
+	{
+		int newsize;
+		int *newhash;
+
+		for (newsize = 64; newsize < 2 * palm->num_dbs_; newsize *= 2)
+			;
+		if ((newhash = (int *) malloc(newsize * sizeof(int)))
+		    == NULL)
+		{
+			Error(_("Out of memory."));
+			return -1;
+		}
+		if (palm->dbhash_ != NULL)
+			free(palm->dbhash_);
+		palm->dbhash_ = newhash;
+		palm->dbhash_size_ = newsize;
+		palm->dbhash_num_ = 0;
+	}
+	mask = palm->dbhash_size_ - 1;
+
+	if (palm->dbhash_num_ == 0)
+		for (i = 0; i < palm->dbhash_size_; i++)
+			palm->dbhash_[i] = -1;
+
+	/* Add the databases we haven't seen yet. If two have the same
+	 * name, the first one wins, same as a linear search.
+	 */
+	for (; palm->dbhash_num_ < palm->num_dbs_; palm->dbhash_num_++)
+	{
+		const char *dbname = palm->dblist_[palm->dbhash_num_]->name;
+
+		for (h = dbname_hash(dbname) & mask;
+		     palm->dbhash_[h] >= 0;
+		     h = (h + 1) & mask)
+		{
+			if (strncmp(dbname,
+				    palm->dblist_[palm->dbhash_[h]]->name,
+				    DLPCMD_DBNAME_LEN) == 0)
+				break;
+		}
+		if (palm->dbhash_[h] < 0)
+			palm->dbhash_[h] = palm->dbhash_num_;
+	}
+
+	/* Now look for 'name' */
+	for (h = dbname_hash(name) & mask;
+	     palm->dbhash_[h] >= 0;
+	     h = (h + 1) & mask)
+	{
+		if (strncmp(name, palm->dblist_[palm->dbhash_[h]]->name,
+			    DLPCMD_DBNAME_LEN) == 0)
+			return palm->dbhash_[h];
+	}
+
+	return -1;
+}
+
+/* ROM database cache
+ * The list of ROM databases on each card is kept in "~/.palm/romdbs"
+ * between syncs. It is only used if the Palm's serial number, and each
+ * card's version, ROM size and ROM database count (all of which come
+ * from DlpReadStorageInfo(), which is needed anyway) are the same as
+ * when it was saved. The file is:
+ *	magic		4 bytes		ROMDB_MAGIC
+ *	serial length	1 byte
+ *	serial number	<serial length> bytes
+ *	# of cards	1 byte
+ * then, for each card:
+ *	card version	2 bytes
+ *	ROM size	4 bytes
+ *	# of databases	2 bytes
+ * followed by that many database entries (ROMDB_ENTRY_LEN bytes each,
+ * laid out as in 'struct dlp_dbinfo').
+ */
+#define ROMDB_MAGIC		"CSrm"
+#define ROMDB_CARD_LEN		8
+#define ROMDB_ENTRY_LEN		(DLPCMD_DBINFO_LEN + DLPCMD_DBNAME_LEN)
+
+static void
+put_dlptime(ubyte **wptr, const struct dlp_time *t)
+{
+	put_uword(wptr, t->year);
+	put_ubyte(wptr, t->month);
+	put_ubyte(wptr, t->day);
+	put_ubyte(wptr, t->hour);
+	put_ubyte(wptr, t->minute);
+	put_ubyte(wptr, t->second);
+	put_ubyte(wptr, t->unused);
+}
+
+static void
+get_dlptime(const ubyte **rptr, struct dlp_time *t)
+{
+	t->year = get_uword(rptr);
+	t->month = get_ubyte(rptr);
+	t->day = get_ubyte(rptr);
+	t->hour = get_ubyte(rptr);
+	t->minute = get_ubyte(rptr);
+	t->second = get_ubyte(rptr);
+	t->unused = get_ubyte(rptr);
+}
+
+/* romdbs_fname
+ * Returns the pathname of the ROM database cache, or NULL if there's
+ * nowhere to put it.
+ */
+static const char *
+romdbs_fname(void)
+{
+	if (palmdir[0] == '\0')
+		return NULL;
+	return mkfname(palmdir, "/romdbs", NULL);
+}
+
+/* load_romdbs
+ * Set up 'palm->romdbs_' with an entry for each card, and fill in the
+ * ones that the cache has an up-to-date list for.
+ * Returns 0 if successful (even if there is no usable cache), or -1 in
+ * case of error.
+ */
+static int
+load_romdbs(struct Palm *palm)
+{
+	const char *fname;
+	const char *serial;
+	FILE *fp;
+	ubyte buf[ROMDB_ENTRY_LEN];
+	const ubyte *rptr;
+	int num_cards;
+	int card;
+	int i;
+
+	free_romdbs(palm);
+	num_cards = palm_num_cards(palm);
+	if ((palm->romdbs_ = (struct rom_dblist *)
+	     calloc(num_cards > 0 ? num_cards : 1,
+		    sizeof(struct rom_dblist))) == NULL)
+	{
+		Error(_("Out of memory."));
+		return -1;
+	}
+	palm->romdbs_changed_ = False;
+
+	if ((fname = romdbs_fname()) == NULL ||
+	    (fp = fopen(fname, "rb")) == NULL)
+		return 0;		/* No cache. That's okay */
+
+	/* Make sure the cache is for this Palm */
+	serial = palm_serial(palm);
+	if (serial == NULL)
+		serial = "";
+	if (fread(buf, 1, 5, fp) != 5 ||
+	    memcmp(buf, ROMDB_MAGIC, 4) != 0 ||
+	    buf[4] != strlen(serial) ||
+	    fread(buf, 1, buf[4] + 1, fp) != (size_t) (buf[4] + 1) ||
+	    memcmp(buf, serial, strlen(serial)) != 0 ||
+	    buf[strlen(serial)] != num_cards)
+	{
+		MISC_TRACE(3)
+			fprintf(stderr, "ROM database cache is for a "
+				"different Palm\n");
+		fclose(fp);
+		return 0;
+	}
+
+	for (card = 0; card < num_cards; card++)
+	{
+		struct rom_dblist *rl = &(palm->romdbs_[card]);
+		int num;
+
+		if (fread(buf, 1, ROMDB_CARD_LEN, fp) != ROMDB_CARD_LEN)
+			break;
+		rptr = buf;
+		rl->cardversion = get_uword(&rptr);
+		rl->rom_size = get_udword(&rptr);
+		num = get_uword(&rptr);
+
+		if ((rl->dbs = (struct dlp_dbinfo *)
+		     calloc(num > 0 ? num : 1, sizeof(struct dlp_dbinfo)))
+		    == NULL)
+			break;
+		for (i = 0; i < num; i++)
+		{
+			struct dlp_dbinfo *db = &(rl->dbs[i]);
+
+			if (fread(buf, 1, ROMDB_ENTRY_LEN, fp) !=
+			    ROMDB_ENTRY_LEN)
+				break;
+			rptr = buf;
+			db->size = get_ubyte(&rptr);
+			db->misc_flags = get_ubyte(&rptr);
+			db->db_flags = get_uword(&rptr);
+			db->type = get_udword(&rptr);
+			db->creator = get_udword(&rptr);
+			db->version = get_uword(&rptr);
+			db->modnum = get_udword(&rptr);
+			get_dlptime(&rptr, &(db->ctime));
+			get_dlptime(&rptr, &(db->mtime));
+			get_dlptime(&rptr, &(db->baktime));
+			db->index = get_uword(&rptr);
+			memcpy(db->name, rptr, DLPCMD_DBNAME_LEN);
+			db->name[DLPCMD_DBNAME_LEN-1] = '\0';
+		}
+		rl->num_dbs = i;
+
+		/* Throw out the list unless it's complete and the card
+		 * still looks the same.
+		 */
+		if (i < num ||
+		    rl->cardversion != palm->cardinfo_[card].cardversion ||
+		    rl->rom_size != palm->cardinfo_[card].rom_size ||
+		    num != palm->cardinfo_[card].rom_dbs)
+		{
+			MISC_TRACE(3)
+				fprintf(stderr, "ROM database cache for card "
+					"%d is out of date\n", card);
+			free(rl->dbs);
+			rl->dbs = NULL;
+			if (i < num)
+				break;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* save_romdbs
+ * Write out the ROM database cache. Failure isn't fatal: the list will
+ * just have to be read from the Palm again next time.
+ */
+static void
+save_romdbs(struct Palm *palm)
+{
+	const char *fname;
+	const char *serial;
+	char tmpfname[MAXPATHLEN+1];
+	FILE *fp;
+	ubyte buf[ROMDB_ENTRY_LEN];
+	ubyte *wptr;
+	int num_cards;
+	int card;
+	int i;
+	Bool ok;
+
+	palm->romdbs_changed_ = False;
+	if ((fname = romdbs_fname()) == NULL)
+		return;
+	num_cards = palm_num_cards(palm);
+	serial = palm_serial(palm);
+	if (serial == NULL)
+		serial = "";
+
+	/* Write to a temporary file, then rename it, so that the cache
+	 * is never half-written.
+	 */
+	snprintf(tmpfname, sizeof(tmpfname), "%s.tmp", fname);
+	if ((fp = fopen(tmpfname, "wb")) == NULL)
+	{
+		MISC_TRACE(2)
+			fprintf(stderr, "Can't create \"%s\"\n", tmpfname);
+		return;
+	}
+
+	ok = (fwrite(ROMDB_MAGIC, 1, 4, fp) == 4 &&
+	      putc(strlen(serial), fp) != EOF &&
+	      fwrite(serial, 1, strlen(serial), fp) == strlen(serial) &&
+	      putc(num_cards, fp) != EOF);
+	for (card = 0; ok && card < num_cards; card++)
+	{
+		const struct rom_dblist *rl = &(palm->romdbs_[card]);
+		int num = (rl->dbs == NULL ? 0 : rl->num_dbs);
+
+		/* A card we have no list for gets an empty one, which
+		 * won't match its database count next time.
+		 */
+		wptr = buf;
+		put_uword(&wptr, rl->cardversion);
+		put_udword(&wptr, rl->rom_size);
+		put_uword(&wptr, num);
+		ok = (fwrite(buf, 1, ROMDB_CARD_LEN, fp) == ROMDB_CARD_LEN);
+
+		for (i = 0; ok && i < num; i++)
+		{
+			const struct dlp_dbinfo *db = &(rl->dbs[i]);
+
+			wptr = buf;
+			put_ubyte(&wptr, db->size);
+			put_ubyte(&wptr, db->misc_flags);
+			put_uword(&wptr, db->db_flags);
+			put_udword(&wptr, db->type);
+			put_udword(&wptr, db->creator);
+			put_uword(&wptr, db->version);
+			put_udword(&wptr, db->modnum);
+			put_dlptime(&wptr, &(db->ctime));
+			put_dlptime(&wptr, &(db->mtime));
+			put_dlptime(&wptr, &(db->baktime));
+			put_uword(&wptr, db->index);
+			memcpy(wptr, db->name, DLPCMD_DBNAME_LEN);
+			ok = (fwrite(buf, 1, ROMDB_ENTRY_LEN, fp) ==
+			      ROMDB_ENTRY_LEN);
+		}
+	}
+
+	if (fclose(fp) != 0)
+		ok = False;
+	if (!ok || rename(tmpfname, fname) < 0)
+	{
+		MISC_TRACE(2)
+			fprintf(stderr, "Can't write \"%s\"\n", fname);
+		unlink(tmpfname);
+	}
+}
+
+/* free_romdbs
+ * Free 'palm->romdbs_'.
+ */
+static void
+free_romdbs(struct Palm *palm)
+{
+	int i;
+
+	if (palm->romdbs_ == NULL)
+		return;
+
+	/* 'romdbs_' has one entry per card */
+	for (i = 0; i < palm->num_cards_; i++)
+		if (palm->romdbs_[i].dbs != NULL)
+			free(palm->romdbs_[i].dbs);
+	free(palm->romdbs_);
+	palm->romdbs_ = NULL;
+}
+
 /* palm_append_dbentry
  * Append an entry for 'db' to palm->dblist.
  */
@@ -1266,7 +1951,6 @@ palm_append_dbentry(struct Palm *palm,
 		    struct dlp_dbinfo *newdb)
 {
 	struct dlp_dbinfo *dbinfo;
-	struct dlp_dbinfo *newdblist;
 	int num_dbs;			/* # databases on Palm */
 
 	MISC_TRACE(4)
@@ -1278,20 +1962,9 @@ palm_append_dbentry(struct Palm *palm,
 	if (num_dbs < 0)
 		return -1;
 
-	/* Resize the existing 'dblist'. */
-	newdblist = realloc(palm->dblist_,
-			    (num_dbs + 1) *
-			    sizeof(struct dlp_dbinfo));
-	if (newdblist == NULL)
-	{
-		Error(_("Can't resize palm->dblist."));
+	/* Add a new entry to 'dblist', and fill it in */
+	if ((dbinfo = new_dbentry(palm, 1)) == NULL)
 		return -1;
-	}
-	palm->dblist_ = newdblist;
-	palm->num_dbs_++;
-
-	/* Fill in the new entry */
-	dbinfo = &(palm->dblist_[num_dbs]);
 
 	memcpy(dbinfo, newdb, sizeof(struct dlp_dbinfo));
 	return 0;
@@ -30,6 +30,34 @@ typedef enum {
 } palm_accessor_stat_t;
 
 
+/* rom_dblist
+ * The ROM databases on one memory card. These don't change unless the
+ * ROM does, so they're remembered from one sync to the next instead of
+ * being read from the Palm every time.
+ */
+struct rom_dblist
+{
+	uword cardversion;		/* Card version */
+	udword rom_size;		/* Size of ROM */
+	int num_dbs;			/* # of ROM databases */
+	struct dlp_dbinfo *dbs;		/* The databases, or NULL if we
+					 * don't have an up-to-date list */
+};
+
+/* dbinfo_chunk
+ * Storage for the entries in a Palm's database list. A chunk is never
+ * resized or moved, so the 'struct dlp_dbinfo *'s handed out by
+ * palm_nextdb() and palm_find_dbentry() stay valid while more databases
+ * are added to the list (e.g., by palm_stream_DBs()).
+ */
+struct dbinfo_chunk
+{
+	struct dbinfo_chunk *next;	/* Next (older) chunk */
+	int size;			/* # of entries in 'dbs' */
+	int used;			/* # of those in use */
+	struct dlp_dbinfo dbs[1];	/* Actually 'size' of them */
+};
+
 /* struct Palm
  * A 'struct Palm' is a local cached representation of information
  * about the Palm device at the other end of a PConnection.
@@ -84,8 +112,34 @@ struct Palm
 	Bool have_all_DBs_;		/* Do we have the entire list of
 					 * databases? */
 	int num_dbs_;			/* # of databases */
-	struct dlp_dbinfo *dblist_;	/* Database list */
+	struct dlp_dbinfo **dblist_;	/* Database list. The entries
+					 * live in 'dbchunks_' */
+	int dbs_slots_;			/* Size of the 'dblist_' array */
+	struct dbinfo_chunk *dbchunks_;	/* Storage for the entries */
 	int dbit_;			/* Iterator for palm_nextdb() */
+	int *dbhash_;			/* Hash table of indices into
+					 * 'dblist_', by name, for
+					 * palm_find_dbentry() */
+	int dbhash_size_;		/* Size of 'dbhash_' */
+	int dbhash_num_;		/* # of databases in 'dbhash_' */
+	struct rom_dblist *romdbs_;	/* ROM databases on each card */
+	Bool romdbs_changed_;		/* Does the ROM database cache need
+					 * to be saved? */
+
+	/* State of a database list that is being read a batch at a time
+	 * (see palm_stream_DBs()).
+	 */
+	Bool listing_DBs_;		/* Have we started reading the list
+					 * of databases, without finishing? */
+	int list_card_;			/* Card being read */
+	uword list_start_;		/* Index of next database to ask
+					 * for */
+	int list_left_;			/* # of databases the card says are
+					 * still to come */
+	Bool list_rom_;			/* Reading ROM (as opposed to RAM)
+					 * databases on this card? */
+	int list_first_;		/* Index in 'dblist_' of this card's
+					 * first ROM database */
 
 	palm_accessor_stat_t accessor_status_;
 					/* Whether the latest accessor called */
@@ -136,6 +190,7 @@ extern const int palm_reload(struct Palm *palm);
 /* XXX - This needs to be redone as a whole set of accessors */
 /*  extern int ListDBs(PConnection *pconn, struct Palm *palm); */
 extern int palm_fetch_all_DBs(struct Palm *palm);
+extern int palm_stream_DBs(struct Palm *palm);
 extern void palm_fetch_some_DBs(struct Palm *palm, udword creator, udword type);
 extern void palm_print_dbs(struct Palm *palm, FILE *fd);
 extern const int palm_num_dbs(struct Palm *palm);
@@ -34,6 +34,17 @@
 					 * Linux */
 #endif	/* HAVE_NETINET_IN_H */
 
+#include <unistd.h>		/* For close(), ftruncate() */
+#include <fcntl.h>		/* For fcntl() */
+
+#if HAVE_SYS_MMAN_H
+#  include <sys/mman.h>		/* For mmap(), memfd_create() */
+#endif	/* HAVE_SYS_MMAN_H */
+
+#if HAVE_LIBINTL_H
+#  include <libintl.h>		/* For i18n */
+#endif	/* HAVE_LIBINTL_H */
+
 #include "pconn/pconn.h"	/* For DLP and debug_dump() */
 #include "coldsync.h"
 #include "spc.h"
@@ -43,6 +54,19 @@ static void pack_dlp_time(const struct dlp_time *t,
 			  unsigned char **ptr);
 static void pack_dbinfo(const struct dlp_dbinfo *dbinfo,
 			unsigned char *buf);
+static int shm_reply(struct spc_hdr *header,
+		     struct spc_shm *shm,
+		     const unsigned char *data,
+		     unsigned char **outbuf);
+static int spc_dlpc(PConnection *pconn,
+		    const unsigned char *inbuf,
+		    udword len,
+		    const ubyte **respbuf,
+		    uword *resplen);
+static int spc_batch(struct spc_hdr *header,
+		     PConnection *pconn,
+		     const unsigned char *inbuf,
+		     unsigned char **outbuf);
 
 /* spc_send
  * Takes an SPC header, the data associated with it, and a pointer to
@@ -57,15 +81,20 @@ static void pack_dbinfo(const struct dlp_dbinfo *dbinfo,
  * NB: the data returned in '*outbuf', if any, is allocated by
  * spc_send(); it is the caller's responsibility to free it
  * afterwards.
+ * 'shm' is the conduit's shared memory region, or NULL if it doesn't
+ * have one. Requests with SPCOP_SHM set are only accepted if it has one.
  */
 int
 spc_send(struct spc_hdr *header,		/* SPC header */
 	 PConnection *pconn,			/* Connection to Palm */
 	 const struct dlp_dbinfo *dbinfo,	/* Current database */
 	 const unsigned char *inbuf,		/* Request data */
-	 unsigned char **outbuf)		/* Response data (allocated) */
+	 unsigned char **outbuf,		/* Response data (allocated) */
+	 struct spc_shm *shm)			/* Shared region, or NULL */
 {
 	int err;
+	Bool with_shm = False;	/* Whether the request came, and the
+				 * response may go, through 'shm' */
 
 	SYNC_TRACE(7)
 	{
@@ -74,6 +103,42 @@ spc_send(struct spc_hdr *header,		/* SPC header */
 		debug_dump(stderr, "SPC", inbuf, header->len);
 	}
 
+	/* If the data is in shared memory, find it. */
+	if (header->op & SPCOP_SHM)
+	{
+		const unsigned char *rptr = inbuf;
+		udword offset;
+		udword len;
+
+		if (shm == NULL || shm->base == NULL ||
+		    header->len != SPC_SHMDESC_LEN)
+		{
+			header->status = SPCERR_BADOP;
+			header->len = 0L;
+			*outbuf = NULL;
+			return 0;
+		}
+		offset = get_udword(&rptr);
+		len = get_udword(&rptr);
+		if (offset > shm->size || len > shm->size - offset)
+		{
+			header->status = SPCERR_BADOP;
+			header->len = 0L;
+			*outbuf = NULL;
+			return 0;
+		}
+
+		SYNC_TRACE(7)
+			fprintf(stderr, "spc_send: %ld bytes in shared "
+				"memory at offset %ld\n",
+				(long) len, (long) offset);
+
+		header->op &= ~SPCOP_SHM;
+		header->len = len;
+		inbuf = shm->base + offset;
+		with_shm = True;
+	}
+
 	/* Decide what to do based on the opcode */
 	switch (header->op)
 	{
@@ -120,38 +185,54 @@ spc_send(struct spc_hdr *header,		/* SPC header */
 		    if (pconn == NULL)	/* Sanity check */
 			    return -1;
 
-		    err = (*pconn->dlp.write)(pconn, inbuf, header->len);
-		    SYNC_TRACE(7)
-			    fprintf(stderr,
-				    "spc_send: dlp.write returned %d\n",
-				    err);
-		    if (err < 0)	/* Problem with padp_write */
+		    err = spc_dlpc(pconn, inbuf, header->len,
+				   &padp_respbuf, &padp_resplen);
+		    if (err < 0)
 			    return -1;
 
-		    err = (*pconn->dlp.read)(pconn, &padp_respbuf, &padp_resplen);
-		    SYNC_TRACE(7)
-		    {
-			    fprintf(stderr,
-				    "spc_send: dlp.read returned %d\n",
-				    err);
-			    fprintf(stderr,
-				    "spc_send: padp_resplen == %d\n",
-				    padp_resplen);
-		    }
-		    if (err < 0)	/* Problem with padp_read */
-			return -1;
+		    header->status = SPCERR_OK;
+		    header->len = padp_resplen;
+		    if (with_shm && padp_resplen <= shm->size)
+			    /* Hand the response back through shared
+			     * memory.
+			     */
+			    return shm_reply(header, shm, padp_respbuf,
+					     outbuf);
 
 		    *outbuf = malloc(padp_resplen);
 		    if (*outbuf == NULL)	/* Out of memory */
 			    return -1;
 
 		    memcpy(*outbuf, padp_respbuf, padp_resplen);
-		    header->status = SPCERR_OK;
-		    header->len = padp_resplen;
 		    return 0;		/* Success */
 	    }
 		break;
 
+	    case SPCOP_BATCH:		/* Send several DLP commands */
+	    {
+		    unsigned char *batch_out;
+
+		    if (pconn == NULL)	/* Sanity check */
+			    return -1;
+
+		    if ((err = spc_batch(header, pconn, inbuf, &batch_out))
+			< 0)
+			    return -1;
+
+		    if (!with_shm || batch_out == NULL ||
+			header->len > shm->size)
+		    {
+			    *outbuf = batch_out;
+			    return 0;
+		    }
+
+		    /* Hand the responses back through shared memory. */
+		    err = shm_reply(header, shm, batch_out, outbuf);
+		    free(batch_out);
+		    return err;
+	    }
+		break;
+
 	    default:			/* Bad opcode */
 		header->status = SPCERR_BADOP;
 		header->len = 0L;
@@ -165,6 +246,274 @@ spc_send(struct spc_hdr *header,		/* SPC header */
 	return 0;		/* Success */
 }
 
+/* spc_dlpc
+ * Helper function: send the 'len'-byte DLP command in 'inbuf' to the
+ * Palm, and read its response. '*respbuf' is set to point to the
+ * response, in the connection's own buffer, so it only stays valid
+ * until the next command; '*resplen' is set to its length.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+spc_dlpc(PConnection *pconn,
+	 const unsigned char *inbuf,
+	 udword len,
+	 const ubyte **respbuf,
+	 uword *resplen)
+{
+	int err;
+
+	/* If the conduit is writing to the sync log, send the messages
+	 * we've queued first, to keep them in order.
+	 */
+	if ((len > 0) &&
+	    (inbuf[0] == (ubyte) DLPCMD_AddSyncLogEntry))
+		flush_log(pconn);
+
+	err = (*pconn->dlp.write)(pconn, inbuf, len);
+	SYNC_TRACE(7)
+		fprintf(stderr, "spc_send: dlp.write returned %d\n", err);
+	if (err < 0)		/* Problem with padp_write */
+		return -1;
+
+	err = (*pconn->dlp.read)(pconn, respbuf, resplen);
+	SYNC_TRACE(7)
+	{
+		fprintf(stderr, "spc_send: dlp.read returned %d\n", err);
+		fprintf(stderr, "spc_send: padp_resplen == %d\n",
+			*resplen);
+	}
+	if (err < 0)		/* Problem with padp_read */
+		return -1;
+
+	return 0;
+}
+
+/* spc_batch
+ * Helper function: run each of the DLP commands in the SPCOP_BATCH
+ * request 'inbuf' (see spc.h), and put the responses in a buffer
+ * allocated here and returned in '*outbuf' (or NULL if there are none).
+ * Fills in the status and length in 'header'.
+ * Returns 0 if successful, or -1 in case of error. As with SPCOP_DLPC, a
+ * malformed request isn't an error.
+ */
+static int
+spc_batch(struct spc_hdr *header,
+	  PConnection *pconn,
+	  const unsigned char *inbuf,
+	  unsigned char **outbuf)
+{
+	int err;
+	const unsigned char *rptr;	/* Pointer into 'inbuf' */
+	unsigned char *wptr;		/* Pointer into '*outbuf' */
+	udword inlen = header->len;	/* Length of 'inbuf' */
+	udword entlen;			/* Length of an entry's data */
+	udword outlen;			/* Length of response so far */
+	udword outsize;			/* Allocated size of '*outbuf' */
+	uword tag;			/* Tag of the current entry */
+	int count;			/* # commands in the batch */
+	const ubyte *padp_respbuf;
+	uword padp_resplen;
+
+	*outbuf = NULL;
+
+	/* Make sure the whole batch is well-formed before sending
+	 * anything to the Palm.
+	 */
+	count = 0;
+	for (rptr = inbuf; rptr < inbuf + inlen; rptr += entlen)
+	{
+		if (inbuf + inlen - rptr < SPC_HEADER_LEN)
+		{
+			count = -1;
+			break;
+		}
+		rptr += 4;		/* Skip tag and status */
+		entlen = get_udword(&rptr);
+		if (entlen == 0 ||
+		    entlen > (udword) (inbuf + inlen - rptr))
+		{
+			count = -1;
+			break;
+		}
+		count++;
+	}
+	if (count < 0)
+	{
+		SYNC_TRACE(3)
+			fprintf(stderr, "spc_batch: malformed batch\n");
+		header->status = SPCERR_BADOP;
+		header->len = 0L;
+		return 0;
+	}
+
+	SYNC_TRACE(5)
+		fprintf(stderr, "spc_batch: %d commands\n", count);
+
+	header->status = SPCERR_OK;
+	header->len = 0L;
+	if (count == 0)
+		return 0;
+
+	outlen = 0L;
+	outsize = 0L;
+	for (rptr = inbuf; rptr < inbuf + inlen; rptr += entlen)
+	{
+		tag = get_uword(&rptr);
+		rptr += 2;		/* Skip status */
+		entlen = get_udword(&rptr);
+
+		err = spc_dlpc(pconn, rptr, entlen,
+			       &padp_respbuf, &padp_resplen);
+		if (err < 0)
+		{
+			if (*outbuf != NULL)
+				free(*outbuf);
+			*outbuf = NULL;
+			return -1;
+		}
+
+		/* Make room for the response */
+		if (outlen + SPC_HEADER_LEN + padp_resplen > outsize)
+		{
+			unsigned char *newbuf;
+
+			outsize = outlen + SPC_HEADER_LEN + padp_resplen;
+			outsize += outsize / 2;
+			if ((newbuf = (unsigned char *)
+			     realloc(*outbuf, outsize)) == NULL)
+			{
+				if (*outbuf != NULL)
+					free(*outbuf);
+				*outbuf = NULL;
+				return -1;
+			}
+			*outbuf = newbuf;
+		}
+
+		wptr = *outbuf + outlen;
+		put_uword(&wptr, tag);
+		put_uword(&wptr, SPCERR_OK);
+		put_udword(&wptr, padp_resplen);
+		memcpy(wptr, padp_respbuf, padp_resplen);
+		outlen += SPC_HEADER_LEN + padp_resplen;
+	}
+
+	header->len = outlen;
+	return 0;
+}
+
+/* spc_shm_create
+ * Set up a region of shared memory for SPC payloads, and fill in 'shm'
+ * to describe it. The region is backed by an anonymous file, so that the
+ * conduit can get at it through the file descriptor it inherits.
+ * The descriptor is close-on-exec, so that it doesn't leak into every
+ * program run later; spawn_conduit() clears the flag in the one conduit
+ * that's supposed to get it.
+ * Returns 0 if successful, or -1 if the region couldn't be set up, or
+ * the OS doesn't support it. This isn't fatal: SPC works without it.
+ */
+int
+spc_shm_create(struct spc_shm *shm)
+{
+#if HAVE_MMAP
+	void *base;
+#  if !HAVE_MEMFD_CREATE
+	char tmpname[] = "/tmp/coldsync-spcXXXXXX";
+#  endif	/* HAVE_MEMFD_CREATE */
+#endif	/* HAVE_MMAP */
+
+	shm->fd = -1;
+	shm->base = NULL;
+	shm->size = 0L;
+
+#if HAVE_MMAP
+#  if HAVE_MEMFD_CREATE
+	if ((shm->fd = memfd_create("coldsync-spc", MFD_CLOEXEC)) < 0)
+	{
+		SYNC_TRACE(3)
+			perror("memfd_create");
+		return -1;
+	}
+#  else	/* HAVE_MEMFD_CREATE */
+	/* Use an unlinked temporary file. */
+	if ((shm->fd = open_tempfile(tmpname)) < 0)
+		return -1;
+	unlink(tmpname);
+	fcntl(shm->fd, F_SETFD, FD_CLOEXEC);
+#  endif	/* HAVE_MEMFD_CREATE */
+
+	if (ftruncate(shm->fd, SPC_SHM_SIZE) < 0)
+	{
+		SYNC_TRACE(3)
+			perror("ftruncate");
+		close(shm->fd);
+		shm->fd = -1;
+		return -1;
+	}
+
+	base = mmap(NULL, SPC_SHM_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, shm->fd, 0);
+	if (base == MAP_FAILED)
+	{
+		SYNC_TRACE(3)
+			perror("mmap");
+		close(shm->fd);
+		shm->fd = -1;
+		return -1;
+	}
+
+	shm->base = (unsigned char *) base;
+	shm->size = SPC_SHM_SIZE;
+	return 0;
+#else	/* HAVE_MMAP */
+	return -1;
+#endif	/* HAVE_MMAP */
+}
+
+/* spc_shm_destroy
+ * Release a region set up by spc_shm_create().
+ */
+void
+spc_shm_destroy(struct spc_shm *shm)
+{
+#if HAVE_MMAP
+	if (shm->base != NULL)
+		munmap((void *) shm->base, shm->size);
+#endif	/* HAVE_MMAP */
+	if (shm->fd >= 0)
+		close(shm->fd);
+	shm->fd = -1;
+	shm->base = NULL;
+	shm->size = 0L;
+}
+
+/* shm_reply
+ * Helper function: copy the 'header->len' bytes of response data in
+ * 'data' to the start of the shared region, and make '*outbuf' a
+ * descriptor for it.
+ */
+static int
+shm_reply(struct spc_hdr *header,
+	  struct spc_shm *shm,
+	  const unsigned char *data,
+	  unsigned char **outbuf)
+{
+	unsigned char *wptr;
+
+	if ((*outbuf = (unsigned char *) malloc(SPC_SHMDESC_LEN)) == NULL)
+		return -1;
+
+	memcpy(shm->base, data, header->len);
+
+	wptr = *outbuf;
+	put_udword(&wptr, 0L);			/* Offset */
+	put_udword(&wptr, header->len);		/* Length */
+
+	header->op |= SPCOP_SHM;
+	header->len = SPC_SHMDESC_LEN;
+	return 0;
+}
+
 /* pack_dlp_time
  * Helper function. Writes 't' to the buffer pointed to by 'ptr', and
  * updates 'ptr' to point to the byte just after that.
@@ -26,11 +26,12 @@ typedef enum {
 	SPCOP_DBINFO,		/* Request information about current
 				 * database */
 	SPCOP_DLPC,		/* DLP command */
-	SPCOP_DLPR		/* RPC over DLP */
+	SPCOP_DLPR,		/* RPC over DLP */
 				/* XXX - Is this a good idea? Would it be
 				 * better to force applications to send
 				 * preformatted RPC-over-DLP packets?
 				 */
+	SPCOP_BATCH		/* Several DLP commands at once */
 } SPC_Op;
 
 /* Status/error codes */
@@ -55,11 +56,70 @@ struct spc_hdr {
 
 #define SPC_HEADER_LEN	8	/* Length of SPC header */
 
+/* Batches
+ * An SPCOP_BATCH request lets a conduit send a whole series of DLP
+ * commands at once, e.g., to read every record in a database, rather than
+ * waiting for the response to each one before sending the next. Coldsync
+ * sends the commands to the Palm one after the other, and returns all of
+ * the responses together.
+ *
+ * The data of an SPCOP_BATCH request is a series of entries, each of
+ * which has the same form as an SPC request: an 8-byte header, followed
+ * by 'len' bytes of data. In a batch entry, the 'op' field is a tag
+ * chosen by the conduit, and the data is a raw DLP command, as for
+ * SPCOP_DLPC. The response data is a series of entries of the same form,
+ * one per command and in the same order: the tag of the command, its
+ * status (one of the SPCERR_* constants), and the raw DLP response.
+ *
+ * If the batch is malformed, none of it is executed, and the response
+ * has status SPCERR_BADOP and no data.
+ */
+
+/* Shared-memory payloads
+ * Copying large DLP requests and responses through the SPC pipe costs
+ * two trips through the kernel, plus a copy into and out of a malloc()ed
+ * buffer in coldsync. So where the OS allows it, coldsync also sets up a
+ * region of shared memory when it starts a conduit, and tells the
+ * conduit about it with the "SPCShm" (file descriptor) and "SPCShmSize"
+ * (length in bytes) headers.
+ *
+ * If a request's opcode has the SPCOP_SHM bit set, the data that follows
+ * the header on the SPC pipe is not the request data, but an 8-byte
+ * descriptor: the offset of the request data in the shared region, then
+ * its length, each four bytes in network byte order. Setting SPCOP_SHM
+ * also tells coldsync that the conduit can take the response the same
+ * way: if the response has SPCOP_SHM set, its data is a descriptor for
+ * the response data in the shared region. Coldsync may still send the
+ * response in-line, e.g., if it doesn't fit.
+ *
+ * Since SPC is strictly request-response, there is no need for a ring or
+ * for locking: the region belongs to the conduit until it sends a
+ * request, and to coldsync from then until it sends the response.
+ */
+#define SPCOP_SHM	0x4000	/* Data is in shared memory */
+#define SPC_SHMDESC_LEN	8	/* Length of a shared memory descriptor */
+#define SPC_SHM_SIZE	(128*1024L)
+				/* Size of the shared region. Big enough
+				 * for any DLP request or response. */
+
+/* spc_shm
+ * A shared region for SPC payloads.
+ */
+struct spc_shm {
+	int fd;			/* File descriptor the conduit gets, or -1
+				 * if there is no region */
+	unsigned char *base;	/* Where coldsync has it mapped */
+	unsigned long size;	/* Length of the region */
+};
+
 extern int spc_send(struct spc_hdr *header,
 		    PConnection *pconn,
 		    const struct dlp_dbinfo *dbinfo,
 		    const unsigned char *inbuf,
-		    unsigned char **outbuf);
+		    unsigned char **outbuf,
+		    struct spc_shm *shm);
+extern int spc_shm_create(struct spc_shm *shm);
+extern void spc_shm_destroy(struct spc_shm *shm);
 
 #endif	/* _spc_h_ */
 
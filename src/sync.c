@@ -31,6 +31,9 @@
 #include <ctype.h>		/* For isalpha() and friends */
 #include <errno.h>		/* For errno. Duh. */
 #include <time.h>		/* For ctime() */
+#include <sys/time.h>		/* For gettimeofday() */
+#include <sys/stat.h>		/* For stat() */
+#include <sys/wait.h>		/* For waitpid() */
 #include <syslog.h>		/* For syslog() */
 #include <pwd.h>		/* For getpwent() */
 
@@ -45,15 +48,41 @@
 #include "coldsync.h"
 #include "pdb.h"
 #include "conduit.h"
+#include "plugin.h"
 #include "parser.h"
 #include "pref.h"
 #include "palment.h"
 #include "symboltable.h"
 #include "palmconn.h"
 #include "netsync.h"
+#include "condprof.h"
 
 extern struct pref_item *pref_cache;
 
+static struct timeval sync_start;	/* When do_sync() started */
+
+#define DUMP_JOB_POLL	50000L	/* How long to wait between checks on
+				 * Dump jobs, in usec */
+
+/* dump_job
+ * The Dump conduits for one database, run in a child process by
+ * conduits_dump_parallel().
+ */
+struct dump_job {
+	const struct dlp_dbinfo *dbinfo;	/* The database */
+	pid_t pid;		/* Child process, or -1 if not started */
+	int outfd;		/* Temporary file holding the child's
+				 * stderr, or -1 */
+	Bool done;		/* Has the child exited? */
+	Bool failed;		/* Did it fail? */
+};
+
+static int sync_palm(pda_block *pda, struct Palm *palm);
+static int conduits_dump_parallel(struct Palm *palm, pda_block *pda);
+static int start_dump_job(struct Palm *palm, pda_block *pda,
+			  struct dump_job *job);
+static void report_dump_job(struct dump_job *job);
+
 /* CheckLocalFiles
  * Clean up the backup directory: if there are any database files in it
  * that aren't installed on the Palm, move them to the attic directory, out
@@ -495,6 +524,9 @@ conduits_dump(struct Palm *palm, pda_block *pda)
  	 	return -1;
  	}
 
+	if (global_opts.dump_jobs > 1)
+		return conduits_dump_parallel(palm, pda);
+
 	palm_resetdb(palm);
 
 	while ((cur_db = palm_nextdb(palm)) != NULL)
@@ -511,6 +543,635 @@ conduits_dump(struct Palm *palm, pda_block *pda)
 	return 0;	
 }
 
+/* conduits_dump_parallel
+ * Run the Dump conduits for up to 'global_opts.dump_jobs' databases at a
+ * time. By now the Palm has been released, and Dump conduits only work
+ * on local files, so databases don't depend on each other. The conduits
+ * for any one database still run one after the other, in the usual
+ * order.
+ * Each database is handled by a child process, whose stderr goes to a
+ * temporary file. When it's done, the file is copied to our own stderr,
+ * in the order in which the databases are listed, so the output is the
+ * same no matter which child finishes first.
+ * As with the serial version, a failure stops any more databases from
+ * being started, and isn't an error.
+ */
+static int
+conduits_dump_parallel(struct Palm *palm, pda_block *pda)
+{
+	struct dump_job *jobs;
+	int num_jobs;		/* # of databases with Dump conduits */
+	int next_start;		/* Next job to start */
+	int next_report;	/* Next job whose output to copy */
+	int running;		/* # of jobs running */
+	Bool failed;		/* Set when a job fails */
+	const struct dlp_dbinfo *cur_db;
+	int reaped;		/* # of jobs reaped this time around */
+	pid_t pid;
+	int status;
+	int i;
+
+	/* Make a list of the databases that have Dump conduits. Don't
+	 * bother forking for the others.
+	 */
+	num_jobs = 0;
+	palm_resetdb(palm);
+	while ((cur_db = palm_nextdb(palm)) != NULL)
+		num_jobs++;
+	if (num_jobs == 0)
+		return 0;
+
+	if ((jobs = (struct dump_job *)
+	     malloc(num_jobs * sizeof(struct dump_job))) == NULL)
+	{
+		Error(_("%s: Out of memory."), "conduits_dump_parallel");
+		return -1;
+	}
+
+	num_jobs = 0;
+	palm_resetdb(palm);
+	while ((cur_db = palm_nextdb(palm)) != NULL)
+	{
+		if (!have_conduits_for(FLAVORFL_DUMP, cur_db))
+			continue;
+		jobs[num_jobs].dbinfo = cur_db;
+		jobs[num_jobs].pid = -1;
+		jobs[num_jobs].outfd = -1;
+		jobs[num_jobs].done = False;
+		jobs[num_jobs].failed = False;
+		num_jobs++;
+	}
+
+	SYNC_TRACE(2)
+		fprintf(stderr, "Running Dump conduits for %d databases, "
+			"%d at a time\n",
+			num_jobs, global_opts.dump_jobs);
+
+	/* Persistent conduits belong to this process. The children
+	 * mustn't share them, so they'll start their own.
+	 */
+	stop_persistent_conduits();
+
+	next_start = 0;
+	next_report = 0;
+	running = 0;
+	failed = False;
+	while (next_report < num_jobs)
+	{
+		/* Start as many jobs as we're allowed to */
+		while (!failed && next_start < num_jobs &&
+		       running < global_opts.dump_jobs)
+		{
+			if (start_dump_job(palm, pda, &jobs[next_start]) < 0)
+			{
+				failed = True;
+				break;
+			}
+			next_start++;
+			running++;
+		}
+		if (running == 0)
+			break;		/* Nothing left to wait for */
+
+		/* Wait for one to finish. Only reap our own jobs: other
+		 * children, like the prefetcher, belong to someone else,
+		 * so waitpid(-1) would steal their exit status.
+		 */
+		reaped = 0;
+		for (i = next_report; i < next_start; i++)
+		{
+			if (jobs[i].done)
+				continue;
+			pid = waitpid(jobs[i].pid, &status, WNOHANG);
+			if (pid == 0 || (pid < 0 && errno == EINTR))
+				continue;	/* Still running */
+			if (pid < 0)
+			{
+				Perror("waitpid");
+				status = -1;	/* Count it as a failure */
+			}
+
+			SYNC_TRACE(4)
+				fprintf(stderr, "Dump job for \"%s\" "
+					"(pid %d) exited with status %d\n",
+					jobs[i].dbinfo->name,
+					(int) jobs[i].pid, status);
+			jobs[i].done = True;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				jobs[i].failed = True;
+			running--;
+			reaped++;
+		}
+		if (reaped == 0)
+		{
+			struct timeval nap;
+
+			/* None of them is done yet. Take a short nap; a
+			 * SIGCHLD will cut it shorter.
+			 */
+			nap.tv_sec = 0;
+			nap.tv_usec = DUMP_JOB_POLL;
+			select(0, NULL, NULL, NULL, &nap);
+			continue;
+		}
+
+		/* Copy the output of the jobs that are done, in order */
+		while (next_report < next_start && jobs[next_report].done)
+		{
+			report_dump_job(&jobs[next_report]);
+			if (jobs[next_report].failed)
+				failed = True;
+			next_report++;
+		}
+	}
+
+	for (i = 0; i < num_jobs; i++)
+		if (jobs[i].outfd >= 0)
+			close(jobs[i].outfd);
+	free(jobs);
+
+	return 0;
+}
+
+/* start_dump_job
+ * Fork a child process to run the Dump conduits for 'job'.
+ * Returns 0 if successful, or -1 in case of error.
+ */
+static int
+start_dump_job(struct Palm *palm, pda_block *pda, struct dump_job *job)
+{
+	int err;
+	char tmpname[] = "/tmp/coldsync-dumpXXXXXX";
+
+	if ((job->outfd = open_tempfile(tmpname)) < 0)
+		return -1;
+	unlink(tmpname);
+	fcntl(job->outfd, F_SETFD, FD_CLOEXEC);
+
+	/* Don't let the child inherit any buffered output */
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((job->pid = fork()) < 0)
+	{
+		Error(_("Can't fork to run Dump conduits."));
+		Perror("fork");
+		close(job->outfd);
+		job->outfd = -1;
+		return -1;
+	}
+
+	if (job->pid == 0)
+	{
+		/* Child */
+		dup2(job->outfd, STDERR_FILENO);
+
+		err = run_Dump_conduits(palm, job->dbinfo, pda);
+		if (err < 0)
+			Error(_("Error %d running post-dump conduits."),
+			      err);
+
+		stop_persistent_conduits();
+		unload_plugins();
+		fflush(stdout);
+		fflush(stderr);
+		_exit(err < 0 ? 1 : 0);
+	}
+
+	return 0;
+}
+
+/* report_dump_job
+ * Copy the output of a finished Dump job to stderr.
+ */
+static void
+report_dump_job(struct dump_job *job)
+{
+	char buf[BUFSIZ];
+	int len;
+
+	if (job->outfd < 0)
+		return;
+
+	lseek(job->outfd, 0L, SEEK_SET);
+	while ((len = read(job->outfd, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, len, stderr);
+	fflush(stderr);
+
+	close(job->outfd);
+	job->outfd = -1;
+}
+
+/* Prefetching
+ * With "-e", daemon mode doesn't make the user wait at the cradle for the
+ * Fetch conduits of the databases already in ~/.palm/backup:
+ * PrefetchConduits() forks a child that runs them while we wait for the
+ * Palm. The child writes down, in an unlinked temporary file, its base
+ * sync directory, followed by a prefetch_ent for each database it has
+ * handled, giving the state of the backup file once the conduits were
+ * done with it. When the Palm connects, sync_palm() waits for the child
+ * before anything touches the backup files, and conduits_fetch() reads
+ * its results and only runs the Fetch conduits for databases
+ * that weren't prefetched (e.g., ones new to this Palm), or whose backup
+ * file has changed since.
+ * The child runs as whoever is running the daemon, with that user's
+ * configuration. Its results are thrown out if the sync turns out to be
+ * for someone else, for a different sync directory, or a slow sync,
+ * since the conduits would have been told something else.
+ * Conduits that ask for preferences are given the ones saved by the last
+ * sync (see LoadPrefCache()). After the directory, the child writes the
+ * serial number of the Palm they came from; the databases whose conduits
+ * used them are done again if a different Palm connects.
+ */
+struct prefetch_ent
+{
+	char name[DLPCMD_DBNAME_LEN];	/* Database name */
+	udword creator;			/* Creator and type of the */
+	udword type;			/* database in the backup file */
+	dev_t dev;			/* These identify the backup file */
+	ino_t ino;			/* as the Fetch conduits left it */
+	off_t size;
+	time_t mtime;
+	Bool used_prefs;		/* Conduits were given saved
+					 * preferences */
+};
+
+static pid_t prefetch_pid = -1;		/* Prefetching child, or -1 */
+static int prefetch_fd = -1;		/* Where the child writes its
+					 * results */
+static uid_t prefetch_uid;		/* User the child runs as */
+static char prefetch_dir[MAXPATHLEN+1];	/* Its base sync directory */
+static char prefetch_snum[SNUM_MAX];	/* Serial number of the Palm whose
+					 * preferences it used */
+static struct prefetch_ent *prefetched = NULL;
+					/* Databases it has handled */
+static int num_prefetched = 0;
+
+/* prefetch_child
+ * This is the prefetching child: load the configuration, run the Fetch
+ * conduits for every database in the backup directory that doesn't need
+ * the Palm, and write the results to 'fd'.
+ */
+static int
+prefetch_child(int fd)
+{
+	int err;
+	DIR *dir;
+	struct dirent *file;
+	const char *snum;
+	int count = 0;
+
+	/* Read the user's configuration, as daemon_sync() will once it
+	 * knows whose Palm this is.
+	 */
+	free_sync_config(sync_config);
+	if (load_config(True) < 0)
+	{
+		Error(_("Can't load configuration."));
+		return -1;
+	}
+
+	if (!have_conduits(FLAVORFL_FETCH))
+		return 0;
+
+	/* We don't know which PDA block will apply: use the default
+	 * directory. collect_prefetch() checks that it's the right one.
+	 */
+	get_palmdir(NULL, palmdir);
+
+	/* Nor do we know which Palm it'll be: use the preferences that
+	 * were saved last.
+	 */
+	if (CacheFromConduits(sync_config->conduits, NULL) < 0)
+		return -1;
+	memset(prefetch_snum, 0, sizeof(prefetch_snum));
+	if ((snum = LoadPrefCache(NULL)) != NULL)
+		strncpy(prefetch_snum, snum, sizeof(prefetch_snum) - 1);
+
+	if ((write(fd, palmdir, sizeof(prefetch_dir)) !=
+	     sizeof(prefetch_dir)) ||
+	    (write(fd, prefetch_snum, sizeof(prefetch_snum)) !=
+	     sizeof(prefetch_snum)))
+	{
+		Error(_("Can't write prefetch results."));
+		Perror("write");
+		return -1;
+	}
+
+	if (make_sync_dirs(palmdir) < 0)
+		return -1;
+
+	if ((dir = opendir(backupdir)) == NULL)
+	{
+		Error(_("%s: Can't open directory \"%s\"."),
+		      "prefetch_child",
+		      backupdir);
+		Perror("opendir");
+		return -1;
+	}
+
+	while ((file = readdir(dir)) != NULL)
+	{
+		static char fname[MAXPATHLEN+1];
+		struct dlp_dbinfo dbinfo;
+		struct pdb pdb;
+		struct prefetch_ent ent;
+		struct stat statbuf;
+		Bool used_prefs;
+		int dbfd;
+
+		if (!is_database_name(file->d_name))
+			continue;
+
+		snprintf(fname, MAXPATHLEN, "%s/%s", backupdir, file->d_name);
+		if ((dbfd = open(fname, O_RDONLY | O_BINARY)) < 0)
+			continue;
+		err = pdb_LoadHeader(dbfd, &pdb);
+		close(dbfd);
+		if (err < 0)
+			continue;
+		dbinfo_fill(&dbinfo, &pdb);
+
+		/* The conduits will be told to use the file named after
+		 * the database. Leave strays for CheckLocalFiles().
+		 */
+		if (strcmp(mkbakfname(&dbinfo), fname) != 0)
+			continue;
+
+		if (!have_conduits_for(FLAVORFL_FETCH, &dbinfo) ||
+		    conduits_need_palm(FLAVORFL_FETCH, &dbinfo, &used_prefs))
+			continue;
+
+		if ((err = run_Fetch_conduits(NULL, &dbinfo, NULL)) < 0)
+		{
+			Error(_("Error %d running pre-fetch conduits."),
+			      err);
+			closedir(dir);
+			return -1;
+		}
+
+		/* If the conduit removed the file, there's nothing to
+		 * check against later: let the sync run it again.
+		 */
+		if (stat(fname, &statbuf) < 0)
+			continue;
+
+		memset(&ent, 0, sizeof(ent));
+		strncpy(ent.name, dbinfo.name, DLPCMD_DBNAME_LEN);
+		ent.creator = dbinfo.creator;
+		ent.type = dbinfo.type;
+		ent.dev = statbuf.st_dev;
+		ent.ino = statbuf.st_ino;
+		ent.size = statbuf.st_size;
+		ent.mtime = statbuf.st_mtime;
+		ent.used_prefs = used_prefs;
+		if (write(fd, &ent, sizeof(ent)) != sizeof(ent))
+		{
+			Error(_("Can't write prefetch results."));
+			Perror("write");
+			closedir(dir);
+			return -1;
+		}
+		count++;
+	}
+	closedir(dir);
+
+	SYNC_TRACE(3)
+		fprintf(stderr, "Prefetched %d database(s)\n", count);
+
+	return 0;
+}
+
+/* PrefetchConduits
+ * Start running the Fetch conduits for the databases in the backup
+ * directory, in the background. Call this before waiting for the Palm.
+ * Problems are reported, but not fatal: the conduits will just be run
+ * when the Palm connects.
+ */
+void
+PrefetchConduits(void)
+{
+	char tmpname[] = "/tmp/coldsync-fetchXXXXXX";
+
+	if ((prefetch_fd = open_tempfile(tmpname)) < 0)
+		return;
+	unlink(tmpname);
+	fcntl(prefetch_fd, F_SETFD, FD_CLOEXEC);
+
+	prefetch_uid = getuid();
+
+	/* Don't let the child inherit any buffered output */
+	fflush(stdout);
+	fflush(stderr);
+
+	if ((prefetch_pid = fork()) < 0)
+	{
+		Error(_("Can't fork to run Fetch conduits."));
+		Perror("fork");
+		close(prefetch_fd);
+		prefetch_fd = -1;
+		return;
+	}
+
+	if (prefetch_pid == 0)
+	{
+		/* Child */
+		int err;
+
+		err = prefetch_child(prefetch_fd);
+		stop_persistent_conduits();
+		unload_plugins();
+		fflush(stdout);
+		fflush(stderr);
+		_exit(err < 0 ? 1 : 0);
+	}
+
+	SYNC_TRACE(3)
+		fprintf(stderr, "Prefetching in pid %d\n", (int) prefetch_pid);
+}
+
+/* UnprefetchConduits
+ * Wait for the prefetching child, if it's still running, and forget
+ * about whatever it did.
+ */
+void
+UnprefetchConduits(void)
+{
+	if (prefetch_pid > 0)
+	{
+		while ((waitpid(prefetch_pid, NULL, 0) < 0) &&
+		       (errno == EINTR))
+			;
+		prefetch_pid = -1;
+	}
+
+	if (prefetch_fd >= 0)
+	{
+		close(prefetch_fd);
+		prefetch_fd = -1;
+	}
+
+	if (prefetched != NULL)
+	{
+		free(prefetched);
+		prefetched = NULL;
+	}
+	num_prefetched = 0;
+}
+
+/* wait_prefetch
+ * Wait for the prefetching child to finish, if it's still running. Its
+ * Fetch conduits work on the backup files, so this must be done before
+ * anything else touches them.
+ */
+static void
+wait_prefetch(void)
+{
+	int status = 0;
+
+	if (prefetch_pid <= 0)
+		return;			/* Not prefetching, or already done */
+
+	SYNC_TRACE(3)
+		fprintf(stderr, "Waiting for prefetch pid %d\n",
+			(int) prefetch_pid);
+
+	while ((waitpid(prefetch_pid, &status, 0) < 0) && (errno == EINTR))
+		;
+	prefetch_pid = -1;
+
+	/* Even if the child failed, whatever it wrote down is good. */
+	SYNC_TRACE(4)
+		fprintf(stderr, "Prefetch child exited with status %d\n",
+			status);
+}
+
+/* collect_prefetch
+ * Read the prefetching child's results into 'prefetched', if they apply
+ * to this sync. Waits for the child first, if need be.
+ */
+static void
+collect_prefetch(void)
+{
+	struct stat statbuf;
+	int len;
+
+	wait_prefetch();
+	if (prefetch_fd < 0)
+		return;			/* Not prefetching */
+
+	if (getuid() != prefetch_uid)
+	{
+		SYNC_TRACE(3)
+			fprintf(stderr, "Prefetched for another user. "
+				"Ignoring.\n");
+		UnprefetchConduits();
+		return;
+	}
+	if ((lseek(prefetch_fd, 0L, SEEK_SET) < 0) ||
+	    (read(prefetch_fd, prefetch_dir, sizeof(prefetch_dir)) !=
+	     sizeof(prefetch_dir)) ||
+	    (read(prefetch_fd, prefetch_snum, sizeof(prefetch_snum)) !=
+	     sizeof(prefetch_snum)))
+	{
+		/* The child didn't get anywhere */
+		UnprefetchConduits();
+		return;
+	}
+	prefetch_dir[MAXPATHLEN] = '\0';
+	prefetch_snum[SNUM_MAX-1] = '\0';
+	if (strcmp(palmdir, prefetch_dir) != 0)
+	{
+		SYNC_TRACE(3)
+			fprintf(stderr, "Prefetched in \"%s\". Ignoring.\n",
+				prefetch_dir);
+		UnprefetchConduits();
+		return;
+	}
+	if (need_slow_sync && !global_opts.force_slow)
+	{
+		/* The prefetched conduits were told this was a fast
+		 * sync.
+		 */
+		SYNC_TRACE(3)
+			fprintf(stderr, "Slow sync. Ignoring prefetch.\n");
+		UnprefetchConduits();
+		return;
+	}
+
+	if (fstat(prefetch_fd, &statbuf) < 0)
+	{
+		UnprefetchConduits();
+		return;
+	}
+	num_prefetched = (statbuf.st_size - sizeof(prefetch_dir) -
+			  sizeof(prefetch_snum)) /
+		sizeof(struct prefetch_ent);
+	if (num_prefetched == 0)
+	{
+		UnprefetchConduits();
+		return;
+	}
+
+	len = num_prefetched * sizeof(struct prefetch_ent);
+	if (((prefetched = (struct prefetch_ent *) malloc(len)) == NULL) ||
+	    (read(prefetch_fd, prefetched, len) != len))
+	{
+		UnprefetchConduits();
+		return;
+	}
+
+	close(prefetch_fd);
+	prefetch_fd = -1;
+
+	SYNC_TRACE(3)
+		fprintf(stderr, "%d database(s) were prefetched\n",
+			num_prefetched);
+}
+
+/* was_prefetched
+ * Returns True iff the Fetch conduits for 'dbinfo' have already been run
+ * by the prefetching child, with this Palm's preferences if they asked
+ * for any, and its backup file hasn't changed since.
+ */
+static Bool
+was_prefetched(struct Palm *palm, const struct dlp_dbinfo *dbinfo)
+{
+	int i;
+	const char *snum;
+	struct stat statbuf;
+
+	for (i = 0; i < num_prefetched; i++)
+	{
+		const struct prefetch_ent *ent = &prefetched[i];
+
+		if (strncmp(ent->name, dbinfo->name, DLPCMD_DBNAME_LEN) != 0)
+			continue;
+
+		/* A different creator or type would have picked
+		 * different conduits.
+		 */
+		if ((ent->creator != dbinfo->creator) ||
+		    (ent->type != dbinfo->type))
+			return False;
+
+		if (ent->used_prefs &&
+		    (((snum = palm_serial(palm)) == NULL) ||
+		     (strcmp(prefetch_snum, snum) != 0)))
+			return False;
+
+		if (stat(mkbakfname(dbinfo), &statbuf) < 0)
+			return False;
+
+		return ((statbuf.st_dev == ent->dev) &&
+			(statbuf.st_ino == ent->ino) &&
+			(statbuf.st_size == ent->size) &&
+			(statbuf.st_mtime == ent->mtime)) ? True : False;
+	}
+
+	return False;
+}
+
 static int
 conduits_fetch(struct Palm *palm, pda_block *pda)
 {
@@ -521,6 +1182,13 @@ conduits_fetch(struct Palm *palm, pda_block *pda)
 
 	Verbose(1, _("Running Fetch conduits"));
 
+	/* If there aren't any, don't walk the list of databases: with
+	 * "stream_dblist", that would read the whole list before the
+	 * first Sync conduit gets to run.
+	 */
+	if (!have_conduits(FLAVORFL_FETCH))
+		return 0;
+
 	/* Run "none" conduits */
  	err = run_Fetch_conduits(palm, NULL, pda);
  	if (err < 0)
@@ -531,10 +1199,21 @@ conduits_fetch(struct Palm *palm, pda_block *pda)
  	}
  
 
+	/* Pick up whatever was done while we waited for the Palm */
+	collect_prefetch();
+
 	palm_resetdb(palm);
 
 	while ((cur_db = palm_nextdb(palm)) != NULL)
 	{
+		if (was_prefetched(palm, cur_db))
+		{
+			SYNC_TRACE(3)
+				fprintf(stderr, "\"%s\" was prefetched\n",
+					cur_db->name);
+			continue;
+		}
+
 		err = run_Fetch_conduits(palm, cur_db, pda);
 		if (err < 0)
 		{
@@ -547,6 +1226,485 @@ conduits_fetch(struct Palm *palm, pda_block *pda)
 	return 0;
 }
 
+/* Sync scheduling
+ * Normally, Sync conduits are run on the databases in the order in which
+ * the Palm lists them. If the "sync_schedule" option is set (or there is
+ * a "sync_budget"), the databases named in "sync_priority" are synced
+ * first, in the order given there, followed by any databases that were
+ * put off last time, and then by the rest, cheapest first. With a time
+ * budget, a database that isn't in "sync_priority" and that isn't
+ * expected to finish before the budget runs out is left for the next
+ * sync. But once a database has been put off SCHED_MAX_DEFERRALS times
+ * in a row, it is synced regardless of the budget; otherwise a big
+ * database whose estimate never fits (say, a 1 MB backup against a 30
+ * second budget) would never be synced at all.
+ * The cost of syncing a database is estimated from how long it took
+ * last time, and how much it has changed since then (its modification
+ * number). That history is kept in "~/.palm/synchist":
+ *	magic		4 bytes		SCHED_MAGIC
+ * followed by an entry for each database:
+ *	name		DLPCMD_DBNAME_LEN bytes
+ *	modnum		4 bytes		Before it was last synced
+ *	msecs		4 bytes		How long the last sync took
+ *	deferred	2 bytes		# of syncs it has been put off
+ */
+#define SCHED_MAGIC		"CSsh"
+#define SCHED_ENTRY_LEN		(DLPCMD_DBNAME_LEN + 10)
+#define SCHED_DEFAULT_PRIORITY	"AddressDB, DatebookDB, ToDoDB, MemoDB"
+#define SCHED_DEFAULT_MSECS	2000L	/* For a database we know nothing
+					 * about */
+#define SCHED_BYTES_PER_SEC	5000L	/* Rough speed of a full backup */
+#define SCHED_MSECS_PER_CHANGE	50L	/* Rough cost of each change */
+#define SCHED_MAX_DEFERRALS	3	/* Put a database off at most this
+					 * many syncs in a row */
+
+struct sync_hist {
+	char name[DLPCMD_DBNAME_LEN];	/* Database name */
+	udword modnum;			/* Modification number before the
+					 * last sync */
+	udword msecs;			/* How long the last sync took */
+	uword deferred;			/* # of syncs it's been put off */
+};
+
+struct sched_entry {
+	struct dlp_dbinfo dbinfo;	/* The database */
+	int rank;			/* Position in "sync_priority",
+					 * or -1 */
+	long cost;			/* Estimated cost, in msecs */
+	int seq;			/* Position in the Palm's list */
+	struct sync_hist hist;		/* History, updated as we go */
+};
+
+static int
+cmp_sync_hist(const void *a, const void *b)
+{
+	return strncmp(((const struct sync_hist *) a)->name,
+		       ((const struct sync_hist *) b)->name,
+		       DLPCMD_DBNAME_LEN);
+}
+
+static int
+cmp_sched_entry(const void *a, const void *b)
+{
+	const struct sched_entry *ea = (const struct sched_entry *) a;
+	const struct sched_entry *eb = (const struct sched_entry *) b;
+
+	/* Priority databases first, in the order listed */
+	if (ea->rank >= 0 || eb->rank >= 0)
+	{
+		if (ea->rank < 0)
+			return 1;
+		if (eb->rank < 0)
+			return -1;
+		if (ea->rank != eb->rank)
+			return ea->rank - eb->rank;
+		return ea->seq - eb->seq;
+	}
+
+	/* Then whatever has been put off longest, so that anything that
+	 * has reached SCHED_MAX_DEFERRALS goes ahead of the rest.
+	 */
+	if (ea->hist.deferred != eb->hist.deferred)
+		return eb->hist.deferred - ea->hist.deferred;
+
+	/* Then the cheapest first, so that as many as possible get done */
+	if (ea->cost != eb->cost)
+		return ea->cost < eb->cost ? -1 : 1;
+
+	return ea->seq - eb->seq;
+}
+
+/* priority_rank
+ * Returns the position of 'name' in 'list', a comma-separated list of
+ * database names, or -1 if it isn't there.
+ */
+static int
+priority_rank(const char *list, const char *name)
+{
+	int rank;
+	const char *p;
+	int len;
+
+	for (rank = 0; *list != '\0'; rank++)
+	{
+		while (*list == ',' || isspace((int) *list))
+			list++;
+		if (*list == '\0')
+			break;
+
+		/* Find the end of this name, and trim trailing blanks */
+		for (p = list; *p != '\0' && *p != ','; p++)
+			;
+		for (len = p - list; len > 0 && isspace((int) list[len-1]);
+		     len--)
+			;
+
+		if (len == (int) strlen(name) &&
+		    strncmp(list, name, len) == 0)
+			return rank;
+		list = p;
+	}
+
+	return -1;
+}
+
+/* sync_elapsed
+ * Returns the number of milliseconds since 'start'.
+ */
+static long
+sync_elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000L +
+		(now.tv_usec - start->tv_usec) / 1000L;
+}
+
+/* synchist_fname
+ * Returns the pathname of the sync history file, or NULL if there's
+ * nowhere to put it.
+ */
+static const char *
+synchist_fname(void)
+{
+	if (palmdir[0] == '\0')
+		return NULL;
+	return mkfname(palmdir, "/synchist", NULL);
+}
+
+/* load_synchist
+ * Read the sync history. Returns a newly-allocated array, sorted by
+ * name, and puts its length in '*num'. Returns NULL if there is no
+ * history, or it can't be read.
+ */
+static struct sync_hist *
+load_synchist(int *num)
+{
+	const char *fname;
+	FILE *fp;
+	ubyte buf[SCHED_ENTRY_LEN];
+	const ubyte *rptr;
+	struct sync_hist *hist = NULL;
+	int max = 0;
+
+	*num = 0;
+	if ((fname = synchist_fname()) == NULL ||
+	    (fp = fopen(fname, "rb")) == NULL)
+		return NULL;		/* No history. That's okay */
+
+	if (fread(buf, 1, 4, fp) != 4 ||
+	    memcmp(buf, SCHED_MAGIC, 4) != 0)
+	{
+		fclose(fp);
+		return NULL;
+	}
+
+	while (fread(buf, 1, SCHED_ENTRY_LEN, fp) == SCHED_ENTRY_LEN)
+	{
+		struct sync_hist *h;
+
+		if (*num >= max)
+		{
+			struct sync_hist *newhist;
+
+			max = (max == 0 ? 64 : max * 2);
+			if ((newhist = (struct sync_hist *)
+			     realloc(hist, max * sizeof(struct sync_hist)))
+			    == NULL)
+				break;
+			hist = newhist;
+		}
+		h = &(hist[*num]);
+		memcpy(h->name, buf, DLPCMD_DBNAME_LEN);
+		h->name[DLPCMD_DBNAME_LEN-1] = '\0';
+		rptr = buf + DLPCMD_DBNAME_LEN;
+		h->modnum = get_udword(&rptr);
+		h->msecs = get_udword(&rptr);
+		h->deferred = get_uword(&rptr);
+		(*num)++;
+	}
+	fclose(fp);
+
+	if (hist != NULL)
+		qsort(hist, *num, sizeof(struct sync_hist), cmp_sync_hist);
+	return hist;
+}
+
+/* save_synchist
+ * Write out the history of the databases in 'sched'. Databases that are
+ * no longer on the Palm are forgotten. Failure isn't fatal: the
+ * scheduler will just have to guess next time.
+ */
+static void
+save_synchist(const struct sched_entry *sched, const int num)
+{
+	const char *fname;
+	char tmpfname[MAXPATHLEN+1];
+	FILE *fp;
+	ubyte buf[SCHED_ENTRY_LEN];
+	ubyte *wptr;
+	int i;
+	Bool ok;
+
+	if ((fname = synchist_fname()) == NULL)
+		return;
+
+	/* Write to a temporary file, then rename it, so that the history
+	 * is never half-written.
+	 */
+	snprintf(tmpfname, sizeof(tmpfname), "%s.tmp", fname);
+	if ((fp = fopen(tmpfname, "wb")) == NULL)
+	{
+		MISC_TRACE(2)
+			fprintf(stderr, "Can't create \"%s\"\n", tmpfname);
+		return;
+	}
+
+	ok = (fwrite(SCHED_MAGIC, 1, 4, fp) == 4);
+	for (i = 0; ok && i < num; i++)
+	{
+		memset(buf, 0, sizeof(buf));
+		strncpy((char *) buf, sched[i].hist.name,
+			DLPCMD_DBNAME_LEN-1);
+		wptr = buf + DLPCMD_DBNAME_LEN;
+		put_udword(&wptr, sched[i].hist.modnum);
+		put_udword(&wptr, sched[i].hist.msecs);
+		put_uword(&wptr, sched[i].hist.deferred);
+		ok = (fwrite(buf, 1, SCHED_ENTRY_LEN, fp) == SCHED_ENTRY_LEN);
+	}
+
+	if (fclose(fp) != 0)
+		ok = False;
+	if (!ok || rename(tmpfname, fname) < 0)
+	{
+		MISC_TRACE(2)
+			fprintf(stderr, "Can't write \"%s\"\n", fname);
+		unlink(tmpfname);
+	}
+}
+
+/* estimate_cost
+ * Guess how many milliseconds it'll take to sync the database in 'e':
+ * as long as last time, plus a bit for each change since. If it's never
+ * been synced, go by the size of its backup file, if it has one.
+ */
+static long
+estimate_cost(const struct sched_entry *e, const Bool known)
+{
+	struct stat statbuf;
+	const char *bakfname;
+
+	if (known)
+	{
+		long cost = e->hist.msecs;
+
+		/* The modification number can go down if the Palm was
+		 * reset or restored.
+		 */
+		if (e->dbinfo.modnum > e->hist.modnum)
+			cost += (long) (e->dbinfo.modnum - e->hist.modnum) *
+				SCHED_MSECS_PER_CHANGE;
+		return cost;
+	}
+
+	bakfname = mkbakfname(&(e->dbinfo));
+	if (bakfname != NULL && stat(bakfname, &statbuf) == 0)
+		return (long) statbuf.st_size * 1000L / SCHED_BYTES_PER_SEC;
+
+	return SCHED_DEFAULT_MSECS;
+}
+
+/* schedule_dbs
+ * Build the list of databases to sync, in the order in which they
+ * should be synced. Returns a newly-allocated array, and puts its length
+ * in '*num'. Returns NULL in case of error.
+ */
+static struct sched_entry *
+schedule_dbs(struct Palm *palm, int *num)
+{
+	const struct dlp_dbinfo *cur_db;
+	struct sched_entry *sched;
+	struct sync_hist *hist;
+	int num_hist;
+	const char *priority;
+	int max;
+	int i;
+
+	/* The whole list is needed before anything can be sorted */
+	max = palm_num_dbs(palm);
+	if ((sched = (struct sched_entry *)
+	     calloc(max > 0 ? max : 1, sizeof(struct sched_entry))) == NULL)
+	{
+		Error(_("Out of memory."));
+		return NULL;
+	}
+
+	priority = sync_config->options.sync_priority;
+	if (priority == NULL)
+		priority = SCHED_DEFAULT_PRIORITY;
+
+	hist = load_synchist(&num_hist);
+
+	palm_resetdb(palm);
+	for (i = 0; (cur_db = palm_nextdb(palm)) != NULL; i++)
+	{
+		struct sched_entry *e;
+		const struct sync_hist *h = NULL;
+		struct sync_hist key;
+
+		if (i >= max)
+		{
+			/* The list grew while we were reading it */
+			struct sched_entry *newsched;
+
+			max *= 2;
+			if ((newsched = (struct sched_entry *)
+			     realloc(sched, max * sizeof(struct sched_entry)))
+			    == NULL)
+			{
+				Error(_("Out of memory."));
+				free(sched);
+				if (hist != NULL)
+					free(hist);
+				return NULL;
+			}
+			sched = newsched;
+		}
+		e = &(sched[i]);
+
+		e->dbinfo = *cur_db;
+		e->seq = i;
+		e->rank = priority_rank(priority, cur_db->name);
+
+		if (hist != NULL)
+		{
+			memcpy(key.name, cur_db->name, DLPCMD_DBNAME_LEN);
+			h = (const struct sync_hist *)
+				bsearch(&key, hist, num_hist,
+					sizeof(struct sync_hist),
+					cmp_sync_hist);
+		}
+		if (h != NULL)
+			e->hist = *h;
+		else {
+			memset(&(e->hist), 0, sizeof(e->hist));
+			memcpy(e->hist.name, cur_db->name,
+			       DLPCMD_DBNAME_LEN);
+		}
+		e->cost = estimate_cost(e, h != NULL ? True : False);
+
+		SYNC_TRACE(5)
+			fprintf(stderr, "schedule_dbs: %s: rank %d, "
+				"cost %ld ms, deferred %d\n",
+				cur_db->name, e->rank, e->cost,
+				e->hist.deferred);
+	}
+	*num = i;
+
+	if (hist != NULL)
+		free(hist);
+
+	qsort(sched, *num, sizeof(struct sched_entry), cmp_sched_entry);
+	return sched;
+}
+
+/* sync_one_db
+ * Run the Sync conduits for one database. Returns 0 if successful, or
+ * -1 if the sync should be abandoned.
+ */
+static int
+sync_one_db(struct Palm *palm, pda_block *pda,
+	    const struct dlp_dbinfo *cur_db)
+{
+	int err;
+
+	/* Run the Sync conduits for this database. This includes
+	 * built-in conduits.
+	 */
+	Verbose(2, _("Syncing %s"), cur_db->name);
+
+	err = run_Sync_conduits(palm, cur_db, pda);
+	if (err < 0)
+	{
+		switch (cs_errno)
+		{
+		    case CSE_CANCEL:
+		    case CSE_NOCONN:
+			return -1;
+
+		    default:
+			Warn(_("Conduit failed for unknown "
+			       "reason."));
+			/* Continue, and hope for the best */
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* conduits_sync_scheduled
+ * Like the main loop of conduits_sync(), but syncs the databases in the
+ * order that schedule_dbs() picks, and leaves some for next time if
+ * there's a time budget. See "Sync scheduling", above.
+ */
+static int
+conduits_sync_scheduled(struct Palm *palm, pda_block *pda)
+{
+	int err = 0;
+	struct sched_entry *sched;
+	int num;
+	int i;
+	long budget;		/* Time budget, in msecs (0 == none) */
+	int deferred = 0;	/* # of databases put off */
+
+	if ((sched = schedule_dbs(palm, &num)) == NULL)
+		return -1;
+
+	budget = sync_config->options.sync_budget * 1000L;
+
+	for (i = 0; i < num; i++)
+	{
+		struct sched_entry *e = &(sched[i]);
+		struct timeval start;
+
+		if (budget > 0 && e->rank < 0 &&
+		    e->hist.deferred < SCHED_MAX_DEFERRALS &&
+		    sync_elapsed(&sync_start) + e->cost > budget)
+		{
+			Verbose(1, _("Deferring %s to the next sync."),
+				e->dbinfo.name);
+			va_add_to_log(palm_pconn(palm), "%s %s - %s\n",
+				      _("Sync"), e->dbinfo.name,
+				      _("Deferred"));
+			e->hist.deferred++;
+			deferred++;
+			continue;
+		}
+
+		gettimeofday(&start, NULL);
+		if ((err = sync_one_db(palm, pda, &(e->dbinfo))) < 0)
+			break;
+
+		e->hist.modnum = e->dbinfo.modnum;
+		e->hist.msecs = sync_elapsed(&start);
+		e->hist.deferred = 0;
+	}
+
+	if (deferred > 0)
+		Verbose(1, _("Deferred %d database(s) to the next sync."),
+			deferred);
+
+	/* Even if the sync was cut short, what we learned about the
+	 * databases we did get to is worth keeping.
+	 */
+	save_synchist(sched, num);
+
+	free(sched);
+	return err;
+}
+
 static int
 conduits_sync(struct Palm *palm, pda_block *pda)
 {
@@ -565,38 +1723,36 @@ conduits_sync(struct Palm *palm, pda_block *pda)
  	 	return -1;
  	}
 
+	if (sync_config->options.sync_schedule == True3 ||
+	    sync_config->options.sync_budget > 0)
+		return conduits_sync_scheduled(palm, pda);
 
 	palm_resetdb(palm);
 	while ((cur_db = palm_nextdb(palm)) != NULL)
 	{
-		/* Run the Sync conduits for this database. This includes
-		 * built-in conduits.
-		 */
-		Verbose(2, _("Syncing %s"), cur_db->name);
-
-		err = run_Sync_conduits(palm, cur_db, pda);
-		if (err < 0)
-		{
-			switch (cs_errno)
-			{
-			    case CSE_CANCEL:
-			    case CSE_NOCONN:
-				return -1;
-
-			    default:
-				Warn(_("Conduit failed for unknown "
-				       "reason."));
-				/* Continue, and hope for the best */
-				continue;
-			}
-		}
+		if (sync_one_db(palm, pda, cur_db) < 0)
+			return -1;
 	}
 
 	return 0;
 }
 
+/* do_sync
+ * Sync the Palm, and if conduits were profiled, wrap up the profile.
+ */
 int
 do_sync(pda_block *pda, struct Palm *palm)
+{
+	int err;
+
+	err = sync_palm(pda, palm);
+	condprof_close(sync_config->options.profile_history == True3 ?
+		       True : False);
+	return err;
+}
+
+static int
+sync_palm(pda_block *pda, struct Palm *palm)
 {
 	int err;
 	struct pref_item *pref_cursor;
@@ -604,6 +1760,8 @@ do_sync(pda_block *pda, struct Palm *palm)
 	udword p_lastsyncPC;		/* Hostid of last host Palm synced
 					 * with */
 
+	gettimeofday(&sync_start, NULL);
+
 	/* XXX - If the PDA block has forwarding turned on, then see which
 	 * host to forward to (NULL == whatever the Palm wants). Check to
 	 * see if we're that host. If so, continue normally. Otherwise,
@@ -642,33 +1800,8 @@ do_sync(pda_block *pda, struct Palm *palm)
 	}
 
 	/* Figure out what the base sync directory is */
-	if ((pda != NULL) && (pda->directory != NULL))
-	{
-		/* Use the directory specified in the config file */
-		strncpy(palmdir, pda->directory, MAXPATHLEN);
-	} else {
-		/* Either there is no applicable PDA, or else it doesn't
-		 * specify a directory. Use the $(DOTPALM) env
-		 * or the default (~/.palm).
-		 */
-		 
-		char *dotpalm = get_symbol("CS_DOTPALM");
-		
-		if (dotpalm)
-		{
-			strncpy(palmdir, dotpalm, MAXPATHLEN);
-		
-			/* Free the our copy of the symbol. */
-			free(dotpalm);			
-		}
-		else
-		{
-			strncpy(palmdir,
-				mkfname(userinfo.homedir, "/.palm", NULL),
-				MAXPATHLEN);
-		}
-	}
-	
+	get_palmdir(pda, palmdir);
+
 	MISC_TRACE(3)
 		fprintf(stderr, "Base directory is [%s]\n", palmdir);
 
@@ -681,6 +1814,16 @@ do_sync(pda_block *pda, struct Palm *palm)
 		return -1;
 	}
 
+	/* Let the prefetching child finish with the backup files before
+	 * installing or fetching anything. Its results are picked up
+	 * later, by conduits_fetch().
+	 */
+	wait_prefetch();
+
+	if (sync_config->options.profile_conduits == True3 ||
+	    sync_config->options.profile_history == True3)
+		condprof_open();
+
 	/* XXX - In daemon mode, presumably load_palm_config() (or
 	 * something) should tell us which user to run as. Therefore fork()
 	 * an instance, have it setuid() to the appropriate user, and load
@@ -796,6 +1939,24 @@ do_sync(pda_block *pda, struct Palm *palm)
 			}
 		}
 	}
+	else if (sync_config->options.stream_dblist == True3)
+	{
+		/* Fetching the list of databases takes a long time
+		 * (several seconds). Just start reading it: the rest
+		 * arrives a batch at a time, as conduits_sync() works
+		 * its way through the databases. Anything that needs the
+		 * whole list before then (installing, Fetch conduits)
+		 * still gets it.
+		 */
+		err = palm_stream_DBs(palm);
+		if (err < 0)
+		{
+			Error(_("Can't fetch list of databases."));
+
+			palm_CSDisconnect(palm);
+			return -1;
+		}
+	}
 	else
 	{	 
 		err = palm_fetch_all_DBs(palm);	/* We're going to be looking at all
@@ -804,12 +1965,10 @@ do_sync(pda_block *pda, struct Palm *palm)
 						 */
 			/* XXX - Off hand, it looks as if fetching the list
 			 * of databases takes a long time (several
-			 * seconds). One way to "fix" this would be to get
-			 * each database in turn, then run its conduits.
-			 * The problems with this are that a) it doesn't
-			 * make things faster in the long run, and b) it
-			 * screws up the sequence of events documented in
-			 * the man page.
+			 * seconds). The "stream_dblist" option gets each
+			 * batch of databases in turn, then runs their
+			 * conduits. That doesn't make things faster in the
+			 * long run, but work starts sooner.
 			 * If it were possible to set the display on the
 			 * Palm to not just say "Identifying", it might
 			 * make things _appear_ significantly faster.
@@ -970,6 +2129,9 @@ do_sync(pda_block *pda, struct Palm *palm)
 		}
 	}
 
+	if (sync_config->options.save_prefs == True3)
+		SavePrefCache(palm_serial(palm));
+
 	/* Install new databases after sync */
 	if (!global_opts.install_first)
 	{
@@ -988,6 +2150,10 @@ do_sync(pda_block *pda, struct Palm *palm)
 	/* Run Dump conduits */
 	err = conduits_dump(palm, pda);
 
+	/* The persistent conduits have nothing left to do */
+	stop_persistent_conduits();
+	unload_plugins();
+
 	/* Free palm! */
 	free_Palm(palm);
 	
@@ -9,5 +9,7 @@
  */
 
 extern int do_sync(pda_block *pda, struct Palm *palm);
+extern void PrefetchConduits(void);
+extern void UnprefetchConduits(void);
 extern int UpdateUserInfo2(struct Palm *palm, struct dlp_setuserinfo *newinfo);
 